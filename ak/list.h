@@ -41,7 +41,7 @@ namespace ak {
         private:
             ListNode<T>* head_;
             ListNode<T>* tail_;
-            system::mutexLock lock;
+            Kernel::mutexLock lock;
 
             int size_;
 
@@ -87,15 +87,13 @@ namespace ak {
                 return iterator(0);
             }
         };
-    }
 }
 
 using namespace ak;
 
 template <typename T>
-ListNode<T>* List<T>::insertInternal(const T& e, ListNode<T>* pos) {
-    this->lock.lock();
-    ListNode<T>* List<T>::insertInternal(const T &e, ListNode<T>* pos)
+ListNode<T>* List<T>::insertInternal(const T &e, ListNode<T>* pos) {
+    ListNode<T>* n = new ListNode<T>(e);
     size_++;
 
     n->next = pos;
@@ -108,6 +106,101 @@ ListNode<T>* List<T>::insertInternal(const T& e, ListNode<T>* pos) {
         tail_ = n;
     }
 
-    this->lock.unlock();
+    if (n->prev)
+        n->prev->next = n;
+    else
+        head_ = n;
+
     return n;
+}
+
+template <typename T>
+void List<T>::removeInternal(ListNode<T>* pos) {
+    if (pos == 0)
+        return;
+
+    if (pos->prev)
+        pos->prev->next = pos->next;
+    else
+        head_ = pos->next;
+
+    if (pos->next)
+        pos->next->prev = pos->prev;
+    else
+        tail_ = pos->prev;
+
+    delete pos;
+    size_--;
+}
+
+template <typename T>
+void List<T>::push_back(const T &e) {
+    this->lock.lock();
+    insertInternal(e, 0);
+    this->lock.unlock();
+}
+
+template <typename T>
+void List<T>::push_front(const T &e) {
+    this->lock.lock();
+    insertInternal(e, head_);
+    this->lock.unlock();
+}
+
+template <typename T>
+void List<T>::clear() {
+    this->lock.lock();
+    while (head_)
+        removeInternal(head_);
+    this->lock.unlock();
+}
+
+template <typename T>
+T List<T>::getat(int index) {
+    this->lock.lock();
+    ListNode<T>* n = head_;
+    for (int i = 0; i < index && n; i++)
+        n = n->next;
+    T result = n->data;
+    this->lock.unlock();
+    return result;
+}
+
+template <typename T>
+T List<T>::operator[](int index) {
+    return getat(index);
+}
+
+template <typename T>
+int List<T>::indexof(const T &e) {
+    this->lock.lock();
+    int index = 0;
+    for (ListNode<T>* n = head_; n; n = n->next, index++)
+        if (n->data == e) {
+            this->lock.unlock();
+            return index;
+        }
+    this->lock.unlock();
+    return -1;
+}
+
+template <typename T>
+void List<T>::remove(int index) {
+    this->lock.lock();
+    ListNode<T>* n = head_;
+    for (int i = 0; i < index && n; i++)
+        n = n->next;
+    removeInternal(n);
+    this->lock.unlock();
+}
+
+template <typename T>
+void List<T>::remove(const T &e) {
+    this->lock.lock();
+    for (ListNode<T>* n = head_; n; n = n->next)
+        if (n->data == e) {
+            removeInternal(n);
+            break;
+        }
+    this->lock.unlock();
 }
\ No newline at end of file
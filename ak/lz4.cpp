@@ -0,0 +1,61 @@
+#include "lz4.h"
+
+using namespace ak;
+
+// Lengths of 15 continue in the following bytes until one is not 255
+static bool readLength(const uint8_t** ip, const uint8_t* end, uint32_t* length) {
+    uint8_t b;
+    do {
+        if(*ip >= end)
+            return false;
+        b = *(*ip)++;
+        *length += b;
+    } while(b == 255);
+
+    return true;
+}
+
+int LZ4::decompressBlock(const uint8_t* source, uint32_t sourceSize, uint8_t* dest, uint32_t destCapacity) {
+    const uint8_t* ip = source;
+    const uint8_t* iend = source + sourceSize;
+    uint8_t* op = dest;
+    uint8_t* oend = dest + destCapacity;
+
+    while(ip < iend) {
+        uint8_t token = *ip++;
+
+        uint32_t literals = token >> 4;
+        if(literals == 15 && !readLength(&ip, iend, &literals))
+            return -1;
+        if(literals > (uint32_t)(iend - ip) || literals > (uint32_t)(oend - op))
+            return -1;
+
+        for(uint32_t i = 0; i < literals; i++)
+            *op++ = *ip++;
+
+        // The last sequence only carries literals
+        if(ip >= iend)
+            break;
+
+        if(iend - ip < 2)
+            return -1;
+        uint32_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if(offset == 0 || offset > (uint32_t)(op - dest))
+            return -1;
+
+        uint32_t matchLength = token & 0x0F;
+        if(matchLength == 15 && !readLength(&ip, iend, &matchLength))
+            return -1;
+        matchLength += 4;
+        if(matchLength > (uint32_t)(oend - op))
+            return -1;
+
+        // Matches may overlap the bytes they produce, so copy forward one at a time
+        const uint8_t* match = op - offset;
+        for(uint32_t i = 0; i < matchLength; i++)
+            *op++ = *match++;
+    }
+
+    return op - dest;
+}
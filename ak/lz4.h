@@ -0,0 +1,13 @@
+#pragma once
+
+#include "types.h"
+
+namespace ak {
+        /**
+         * @brief LZ4[decompressBlock] decoder for the raw LZ4 block format, without the frame header
+         */
+        class LZ4 {
+        public:
+            static int decompressBlock(const uint8_t* source, uint32_t sourceSize, uint8_t* dest, uint32_t destCapacity);
+        };
+}
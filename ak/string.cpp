@@ -149,4 +149,18 @@ char* String::strncpy(char *s1, const char *s2, unsigned int n) {
 	}
 
 	return s1;
-}
\ No newline at end of file
+}
+
+uint32_t String::hash(const char* str) {
+    return hash(str, strlen(str));
+}
+
+uint32_t String::hash(const char* str, int length, bool ignoreCase) {
+    // FNV-1a, the case folded variant is for names of filesystems that compare without case
+    uint32_t hash = 2166136261u;
+    for(int i = 0; i < length; i++) {
+        hash ^= (uint8_t)(ignoreCase ? uppercase(str[i]) : str[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
@@ -22,6 +22,8 @@ namespace pranaOS {
             static char lowercase(char c);
             static char* strcpy(char *s1, const char *s2);
             static char* strncpy(char *s1, const char *s2, unsigned int n);
+            static uint32_t hash(const char* str);
+            static uint32_t hash(const char* str, int length, bool ignoreCase = false);
         };
     }
 }
\ No newline at end of file
@@ -44,13 +44,12 @@ namespace ak {
             
             return res;
         }
-    }
 
     constexpr ak::uint32_t operator"" _KB(unsigned long long no) {
         return no * 1024;
     }
 
-    constexpr ak::uint32_t operator"" _MB(unsigned long long no {
+    constexpr ak::uint32_t operator"" _MB(unsigned long long no) {
         return no * (1024_KB);
     }
     
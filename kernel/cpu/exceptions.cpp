@@ -0,0 +1,48 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#include "exceptions.h"
+#include <memory/virtualmemory.h>
+#include <memory/filemapping.h>
+#include <tasking/scheduler.h>
+#include <kernel/system/log.h>
+
+using namespace Kernel::ak;
+using namespace Kernel;
+
+static bool pagefaultAutoFix = false;
+
+void exceptions::enablePagefaultAutoFix() {
+    pagefaultAutoFix = true;
+}
+
+void exceptions::disablePagefaultAutoFix() {
+    pagefaultAutoFix = false;
+}
+
+uint32_t exceptions::pageFault(uint32_t esp) {
+    CPUState* regs = (CPUState*)esp;
+
+    uint32_t faultAddress;
+    asm volatile("mov %%cr2, %0" : "=r" (faultAddress));
+
+    // Mapped files are paged in lazily, most faults in user space end here
+    Thread* thread = scheduler::currentThread();
+    if(thread != 0 && thread->parent != 0 && memoryMapping::handlePageFault(thread->parent, faultAddress, regs->errorCode))
+        return esp;
+
+    if(pagefaultAutoFix && !(regs->errorCode & PAGEFAULT_PRESENT)) {
+        virtualMemoryManager::allocatePage((void*)pageRoundDown(faultAddress), !(regs->errorCode & PAGEFAULT_USER), true);
+        virtualMemoryManager::invalidatePage(pageRoundDown(faultAddress));
+        return esp;
+    }
+
+    Log(Error, "Page fault at %x (eip %x, error %x)", faultAddress, regs->EIP, regs->errorCode);
+    showStacktrace(esp);
+
+    while(true)
+        asm volatile("cli; hlt");
+
+    return esp;
+}
@@ -0,0 +1,89 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#include "cdromcache.h"
+#include <ak/memoperator.h>
+
+using namespace Kernel::ak;
+using namespace Kernel;
+
+cdromCache::cdromCache() {
+    for(int i = 0; i < CDROM_CACHE_SECTORS; i++) {
+        this->sectors[i].valid = false;
+        this->sectors[i].lastUse = 0;
+        this->sectors[i].data = 0;
+    }
+}
+
+cdromCache::~cdromCache() {
+    for(int i = 0; i < CDROM_CACHE_SECTORS; i++)
+        if(this->sectors[i].data)
+            delete[] this->sectors[i].data;
+}
+
+bool cdromCache::cacheable(uint32_t count) {
+    // Long reads stream file data, keeping them would only push the directories out
+    return count <= CDROM_CACHE_MAX_READ;
+}
+
+cdromCachedSector* cdromCache::find(uint32_t lba) {
+    for(int i = 0; i < CDROM_CACHE_SECTORS; i++)
+        if(this->sectors[i].valid && this->sectors[i].lba == lba)
+            return &this->sectors[i];
+    return 0;
+}
+
+bool cdromCache::read(uint32_t lba, uint32_t count, uint8_t* buf) {
+    if(!cacheable(count))
+        return false;
+
+    // All or nothing, a partial hit still needs the drive to spin up and seek
+    this->lock.lock();
+    for(uint32_t i = 0; i < count; i++)
+        if(find(lba + i) == 0) {
+            this->lock.unlock();
+            return false;
+        }
+
+    for(uint32_t i = 0; i < count; i++) {
+        cdromCachedSector* sector = find(lba + i);
+        sector->lastUse = ++this->useCounter;
+        memOperator::memcpy(buf + i * CDROM_CACHE_BLOCK_SIZE, sector->data, CDROM_CACHE_BLOCK_SIZE);
+    }
+    this->lock.unlock();
+
+    return true;
+}
+
+void cdromCache::fill(uint32_t lba, uint32_t count, uint8_t* buf) {
+    if(!cacheable(count))
+        return;
+
+    this->lock.lock();
+    for(uint32_t i = 0; i < count; i++) {
+        cdromCachedSector* sector = find(lba + i);
+        if(sector == 0) {
+            sector = &this->sectors[0];
+            for(int j = 1; j < CDROM_CACHE_SECTORS && sector->valid; j++)
+                if(!this->sectors[j].valid || this->sectors[j].lastUse < sector->lastUse)
+                    sector = &this->sectors[j];
+        }
+
+        if(sector->data == 0)
+            sector->data = new uint8_t[CDROM_CACHE_BLOCK_SIZE];
+
+        memOperator::memcpy(sector->data, buf + i * CDROM_CACHE_BLOCK_SIZE, CDROM_CACHE_BLOCK_SIZE);
+        sector->lba = lba + i;
+        sector->valid = true;
+        sector->lastUse = ++this->useCounter;
+    }
+    this->lock.unlock();
+}
+
+void cdromCache::invalidate() {
+    this->lock.lock();
+    for(int i = 0; i < CDROM_CACHE_SECTORS; i++)
+        this->sectors[i].valid = false;
+    this->lock.unlock();
+}
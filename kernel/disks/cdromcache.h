@@ -0,0 +1,44 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#pragma once
+
+#include <ak/types.h>
+#include <tasking/lock.h>
+
+namespace Kernel {
+
+    #define CDROM_CACHE_SECTORS     32
+    #define CDROM_CACHE_MAX_READ    4
+    #define CDROM_CACHE_BLOCK_SIZE  2048
+
+    struct cdromCachedSector {
+        ak::uint32_t lba;
+        ak::uint32_t lastUse;
+        bool valid;
+        ak::uint8_t* data;
+    };
+
+    /**
+     * @brief cdromCache[read, fill, invalidate] recently read 2K sectors of an optical drive, only small reads like directory extents go through it
+     */
+    class cdromCache {
+      public:
+        cdromCache();
+        ~cdromCache();
+
+        static bool cacheable(ak::uint32_t count);
+
+        bool read(ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf);
+        void fill(ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf);
+        void invalidate();
+
+      private:
+        cdromCachedSector sectors[CDROM_CACHE_SECTORS];
+        ak::uint32_t useCounter = 0;
+        mutexLock lock;
+
+        cdromCachedSector* find(ak::uint32_t lba);
+    };
+}
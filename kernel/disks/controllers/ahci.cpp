@@ -0,0 +1,445 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#include "ahci.h"
+#include <cpu/idt.h>
+#include <memory/virtualmemory.h>
+#include <memory/devicememory.h>
+#include <kernel/disks/dmabuffer.h>
+#include <kernel/system/log.h>
+
+using namespace Kernel::ak;
+using namespace Kernel;
+using namespace Kernel::system;
+
+ahciController::ahciController(pciDevice* device, pciController* pci)
+: diskController(), driver((char*)"AHCI Controller", (char*)"SATA disks with native command queuing"), interruptHandler(IDT_INTERRUPT_OFFSET + device->interrupt) {
+    this->device = device;
+    this->pci = pci;
+    memOperator::memset(this->ports, 0, sizeof(this->ports));
+}
+
+ahciController::~ahciController() {
+    // Device memory is never handed back, only the ports are stopped and their bookkeeping freed
+    if(this->host != 0)
+        this->host->globalControl &= ~AHCI_GHC_IE;
+
+    for(int i = 0; i < AHCI_MAX_PORTS; i++)
+        if(this->ports[i] != 0) {
+            stopPort(this->ports[i]->registers);
+            delete this->ports[i];
+        }
+}
+
+int ahciController::probe(pciController* pci, diskManager* disks) {
+    int found = 0;
+
+    for(int i = 0; i < pci->deviceList.size(); i++) {
+        pciDevice* device = pci->deviceList[i];
+        if(device->classID != 0x01 || device->subclassID != 0x06 || device->interfaceID != 0x01)
+            continue;
+
+        ahciController* controller = new ahciController(device, pci);
+        if(!controller->initialize()) {
+            interruptManager::removeHandler(controller, IDT_INTERRUPT_OFFSET + device->interrupt);
+            delete controller;
+            continue;
+        }
+
+        controller->addDisks(disks);
+        found++;
+    }
+
+    return found;
+}
+
+bool ahciController::initialize() {
+    uint16_t bus = this->device->bus;
+    uint16_t slot = this->device->device;
+    uint16_t function = this->device->function;
+
+    baseAddress bar = this->pci->getBaseAddressRegister(bus, slot, function, 5);
+    if(bar.type != MemoryMapping || bar.address == 0)
+        return false;
+
+    this->pci->write(bus, slot, function, 0x04, this->pci->read(bus, slot, function, 0x04) | PCI_CMDREG_MEM | PCI_CMDREG_BM);
+
+    this->host = (volatile ahciHostRegisters*)deviceMemory::mapRegisters((uint32_t)bar.address, sizeof(ahciHostRegisters));
+    if(this->host == 0)
+        return false;
+
+    this->host->globalControl |= AHCI_GHC_AE;
+    this->commandSlots = ((this->host->capabilities >> 8) & 0x1F) + 1;
+    this->ncqCapable = this->host->capabilities & AHCI_CAP_SNCQ;
+
+    // Ports are set up before interrupts are on, identify completes through the interrupt or polling
+    uint32_t implemented = this->host->portsImplemented;
+    for(int i = 0; i < AHCI_MAX_PORTS; i++)
+        if(implemented & (1 << i))
+            this->ports[i] = setupPort(i);
+
+    this->host->interruptStatus = 0xFFFFFFFF;
+    this->host->globalControl |= AHCI_GHC_IE;
+
+    bool anyDisk = false;
+    for(int i = 0; i < AHCI_MAX_PORTS; i++) {
+        ahciPort* port = this->ports[i];
+        if(port == 0)
+            continue;
+
+        if(!identify(port)) {
+            stopPort(port->registers);
+            delete port;
+            this->ports[i] = 0;
+            continue;
+        }
+
+        // The drive may take fewer queued commands than the HBA has slots
+        port->ncq = this->ncqCapable && port->identity.ncq;
+        if(port->ncq && port->identity.queueDepth < port->slotCount)
+            port->slotCount = port->identity.queueDepth;
+
+        Log(Info, "AHCI port %d: %s, %d MB, %d slots%s", i, port->identity.model, port->identity.sectors / 2048, port->slotCount, port->ncq ? " with NCQ" : "");
+        anyDisk = true;
+    }
+
+    return anyDisk;
+}
+
+void ahciController::addDisks(diskManager* disks) {
+    for(int i = 0; i < AHCI_MAX_PORTS; i++) {
+        ahciPort* port = this->ports[i];
+        if(port == 0)
+            continue;
+
+        Disk* disk = new Disk(i, this, hardDisk, (uint64_t)port->identity.sectors * AHCI_SECTOR_SIZE, port->identity.sectors, AHCI_SECTOR_SIZE);
+        disk->identifier = port->identity.model;
+        disks->addDisk(disk);
+    }
+}
+
+bool ahciController::stopPort(volatile ahciPortRegisters* registers) {
+    registers->command &= ~AHCI_PORT_CMD_ST;
+    for(uint32_t i = 0; i < AHCI_TIMEOUT && (registers->command & AHCI_PORT_CMD_CR); i++);
+
+    registers->command &= ~AHCI_PORT_CMD_FRE;
+    for(uint32_t i = 0; i < AHCI_TIMEOUT && (registers->command & AHCI_PORT_CMD_FR); i++);
+
+    return !(registers->command & (AHCI_PORT_CMD_CR | AHCI_PORT_CMD_FR));
+}
+
+void ahciController::startPort(volatile ahciPortRegisters* registers) {
+    for(uint32_t i = 0; i < AHCI_TIMEOUT && (registers->taskFile & (ATA_STATUS_BSY | ATA_STATUS_DRQ)); i++);
+
+    registers->command |= AHCI_PORT_CMD_FRE;
+    registers->command |= AHCI_PORT_CMD_ST;
+}
+
+ahciPort* ahciController::setupPort(int number) {
+    volatile ahciPortRegisters* registers = &this->host->ports[number];
+
+    if((registers->sataStatus & 0x0F) != AHCI_SSTS_DET_PRESENT || registers->signature != AHCI_SIG_ATA)
+        return 0;
+
+    if(!stopPort(registers)) {
+        Log(Warning, "AHCI port %d does not stop, skipping it", number);
+        return 0;
+    }
+
+    ahciPort* port = new ahciPort;
+    memOperator::memset(port, 0, sizeof(ahciPort));
+    port->controller = this;
+    port->registers = registers;
+    port->slotCount = this->commandSlots;
+
+    // One page holds the 1K command list and the 256 byte received FIS area behind it
+    uint32_t listPhysical = 0;
+    port->commandList = (ahciCommandHeader*)deviceMemory::allocatePage(&listPhysical);
+    if(port->commandList == 0) {
+        delete port;
+        return 0;
+    }
+
+    // Tables only need 128 byte alignment and are addressed one by one, so they do not have to be contiguous
+    uint32_t tablesPerPage = PAGE_SIZE / sizeof(ahciCommandTable);
+    for(uint32_t i = 0; i < port->slotCount; i++) {
+        if(i % tablesPerPage == 0) {
+            uint32_t physical = 0;
+            uint8_t* page = (uint8_t*)deviceMemory::allocatePage(&physical);
+            if(page == 0) {
+                port->slotCount = i;
+                break;
+            }
+
+            for(uint32_t j = 0; j < tablesPerPage && i + j < AHCI_MAX_SLOTS; j++) {
+                port->tables[i + j] = (ahciCommandTable*)(page + j * sizeof(ahciCommandTable));
+                port->tablePhysical[i + j] = physical + j * sizeof(ahciCommandTable);
+            }
+        }
+
+        port->commandList[i].table = port->tablePhysical[i];
+        port->commandList[i].tableHigh = 0;
+    }
+
+    registers->commandList = listPhysical;
+    registers->commandListHigh = 0;
+    registers->fis = listPhysical + 1_KB;
+    registers->fisHigh = 0;
+
+    registers->sataError = 0xFFFFFFFF;
+    registers->interruptStatus = 0xFFFFFFFF;
+    registers->interruptEnable = AHCI_PORT_IS_DHRS | AHCI_PORT_IS_PSS | AHCI_PORT_IS_DSS | AHCI_PORT_IS_SDBS | AHCI_PORT_IS_ERRORS;
+
+    startPort(registers);
+    return port;
+}
+
+int ahciController::buildPrdt(ahciCommandTable* table, uint8_t* buf, uint32_t bytes) {
+    int entries = 0;
+    uint32_t address = (uint32_t)buf;
+
+    // One entry per physically contiguous run, an entry holds up to 4MB
+    while(bytes > 0) {
+        uint32_t physical = (uint32_t)virtualMemoryManager::virtualToPhysical((void*)address);
+        uint32_t chunk = PAGE_SIZE - (address % PAGE_SIZE);
+        if(chunk > bytes)
+            chunk = bytes;
+
+        ahciPrdtEntry* last = entries > 0 ? &table->prdt[entries - 1] : 0;
+        if(last && last->address + (last->byteCount & 0x3FFFFF) + 1 == physical) {
+            last->byteCount += chunk;
+        }
+        else {
+            if(entries == AHCI_PRDT_ENTRIES)
+                return -1;
+
+            table->prdt[entries].address = physical;
+            table->prdt[entries].addressHigh = 0;
+            table->prdt[entries].reserved = 0;
+            table->prdt[entries].byteCount = chunk - 1;
+            entries++;
+        }
+
+        address += chunk;
+        bytes -= chunk;
+    }
+
+    return entries;
+}
+
+bool ahciController::execute(ahciPort* port, int slot) {
+    ahciSlot* state = &port->slots[slot];
+    completionHelper::reset(&state->completed);
+    state->failed = false;
+
+    fisRegisterH2D* fis = (fisRegisterH2D*)port->tables[slot]->fis;
+    bool queued = fis->command == ATA_CMD_READ_FPDMA_QUEUED || fis->command == ATA_CMD_WRITE_FPDMA_QUEUED;
+
+    interruptDescriptorTable::disableInterrupts();
+    port->issuedSlots |= 1 << slot;
+    if(queued)
+        port->registers->sataActive = 1 << slot;
+    port->registers->commandIssue = 1 << slot;
+    interruptDescriptorTable::enableInterrupts();
+
+    if(!completionHelper::wait(&state->completed, AHCI_COMMAND_TIMEOUT_MS, pollPort, port)) {
+        Log(Error, "AHCI command in slot %d timed out", slot);
+
+        // It may have finished right after the timeout, only a command still outstanding resets the port
+        interruptDescriptorTable::disableInterrupts();
+        if(!state->completed.done)
+            recoverPort(port);
+        interruptDescriptorTable::enableInterrupts();
+    }
+
+    return !state->failed;
+}
+
+void ahciController::completePort(ahciPort* port) {
+    volatile ahciPortRegisters* registers = port->registers;
+
+    uint32_t status = registers->interruptStatus;
+    registers->interruptStatus = status;
+
+    if(status & AHCI_PORT_IS_ERRORS) {
+        Log(Error, "AHCI port error, status %x task file %x", status, registers->taskFile);
+        recoverPort(port);
+        return;
+    }
+
+    // A queued command leaves the issue register when the drive accepts it and the active register when it is done
+    uint32_t finished = port->issuedSlots & ~(registers->commandIssue | registers->sataActive);
+    for(int slot = 0; finished != 0; slot++, finished >>= 1) {
+        if(!(finished & 1))
+            continue;
+
+        port->issuedSlots &= ~(1 << slot);
+        completionHelper::signal(&port->slots[slot].completed);
+    }
+}
+
+bool ahciController::pollPort(void* context) {
+    ahciPort* port = (ahciPort*)context;
+    volatile ahciPortRegisters* registers = port->registers;
+
+    if((registers->interruptStatus & AHCI_PORT_IS_ERRORS) || (port->issuedSlots & ~(registers->commandIssue | registers->sataActive)))
+        port->controller->completePort(port);
+
+    return false;
+}
+
+void ahciController::recoverPort(ahciPort* port) {
+    // An error aborts everything outstanding on the port, the owners see it failed and may retry
+    stopPort(port->registers);
+    port->registers->sataError = 0xFFFFFFFF;
+    port->registers->interruptStatus = 0xFFFFFFFF;
+    startPort(port->registers);
+
+    uint32_t issued = port->issuedSlots;
+    port->issuedSlots = 0;
+    for(int slot = 0; issued != 0; slot++, issued >>= 1) {
+        if(!(issued & 1))
+            continue;
+
+        port->slots[slot].failed = true;
+        completionHelper::signal(&port->slots[slot].completed);
+    }
+}
+
+uint32_t ahciController::handleInterrupt(uint32_t esp) {
+    if(this->host == 0)
+        return esp;
+
+    uint32_t pending = this->host->interruptStatus;
+    if(pending == 0)
+        return esp;
+
+    for(int i = 0; i < AHCI_MAX_PORTS; i++)
+        if((pending & (1 << i)) && this->ports[i] != 0)
+            completePort(this->ports[i]);
+
+    // The HBA status is cleared after the ports, otherwise it is raised again right away
+    this->host->interruptStatus = pending;
+    return esp;
+}
+
+bool ahciController::identify(ahciPort* port) {
+    uint16_t* data = new uint16_t[ATA_IDENTIFY_WORDS];
+    int slot = completionHelper::claimSlot(&port->usedSlots, port->slotCount);
+
+    ahciCommandTable* table = port->tables[slot];
+    memOperator::memset(table, 0, sizeof(ahciCommandTable));
+
+    fisRegisterH2D* fis = (fisRegisterH2D*)table->fis;
+    fis->type = FIS_TYPE_REG_H2D;
+    fis->flags = FIS_H2D_COMMAND;
+    fis->command = ATA_CMD_IDENTIFY;
+
+    ahciCommandHeader* header = &port->commandList[slot];
+    header->flags = sizeof(fisRegisterH2D) / 4;
+    header->prdtLength = buildPrdt(table, (uint8_t*)data, ATA_IDENTIFY_WORDS * 2);
+    header->prdByteCount = 0;
+
+    bool result = execute(port, slot);
+    completionHelper::releaseSlot(&port->usedSlots, slot);
+
+    if(result)
+        parseIdentify(data, &port->identity);
+
+    delete[] data;
+    return result;
+}
+
+char ahciController::transferCommand(ahciPort* port, bool write, uint32_t lba, uint32_t count, uint8_t* buf) {
+    int slot = completionHelper::claimSlot(&port->usedSlots, port->slotCount);
+
+    ahciCommandTable* table = port->tables[slot];
+    memOperator::memset(table->fis, 0, sizeof(table->fis));
+
+    int entries = buildPrdt(table, buf, count * AHCI_SECTOR_SIZE);
+    if(entries < 0) {
+        completionHelper::releaseSlot(&port->usedSlots, slot);
+        return DISK_ERROR_UNSUPPORTED;
+    }
+
+    fisRegisterH2D* fis = (fisRegisterH2D*)table->fis;
+    fis->type = FIS_TYPE_REG_H2D;
+    fis->flags = FIS_H2D_COMMAND;
+    fis->device = FIS_DEVICE_LBA;
+    fis->lba0 = lba & 0xFF;
+    fis->lba1 = (lba >> 8) & 0xFF;
+    fis->lba2 = (lba >> 16) & 0xFF;
+    fis->lba3 = (lba >> 24) & 0xFF;
+
+    // Queued commands carry the sector count in the feature registers and the slot as their tag
+    if(port->ncq) {
+        fis->command = write ? ATA_CMD_WRITE_FPDMA_QUEUED : ATA_CMD_READ_FPDMA_QUEUED;
+        fis->featureLow = count & 0xFF;
+        fis->featureHigh = (count >> 8) & 0xFF;
+        fis->countLow = slot << 3;
+    }
+    else {
+        fis->command = write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT;
+        fis->countLow = count & 0xFF;
+        fis->countHigh = (count >> 8) & 0xFF;
+    }
+
+    ahciCommandHeader* header = &port->commandList[slot];
+    header->flags = (sizeof(fisRegisterH2D) / 4) | (write ? AHCI_HEADER_WRITE : 0);
+    header->prdtLength = entries;
+    header->prdByteCount = 0;
+
+    bool result = execute(port, slot);
+    completionHelper::releaseSlot(&port->usedSlots, slot);
+
+    if(!result) {
+        Log(Error, "AHCI %s of %d sectors at %d failed", write ? "write" : "read", count, lba);
+        return DISK_ERROR;
+    }
+
+    return DISK_SUCCESS;
+}
+
+char ahciController::transfer(uint16_t drive, bool write, uint32_t lba, uint32_t count, uint8_t* buf) {
+    if(drive >= AHCI_MAX_PORTS || this->ports[drive] == 0)
+        return DISK_ERROR;
+
+    ahciPort* port = this->ports[drive];
+
+    // The HBA needs word aligned buffers
+    dmaBuffer dma(buf, AHCI_MAX_SECTORS * AHCI_SECTOR_SIZE, 2);
+
+    char result = DISK_SUCCESS;
+    for(uint32_t done = 0; done < count && result == DISK_SUCCESS; ) {
+        uint32_t sectors = count - done > AHCI_MAX_SECTORS ? AHCI_MAX_SECTORS : count - done;
+        uint8_t* part = buf + done * AHCI_SECTOR_SIZE;
+
+        result = transferCommand(port, write, lba + done, sectors, dma.begin(part, sectors * AHCI_SECTOR_SIZE, write));
+        dma.end(part, sectors * AHCI_SECTOR_SIZE, write, result == DISK_SUCCESS);
+
+        done += sectors;
+    }
+
+    return result;
+}
+
+char ahciController::readSector(uint16_t drive, uint32_t lba, uint8_t* buf) {
+    return transfer(drive, false, lba, 1, buf);
+}
+
+char ahciController::writeSector(uint16_t drive, uint32_t lba, uint8_t* buf) {
+    return transfer(drive, true, lba, 1, buf);
+}
+
+char ahciController::readSectors(uint16_t drive, uint32_t lba, uint32_t count, uint8_t* buf) {
+    return transfer(drive, false, lba, count, buf);
+}
+
+char ahciController::writeSectors(uint16_t drive, uint32_t lba, uint32_t count, uint8_t* buf) {
+    return transfer(drive, true, lba, count, buf);
+}
+
+bool ahciController::queuesCommands(uint16_t drive) {
+    return drive < AHCI_MAX_PORTS && this->ports[drive] != 0 && this->ports[drive]->ncq;
+}
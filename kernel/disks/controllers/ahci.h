@@ -0,0 +1,206 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#pragma once
+
+#include <ak/types.h>
+#include <internal/pci.h>
+#include <system/interrupthandler.h>
+#include <kernel/drivers/driver.h>
+#include <tasking/completion.h>
+#include <kernel/disks/diskcontroller.h>
+#include "ata.h"
+
+namespace Kernel {
+
+    #define AHCI_MAX_PORTS              32
+    #define AHCI_MAX_SLOTS              32
+    #define AHCI_PRDT_ENTRIES           24
+    #define AHCI_MAX_SECTORS            128
+    #define AHCI_SECTOR_SIZE            512
+    #define AHCI_TIMEOUT                1000000
+    #define AHCI_COMMAND_TIMEOUT_MS     10000
+
+    #define AHCI_CAP_SNCQ               (1 << 30)
+    #define AHCI_GHC_IE                 (1 << 1)
+    #define AHCI_GHC_AE                 (1 << 31)
+
+    #define AHCI_PORT_CMD_ST            (1 << 0)
+    #define AHCI_PORT_CMD_FRE           (1 << 4)
+    #define AHCI_PORT_CMD_FR            (1 << 14)
+    #define AHCI_PORT_CMD_CR            (1 << 15)
+
+    #define AHCI_PORT_IS_DHRS           (1 << 0)
+    #define AHCI_PORT_IS_PSS            (1 << 1)
+    #define AHCI_PORT_IS_DSS            (1 << 2)
+    #define AHCI_PORT_IS_SDBS           (1 << 3)
+    #define AHCI_PORT_IS_IFS            (1 << 27)
+    #define AHCI_PORT_IS_HBDS           (1 << 28)
+    #define AHCI_PORT_IS_HBFS           (1 << 29)
+    #define AHCI_PORT_IS_TFES           (1 << 30)
+    #define AHCI_PORT_IS_ERRORS         (AHCI_PORT_IS_IFS | AHCI_PORT_IS_HBDS | AHCI_PORT_IS_HBFS | AHCI_PORT_IS_TFES)
+
+    #define AHCI_SSTS_DET_PRESENT       3
+    #define AHCI_SIG_ATA                0x00000101
+
+    #define AHCI_HEADER_WRITE           (1 << 6)
+    #define AHCI_PRDT_INTERRUPT         (1 << 31)
+
+    #define FIS_TYPE_REG_H2D            0x27
+    #define FIS_H2D_COMMAND             0x80
+    #define FIS_DEVICE_LBA              0x40
+
+    struct ahciPortRegisters {
+        ak::uint32_t commandList;
+        ak::uint32_t commandListHigh;
+        ak::uint32_t fis;
+        ak::uint32_t fisHigh;
+        ak::uint32_t interruptStatus;
+        ak::uint32_t interruptEnable;
+        ak::uint32_t command;
+        ak::uint32_t reserved0;
+        ak::uint32_t taskFile;
+        ak::uint32_t signature;
+        ak::uint32_t sataStatus;
+        ak::uint32_t sataControl;
+        ak::uint32_t sataError;
+        ak::uint32_t sataActive;
+        ak::uint32_t commandIssue;
+        ak::uint32_t sataNotification;
+        ak::uint32_t fisSwitching;
+        ak::uint32_t reserved1[11];
+        ak::uint32_t vendor[4];
+    } __attribute__((packed));
+
+    struct ahciHostRegisters {
+        ak::uint32_t capabilities;
+        ak::uint32_t globalControl;
+        ak::uint32_t interruptStatus;
+        ak::uint32_t portsImplemented;
+        ak::uint32_t version;
+        ak::uint32_t coalescingControl;
+        ak::uint32_t coalescingPorts;
+        ak::uint32_t enclosureLocation;
+        ak::uint32_t enclosureControl;
+        ak::uint32_t capabilities2;
+        ak::uint32_t handoff;
+        ak::uint8_t  reserved[0xA0 - 0x2C];
+        ak::uint8_t  vendor[0x100 - 0xA0];
+        ahciPortRegisters ports[AHCI_MAX_PORTS];
+    } __attribute__((packed));
+
+    struct ahciCommandHeader {
+        ak::uint16_t flags;
+        ak::uint16_t prdtLength;
+        ak::uint32_t prdByteCount;
+        ak::uint32_t table;
+        ak::uint32_t tableHigh;
+        ak::uint32_t reserved[4];
+    } __attribute__((packed));
+
+    struct ahciPrdtEntry {
+        ak::uint32_t address;
+        ak::uint32_t addressHigh;
+        ak::uint32_t reserved;
+        ak::uint32_t byteCount;
+    } __attribute__((packed));
+
+    struct ahciCommandTable {
+        ak::uint8_t  fis[64];
+        ak::uint8_t  atapiCommand[16];
+        ak::uint8_t  reserved[48];
+        ahciPrdtEntry prdt[AHCI_PRDT_ENTRIES];
+    } __attribute__((packed));
+
+    struct fisRegisterH2D {
+        ak::uint8_t type;
+        ak::uint8_t flags;
+        ak::uint8_t command;
+        ak::uint8_t featureLow;
+        ak::uint8_t lba0;
+        ak::uint8_t lba1;
+        ak::uint8_t lba2;
+        ak::uint8_t device;
+        ak::uint8_t lba3;
+        ak::uint8_t lba4;
+        ak::uint8_t lba5;
+        ak::uint8_t featureHigh;
+        ak::uint8_t countLow;
+        ak::uint8_t countHigh;
+        ak::uint8_t icc;
+        ak::uint8_t control;
+        ak::uint8_t reserved[4];
+    } __attribute__((packed));
+
+    /**
+     * @brief command slot of a port, owned by one caller from claim until its completion is seen
+     */
+    struct ahciSlot {
+        completion completed;
+        volatile bool failed;
+    };
+
+    class ahciController;
+
+    struct ahciPort {
+        ahciController* controller;
+        volatile ahciPortRegisters* registers;
+        ahciCommandHeader* commandList;
+        ahciCommandTable* tables[AHCI_MAX_SLOTS];
+        ak::uint32_t tablePhysical[AHCI_MAX_SLOTS];
+
+        ak::uint32_t slotCount;
+        volatile ak::uint32_t usedSlots;
+        volatile ak::uint32_t issuedSlots;
+        ahciSlot slots[AHCI_MAX_SLOTS];
+
+        bool ncq;
+        ataIdentity identity;
+    };
+
+    /**
+     * @brief ahciController[read, write] SATA disks behind an AHCI HBA, every caller gets its own command slot and NCQ lets the drive reorder them
+     */
+    class ahciController : public diskController, public driver, public system::interruptHandler {
+      public:
+        ahciController(pciDevice* device, pciController* pci);
+        ~ahciController();
+
+        static int probe(pciController* pci, diskManager* disks);
+
+        bool initialize();
+        void addDisks(diskManager* disks);
+        ak::uint32_t handleInterrupt(ak::uint32_t esp);
+
+        char readSector(ak::uint16_t drive, ak::uint32_t lba, ak::uint8_t* buf);
+        char writeSector(ak::uint16_t drive, ak::uint32_t lba, ak::uint8_t* buf);
+
+        char readSectors(ak::uint16_t drive, ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf);
+        char writeSectors(ak::uint16_t drive, ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf);
+
+        bool queuesCommands(ak::uint16_t drive);
+
+      private:
+        pciDevice* device;
+        pciController* pci;
+        volatile ahciHostRegisters* host = 0;
+        ak::uint32_t commandSlots = 0;
+        bool ncqCapable = false;
+        ahciPort* ports[AHCI_MAX_PORTS];
+
+        bool stopPort(volatile ahciPortRegisters* registers);
+        void startPort(volatile ahciPortRegisters* registers);
+        ahciPort* setupPort(int number);
+        bool identify(ahciPort* port);
+        void recoverPort(ahciPort* port);
+        void completePort(ahciPort* port);
+        static bool pollPort(void* context);
+
+        int buildPrdt(ahciCommandTable* table, ak::uint8_t* buf, ak::uint32_t bytes);
+        bool execute(ahciPort* port, int slot);
+
+        char transferCommand(ahciPort* port, bool write, ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf);
+        char transfer(ak::uint16_t drive, bool write, ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf);
+    };
+}
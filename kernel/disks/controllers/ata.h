@@ -0,0 +1,76 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#pragma once
+
+#include <ak/types.h>
+
+namespace Kernel {
+
+    #define ATA_STATUS_ERR              0x01
+    #define ATA_STATUS_DRQ              0x08
+    #define ATA_STATUS_DF               0x20
+    #define ATA_STATUS_BSY              0x80
+
+    #define ATA_CMD_READ_PIO            0x20
+    #define ATA_CMD_READ_PIO_EXT        0x24
+    #define ATA_CMD_READ_DMA_EXT        0x25
+    #define ATA_CMD_WRITE_PIO           0x30
+    #define ATA_CMD_WRITE_PIO_EXT       0x34
+    #define ATA_CMD_WRITE_DMA_EXT       0x35
+    #define ATA_CMD_READ_FPDMA_QUEUED   0x60
+    #define ATA_CMD_WRITE_FPDMA_QUEUED  0x61
+    #define ATA_CMD_PACKET              0xA0
+    #define ATA_CMD_IDENTIFY_PACKET     0xA1
+    #define ATA_CMD_READ_DMA            0xC8
+    #define ATA_CMD_WRITE_DMA           0xCA
+    #define ATA_CMD_IDENTIFY            0xEC
+
+    #define ATAPI_CMD_TEST_UNIT_READY   0x00
+    #define ATAPI_CMD_REQUEST_SENSE     0x03
+    #define ATAPI_CMD_START_STOP_UNIT   0x1B
+    #define ATAPI_CMD_READ_CAPACITY     0x25
+    #define ATAPI_CMD_READ_12           0xA8
+    #define ATAPI_PACKET_SIZE           12
+    #define ATAPI_SECTOR_SIZE           2048
+    #define ATAPI_SENSE_LENGTH          18
+    #define ATAPI_SENSE_UNIT_ATTENTION  0x06
+    #define ATAPI_ASC_NO_MEDIUM         0x3A
+
+    #define ATA_IDENTIFY_WORDS          256
+    #define ATA_MODEL_LENGTH            40
+
+    /**
+     * @brief identify data of an ATA device, the fields the disk controllers care about
+     */
+    struct ataIdentity {
+        bool lba48;
+        bool dma;
+        bool ncq;
+        ak::uint32_t queueDepth;
+        ak::uint32_t sectors;
+        char model[ATA_MODEL_LENGTH + 1];
+    };
+
+    inline static void parseIdentify(ak::uint16_t* data, ataIdentity* identity) {
+        identity->lba48 = data[83] & (1 << 10);
+        identity->dma = data[49] & (1 << 8);
+        identity->ncq = data[76] & (1 << 8);
+        identity->queueDepth = (data[75] & 0x1F) + 1;
+
+        identity->sectors = identity->lba48 ? (data[100] | (data[101] << 16)) : (data[60] | (data[61] << 16));
+        if(identity->lba48 && (data[102] || data[103]))
+            identity->sectors = 0xFFFFFFFF;
+
+        // The model string is stored with the bytes of every word swapped and padded with spaces
+        for(int i = 0; i < ATA_MODEL_LENGTH / 2; i++) {
+            identity->model[i * 2] = data[27 + i] >> 8;
+            identity->model[i * 2 + 1] = data[27 + i] & 0xFF;
+        }
+        int length = ATA_MODEL_LENGTH;
+        while(length > 0 && identity->model[length - 1] == ' ')
+            length--;
+        identity->model[length] = '\0';
+    }
+}
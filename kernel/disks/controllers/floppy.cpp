@@ -0,0 +1,389 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#include "floppy.h"
+#include <cpu/idt.h>
+#include <cpu/port.h>
+#include <kernel/system/log.h>
+
+using namespace Kernel::ak;
+using namespace Kernel;
+using namespace Kernel::system;
+
+// Indexed by the CMOS drive type, 0 is no drive
+static const floppyGeometry geometries[6] = {
+    { 0, 0, 0, 0, 0 },
+    { 40, 2, 9, 2, 0x2A },      // 360 KB 5.25"
+    { 80, 2, 15, 0, 0x1B },     // 1.2 MB 5.25"
+    { 80, 2, 9, 2, 0x1B },      // 720 KB 3.5"
+    { 80, 2, 18, 0, 0x1B },     // 1.44 MB 3.5"
+    { 80, 2, 36, 3, 0x1B }      // 2.88 MB 3.5"
+};
+
+// The DMA controller can not cross a 64K boundary, aligning to one keeps the whole cylinder inside it
+static uint8_t cylinderBuffer[FLOPPY_CYLINDER_BYTES] __attribute__((aligned(0x10000)));
+
+floppyController* floppyController::instance = 0;
+
+floppyController::floppyController(dmaController* dma)
+: diskController(), driver((char*)"Floppy Controller", (char*)"ISA floppy controller using DMA channel 2"), interruptHandler(IDT_INTERRUPT_OFFSET + FLOPPY_IRQ) {
+    this->dma = dma;
+    this->buffer = cylinderBuffer;
+    this->bufferPhysical = virt2phys((uint32_t)cylinderBuffer);
+    memOperator::memset(this->drives, 0, sizeof(this->drives));
+    completionHelper::reset(&this->irq);
+}
+
+int floppyController::probe(diskManager* disks, dmaController* dma) {
+    if(instance != 0)
+        return 0;
+
+    floppyController* controller = new floppyController(dma);
+    if(!controller->initialize()) {
+        interruptManager::removeHandler(controller, IDT_INTERRUPT_OFFSET + FLOPPY_IRQ);
+        delete controller;
+        return 0;
+    }
+
+    instance = controller;
+    controller->addDisks(disks);
+    threadHelper::createFromFunction(motorThread, true);
+    return 1;
+}
+
+bool floppyController::initialize() {
+    if(this->bufferPhysical + FLOPPY_CYLINDER_BYTES > DMA_ISA_LIMIT)
+        return false;
+
+    // CMOS register 0x10 holds the type of drive 0 in the high nibble and drive 1 in the low one
+    outportb(0x70, 0x10);
+    uint8_t types = inportb(0x71);
+
+    bool anyDrive = false;
+    for(uint8_t drive = 0; drive < 2; drive++) {
+        uint8_t type = drive == 0 ? types >> 4 : types & 0x0F;
+        if(type == 0 || type > 5)
+            continue;
+
+        this->drives[drive].present = true;
+        this->drives[drive].geometry = geometries[type];
+        anyDrive = true;
+    }
+
+    if(!anyDrive || !reset())
+        return false;
+
+    for(uint8_t drive = 0; drive < 2; drive++) {
+        if(!this->drives[drive].present)
+            continue;
+
+        floppyGeometry* geometry = &this->drives[drive].geometry;
+        Log(Info, "Floppy drive %d: %d KB", drive, geometry->cylinders * geometry->heads * geometry->sectorsPerTrack / 2);
+    }
+
+    return true;
+}
+
+void floppyController::addDisks(diskManager* disks) {
+    for(uint16_t drive = 0; drive < 2; drive++) {
+        floppyDrive* info = &this->drives[drive];
+        if(!info->present)
+            continue;
+
+        uint32_t blocks = info->geometry.cylinders * info->geometry.heads * info->geometry.sectorsPerTrack;
+        Disk* disk = new Disk(drive, this, floppy, (uint64_t)blocks * FLOPPY_SECTOR_SIZE, blocks, FLOPPY_SECTOR_SIZE);
+        disk->identifier = (char*)(drive == 0 ? "Floppy A" : "Floppy B");
+        disks->addDisk(disk);
+    }
+}
+
+uint32_t floppyController::handleInterrupt(uint32_t esp) {
+    // The controller has no interrupt status of its own, sense interrupt or the result phase acknowledges it
+    completionHelper::signal(&this->irq);
+    return esp;
+}
+
+void floppyController::delay(uint32_t ms) {
+    if(scheduler::currentThread() == 0) {
+        for(uint32_t i = 0; i < ms * 1000; i++)
+            inportb(0x80);
+        return;
+    }
+
+    uint32_t start = scheduler::ticks();
+    for(uint32_t elapsed = 0; elapsed < ms; elapsed = scheduler::ticks() - start)
+        scheduler::sleep(scheduler::currentThread(), ms - elapsed);
+}
+
+bool floppyController::sendByte(uint8_t value) {
+    for(uint32_t i = 0; i < FLOPPY_TIMEOUT; i++) {
+        if((inportb(FLOPPY_MSR) & (FLOPPY_MSR_RQM | FLOPPY_MSR_DIO)) == FLOPPY_MSR_RQM) {
+            outportb(FLOPPY_FIFO, value);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool floppyController::readByte(uint8_t* value) {
+    for(uint32_t i = 0; i < FLOPPY_TIMEOUT; i++) {
+        if((inportb(FLOPPY_MSR) & (FLOPPY_MSR_RQM | FLOPPY_MSR_DIO)) == (FLOPPY_MSR_RQM | FLOPPY_MSR_DIO)) {
+            *value = inportb(FLOPPY_FIFO);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool floppyController::waitInterrupt() {
+    // A missing disc or a stuck controller never interrupts, the command then fails after the timeout
+    bool fired = completionHelper::wait(&this->irq, FLOPPY_TIMEOUT_MS);
+    completionHelper::reset(&this->irq);
+    return fired;
+}
+
+void floppyController::senseInterrupt(uint8_t* st0, uint8_t* cylinder) {
+    sendByte(FLOPPY_CMD_SENSE_INTERRUPT);
+    readByte(st0);
+    readByte(cylinder);
+}
+
+bool floppyController::reset() {
+    completionHelper::reset(&this->irq);
+    outportb(FLOPPY_DOR, 0);
+    delay(1);
+    outportb(FLOPPY_DOR, FLOPPY_DOR_RESET | FLOPPY_DOR_IRQ_DMA);
+
+    if(!waitInterrupt())
+        return false;
+
+    // After a reset every drive reports a polling interrupt that has to be sensed
+    uint8_t st0, cylinder;
+    for(int i = 0; i < 4; i++)
+        senseInterrupt(&st0, &cylinder);
+
+    // Step rate 3ms, head unload 240ms, head load 10ms and DMA mode
+    sendByte(FLOPPY_CMD_SPECIFY);
+    sendByte(0xDF);
+    sendByte(0x0A);
+
+    this->cachedDrive = -1;
+    this->cachedCylinder = -1;
+    for(uint8_t drive = 0; drive < 2; drive++) {
+        this->drives[drive].motor = false;
+        if(this->drives[drive].present && !recalibrate(drive))
+            this->drives[drive].present = false;
+    }
+
+    return true;
+}
+
+void floppyController::motorOn(uint8_t drive) {
+    floppyDrive* info = &this->drives[drive];
+    info->lastUse = scheduler::ticks();
+
+    outportb(FLOPPY_CCR, info->geometry.rate);
+    if(info->motor) {
+        writeDigitalOutput(drive);
+        return;
+    }
+
+    info->motor = true;
+    writeDigitalOutput(drive);
+    delay(FLOPPY_SPINUP_MS);
+}
+
+void floppyController::motorOff(uint8_t drive) {
+    this->drives[drive].motor = false;
+    writeDigitalOutput(this->drives[0].motor ? 0 : 1);
+}
+
+void floppyController::writeDigitalOutput(uint8_t select) {
+    // Both motor bits live in the same register, writing it for one drive must not stop the other
+    uint8_t motors = 0;
+    for(uint8_t drive = 0; drive < 2; drive++)
+        if(this->drives[drive].motor)
+            motors |= FLOPPY_DOR_MOTOR(drive);
+
+    outportb(FLOPPY_DOR, select | FLOPPY_DOR_RESET | FLOPPY_DOR_IRQ_DMA | motors);
+}
+
+bool floppyController::recalibrate(uint8_t drive) {
+    motorOn(drive);
+
+    // A single recalibrate steps at most 79 times, an 80 cylinder drive can need two
+    for(int i = 0; i < 2; i++) {
+        completionHelper::reset(&this->irq);
+        sendByte(FLOPPY_CMD_RECALIBRATE);
+        sendByte(drive);
+        if(!waitInterrupt())
+            return false;
+
+        uint8_t st0, cylinder;
+        senseInterrupt(&st0, &cylinder);
+        if(!(st0 & 0xC0) && cylinder == 0) {
+            this->drives[drive].cylinder = 0;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool floppyController::seek(uint8_t drive, uint8_t cylinder) {
+    if(this->drives[drive].cylinder == cylinder)
+        return true;
+
+    completionHelper::reset(&this->irq);
+    sendByte(FLOPPY_CMD_SEEK);
+    sendByte(drive);
+    sendByte(cylinder);
+    if(!waitInterrupt())
+        return false;
+
+    uint8_t st0, position;
+    senseInterrupt(&st0, &position);
+    if((st0 & 0xC0) || position != cylinder)
+        return false;
+
+    this->drives[drive].cylinder = cylinder;
+    return true;
+}
+
+bool floppyController::transferCylinder(uint8_t drive, uint8_t cylinder, bool write, uint32_t first, uint32_t count) {
+    floppyGeometry* geometry = &this->drives[drive].geometry;
+    uint8_t head = first / geometry->sectorsPerTrack;
+    uint8_t sector = first % geometry->sectorsPerTrack + 1;
+    uint32_t offset = first * FLOPPY_SECTOR_SIZE;
+
+    for(int attempt = 0; attempt < FLOPPY_RETRIES; attempt++) {
+        motorOn(drive);
+        if(!seek(drive, cylinder)) {
+            recalibrate(drive);
+            continue;
+        }
+
+        // Terminal count from the DMA controller ends the command, multi track mode carries it over to head 1
+        if(!this->dma->prepareTransfer(FLOPPY_DMA_CHANNEL, this->bufferPhysical + offset, count * FLOPPY_SECTOR_SIZE, !write))
+            return false;
+
+        completionHelper::reset(&this->irq);
+        sendByte(write ? FLOPPY_CMD_WRITE : FLOPPY_CMD_READ);
+        sendByte((head << 2) | drive);
+        sendByte(cylinder);
+        sendByte(head);
+        sendByte(sector);
+        sendByte(2);
+        sendByte(geometry->sectorsPerTrack);
+        sendByte(geometry->gap);
+        sendByte(0xFF);
+
+        bool completed = waitInterrupt();
+
+        uint8_t result[7];
+        for(int i = 0; i < 7; i++)
+            readByte(&result[i]);
+
+        if(completed && !(result[0] & 0xC0))
+            return true;
+
+        // Write protected media will not get better by trying again
+        if(result[1] & 0x02)
+            return false;
+
+        recalibrate(drive);
+    }
+
+    return false;
+}
+
+char floppyController::transfer(uint16_t drive, bool write, uint32_t lba, uint32_t count, uint8_t* buf) {
+    if(drive > 1 || !this->drives[drive].present)
+        return DISK_ERROR;
+
+    floppyGeometry* geometry = &this->drives[drive].geometry;
+    uint32_t cylinderSectors = geometry->heads * geometry->sectorsPerTrack;
+    if(lba + count > geometry->cylinders * cylinderSectors)
+        return DISK_ERROR;
+
+    this->lock.lock();
+    while(count > 0) {
+        uint8_t cylinder = lba / cylinderSectors;
+        uint32_t first = lba % cylinderSectors;
+        uint32_t chunk = cylinderSectors - first;
+        if(chunk > count)
+            chunk = count;
+
+        bool cached = this->cachedDrive == drive && this->cachedCylinder == cylinder;
+        uint8_t* data = this->buffer + first * FLOPPY_SECTOR_SIZE;
+
+        if(write) {
+            // The buffer stays a valid copy of the cylinder only if it held this cylinder before
+            memOperator::memcpy(data, buf, chunk * FLOPPY_SECTOR_SIZE);
+            if(!cached)
+                this->cachedCylinder = -1;
+
+            if(!transferCylinder(drive, cylinder, true, first, chunk)) {
+                this->cachedCylinder = -1;
+                this->lock.unlock();
+                return DISK_ERROR;
+            }
+        }
+        else {
+            // A seek and the rotation cost far more than the extra sectors, the whole cylinder is read at once
+            if(!cached) {
+                this->cachedCylinder = -1;
+                if(!transferCylinder(drive, cylinder, false, 0, cylinderSectors)) {
+                    this->lock.unlock();
+                    return DISK_ERROR;
+                }
+
+                this->cachedDrive = drive;
+                this->cachedCylinder = cylinder;
+            }
+
+            memOperator::memcpy(buf, data, chunk * FLOPPY_SECTOR_SIZE);
+        }
+
+        lba += chunk;
+        count -= chunk;
+        buf += chunk * FLOPPY_SECTOR_SIZE;
+    }
+    this->lock.unlock();
+
+    return DISK_SUCCESS;
+}
+
+char floppyController::readSector(uint16_t drive, uint32_t lba, uint8_t* buf) {
+    return transfer(drive, false, lba, 1, buf);
+}
+
+char floppyController::writeSector(uint16_t drive, uint32_t lba, uint8_t* buf) {
+    return transfer(drive, true, lba, 1, buf);
+}
+
+char floppyController::readSectors(uint16_t drive, uint32_t lba, uint32_t count, uint8_t* buf) {
+    return transfer(drive, false, lba, count, buf);
+}
+
+char floppyController::writeSectors(uint16_t drive, uint32_t lba, uint32_t count, uint8_t* buf) {
+    return transfer(drive, true, lba, count, buf);
+}
+
+void floppyController::motorThread() {
+    // Leaving the motor on wears the disk, it is switched off once the drive sat idle for a while
+    while(true) {
+        scheduler::sleep(scheduler::currentThread(), 1000);
+
+        instance->lock.lock();
+        for(uint8_t drive = 0; drive < 2; drive++) {
+            floppyDrive* info = &instance->drives[drive];
+            if(info->motor && scheduler::ticks() - info->lastUse >= FLOPPY_MOTOR_IDLE_MS)
+                instance->motorOff(drive);
+        }
+        instance->lock.unlock();
+    }
+}
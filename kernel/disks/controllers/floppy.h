@@ -0,0 +1,118 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#pragma once
+
+#include <ak/types.h>
+#include <internal/dma.h>
+#include <system/interrupthandler.h>
+#include <kernel/drivers/driver.h>
+#include <tasking/lock.h>
+#include <tasking/completion.h>
+#include <kernel/disks/diskcontroller.h>
+
+namespace Kernel {
+
+    #define FLOPPY_DOR                  0x3F2
+    #define FLOPPY_MSR                  0x3F4
+    #define FLOPPY_FIFO                 0x3F5
+    #define FLOPPY_CCR                  0x3F7
+    #define FLOPPY_IRQ                  6
+    #define FLOPPY_DMA_CHANNEL          2
+
+    #define FLOPPY_DOR_RESET            0x04
+    #define FLOPPY_DOR_IRQ_DMA          0x08
+    #define FLOPPY_DOR_MOTOR(drive)     (0x10 << (drive))
+
+    #define FLOPPY_MSR_BUSY             0x10
+    #define FLOPPY_MSR_DIO              0x40
+    #define FLOPPY_MSR_RQM              0x80
+
+    #define FLOPPY_CMD_SPECIFY          0x03
+    #define FLOPPY_CMD_WRITE            0xC5
+    #define FLOPPY_CMD_READ             0xC6
+    #define FLOPPY_CMD_RECALIBRATE      0x07
+    #define FLOPPY_CMD_SENSE_INTERRUPT  0x08
+    #define FLOPPY_CMD_SEEK             0x0F
+
+    #define FLOPPY_SECTOR_SIZE          512
+    #define FLOPPY_MAX_SPT              36
+    #define FLOPPY_CYLINDER_BYTES       (2 * FLOPPY_MAX_SPT * FLOPPY_SECTOR_SIZE)
+    #define FLOPPY_RETRIES              3
+    #define FLOPPY_SPINUP_MS            300
+    #define FLOPPY_MOTOR_IDLE_MS        3000
+    #define FLOPPY_TIMEOUT_MS           2000
+    #define FLOPPY_TIMEOUT              1000000
+
+    /**
+     * @brief drive geometry picked from the CMOS drive type, the data rate goes to the CCR
+     */
+    struct floppyGeometry {
+        ak::uint8_t cylinders;
+        ak::uint8_t heads;
+        ak::uint8_t sectorsPerTrack;
+        ak::uint8_t rate;
+        ak::uint8_t gap;
+    };
+
+    struct floppyDrive {
+        bool present;
+        floppyGeometry geometry;
+        ak::uint8_t cylinder;
+        bool motor;
+        ak::uint32_t lastUse;
+    };
+
+    /**
+     * @brief floppyController[read, write] ISA floppy controller, every transfer moves a whole cylinder through one DMA buffer that doubles as a cache
+     */
+    class floppyController : public diskController, public driver, public system::interruptHandler {
+      public:
+        floppyController(dmaController* dma);
+
+        static int probe(diskManager* disks, dmaController* dma);
+
+        bool initialize();
+        void addDisks(diskManager* disks);
+        ak::uint32_t handleInterrupt(ak::uint32_t esp);
+
+        char readSector(ak::uint16_t drive, ak::uint32_t lba, ak::uint8_t* buf);
+        char writeSector(ak::uint16_t drive, ak::uint32_t lba, ak::uint8_t* buf);
+
+        char readSectors(ak::uint16_t drive, ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf);
+        char writeSectors(ak::uint16_t drive, ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf);
+
+      private:
+        static floppyController* instance;
+        static void motorThread();
+
+        dmaController* dma;
+        floppyDrive drives[2];
+        mutexLock lock;
+
+        completion irq;
+        Thread* motorWaiter = 0;
+
+        ak::uint8_t* buffer;
+        ak::uint32_t bufferPhysical;
+        int cachedDrive = -1;
+        int cachedCylinder = -1;
+
+        void delay(ak::uint32_t ms);
+        bool sendByte(ak::uint8_t value);
+        bool readByte(ak::uint8_t* value);
+        bool waitInterrupt();
+        void senseInterrupt(ak::uint8_t* st0, ak::uint8_t* cylinder);
+
+        bool reset();
+        bool recalibrate(ak::uint8_t drive);
+        bool seek(ak::uint8_t drive, ak::uint8_t cylinder);
+        void motorOn(ak::uint8_t drive);
+        void motorOff(ak::uint8_t drive);
+        void writeDigitalOutput(ak::uint8_t select);
+
+        bool transferCylinder(ak::uint8_t drive, ak::uint8_t cylinder, bool write, ak::uint32_t first, ak::uint32_t count);
+        char transfer(ak::uint16_t drive, bool write, ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf);
+    };
+}
@@ -0,0 +1,572 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#include "ide.h"
+#include <cpu/idt.h>
+#include <cpu/port.h>
+#include <memory/virtualmemory.h>
+#include <kernel/disks/dmabuffer.h>
+#include <kernel/system/log.h>
+
+using namespace Kernel::ak;
+using namespace Kernel;
+using namespace Kernel::system;
+
+ideChannel::ideChannel(uint8_t irq, uint16_t ioBase, uint16_t controlBase, uint16_t busMaster)
+: interruptHandler(IDT_INTERRUPT_OFFSET + irq) {
+    this->vector = IDT_INTERRUPT_OFFSET + irq;
+    this->ioBase = ioBase;
+    this->controlBase = controlBase;
+    this->busMaster = busMaster;
+    completionHelper::reset(&this->irq);
+
+    // The table has to be dword aligned and may not cross a 64K boundary, a 256 byte aligned block inside one page is both
+    this->prdMemory = new uint8_t[IDE_PRD_ENTRIES * sizeof(idePrdEntry) * 2];
+    this->prdTable = (idePrdEntry*)(((uint32_t)this->prdMemory + 255) & ~255);
+    this->prdPhysical = (uint32_t)virtualMemoryManager::virtualToPhysical(this->prdTable);
+}
+
+ideChannel::~ideChannel() {
+    interruptManager::removeHandler(this, this->vector);
+    delete[] this->prdMemory;
+}
+
+uint32_t ideChannel::handleInterrupt(uint32_t esp) {
+    if(this->busMaster != 0) {
+        uint8_t status = inportb(this->busMaster + IDE_BM_STATUS);
+        if(!(status & IDE_BM_STATUS_IRQ))
+            return esp;
+
+        // Writing the status back clears the interrupt and error bits
+        this->busMasterStatus = status;
+        outportb(this->busMaster + IDE_BM_STATUS, status);
+    }
+
+    // Reading the status register acknowledges the interrupt on the drive
+    inportb(this->ioBase + ATA_REG_STATUS);
+    completionHelper::signal(&this->irq);
+
+    return esp;
+}
+
+bool ideChannel::pollStatus(void* context) {
+    // A lost IRQ still leaves the interrupt bit set in the bus master status
+    ideChannel* channel = (ideChannel*)context;
+    if(!channel->irq.done && (inportb(channel->busMaster + IDE_BM_STATUS) & IDE_BM_STATUS_IRQ))
+        channel->handleInterrupt(0);
+
+    return false;
+}
+
+ideController::ideController(pciDevice* device, pciController* pci)
+: diskController(), driver((char*)"IDE Controller", (char*)"PCI IDE controller with bus master DMA") {
+    this->device = device;
+    this->pci = pci;
+    this->channels[0] = 0;
+    this->channels[1] = 0;
+    memOperator::memset(this->drives, 0, sizeof(this->drives));
+}
+
+ideController::~ideController() {
+    delete this->channels[0];
+    delete this->channels[1];
+
+    for(int drive = 0; drive < 4; drive++)
+        if(this->drives[drive].cache)
+            delete this->drives[drive].cache;
+}
+
+int ideController::probe(pciController* pci, diskManager* disks) {
+    int found = 0;
+
+    for(int i = 0; i < pci->deviceList.size(); i++) {
+        pciDevice* device = pci->deviceList[i];
+        if(device->classID != 0x01 || device->subclassID != 0x01)
+            continue;
+
+        ideController* controller = new ideController(device, pci);
+        if(!controller->initialize()) {
+            delete controller;
+            continue;
+        }
+
+        controller->addDisks(disks);
+        found++;
+    }
+
+    return found;
+}
+
+bool ideController::initialize() {
+    uint16_t bus = this->device->bus;
+    uint16_t slot = this->device->device;
+    uint16_t function = this->device->function;
+
+    // Programming interface bit 0 and 2 tell if a channel runs in native mode with its ports in the BARs
+    bool primaryNative = this->device->interfaceID & 0x01;
+    bool secondaryNative = this->device->interfaceID & 0x04;
+
+    uint16_t ports[5];
+    for(int i = 0; i < 5; i++) {
+        baseAddress bar = this->pci->getBaseAddressRegister(bus, slot, function, i);
+        ports[i] = bar.type == InputOutput ? (uint16_t)(bar.address & ~3) : 0;
+    }
+
+    uint16_t busMaster = ports[4];
+    this->pci->write(bus, slot, function, 0x04, this->pci->read(bus, slot, function, 0x04) | PCI_CMDREG_IO | PCI_CMDREG_BM);
+
+    this->channels[0] = new ideChannel(primaryNative ? this->device->interrupt : IDE_PRIMARY_IRQ,
+                                       primaryNative ? ports[0] : IDE_PRIMARY_IO,
+                                       primaryNative ? ports[1] + 2 : IDE_PRIMARY_CONTROL,
+                                       busMaster);
+    this->channels[1] = new ideChannel(secondaryNative ? this->device->interrupt : IDE_SECONDARY_IRQ,
+                                       secondaryNative ? ports[2] : IDE_SECONDARY_IO,
+                                       secondaryNative ? ports[3] + 2 : IDE_SECONDARY_CONTROL,
+                                       busMaster ? busMaster + 8 : 0);
+
+    bool anyDrive = false;
+    uint16_t* data = new uint16_t[ATA_IDENTIFY_WORDS];
+    for(uint16_t drive = 0; drive < 4; drive++) {
+        bool atapi = false;
+        if(!identify(drive, data, &atapi))
+            continue;
+
+        ideDrive* info = &this->drives[drive];
+        parseIdentify(data, &info->identity);
+        info->present = true;
+        info->atapi = atapi;
+        info->dma = busMaster != 0 && info->identity.dma;
+
+        // The identify data of a packet device says nothing about the medium, the drive is asked for it
+        if(atapi) {
+            info->cache = new cdromCache();
+            info->identity.sectors = readCapacity(drive);
+        }
+
+        Log(Info, "IDE %s %d: %s, %d MB using %s", atapi ? "CD-ROM" : "drive", drive, info->identity.model,
+            info->identity.sectors / (atapi ? 512 : 2048), info->dma ? "DMA" : "PIO");
+        anyDrive = true;
+    }
+    delete[] data;
+
+    return anyDrive;
+}
+
+void ideController::addDisks(diskManager* disks) {
+    for(uint16_t drive = 0; drive < 4; drive++) {
+        ideDrive* info = &this->drives[drive];
+        if(!info->present)
+            continue;
+
+        uint32_t blockSize = info->atapi ? ATAPI_SECTOR_SIZE : IDE_SECTOR_SIZE;
+        Disk* disk = new Disk(drive, this, info->atapi ? cdROM : hardDisk, (uint64_t)info->identity.sectors * blockSize, info->identity.sectors, blockSize);
+        disk->identifier = info->identity.model;
+        info->disk = disk;
+        disks->addDisk(disk);
+    }
+}
+
+bool ideController::poll(ideChannel* channel, bool dataRequest) {
+    // The alternate status register does not clear a pending interrupt, 4 reads give the drive its 400ns
+    for(int i = 0; i < 4; i++)
+        inportb(channel->controlBase);
+
+    for(uint32_t i = 0; i < IDE_TIMEOUT; i++) {
+        uint8_t status = inportb(channel->controlBase);
+        if(status & ATA_STATUS_BSY)
+            continue;
+        if(status & (ATA_STATUS_ERR | ATA_STATUS_DF))
+            return false;
+        if(!dataRequest || (status & ATA_STATUS_DRQ))
+            return true;
+    }
+
+    return false;
+}
+
+bool ideController::identify(uint16_t drive, uint16_t* data, bool* atapi) {
+    ideChannel* channel = this->channels[drive / 2];
+    uint16_t io = channel->ioBase;
+
+    outportb(io + ATA_REG_DRIVE, 0xA0 | ((drive & 1) << 4));
+    for(int i = 0; i < 4; i++)
+        inportb(channel->controlBase);
+
+    outportb(io + ATA_REG_SECCOUNT, 0);
+    outportb(io + ATA_REG_LBA0, 0);
+    outportb(io + ATA_REG_LBA1, 0);
+    outportb(io + ATA_REG_LBA2, 0);
+    outportb(io + ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
+
+    // Nothing attached reads as 0 or a floating 0xFF bus
+    uint8_t status = inportb(io + ATA_REG_STATUS);
+    if(status == 0 || status == 0xFF)
+        return false;
+
+    for(uint32_t i = 0; i < IDE_TIMEOUT && (inportb(io + ATA_REG_STATUS) & ATA_STATUS_BSY); i++);
+
+    // Packet and SATA devices abort IDENTIFY and leave their signature in the LBA registers
+    uint8_t signatureLow = inportb(io + ATA_REG_LBA1);
+    uint8_t signatureHigh = inportb(io + ATA_REG_LBA2);
+    if((signatureLow == 0x14 && signatureHigh == 0xEB) || (signatureLow == 0x69 && signatureHigh == 0x96)) {
+        *atapi = true;
+        outportb(io + ATA_REG_COMMAND, ATA_CMD_IDENTIFY_PACKET);
+    }
+    else if(signatureLow != 0 || signatureHigh != 0) {
+        return false;
+    }
+
+    if(!poll(channel, true))
+        return false;
+
+    inportsm(io + ATA_REG_DATA, (uint8_t*)data, ATA_IDENTIFY_WORDS);
+    return true;
+}
+
+bool ideController::selectDrive(uint16_t drive, uint32_t lba, uint32_t count) {
+    uint16_t io = this->channels[drive / 2]->ioBase;
+    uint8_t slave = (drive & 1) << 4;
+
+    if(this->drives[drive].identity.lba48 && lba + count > 0x0FFFFFFF) {
+        outportb(io + ATA_REG_DRIVE, 0x40 | slave);
+        outportb(io + ATA_REG_SECCOUNT, (count >> 8) & 0xFF);
+        outportb(io + ATA_REG_LBA0, (lba >> 24) & 0xFF);
+        outportb(io + ATA_REG_LBA1, 0);
+        outportb(io + ATA_REG_LBA2, 0);
+        outportb(io + ATA_REG_SECCOUNT, count & 0xFF);
+        outportb(io + ATA_REG_LBA0, lba & 0xFF);
+        outportb(io + ATA_REG_LBA1, (lba >> 8) & 0xFF);
+        outportb(io + ATA_REG_LBA2, (lba >> 16) & 0xFF);
+        return true;
+    }
+
+    outportb(io + ATA_REG_DRIVE, 0xE0 | slave | ((lba >> 24) & 0x0F));
+    outportb(io + ATA_REG_SECCOUNT, count & 0xFF);
+    outportb(io + ATA_REG_LBA0, lba & 0xFF);
+    outportb(io + ATA_REG_LBA1, (lba >> 8) & 0xFF);
+    outportb(io + ATA_REG_LBA2, (lba >> 16) & 0xFF);
+    return false;
+}
+
+bool ideController::buildPrdTable(ideChannel* channel, uint8_t* buf, uint32_t bytes) {
+    // The controller needs word aligned buffers, anything else goes through PIO
+    if(!dmaBuffer::reachable(buf, 2))
+        return false;
+
+    idePrdEntry* table = channel->prdTable;
+    int entries = 0;
+    uint32_t address = (uint32_t)buf;
+
+    // One entry per physically contiguous run, a page never crosses a 64K boundary so only merging has to check it
+    while(bytes > 0) {
+        uint32_t physical = (uint32_t)virtualMemoryManager::virtualToPhysical((void*)address);
+        uint32_t chunk = PAGE_SIZE - (address % PAGE_SIZE);
+        if(chunk > bytes)
+            chunk = bytes;
+
+        idePrdEntry* last = entries > 0 ? &table[entries - 1] : 0;
+        uint32_t lastBytes = last ? (last->byteCount ? last->byteCount : 0x10000) : 0;
+        if(last && last->address + lastBytes == physical && (last->address >> 16) == ((physical + chunk - 1) >> 16)) {
+            last->byteCount = (uint16_t)(lastBytes + chunk);
+        }
+        else {
+            if(entries == IDE_PRD_ENTRIES)
+                return false;
+
+            table[entries].address = physical;
+            table[entries].byteCount = (uint16_t)chunk;
+            table[entries].flags = 0;
+            entries++;
+        }
+
+        address += chunk;
+        bytes -= chunk;
+    }
+
+    table[entries - 1].flags = IDE_PRD_END;
+    return true;
+}
+
+bool ideController::waitInterrupt(ideChannel* channel) {
+    if(completionHelper::wait(&channel->irq, IDE_DMA_TIMEOUT_MS, ideChannel::pollStatus, channel))
+        return true;
+
+    Log(Error, "IDE DMA on %x timed out, bus master status %x", channel->ioBase, inportb(channel->busMaster + IDE_BM_STATUS));
+    return false;
+}
+
+char ideController::transferDMA(uint16_t drive, bool write, uint32_t lba, uint32_t count, uint8_t* buf) {
+    ideChannel* channel = this->channels[drive / 2];
+    uint16_t bm = channel->busMaster;
+    uint8_t direction = write ? 0 : IDE_BM_CMD_READ;
+
+    if(!buildPrdTable(channel, buf, count * IDE_SECTOR_SIZE))
+        return DISK_ERROR_UNSUPPORTED;
+
+    if(!poll(channel))
+        return DISK_ERROR;
+
+    outportb(bm + IDE_BM_COMMAND, 0);
+    outportl(bm + IDE_BM_PRDT, channel->prdPhysical);
+    outportb(bm + IDE_BM_STATUS, inportb(bm + IDE_BM_STATUS) | IDE_BM_STATUS_IRQ | IDE_BM_STATUS_ERROR);
+    outportb(bm + IDE_BM_COMMAND, direction);
+
+    completionHelper::reset(&channel->irq);
+    channel->busMasterStatus = 0;
+
+    bool extended = selectDrive(drive, lba, count);
+    if(write)
+        outportb(channel->ioBase + ATA_REG_COMMAND, extended ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_WRITE_DMA);
+    else
+        outportb(channel->ioBase + ATA_REG_COMMAND, extended ? ATA_CMD_READ_DMA_EXT : ATA_CMD_READ_DMA);
+
+    outportb(bm + IDE_BM_COMMAND, direction | IDE_BM_CMD_START);
+
+    bool completed = waitInterrupt(channel);
+    outportb(bm + IDE_BM_COMMAND, direction);
+
+    uint8_t status = inportb(channel->ioBase + ATA_REG_STATUS);
+    if(!completed || (channel->busMasterStatus & IDE_BM_STATUS_ERROR) || (status & (ATA_STATUS_ERR | ATA_STATUS_DF))) {
+        Log(Error, "IDE DMA %s of %d sectors at %d on drive %d failed, status %x", write ? "write" : "read", count, lba, drive, status);
+        return DISK_ERROR;
+    }
+
+    return DISK_SUCCESS;
+}
+
+char ideController::transferPIO(uint16_t drive, bool write, uint32_t lba, uint32_t count, uint8_t* buf) {
+    ideChannel* channel = this->channels[drive / 2];
+
+    if(!poll(channel))
+        return DISK_ERROR;
+
+    bool extended = selectDrive(drive, lba, count);
+    if(write)
+        outportb(channel->ioBase + ATA_REG_COMMAND, extended ? ATA_CMD_WRITE_PIO_EXT : ATA_CMD_WRITE_PIO);
+    else
+        outportb(channel->ioBase + ATA_REG_COMMAND, extended ? ATA_CMD_READ_PIO_EXT : ATA_CMD_READ_PIO);
+
+    for(uint32_t i = 0; i < count; i++) {
+        if(!poll(channel, true)) {
+            Log(Error, "IDE PIO %s of sector %d on drive %d failed", write ? "write" : "read", lba + i, drive);
+            return DISK_ERROR;
+        }
+
+        if(write)
+            outportsm(channel->ioBase + ATA_REG_DATA, buf + i * IDE_SECTOR_SIZE, IDE_SECTOR_SIZE / 2);
+        else
+            inportsm(channel->ioBase + ATA_REG_DATA, buf + i * IDE_SECTOR_SIZE, IDE_SECTOR_SIZE / 2);
+    }
+
+    return poll(channel) ? DISK_SUCCESS : DISK_ERROR;
+}
+
+char ideController::transferPacket(uint16_t drive, uint8_t* packet, uint8_t* buf, uint32_t bytes) {
+    ideChannel* channel = this->channels[drive / 2];
+    uint16_t io = channel->ioBase;
+    uint16_t bm = channel->busMaster;
+
+    if(!poll(channel))
+        return DISK_ERROR;
+
+    bool dma = bytes > 0 && this->drives[drive].dma && buildPrdTable(channel, buf, bytes);
+    if(dma) {
+        outportb(bm + IDE_BM_COMMAND, 0);
+        outportl(bm + IDE_BM_PRDT, channel->prdPhysical);
+        outportb(bm + IDE_BM_STATUS, inportb(bm + IDE_BM_STATUS) | IDE_BM_STATUS_IRQ | IDE_BM_STATUS_ERROR);
+        outportb(bm + IDE_BM_COMMAND, IDE_BM_CMD_READ);
+        completionHelper::reset(&channel->irq);
+        channel->busMasterStatus = 0;
+    }
+
+    // The byte count limit is how much the drive hands over per data request in PIO mode
+    uint32_t limit = bytes < IDE_ATAPI_BYTE_LIMIT ? bytes : IDE_ATAPI_BYTE_LIMIT;
+    outportb(io + ATA_REG_DRIVE, 0xA0 | ((drive & 1) << 4));
+    for(int i = 0; i < 4; i++)
+        inportb(channel->controlBase);
+    outportb(io + ATA_REG_FEATURES, dma ? 1 : 0);
+    outportb(io + ATA_REG_LBA1, limit & 0xFF);
+    outportb(io + ATA_REG_LBA2, (limit >> 8) & 0xFF);
+    outportb(io + ATA_REG_COMMAND, ATA_CMD_PACKET);
+
+    if(!poll(channel, true))
+        return DISK_ERROR;
+    outportsm(io + ATA_REG_DATA, packet, ATAPI_PACKET_SIZE / 2);
+
+    if(dma) {
+        outportb(bm + IDE_BM_COMMAND, IDE_BM_CMD_READ | IDE_BM_CMD_START);
+        bool completed = waitInterrupt(channel);
+        outportb(bm + IDE_BM_COMMAND, IDE_BM_CMD_READ);
+
+        uint8_t status = inportb(io + ATA_REG_STATUS);
+        if(!completed || (channel->busMasterStatus & IDE_BM_STATUS_ERROR) || (status & (ATA_STATUS_ERR | ATA_STATUS_DF)))
+            return DISK_ERROR;
+        return DISK_SUCCESS;
+    }
+
+    for(uint32_t done = 0; done < bytes; ) {
+        if(!poll(channel, true))
+            return DISK_ERROR;
+
+        uint32_t length = inportb(io + ATA_REG_LBA1) | (inportb(io + ATA_REG_LBA2) << 8);
+        if(length == 0 || done + length > bytes)
+            return DISK_ERROR;
+
+        inportsm(io + ATA_REG_DATA, buf + done, length / 2);
+        done += length;
+    }
+
+    return poll(channel) ? DISK_SUCCESS : DISK_ERROR;
+}
+
+uint32_t ideController::readCapacity(uint16_t drive) {
+    uint8_t packet[ATAPI_PACKET_SIZE] = { ATAPI_CMD_READ_CAPACITY, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+    uint8_t* data = new uint8_t[8];
+
+    // Last LBA and block length, both big endian, no medium reads as 0
+    uint32_t sectors = 0;
+    if(transferPacket(drive, packet, data, 8) == DISK_SUCCESS)
+        sectors = ((data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3]) + 1;
+
+    delete[] data;
+    return sectors;
+}
+
+bool ideController::mediumChanged(uint16_t drive) {
+    // A swapped disc fails the next command with a unit attention, reading the sense data also clears it
+    uint8_t packet[ATAPI_PACKET_SIZE] = { ATAPI_CMD_REQUEST_SENSE, 0, 0, 0, ATAPI_SENSE_LENGTH, 0, 0, 0, 0, 0, 0, 0 };
+    uint8_t* sense = new uint8_t[ATAPI_SENSE_LENGTH];
+    memOperator::memset(sense, 0, ATAPI_SENSE_LENGTH);
+
+    bool changed = false;
+    if(transferPacket(drive, packet, sense, ATAPI_SENSE_LENGTH) == DISK_SUCCESS)
+        changed = (sense[2] & 0x0F) == ATAPI_SENSE_UNIT_ATTENTION || sense[12] == ATAPI_ASC_NO_MEDIUM;
+    delete[] sense;
+
+    if(!changed)
+        return false;
+
+    ideDrive* info = &this->drives[drive];
+    info->cache->invalidate();
+    info->identity.sectors = readCapacity(drive);
+    if(info->disk) {
+        info->disk->numBlocks = info->identity.sectors;
+        info->disk->size = (uint64_t)info->identity.sectors * ATAPI_SECTOR_SIZE;
+    }
+
+    Log(Info, "IDE CD-ROM %d: medium changed, %d MB", drive, info->identity.sectors / 512);
+    return true;
+}
+
+char ideController::readPacketSectors(uint16_t drive, uint32_t lba, uint32_t count, uint8_t* buf) {
+    ideDrive* info = &this->drives[drive];
+
+    // A hit never reaches the drive, so it is asked first whether the disc is still the same one
+    if(cdromCache::cacheable(count)) {
+        uint8_t packet[ATAPI_PACKET_SIZE] = { ATAPI_CMD_TEST_UNIT_READY, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+        if(transferPacket(drive, packet, 0, 0) != DISK_SUCCESS)
+            mediumChanged(drive);
+
+        if(info->cache->read(lba, count, buf))
+            return DISK_SUCCESS;
+    }
+
+    bool retried = false;
+
+    // READ(12) carries a 32 bit length, the drive gets at most 32 sectors per command
+    for(uint32_t done = 0; done < count; ) {
+        uint32_t sectors = count - done > IDE_ATAPI_MAX_SECTORS ? IDE_ATAPI_MAX_SECTORS : count - done;
+        uint32_t sector = lba + done;
+
+        uint8_t packet[ATAPI_PACKET_SIZE] = { ATAPI_CMD_READ_12, 0,
+            (uint8_t)(sector >> 24), (uint8_t)(sector >> 16), (uint8_t)(sector >> 8), (uint8_t)sector,
+            (uint8_t)(sectors >> 24), (uint8_t)(sectors >> 16), (uint8_t)(sectors >> 8), (uint8_t)sectors, 0, 0 };
+
+        if(transferPacket(drive, packet, buf + done * ATAPI_SECTOR_SIZE, sectors * ATAPI_SECTOR_SIZE) != DISK_SUCCESS) {
+            // The first command after a disc change fails, the whole read then starts over on the new disc
+            if(!retried && mediumChanged(drive)) {
+                retried = true;
+                done = 0;
+                continue;
+            }
+
+            Log(Error, "ATAPI read of %d sectors at %d on drive %d failed", sectors, sector, drive);
+            return DISK_ERROR;
+        }
+        done += sectors;
+    }
+
+    info->cache->fill(lba, count, buf);
+    return DISK_SUCCESS;
+}
+
+bool ideController::ejectDrive(uint8_t drive) {
+    if(drive >= 4 || !this->drives[drive].present || !this->drives[drive].atapi)
+        return false;
+
+    // Stop the disc and open the tray, whatever was cached belongs to the old medium
+    uint8_t packet[ATAPI_PACKET_SIZE] = { ATAPI_CMD_START_STOP_UNIT, 0, 0, 0, 0x02, 0, 0, 0, 0, 0, 0, 0 };
+
+    ideChannel* channel = this->channels[drive / 2];
+    channel->lock.lock();
+    char result = transferPacket(drive, packet, 0, 0);
+    channel->lock.unlock();
+
+    this->drives[drive].cache->invalidate();
+    return result == DISK_SUCCESS;
+}
+
+char ideController::transfer(uint16_t drive, bool write, uint32_t lba, uint32_t count, uint8_t* buf) {
+    if(drive >= 4 || !this->drives[drive].present)
+        return DISK_ERROR;
+
+    if(this->drives[drive].atapi) {
+        if(write)
+            return DISK_ERROR;
+
+        this->channels[drive / 2]->lock.lock();
+        char result = readPacketSectors(drive, lba, count, buf);
+        this->channels[drive / 2]->lock.unlock();
+        return result;
+    }
+
+    ideChannel* channel = this->channels[drive / 2];
+    char result = DISK_ERROR_UNSUPPORTED;
+
+    // Both drives of a channel share its registers and PRD table
+    channel->lock.lock();
+    for(uint32_t done = 0; done < count; ) {
+        uint32_t sectors = count - done > IDE_MAX_SECTORS ? IDE_MAX_SECTORS : count - done;
+        uint8_t* part = buf + done * IDE_SECTOR_SIZE;
+
+        result = DISK_ERROR_UNSUPPORTED;
+        if(this->drives[drive].dma)
+            result = transferDMA(drive, write, lba + done, sectors, part);
+        if(result == DISK_ERROR_UNSUPPORTED)
+            result = transferPIO(drive, write, lba + done, sectors, part);
+
+        if(result != DISK_SUCCESS)
+            break;
+        done += sectors;
+    }
+    channel->lock.unlock();
+
+    return result;
+}
+
+char ideController::readSector(uint16_t drive, uint32_t lba, uint8_t* buf) {
+    return transfer(drive, false, lba, 1, buf);
+}
+
+char ideController::writeSector(uint16_t drive, uint32_t lba, uint8_t* buf) {
+    return transfer(drive, true, lba, 1, buf);
+}
+
+char ideController::readSectors(uint16_t drive, uint32_t lba, uint32_t count, uint8_t* buf) {
+    return transfer(drive, false, lba, count, buf);
+}
+
+char ideController::writeSectors(uint16_t drive, uint32_t lba, uint32_t count, uint8_t* buf) {
+    return transfer(drive, true, lba, count, buf);
+}
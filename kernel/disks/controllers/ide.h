@@ -0,0 +1,143 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#pragma once
+
+#include <ak/types.h>
+#include <internal/pci.h>
+#include <system/interrupthandler.h>
+#include <kernel/drivers/driver.h>
+#include <tasking/lock.h>
+#include <tasking/completion.h>
+#include <kernel/disks/diskcontroller.h>
+#include <kernel/disks/cdromcache.h>
+#include "ata.h"
+
+namespace Kernel {
+
+    #define IDE_PRIMARY_IO              0x1F0
+    #define IDE_PRIMARY_CONTROL         0x3F6
+    #define IDE_SECONDARY_IO            0x170
+    #define IDE_SECONDARY_CONTROL       0x376
+    #define IDE_PRIMARY_IRQ             14
+    #define IDE_SECONDARY_IRQ           15
+
+    #define ATA_REG_DATA                0
+    #define ATA_REG_ERROR               1
+    #define ATA_REG_FEATURES            1
+    #define ATA_REG_SECCOUNT            2
+    #define ATA_REG_LBA0                3
+    #define ATA_REG_LBA1                4
+    #define ATA_REG_LBA2                5
+    #define ATA_REG_DRIVE               6
+    #define ATA_REG_COMMAND             7
+    #define ATA_REG_STATUS              7
+
+    #define IDE_BM_COMMAND              0
+    #define IDE_BM_STATUS               2
+    #define IDE_BM_PRDT                 4
+    #define IDE_BM_CMD_START            0x01
+    #define IDE_BM_CMD_READ             0x08
+    #define IDE_BM_STATUS_ACTIVE        0x01
+    #define IDE_BM_STATUS_ERROR         0x02
+    #define IDE_BM_STATUS_IRQ           0x04
+
+    #define IDE_PRD_END                 0x8000
+    #define IDE_PRD_ENTRIES             32
+    #define IDE_MAX_SECTORS             128
+    #define IDE_SECTOR_SIZE             512
+    #define IDE_TIMEOUT                 1000000
+    #define IDE_DMA_TIMEOUT_MS          10000
+    #define IDE_ATAPI_MAX_SECTORS       32
+    #define IDE_ATAPI_BYTE_LIMIT        0xF800
+
+    /**
+     * @brief physical region descriptor, one piece of a DMA transfer that may not cross a 64K boundary
+     */
+    struct idePrdEntry {
+        ak::uint32_t address;
+        ak::uint16_t byteCount;
+        ak::uint16_t flags;
+    } __attribute__((packed));
+
+    struct ideDrive {
+        bool present;
+        bool atapi;
+        bool dma;
+        ataIdentity identity;
+        cdromCache* cache;
+        Disk* disk;
+    };
+
+    /**
+     * @brief one ATA channel, owns its PRD table and wakes the thread waiting on it from IRQ 14 or 15
+     */
+    class ideChannel : public system::interruptHandler {
+      public:
+        ak::uint16_t ioBase;
+        ak::uint16_t controlBase;
+        ak::uint16_t busMaster;
+
+        idePrdEntry* prdTable = 0;
+        ak::uint32_t prdPhysical = 0;
+
+        completion irq;
+        volatile ak::uint8_t busMasterStatus = 0;
+        mutexLock lock;
+
+        ideChannel(ak::uint8_t irq, ak::uint16_t ioBase, ak::uint16_t controlBase, ak::uint16_t busMaster);
+        ~ideChannel();
+
+        ak::uint32_t handleInterrupt(ak::uint32_t esp);
+        static bool pollStatus(void* context);
+
+      private:
+        ak::uint8_t vector;
+        ak::uint8_t* prdMemory = 0;
+    };
+
+    /**
+     * @brief ideController[read, write] PCI IDE controller, bus master DMA for ATA disks with PIO for everything DMA can not reach
+     */
+    class ideController : public diskController, public driver {
+      public:
+        ideController(pciDevice* device, pciController* pci);
+        ~ideController();
+
+        static int probe(pciController* pci, diskManager* disks);
+
+        bool initialize();
+        void addDisks(diskManager* disks);
+
+        char readSector(ak::uint16_t drive, ak::uint32_t lba, ak::uint8_t* buf);
+        char writeSector(ak::uint16_t drive, ak::uint32_t lba, ak::uint8_t* buf);
+
+        char readSectors(ak::uint16_t drive, ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf);
+        char writeSectors(ak::uint16_t drive, ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf);
+
+        bool ejectDrive(ak::uint8_t drive);
+
+      private:
+        pciDevice* device;
+        pciController* pci;
+        ideChannel* channels[2];
+        ideDrive drives[4];
+
+        bool identify(ak::uint16_t drive, ak::uint16_t* data, bool* atapi);
+        bool poll(ideChannel* channel, bool dataRequest = false);
+        bool selectDrive(ak::uint16_t drive, ak::uint32_t lba, ak::uint32_t count);
+
+        bool buildPrdTable(ideChannel* channel, ak::uint8_t* buf, ak::uint32_t bytes);
+        bool waitInterrupt(ideChannel* channel);
+
+        char transfer(ak::uint16_t drive, bool write, ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf);
+        char transferDMA(ak::uint16_t drive, bool write, ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf);
+        char transferPIO(ak::uint16_t drive, bool write, ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf);
+
+        char transferPacket(ak::uint16_t drive, ak::uint8_t* packet, ak::uint8_t* buf, ak::uint32_t bytes);
+        ak::uint32_t readCapacity(ak::uint16_t drive);
+        bool mediumChanged(ak::uint16_t drive);
+        char readPacketSectors(ak::uint16_t drive, ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf);
+    };
+}
@@ -0,0 +1,481 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#include "nvme.h"
+#include <cpu/idt.h>
+#include <memory/virtualmemory.h>
+#include <memory/devicememory.h>
+#include <kernel/disks/dmabuffer.h>
+#include <kernel/system/log.h>
+
+using namespace Kernel::ak;
+using namespace Kernel;
+using namespace Kernel::system;
+
+nvmeController::nvmeController(pciDevice* device, pciController* pci)
+: diskController(), driver((char*)"NVMe Controller", (char*)"NVM Express namespaces"), interruptHandler(IDT_INTERRUPT_OFFSET + device->interrupt) {
+    this->device = device;
+    this->pci = pci;
+    memOperator::memset(&this->admin, 0, sizeof(nvmeQueuePair));
+    memOperator::memset(&this->io, 0, sizeof(nvmeQueuePair));
+    memOperator::memset(this->slots, 0, sizeof(this->slots));
+    memOperator::memset(this->namespaces, 0, sizeof(this->namespaces));
+    this->model[0] = '\0';
+}
+
+nvmeController::~nvmeController() {
+    // Queue memory is never handed back, a disabled controller no longer touches it
+    if(this->registers != 0) {
+        writeRegister(NVME_REG_INTMS, 1);
+        writeRegister(NVME_REG_CC, readRegister(NVME_REG_CC) & ~NVME_CC_ENABLE);
+    }
+}
+
+int nvmeController::probe(pciController* pci, diskManager* disks) {
+    int found = 0;
+
+    for(int i = 0; i < pci->deviceList.size(); i++) {
+        pciDevice* device = pci->deviceList[i];
+        if(device->classID != 0x01 || device->subclassID != 0x08 || device->interfaceID != 0x02)
+            continue;
+
+        nvmeController* controller = new nvmeController(device, pci);
+        if(!controller->initialize()) {
+            interruptManager::removeHandler(controller, IDT_INTERRUPT_OFFSET + device->interrupt);
+            delete controller;
+            continue;
+        }
+
+        controller->addDisks(disks);
+        found++;
+    }
+
+    return found;
+}
+
+uint32_t nvmeController::readRegister(uint32_t offset) {
+    return *(volatile uint32_t*)(this->registers + offset);
+}
+
+void nvmeController::writeRegister(uint32_t offset, uint32_t value) {
+    *(volatile uint32_t*)(this->registers + offset) = value;
+}
+
+void nvmeController::writeRegister64(uint32_t offset, uint64_t value) {
+    writeRegister(offset, (uint32_t)value);
+    writeRegister(offset + 4, (uint32_t)(value >> 32));
+}
+
+bool nvmeController::initialize() {
+    uint16_t bus = this->device->bus;
+    uint16_t slot = this->device->device;
+    uint16_t function = this->device->function;
+
+    baseAddress bar = this->pci->getBaseAddressRegister(bus, slot, function, 0);
+    if(bar.type != MemoryMapping || bar.address == 0 || (bar.address >> 32) != 0) {
+        Log(Warning, "NVMe controller registers are not reachable");
+        return false;
+    }
+
+    // Memory space and bus mastering on, the INTx disable bit off
+    uint32_t command = this->pci->read(bus, slot, function, 0x04);
+    this->pci->write(bus, slot, function, 0x04, (command | PCI_CMDREG_MEM | PCI_CMDREG_BM) & ~(1 << 10));
+
+    this->registers = (volatile uint8_t*)deviceMemory::mapRegisters((uint32_t)bar.address, NVME_REGISTER_WINDOW);
+    if(this->registers == 0)
+        return false;
+
+    if(!resetController())
+        return false;
+
+    uint32_t physical = 0;
+    uint8_t* buffer = (uint8_t*)deviceMemory::allocatePage(&physical);
+    if(buffer == 0 || !identify(buffer, physical))
+        return false;
+
+    if(!createIOQueues())
+        return false;
+
+    Log(Info, "NVMe %s: %d namespaces, %d commands in flight of up to %d KB", this->model, this->namespaceCount, this->slotCount, this->maxTransfer / 1_KB);
+    return this->namespaceCount > 0;
+}
+
+bool nvmeController::setupQueue(nvmeQueuePair* queue, uint16_t id, uint16_t entries) {
+    queue->submissions = (nvmeCommand*)deviceMemory::allocatePage(&queue->submissionPhysical);
+    queue->completions = (nvmeCompletion*)deviceMemory::allocatePage(&queue->completionPhysical);
+    if(queue->submissions == 0 || queue->completions == 0)
+        return false;
+
+    queue->submissionDoorbell = (volatile uint32_t*)(this->registers + NVME_REG_DOORBELLS + (2 * id) * this->doorbellStride);
+    queue->completionDoorbell = (volatile uint32_t*)(this->registers + NVME_REG_DOORBELLS + (2 * id + 1) * this->doorbellStride);
+    queue->size = entries;
+    queue->tail = 0;
+    queue->head = 0;
+    queue->phase = 1;
+    return true;
+}
+
+bool nvmeController::resetController() {
+    uint32_t capabilities = readRegister(NVME_REG_CAP);
+    uint32_t capabilitiesHigh = readRegister(NVME_REG_CAP + 4);
+
+    uint32_t maxEntries = (capabilities & 0xFFFF) + 1;
+    this->doorbellStride = 4 << (capabilitiesHigh & 0x0F);
+    if(NVME_REG_DOORBELLS + 4 * this->doorbellStride > NVME_REGISTER_WINDOW)
+        return false;
+
+    // Everything up to the I/O queues is polled, interrupts stay masked until then
+    writeRegister(NVME_REG_INTMS, 1);
+
+    writeRegister(NVME_REG_CC, readRegister(NVME_REG_CC) & ~NVME_CC_ENABLE);
+    for(uint32_t i = 0; i < NVME_TIMEOUT && (readRegister(NVME_REG_CSTS) & NVME_CSTS_READY); i++);
+    if(readRegister(NVME_REG_CSTS) & NVME_CSTS_READY)
+        return false;
+
+    uint16_t entries = maxEntries < NVME_QUEUE_ENTRIES ? maxEntries : NVME_QUEUE_ENTRIES;
+    if(!setupQueue(&this->admin, 0, entries))
+        return false;
+
+    writeRegister(NVME_REG_AQA, ((entries - 1) << 16) | (entries - 1));
+    writeRegister64(NVME_REG_ASQ, this->admin.submissionPhysical);
+    writeRegister64(NVME_REG_ACQ, this->admin.completionPhysical);
+
+    // 4K memory pages, 64 byte submission and 16 byte completion entries
+    writeRegister(NVME_REG_CC, NVME_CC_ENABLE | NVME_CC_IOSQES | NVME_CC_IOCQES);
+    for(uint32_t i = 0; i < NVME_TIMEOUT && !(readRegister(NVME_REG_CSTS) & (NVME_CSTS_READY | NVME_CSTS_FATAL)); i++);
+
+    uint32_t status = readRegister(NVME_REG_CSTS);
+    if(!(status & NVME_CSTS_READY) || (status & NVME_CSTS_FATAL)) {
+        Log(Error, "NVMe controller did not become ready, status %x", status);
+        return false;
+    }
+
+    return true;
+}
+
+bool nvmeController::adminCommand(nvmeCommand* command) {
+    nvmeQueuePair* queue = &this->admin;
+
+    command->command |= queue->tail << 16;
+    memOperator::memcpy(&queue->submissions[queue->tail], command, sizeof(nvmeCommand));
+    queue->tail = (queue->tail + 1) % queue->size;
+    *queue->submissionDoorbell = queue->tail;
+
+    for(uint32_t i = 0; i < NVME_TIMEOUT; i++) {
+        volatile nvmeCompletion* entry = &queue->completions[queue->head];
+        if((entry->status & 1) != queue->phase)
+            continue;
+
+        uint16_t status = entry->status >> 1;
+        if(++queue->head == queue->size) {
+            queue->head = 0;
+            queue->phase ^= 1;
+        }
+        *queue->completionDoorbell = queue->head;
+
+        if(status != 0)
+            Log(Error, "NVMe admin command %d failed, status %x", command->command & 0xFF, status);
+        return status == 0;
+    }
+
+    Log(Error, "NVMe admin command %d timed out", command->command & 0xFF);
+    return false;
+}
+
+bool nvmeController::identify(uint8_t* buffer, uint32_t physical) {
+    nvmeCommand command;
+    memOperator::memset(&command, 0, sizeof(nvmeCommand));
+    command.command = NVME_ADMIN_IDENTIFY;
+    command.prp1 = physical;
+    command.dword10 = NVME_IDENTIFY_CONTROLLER;
+    if(!adminCommand(&command))
+        return false;
+
+    // The model number is ASCII padded with spaces, not byte swapped like ATA
+    memOperator::memcpy(this->model, buffer + 24, 40);
+    int length = 40;
+    while(length > 0 && this->model[length - 1] == ' ')
+        length--;
+    this->model[length] = '\0';
+
+    // MDTS counts in minimum memory pages as a power of two, 0 means no limit
+    uint8_t maxTransferShift = buffer[77];
+    if(maxTransferShift != 0 && maxTransferShift < 20 && (PAGE_SIZE << maxTransferShift) < this->maxTransfer)
+        this->maxTransfer = PAGE_SIZE << maxTransferShift;
+
+    uint32_t count = *(uint32_t*)(buffer + 516);
+    for(uint32_t id = 1; id <= count && this->namespaceCount < NVME_MAX_NAMESPACES; id++) {
+        memOperator::memset(&command, 0, sizeof(nvmeCommand));
+        command.command = NVME_ADMIN_IDENTIFY;
+        command.namespaceID = id;
+        command.prp1 = physical;
+        command.dword10 = NVME_IDENTIFY_NAMESPACE;
+        if(!adminCommand(&command))
+            continue;
+
+        uint32_t size = *(uint32_t*)buffer;
+        uint32_t sizeHigh = *(uint32_t*)(buffer + 4);
+        if(size == 0 && sizeHigh == 0)
+            continue;
+
+        // The formatted LBA size picks one of the formats at byte 128, bits 16 to 23 hold the block size shift
+        uint8_t format = buffer[26] & 0x0F;
+        uint32_t lbaFormat = *(uint32_t*)(buffer + 128 + format * 4);
+        uint32_t blockSize = 1 << ((lbaFormat >> 16) & 0xFF);
+
+        // Partition tables and filesystems are read in 512 byte sectors
+        if(blockSize != NVME_BLOCK_SIZE) {
+            Log(Warning, "NVMe namespace %d uses %d byte blocks, skipping it", id, blockSize);
+            continue;
+        }
+
+        nvmeNamespace* space = &this->namespaces[this->namespaceCount++];
+        space->id = id;
+        space->blocks = sizeHigh != 0 ? 0xFFFFFFFF : size;
+        space->blockSize = blockSize;
+    }
+
+    return true;
+}
+
+bool nvmeController::createIOQueues() {
+    // The kernel runs on one CPU, so that is one I/O queue pair
+    if(!setupQueue(&this->io, 1, this->admin.size))
+        return false;
+
+    nvmeCommand command;
+    memOperator::memset(&command, 0, sizeof(nvmeCommand));
+    command.command = NVME_ADMIN_CREATE_CQ;
+    command.prp1 = this->io.completionPhysical;
+    command.dword10 = ((this->io.size - 1) << 16) | 1;
+    command.dword11 = NVME_QUEUE_INTERRUPTS | NVME_QUEUE_CONTIGUOUS;
+    if(!adminCommand(&command))
+        return false;
+
+    memOperator::memset(&command, 0, sizeof(nvmeCommand));
+    command.command = NVME_ADMIN_CREATE_SQ;
+    command.prp1 = this->io.submissionPhysical;
+    command.dword10 = ((this->io.size - 1) << 16) | 1;
+    command.dword11 = (1 << 16) | NVME_QUEUE_CONTIGUOUS;
+    if(!adminCommand(&command))
+        return false;
+
+    // One slot less than the queue holds, so the submission queue can never overflow
+    this->slotCount = this->io.size - 1 < NVME_SLOTS ? this->io.size - 1 : NVME_SLOTS;
+    for(uint32_t i = 0; i < this->slotCount; i++) {
+        this->slots[i].prpList = (uint64_t*)deviceMemory::allocatePage(&this->slots[i].prpPhysical);
+        if(this->slots[i].prpList == 0) {
+            this->slotCount = i;
+            break;
+        }
+    }
+
+    this->ioReady = this->slotCount > 0;
+    writeRegister(NVME_REG_INTMC, 1);
+    return this->ioReady;
+}
+
+void nvmeController::addDisks(diskManager* disks) {
+    for(uint32_t i = 0; i < this->namespaceCount; i++) {
+        nvmeNamespace* space = &this->namespaces[i];
+        Disk* disk = new Disk(i, this, hardDisk, (uint64_t)space->blocks * space->blockSize, space->blocks, space->blockSize);
+        disk->identifier = this->model;
+        disks->addDisk(disk);
+    }
+}
+
+bool nvmeController::buildPrps(nvmeCommand* command, nvmeSlot* slot, uint8_t* buf, uint32_t bytes) {
+    uint32_t address = (uint32_t)buf;
+    command->prp1 = (uint32_t)virtualMemoryManager::virtualToPhysical((void*)address);
+    command->prp2 = 0;
+
+    // The first entry may start inside a page, every following one covers a whole page
+    uint32_t first = PAGE_SIZE - (address % PAGE_SIZE);
+    if(bytes <= first)
+        return true;
+
+    bytes -= first;
+    address += first;
+    if(bytes <= PAGE_SIZE) {
+        command->prp2 = (uint32_t)virtualMemoryManager::virtualToPhysical((void*)address);
+        return true;
+    }
+
+    uint32_t entries = 0;
+    while(bytes > 0) {
+        if(entries == PAGE_SIZE / sizeof(uint64_t))
+            return false;
+
+        slot->prpList[entries++] = (uint32_t)virtualMemoryManager::virtualToPhysical((void*)address);
+        address += PAGE_SIZE;
+        bytes -= bytes > PAGE_SIZE ? PAGE_SIZE : bytes;
+    }
+
+    command->prp2 = slot->prpPhysical;
+    return true;
+}
+
+void nvmeController::reap() {
+    nvmeQueuePair* queue = &this->io;
+    bool reaped = false;
+
+    while(true) {
+        volatile nvmeCompletion* entry = &queue->completions[queue->head];
+        if((entry->status & 1) != queue->phase)
+            break;
+
+        uint16_t id = entry->commandID;
+        if(id < this->slotCount) {
+            this->slots[id].status = entry->status >> 1;
+            this->inFlight--;
+            completionHelper::signal(&this->slots[id].completed);
+        }
+
+        if(++queue->head == queue->size) {
+            queue->head = 0;
+            queue->phase ^= 1;
+        }
+        reaped = true;
+    }
+
+    if(reaped)
+        *queue->completionDoorbell = queue->head;
+
+    // Under load the waiters poll, an interrupt for every completion would only add work
+    bool busy = this->inFlight > NVME_POLL_DEPTH;
+    if(busy != this->interruptsMasked) {
+        writeRegister(busy ? NVME_REG_INTMS : NVME_REG_INTMC, 1);
+        this->interruptsMasked = busy;
+    }
+}
+
+uint32_t nvmeController::handleInterrupt(uint32_t esp) {
+    if(this->ioReady)
+        reap();
+    return esp;
+}
+
+bool nvmeController::pollQueue(void* context) {
+    nvmeController* controller = (nvmeController*)context;
+    controller->reap();
+
+    // Busy queue, the next completion is close and some waiter will reap it
+    return controller->interruptsMasked;
+}
+
+void nvmeController::failController() {
+    // Called with interrupts off, a command that never completes leaves the queue in an unknown state so the controller is switched off
+    if(!this->ioReady)
+        return;
+
+    Log(Error, "NVMe %s stopped responding, disabling it", this->model);
+    this->ioReady = false;
+    writeRegister(NVME_REG_INTMS, 1);
+    writeRegister(NVME_REG_CC, readRegister(NVME_REG_CC) & ~NVME_CC_ENABLE);
+
+    for(uint32_t i = 0; i < this->slotCount; i++) {
+        if(!(this->usedSlots & (1 << i)) || this->slots[i].completed.done)
+            continue;
+
+        this->slots[i].status = NVME_STATUS_ABORTED;
+        completionHelper::signal(&this->slots[i].completed);
+    }
+    this->inFlight = 0;
+}
+
+char nvmeController::transferCommand(nvmeNamespace* space, bool write, uint32_t lba, uint32_t count, uint8_t* buf) {
+    int slot = completionHelper::claimSlot(&this->usedSlots, this->slotCount);
+    nvmeSlot* state = &this->slots[slot];
+
+    nvmeCommand command;
+    memOperator::memset(&command, 0, sizeof(nvmeCommand));
+    command.command = (write ? NVME_CMD_WRITE : NVME_CMD_READ) | (slot << 16);
+    command.namespaceID = space->id;
+    command.dword10 = lba;
+    command.dword11 = 0;
+    command.dword12 = count - 1;
+
+    if(!buildPrps(&command, state, buf, count * space->blockSize)) {
+        completionHelper::releaseSlot(&this->usedSlots, slot);
+        return DISK_ERROR;
+    }
+
+    completionHelper::reset(&state->completed);
+    state->status = 0;
+
+    interruptDescriptorTable::disableInterrupts();
+    if(!this->ioReady) {
+        interruptDescriptorTable::enableInterrupts();
+        completionHelper::releaseSlot(&this->usedSlots, slot);
+        return DISK_ERROR;
+    }
+
+    memOperator::memcpy(&this->io.submissions[this->io.tail], &command, sizeof(nvmeCommand));
+    this->io.tail = (this->io.tail + 1) % this->io.size;
+    *this->io.submissionDoorbell = this->io.tail;
+    this->inFlight++;
+    interruptDescriptorTable::enableInterrupts();
+
+    if(!completionHelper::wait(&state->completed, NVME_COMMAND_TIMEOUT_MS, pollQueue, this)) {
+        interruptDescriptorTable::disableInterrupts();
+        if(!state->completed.done)
+            failController();
+        interruptDescriptorTable::enableInterrupts();
+    }
+
+    bool result = state->completed.done && state->status == 0;
+    uint16_t status = state->status;
+    completionHelper::releaseSlot(&this->usedSlots, slot);
+
+    if(!result) {
+        Log(Error, "NVMe %s of %d blocks at %d failed, status %x", write ? "write" : "read", count, lba, status);
+        return DISK_ERROR;
+    }
+
+    return DISK_SUCCESS;
+}
+
+char nvmeController::transfer(uint16_t drive, bool write, uint32_t lba, uint32_t count, uint8_t* buf) {
+    if(drive >= this->namespaceCount || !this->ioReady)
+        return DISK_ERROR;
+
+    nvmeNamespace* space = &this->namespaces[drive];
+    uint32_t maxBlocks = this->maxTransfer / space->blockSize;
+
+    // PRP entries need dword aligned buffers
+    dmaBuffer dma(buf, this->maxTransfer, 4);
+
+    char result = DISK_SUCCESS;
+    for(uint32_t done = 0; done < count && result == DISK_SUCCESS; ) {
+        uint32_t blocks = count - done > maxBlocks ? maxBlocks : count - done;
+        uint8_t* part = buf + done * space->blockSize;
+
+        result = transferCommand(space, write, lba + done, blocks, dma.begin(part, blocks * space->blockSize, write));
+        dma.end(part, blocks * space->blockSize, write, result == DISK_SUCCESS);
+
+        done += blocks;
+    }
+
+    return result;
+}
+
+char nvmeController::readSector(uint16_t drive, uint32_t lba, uint8_t* buf) {
+    return transfer(drive, false, lba, 1, buf);
+}
+
+char nvmeController::writeSector(uint16_t drive, uint32_t lba, uint8_t* buf) {
+    return transfer(drive, true, lba, 1, buf);
+}
+
+char nvmeController::readSectors(uint16_t drive, uint32_t lba, uint32_t count, uint8_t* buf) {
+    return transfer(drive, false, lba, count, buf);
+}
+
+char nvmeController::writeSectors(uint16_t drive, uint32_t lba, uint32_t count, uint8_t* buf) {
+    return transfer(drive, true, lba, count, buf);
+}
+
+bool nvmeController::queuesCommands(uint16_t drive) {
+    return true;
+}
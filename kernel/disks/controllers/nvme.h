@@ -0,0 +1,171 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#pragma once
+
+#include <ak/types.h>
+#include <internal/pci.h>
+#include <system/interrupthandler.h>
+#include <kernel/drivers/driver.h>
+#include <tasking/completion.h>
+#include <kernel/disks/diskcontroller.h>
+
+namespace Kernel {
+
+    #define NVME_REG_CAP                0x00
+    #define NVME_REG_INTMS              0x0C
+    #define NVME_REG_INTMC              0x10
+    #define NVME_REG_CC                 0x14
+    #define NVME_REG_CSTS               0x1C
+    #define NVME_REG_AQA                0x24
+    #define NVME_REG_ASQ                0x28
+    #define NVME_REG_ACQ                0x30
+    #define NVME_REG_DOORBELLS          0x1000
+    #define NVME_REGISTER_WINDOW        0x2000
+
+    #define NVME_CC_ENABLE              (1 << 0)
+    #define NVME_CC_IOSQES              (6 << 16)
+    #define NVME_CC_IOCQES              (4 << 20)
+    #define NVME_CSTS_READY             (1 << 0)
+    #define NVME_CSTS_FATAL             (1 << 1)
+
+    #define NVME_ADMIN_CREATE_SQ        0x01
+    #define NVME_ADMIN_CREATE_CQ        0x05
+    #define NVME_ADMIN_IDENTIFY         0x06
+    #define NVME_CMD_WRITE              0x01
+    #define NVME_CMD_READ               0x02
+
+    #define NVME_IDENTIFY_NAMESPACE     0
+    #define NVME_IDENTIFY_CONTROLLER    1
+    #define NVME_QUEUE_CONTIGUOUS       (1 << 0)
+    #define NVME_QUEUE_INTERRUPTS       (1 << 1)
+
+    #define NVME_QUEUE_ENTRIES          64
+    #define NVME_SLOTS                  32
+    #define NVME_MAX_NAMESPACES         8
+    #define NVME_MAX_TRANSFER           128_KB
+    #define NVME_BLOCK_SIZE             512
+    #define NVME_POLL_DEPTH             4
+    #define NVME_TIMEOUT                1000000
+    #define NVME_COMMAND_TIMEOUT_MS     10000
+    #define NVME_STATUS_ABORTED         0xFFFF
+
+    struct nvmeCommand {
+        ak::uint32_t command;
+        ak::uint32_t namespaceID;
+        ak::uint32_t reserved[2];
+        ak::uint64_t metadata;
+        ak::uint64_t prp1;
+        ak::uint64_t prp2;
+        ak::uint32_t dword10;
+        ak::uint32_t dword11;
+        ak::uint32_t dword12;
+        ak::uint32_t dword13;
+        ak::uint32_t dword14;
+        ak::uint32_t dword15;
+    } __attribute__((packed));
+
+    struct nvmeCompletion {
+        ak::uint32_t result;
+        ak::uint32_t reserved;
+        ak::uint16_t submissionHead;
+        ak::uint16_t submissionID;
+        ak::uint16_t commandID;
+        ak::uint16_t status;
+    } __attribute__((packed));
+
+    /**
+     * @brief submission and completion queue pair, the phase bit tells which completions are new
+     */
+    struct nvmeQueuePair {
+        nvmeCommand* submissions;
+        nvmeCompletion* completions;
+        ak::uint32_t submissionPhysical;
+        ak::uint32_t completionPhysical;
+        volatile ak::uint32_t* submissionDoorbell;
+        volatile ak::uint32_t* completionDoorbell;
+        ak::uint16_t size;
+        ak::uint16_t tail;
+        ak::uint16_t head;
+        ak::uint16_t phase;
+    };
+
+    /**
+     * @brief command in flight on the I/O queue, the command id is the slot number
+     */
+    struct nvmeSlot {
+        completion completed;
+        ak::uint16_t status;
+        ak::uint64_t* prpList;
+        ak::uint32_t prpPhysical;
+    };
+
+    struct nvmeNamespace {
+        ak::uint32_t id;
+        ak::uint32_t blocks;
+        ak::uint32_t blockSize;
+    };
+
+    /**
+     * @brief nvmeController[read, write] NVMe namespaces as disks, completions are polled while the queue is busy and come by interrupt when it is not
+     */
+    class nvmeController : public diskController, public driver, public system::interruptHandler {
+      public:
+        nvmeController(pciDevice* device, pciController* pci);
+        ~nvmeController();
+
+        static int probe(pciController* pci, diskManager* disks);
+
+        bool initialize();
+        void addDisks(diskManager* disks);
+        ak::uint32_t handleInterrupt(ak::uint32_t esp);
+
+        char readSector(ak::uint16_t drive, ak::uint32_t lba, ak::uint8_t* buf);
+        char writeSector(ak::uint16_t drive, ak::uint32_t lba, ak::uint8_t* buf);
+
+        char readSectors(ak::uint16_t drive, ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf);
+        char writeSectors(ak::uint16_t drive, ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf);
+
+        bool queuesCommands(ak::uint16_t drive);
+
+      private:
+        pciDevice* device;
+        pciController* pci;
+        volatile ak::uint8_t* registers = 0;
+        ak::uint32_t doorbellStride = 4;
+        ak::uint32_t maxTransfer = NVME_MAX_TRANSFER;
+        char model[41];
+
+        nvmeQueuePair admin;
+        nvmeQueuePair io;
+        bool ioReady = false;
+
+        nvmeSlot slots[NVME_SLOTS];
+        ak::uint32_t slotCount = 0;
+        volatile ak::uint32_t usedSlots = 0;
+        volatile ak::uint32_t inFlight = 0;
+        bool interruptsMasked = false;
+
+        nvmeNamespace namespaces[NVME_MAX_NAMESPACES];
+        ak::uint32_t namespaceCount = 0;
+
+        ak::uint32_t readRegister(ak::uint32_t offset);
+        void writeRegister(ak::uint32_t offset, ak::uint32_t value);
+        void writeRegister64(ak::uint32_t offset, ak::uint64_t value);
+
+        bool setupQueue(nvmeQueuePair* queue, ak::uint16_t id, ak::uint16_t entries);
+        bool resetController();
+        bool adminCommand(nvmeCommand* command);
+        bool identify(ak::uint8_t* buffer, ak::uint32_t physical);
+        bool createIOQueues();
+
+        bool buildPrps(nvmeCommand* command, nvmeSlot* slot, ak::uint8_t* buf, ak::uint32_t bytes);
+        void reap();
+        void failController();
+        static bool pollQueue(void* context);
+
+        char transferCommand(nvmeNamespace* space, bool write, ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf);
+        char transfer(ak::uint16_t drive, bool write, ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf);
+    };
+}
@@ -0,0 +1,71 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#include "virtio.h"
+#include <cpu/port.h>
+#include <memory/virtualmemory.h>
+#include <memory/devicememory.h>
+#include <kernel/system/log.h>
+
+using namespace Kernel::ak;
+using namespace Kernel;
+
+// x86 keeps stores in order, only the compiler has to be stopped from moving them
+static inline void barrier() {
+    asm volatile("" ::: "memory");
+}
+
+bool virtQueue::setup(uint16_t ioBase, uint16_t index) {
+    this->ioBase = ioBase;
+    this->index = index;
+
+    outportw(ioBase + VIRTIO_PCI_QUEUE_SELECT, index);
+    this->size = inportw(ioBase + VIRTIO_PCI_QUEUE_SIZE);
+    if(this->size == 0)
+        return false;
+
+    // Legacy devices take one page number, so the rings have to be physically contiguous with the used ring page aligned
+    uint32_t availableEnd = this->size * sizeof(virtqDescriptor) + sizeof(virtqAvailable) + this->size * sizeof(uint16_t) + sizeof(uint16_t);
+    uint32_t usedOffset = (availableEnd + VIRTQ_ALIGN - 1) & ~(VIRTQ_ALIGN - 1);
+    uint32_t usedSize = sizeof(virtqUsed) + this->size * sizeof(virtqUsedElement) + sizeof(uint16_t);
+    uint32_t pages = (usedOffset + usedSize + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    uint32_t physical = 0;
+    uint8_t* memory = (uint8_t*)deviceMemory::allocatePages(pages, &physical);
+    if(memory == 0)
+        return false;
+
+    this->descriptors = (virtqDescriptor*)memory;
+    this->available = (virtqAvailable*)(memory + this->size * sizeof(virtqDescriptor));
+    this->used = (virtqUsed*)(memory + usedOffset);
+
+    outportl(ioBase + VIRTIO_PCI_QUEUE_ADDRESS, physical / VIRTQ_ALIGN);
+    return true;
+}
+
+void virtQueue::publish(uint16_t head) {
+    this->available->ring[this->available->index % this->size] = head;
+    barrier();
+    this->available->index++;
+}
+
+void virtQueue::kick() {
+    barrier();
+
+    // A device that is still working through the ring picks new entries up without being told
+    if(this->available->index != this->lastKicked && !(this->used->flags & VIRTQ_USED_F_NO_NOTIFY))
+        outportw(this->ioBase + VIRTIO_PCI_QUEUE_NOTIFY, this->index);
+
+    this->lastKicked = this->available->index;
+}
+
+bool virtQueue::nextUsed(uint32_t* id) {
+    barrier();
+    if(this->lastUsed == this->used->index)
+        return false;
+
+    *id = this->used->ring[this->lastUsed % this->size].id;
+    this->lastUsed++;
+    return true;
+}
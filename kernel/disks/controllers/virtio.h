@@ -0,0 +1,83 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#pragma once
+
+#include <ak/types.h>
+
+namespace Kernel {
+
+    #define VIRTIO_VENDOR_ID                0x1AF4
+
+    #define VIRTIO_PCI_DEVICE_FEATURES      0x00
+    #define VIRTIO_PCI_GUEST_FEATURES       0x04
+    #define VIRTIO_PCI_QUEUE_ADDRESS        0x08
+    #define VIRTIO_PCI_QUEUE_SIZE           0x0C
+    #define VIRTIO_PCI_QUEUE_SELECT         0x0E
+    #define VIRTIO_PCI_QUEUE_NOTIFY         0x10
+    #define VIRTIO_PCI_STATUS               0x12
+    #define VIRTIO_PCI_ISR                  0x13
+    #define VIRTIO_PCI_CONFIG               0x14
+
+    #define VIRTIO_STATUS_ACKNOWLEDGE       1
+    #define VIRTIO_STATUS_DRIVER            2
+    #define VIRTIO_STATUS_DRIVER_OK         4
+    #define VIRTIO_STATUS_FAILED            128
+
+    #define VIRTIO_ISR_QUEUE                1
+    #define VIRTIO_RING_F_INDIRECT_DESC     (1 << 28)
+
+    #define VIRTQ_DESC_F_NEXT               1
+    #define VIRTQ_DESC_F_WRITE              2
+    #define VIRTQ_DESC_F_INDIRECT           4
+    #define VIRTQ_USED_F_NO_NOTIFY          1
+    #define VIRTQ_ALIGN                     4096
+
+    struct virtqDescriptor {
+        ak::uint64_t address;
+        ak::uint32_t length;
+        ak::uint16_t flags;
+        ak::uint16_t next;
+    } __attribute__((packed));
+
+    struct virtqAvailable {
+        ak::uint16_t flags;
+        ak::uint16_t index;
+        ak::uint16_t ring[];
+    } __attribute__((packed));
+
+    struct virtqUsedElement {
+        ak::uint32_t id;
+        ak::uint32_t length;
+    } __attribute__((packed));
+
+    struct virtqUsed {
+        ak::uint16_t flags;
+        ak::uint16_t index;
+        virtqUsedElement ring[];
+    } __attribute__((packed));
+
+    /**
+     * @brief virtQueue[setup, publish, kick, next used] split virtqueue of a legacy virtio PCI device, descriptors, available and used ring in one contiguous block
+     */
+    class virtQueue {
+      public:
+        ak::uint16_t size = 0;
+        virtqDescriptor* descriptors = 0;
+
+        bool setup(ak::uint16_t ioBase, ak::uint16_t index);
+
+        void publish(ak::uint16_t head);
+        void kick();
+        bool nextUsed(ak::uint32_t* id);
+
+      private:
+        ak::uint16_t ioBase = 0;
+        ak::uint16_t index = 0;
+        virtqAvailable* available = 0;
+        virtqUsed* used = 0;
+        ak::uint16_t lastUsed = 0;
+        ak::uint16_t lastKicked = 0;
+    };
+}
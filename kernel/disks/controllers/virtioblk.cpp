@@ -0,0 +1,319 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#include "virtioblk.h"
+#include <cpu/idt.h>
+#include <cpu/port.h>
+#include <memory/virtualmemory.h>
+#include <memory/devicememory.h>
+#include <kernel/disks/dmabuffer.h>
+#include <kernel/system/log.h>
+
+using namespace Kernel::ak;
+using namespace Kernel;
+using namespace Kernel::system;
+
+virtioBlock::virtioBlock(pciDevice* device, pciController* pci)
+: diskController(), driver((char*)"Virtio Block", (char*)"Paravirtual disk of QEMU and KVM"), interruptHandler(IDT_INTERRUPT_OFFSET + device->interrupt) {
+    this->device = device;
+    this->pci = pci;
+    memOperator::memset(this->slots, 0, sizeof(this->slots));
+}
+
+int virtioBlock::probe(pciController* pci, diskManager* disks) {
+    int found = 0;
+
+    for(int i = 0; i < pci->deviceList.size(); i++) {
+        pciDevice* device = pci->deviceList[i];
+        if(device->vendorID != VIRTIO_VENDOR_ID || device->deviceID != VIRTIO_BLK_DEVICE_ID)
+            continue;
+
+        virtioBlock* controller = new virtioBlock(device, pci);
+        if(!controller->initialize()) {
+            interruptManager::removeHandler(controller, IDT_INTERRUPT_OFFSET + device->interrupt);
+            delete controller;
+            continue;
+        }
+
+        controller->addDisk(disks);
+        found++;
+    }
+
+    return found;
+}
+
+bool virtioBlock::initialize() {
+    uint16_t bus = this->device->bus;
+    uint16_t slot = this->device->device;
+    uint16_t function = this->device->function;
+
+    baseAddress bar = this->pci->getBaseAddressRegister(bus, slot, function, 0);
+    if(bar.type != InputOutput || bar.address == 0)
+        return false;
+
+    this->ioBase = (uint16_t)(bar.address & ~3);
+    this->pci->write(bus, slot, function, 0x04, this->pci->read(bus, slot, function, 0x04) | PCI_CMDREG_IO | PCI_CMDREG_BM);
+
+    outportb(this->ioBase + VIRTIO_PCI_STATUS, 0);
+    outportb(this->ioBase + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+    outportb(this->ioBase + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+
+    uint32_t features = inportl(this->ioBase + VIRTIO_PCI_DEVICE_FEATURES) & (VIRTIO_RING_F_INDIRECT_DESC | VIRTIO_BLK_F_SEG_MAX | VIRTIO_BLK_F_RO);
+    outportl(this->ioBase + VIRTIO_PCI_GUEST_FEATURES, features);
+    this->indirect = features & VIRTIO_RING_F_INDIRECT_DESC;
+    this->readOnly = features & VIRTIO_BLK_F_RO;
+
+    // Config space: capacity in 512 byte sectors, maximum segment size and maximum segment count
+    this->capacity = inportl(this->ioBase + VIRTIO_PCI_CONFIG);
+    if(inportl(this->ioBase + VIRTIO_PCI_CONFIG + 4) != 0)
+        this->capacity = 0xFFFFFFFF;
+
+    if(features & VIRTIO_BLK_F_SEG_MAX) {
+        uint32_t segmentMax = inportl(this->ioBase + VIRTIO_PCI_CONFIG + 12);
+        if(segmentMax < this->segments)
+            this->segments = segmentMax;
+    }
+
+    if(!this->queue.setup(this->ioBase, 0)) {
+        outportb(this->ioBase + VIRTIO_PCI_STATUS, VIRTIO_STATUS_FAILED);
+        return false;
+    }
+
+    // Without indirect tables every slot owns a fixed run of ring descriptors for its whole chain
+    if(!this->indirect && this->segments + 2 > this->queue.size)
+        this->segments = this->queue.size - 2;
+    this->descriptorsPerSlot = this->indirect ? 1 : this->segments + 2;
+
+    // An unaligned buffer touches one page more than it covers
+    if(this->segments < 2) {
+        outportb(this->ioBase + VIRTIO_PCI_STATUS, VIRTIO_STATUS_FAILED);
+        return false;
+    }
+    if((this->segments - 1) * (PAGE_SIZE / VIRTIO_BLK_SECTOR_SIZE) < this->maxSectors)
+        this->maxSectors = (this->segments - 1) * (PAGE_SIZE / VIRTIO_BLK_SECTOR_SIZE);
+
+    this->slotCount = this->queue.size / this->descriptorsPerSlot;
+    if(this->slotCount > VIRTIO_BLK_SLOTS)
+        this->slotCount = VIRTIO_BLK_SLOTS;
+
+    uint32_t requestsPerPage = PAGE_SIZE / sizeof(virtioBlockRequest);
+    for(uint32_t i = 0; i < this->slotCount; i += requestsPerPage) {
+        uint32_t physical = 0;
+        uint8_t* page = (uint8_t*)deviceMemory::allocatePage(&physical);
+        if(page == 0) {
+            this->slotCount = i;
+            break;
+        }
+
+        for(uint32_t j = 0; j < requestsPerPage && i + j < this->slotCount; j++) {
+            this->slots[i + j].request = (virtioBlockRequest*)(page + j * sizeof(virtioBlockRequest));
+            this->slots[i + j].physAddress = physical + j * sizeof(virtioBlockRequest);
+        }
+    }
+
+    if(this->slotCount == 0) {
+        outportb(this->ioBase + VIRTIO_PCI_STATUS, VIRTIO_STATUS_FAILED);
+        return false;
+    }
+
+    outportb(this->ioBase + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+
+    Log(Info, "Virtio block device: %d MB, %d requests in flight of up to %d sectors%s", this->capacity / 2048, this->slotCount, this->maxSectors, this->indirect ? " with indirect descriptors" : "");
+    return true;
+}
+
+void virtioBlock::addDisk(diskManager* disks) {
+    Disk* disk = new Disk(0, this, hardDisk, (uint64_t)this->capacity * VIRTIO_BLK_SECTOR_SIZE, this->capacity, VIRTIO_BLK_SECTOR_SIZE);
+    disk->identifier = (char*)"Virtio Block Device";
+    disks->addDisk(disk);
+}
+
+bool virtioBlock::prepare(int slot, bool write, uint32_t lba, uint32_t count, uint8_t* buf) {
+    virtioBlockSlot* state = &this->slots[slot];
+    virtioBlockRequest* request = state->request;
+
+    request->header.type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    request->header.reserved = 0;
+    request->header.sector = lba;
+    request->status = 0xFF;
+
+    // The chain is header, data runs and status, next indices count from the start of the table it lives in
+    virtqDescriptor* chain = this->indirect ? request->table : &this->queue.descriptors[slot * this->descriptorsPerSlot];
+    uint16_t base = this->indirect ? 0 : slot * this->descriptorsPerSlot;
+
+    chain[0].address = state->physAddress + ((uint8_t*)&request->header - (uint8_t*)request);
+    chain[0].length = sizeof(virtioBlockHeader);
+    chain[0].flags = VIRTQ_DESC_F_NEXT;
+    chain[0].next = base + 1;
+
+    uint32_t entries = 1;
+    uint32_t address = (uint32_t)buf;
+    uint32_t bytes = count * VIRTIO_BLK_SECTOR_SIZE;
+    while(bytes > 0) {
+        uint32_t physical = (uint32_t)virtualMemoryManager::virtualToPhysical((void*)address);
+        uint32_t chunk = PAGE_SIZE - (address % PAGE_SIZE);
+        if(chunk > bytes)
+            chunk = bytes;
+
+        virtqDescriptor* last = &chain[entries - 1];
+        if(entries > 1 && last->address + last->length == physical) {
+            last->length += chunk;
+        }
+        else {
+            if(entries == this->segments + 1)
+                return false;
+
+            chain[entries].address = physical;
+            chain[entries].length = chunk;
+            chain[entries].flags = VIRTQ_DESC_F_NEXT | (write ? 0 : VIRTQ_DESC_F_WRITE);
+            chain[entries].next = base + entries + 1;
+            entries++;
+        }
+
+        address += chunk;
+        bytes -= chunk;
+    }
+
+    chain[entries].address = state->physAddress + (&request->status - (uint8_t*)request);
+    chain[entries].length = 1;
+    chain[entries].flags = VIRTQ_DESC_F_WRITE;
+    chain[entries].next = 0;
+    entries++;
+
+    if(this->indirect) {
+        virtqDescriptor* head = &this->queue.descriptors[slot];
+        head->address = state->physAddress + ((uint8_t*)request->table - (uint8_t*)request);
+        head->length = entries * sizeof(virtqDescriptor);
+        head->flags = VIRTQ_DESC_F_INDIRECT;
+        head->next = 0;
+    }
+
+    completionHelper::reset(&state->completed);
+    return true;
+}
+
+void virtioBlock::completeUsed() {
+    uint32_t id;
+    while(this->queue.nextUsed(&id)) {
+        completionHelper::signal(&this->slots[id / this->descriptorsPerSlot].completed);
+    }
+}
+
+bool virtioBlock::pollUsed(void* context) {
+    ((virtioBlock*)context)->completeUsed();
+    return false;
+}
+
+uint32_t virtioBlock::handleInterrupt(uint32_t esp) {
+    // Reading the ISR status acknowledges the interrupt
+    if(this->ioBase == 0 || !(inportb(this->ioBase + VIRTIO_PCI_ISR) & VIRTIO_ISR_QUEUE))
+        return esp;
+
+    completeUsed();
+    return esp;
+}
+
+void virtioBlock::failDevice() {
+    // Called with interrupts off, the reset stops the device from touching the ring and the requests it still held fail with their status untouched
+    if(this->broken)
+        return;
+
+    Log(Error, "Virtio block device stopped responding, resetting it");
+    this->broken = true;
+    outportb(this->ioBase + VIRTIO_PCI_STATUS, 0);
+    outportb(this->ioBase + VIRTIO_PCI_STATUS, VIRTIO_STATUS_FAILED);
+
+    for(uint32_t i = 0; i < this->slotCount; i++)
+        if((this->usedSlots & (1 << i)) && !this->slots[i].completed.done)
+            completionHelper::signal(&this->slots[i].completed);
+}
+
+bool virtioBlock::waitSlot(int slot) {
+    virtioBlockSlot* state = &this->slots[slot];
+    if(!completionHelper::wait(&state->completed, VIRTIO_BLK_TIMEOUT_MS, pollUsed, this)) {
+        interruptDescriptorTable::disableInterrupts();
+        if(!state->completed.done)
+            failDevice();
+        interruptDescriptorTable::enableInterrupts();
+    }
+
+    return state->completed.done && state->request->status == VIRTIO_BLK_S_OK;
+}
+
+char virtioBlock::transfer(bool write, uint32_t lba, uint32_t count, uint8_t* buf) {
+    if((write && this->readOnly) || this->broken)
+        return DISK_ERROR;
+
+    dmaBuffer dma(buf, count * VIRTIO_BLK_SECTOR_SIZE, 1);
+    uint8_t* data = dma.begin(buf, count * VIRTIO_BLK_SECTOR_SIZE, write);
+
+    char result = DISK_SUCCESS;
+    int batch[VIRTIO_BLK_SLOTS];
+    for(uint32_t done = 0; done < count && result == DISK_SUCCESS; ) {
+        // Fill every free slot before telling the device, it then finds the whole batch with a single notify
+        uint32_t batchSize = 0;
+        while(done < count && batchSize < this->slotCount) {
+            int slot = completionHelper::claimSlot(&this->usedSlots, this->slotCount, batchSize == 0);
+            if(slot < 0)
+                break;
+
+            uint32_t sectors = count - done > this->maxSectors ? this->maxSectors : count - done;
+            if(!prepare(slot, write, lba + done, sectors, data + done * VIRTIO_BLK_SECTOR_SIZE)) {
+                completionHelper::releaseSlot(&this->usedSlots, slot);
+                result = DISK_ERROR;
+                break;
+            }
+
+            interruptDescriptorTable::disableInterrupts();
+            if(this->broken) {
+                interruptDescriptorTable::enableInterrupts();
+                completionHelper::releaseSlot(&this->usedSlots, slot);
+                result = DISK_ERROR;
+                break;
+            }
+            this->queue.publish(slot * this->descriptorsPerSlot);
+            interruptDescriptorTable::enableInterrupts();
+
+            batch[batchSize++] = slot;
+            done += sectors;
+        }
+
+        interruptDescriptorTable::disableInterrupts();
+        this->queue.kick();
+        interruptDescriptorTable::enableInterrupts();
+
+        for(uint32_t i = 0; i < batchSize; i++) {
+            if(!waitSlot(batch[i]))
+                result = DISK_ERROR;
+            completionHelper::releaseSlot(&this->usedSlots, batch[i]);
+        }
+    }
+
+    if(result != DISK_SUCCESS)
+        Log(Error, "Virtio %s of %d sectors at %d failed", write ? "write" : "read", count, lba);
+
+    dma.end(buf, count * VIRTIO_BLK_SECTOR_SIZE, write, result == DISK_SUCCESS);
+    return result;
+}
+
+char virtioBlock::readSector(uint16_t drive, uint32_t lba, uint8_t* buf) {
+    return drive == 0 ? transfer(false, lba, 1, buf) : DISK_ERROR;
+}
+
+char virtioBlock::writeSector(uint16_t drive, uint32_t lba, uint8_t* buf) {
+    return drive == 0 ? transfer(true, lba, 1, buf) : DISK_ERROR;
+}
+
+char virtioBlock::readSectors(uint16_t drive, uint32_t lba, uint32_t count, uint8_t* buf) {
+    return drive == 0 ? transfer(false, lba, count, buf) : DISK_ERROR;
+}
+
+char virtioBlock::writeSectors(uint16_t drive, uint32_t lba, uint32_t count, uint8_t* buf) {
+    return drive == 0 ? transfer(true, lba, count, buf) : DISK_ERROR;
+}
+
+bool virtioBlock::queuesCommands(uint16_t drive) {
+    // The host has its own elevator, many requests in flight serve it better than the single dispatcher
+    return true;
+}
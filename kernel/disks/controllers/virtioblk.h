@@ -0,0 +1,101 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#pragma once
+
+#include <ak/types.h>
+#include <internal/pci.h>
+#include <system/interrupthandler.h>
+#include <kernel/drivers/driver.h>
+#include <tasking/completion.h>
+#include <kernel/disks/diskcontroller.h>
+#include "virtio.h"
+
+namespace Kernel {
+
+    #define VIRTIO_BLK_DEVICE_ID        0x1001
+    #define VIRTIO_BLK_F_SEG_MAX        (1 << 2)
+    #define VIRTIO_BLK_F_RO             (1 << 5)
+
+    #define VIRTIO_BLK_T_IN             0
+    #define VIRTIO_BLK_T_OUT            1
+    #define VIRTIO_BLK_S_OK             0
+
+    #define VIRTIO_BLK_SLOTS            32
+    #define VIRTIO_BLK_SEGMENTS         32
+    #define VIRTIO_BLK_MAX_SECTORS      128
+    #define VIRTIO_BLK_SECTOR_SIZE      512
+    #define VIRTIO_BLK_TIMEOUT          1000000
+    #define VIRTIO_BLK_TIMEOUT_MS       10000
+
+    struct virtioBlockHeader {
+        ak::uint32_t type;
+        ak::uint32_t reserved;
+        ak::uint64_t sector;
+    } __attribute__((packed));
+
+    /**
+     * @brief everything of one request the device reads or writes, header, indirect descriptor table and status byte
+     */
+    struct virtioBlockRequest {
+        virtioBlockHeader header;
+        virtqDescriptor table[VIRTIO_BLK_SEGMENTS + 2];
+        ak::uint8_t status;
+        ak::uint8_t reserved[15];
+    } __attribute__((packed));
+
+    struct virtioBlockSlot {
+        virtioBlockRequest* request;
+        ak::uint32_t physAddress;
+        completion completed;
+    };
+
+    /**
+     * @brief virtioBlock[read, write] paravirtual disk, requests of a transfer go out together with a single notify
+     */
+    class virtioBlock : public diskController, public driver, public system::interruptHandler {
+      public:
+        virtioBlock(pciDevice* device, pciController* pci);
+
+        static int probe(pciController* pci, diskManager* disks);
+
+        bool initialize();
+        void addDisk(diskManager* disks);
+        ak::uint32_t handleInterrupt(ak::uint32_t esp);
+
+        char readSector(ak::uint16_t drive, ak::uint32_t lba, ak::uint8_t* buf);
+        char writeSector(ak::uint16_t drive, ak::uint32_t lba, ak::uint8_t* buf);
+
+        char readSectors(ak::uint16_t drive, ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf);
+        char writeSectors(ak::uint16_t drive, ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf);
+
+        bool queuesCommands(ak::uint16_t drive);
+
+      private:
+        pciDevice* device;
+        pciController* pci;
+        ak::uint16_t ioBase = 0;
+        virtQueue queue;
+
+        bool indirect = false;
+        bool readOnly = false;
+        bool broken = false;
+        ak::uint32_t segments = VIRTIO_BLK_SEGMENTS;
+        ak::uint32_t maxSectors = VIRTIO_BLK_MAX_SECTORS;
+        ak::uint32_t capacity = 0;
+
+        virtioBlockSlot slots[VIRTIO_BLK_SLOTS];
+        ak::uint32_t slotCount = 0;
+        volatile ak::uint32_t usedSlots = 0;
+        ak::uint32_t descriptorsPerSlot = 1;
+
+        bool prepare(int slot, bool write, ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf);
+        void completeUsed();
+        void failDevice();
+        static bool pollUsed(void* context);
+        bool waitSlot(int slot);
+
+        char transfer(bool write, ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf);
+    };
+}
@@ -0,0 +1,100 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#include "disk.h"
+#include "writeback.h"
+#include "ioqueue.h"
+
+using namespace Kernel::ak;
+using namespace Kernel;
+
+Disk::Disk(uint32_t controllerIndex, diskController* controller, diskType type, uint64_t size, uint32_t blocks, uint32_t blocksize) {
+    this->controllerIndex = controllerIndex;
+    this->controller = controller;
+    this->type = type;
+    this->size = size;
+    this->numBlocks = blocks;
+    this->blockSize = blocksize;
+    this->queue = new ioQueue(this);
+}
+
+Disk::~Disk() {
+    delete this->queue;
+}
+
+char Disk::readSector(uint32_t lba, uint8_t* buf) {
+    return readSectors(lba, 1, buf);
+}
+
+char Disk::writeSector(uint32_t lba, uint8_t* buf) {
+    return writeSectors(lba, 1, buf);
+}
+
+char Disk::readSectors(uint32_t lba, uint32_t count, uint8_t* buf) {
+    if(this->controller == 0)
+        return DISK_ERROR;
+
+    // A flush finishing during the read can clean a sector the controller returned old, read again without flushes then
+    bool flushesHeld = false;
+    char result;
+    while(true) {
+        uint32_t cleaned = writeBack::cleanedCount();
+        result = queued() ? this->queue->transfer(ioRead, lba, count, buf) : readController(lba, count, buf);
+        if(result != DISK_SUCCESS || writeBack::overlay(this, lba, count, buf, cleaned) || flushesHeld)
+            break;
+
+        writeBack::holdFlushes();
+        flushesHeld = true;
+    }
+
+    if(flushesHeld)
+        writeBack::releaseFlushes();
+    return result;
+}
+
+char Disk::writeSectors(uint32_t lba, uint32_t count, uint8_t* buf) {
+    if(this->controller == 0)
+        return DISK_ERROR;
+
+    if(writeBack::caching(this))
+        return writeBack::write(this, lba, count, buf);
+
+    return writeDirect(lba, count, buf);
+}
+
+bool Disk::queued() {
+    return ioQueue::running() && !this->controller->queuesCommands(this->controllerIndex);
+}
+
+char Disk::writeDirect(uint32_t lba, uint32_t count, uint8_t* buf) {
+    if(this->controller == 0)
+        return DISK_ERROR;
+
+    return queued() ? this->queue->transfer(ioWrite, lba, count, buf) : writeController(lba, count, buf);
+}
+
+char Disk::readController(uint32_t lba, uint32_t count, uint8_t* buf) {
+    char result = count == 1 ? DISK_ERROR_UNSUPPORTED : this->controller->readSectors(this->controllerIndex, lba, count, buf);
+    if(result != DISK_ERROR_UNSUPPORTED)
+        return result;
+
+    // No multi-sector command on this controller, issue them one by one
+    for(uint32_t i = 0; i < count; i++)
+        if((result = this->controller->readSector(this->controllerIndex, lba + i, buf + (i * this->blockSize))) != DISK_SUCCESS)
+            return result;
+
+    return DISK_SUCCESS;
+}
+
+char Disk::writeController(uint32_t lba, uint32_t count, uint8_t* buf) {
+    char result = count == 1 ? DISK_ERROR_UNSUPPORTED : this->controller->writeSectors(this->controllerIndex, lba, count, buf);
+    if(result != DISK_ERROR_UNSUPPORTED)
+        return result;
+
+    for(uint32_t i = 0; i < count; i++)
+        if((result = this->controller->writeSector(this->controllerIndex, lba + i, buf + (i * this->blockSize))) != DISK_SUCCESS)
+            return result;
+
+    return DISK_SUCCESS;
+}
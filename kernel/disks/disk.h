@@ -6,12 +6,14 @@
 namespace Kernel {
     
     class diskController;
+    class ioQueue;
 
     enum diskType {
         hardDisk,
         usbDisk,
         floppy,
-        cdROM
+        cdROM,
+        memoryDisk
     };
 
     class Disk {
@@ -23,11 +25,22 @@ namespace Kernel {
         ak::uint64_t size;
         ak::uint32_t numBlocks;
         ak::uint32_t blockSize;
+        ioQueue* queue = 0;
 
         Disk(ak::uint32_t controllerIndex, diskController* controller, diskType type, ak::uint64_t size, ak::uint32_t blocks, ak::uint32_t blocksize);
+        virtual ~Disk();
             
         virtual char readSector(ak::uint32_t lba, ak::uint8_t* buf);
         virtual char writeSector(ak::uint32_t lba, ak::uint8_t* buf);
+
+        virtual char readSectors(ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf);
+        virtual char writeSectors(ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf);
+
+        bool queued();
+        char writeDirect(ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf);
+
+        char readController(ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf);
+        char writeController(ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf);
     };
     
 }
\ No newline at end of file
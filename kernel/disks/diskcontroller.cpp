@@ -0,0 +1,37 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#include "diskcontroller.h"
+#include <kernel/system/log.h>
+
+using namespace Kernel::ak;
+using namespace Kernel;
+
+diskController::diskController() {}
+
+char diskController::readSector(uint16_t drive, uint32_t lba, uint8_t* buf) {
+    Log(Error, "Virtual function called directly %s:%d", __FILE__, __LINE__);
+    return DISK_ERROR;
+}
+
+char diskController::writeSector(uint16_t drive, uint32_t lba, uint8_t* buf) {
+    Log(Error, "Virtual function called directly %s:%d", __FILE__, __LINE__);
+    return DISK_ERROR;
+}
+
+char diskController::readSectors(uint16_t drive, uint32_t lba, uint32_t count, uint8_t* buf) {
+    return DISK_ERROR_UNSUPPORTED;
+}
+
+char diskController::writeSectors(uint16_t drive, uint32_t lba, uint32_t count, uint8_t* buf) {
+    return DISK_ERROR_UNSUPPORTED;
+}
+
+bool diskController::ejectDrive(uint8_t drive) {
+    return false;
+}
+
+bool diskController::queuesCommands(uint16_t drive) {
+    return false;
+}
@@ -7,12 +7,23 @@
 #include "diskmanager.h"
 
 namespace Kernel {
+    #define DISK_SUCCESS            0
+    #define DISK_ERROR              1
+    #define DISK_ERROR_UNSUPPORTED  2
+
     class diskController {
     public:
         diskController();
 
-        char readSector(ak::uint16_t drive, ak::uint32_t lba, ak::uint8_t* buf);
-        char writeSector();
-        bool ejectDrive(ak::uint8_t drive);
+        virtual char readSector(ak::uint16_t drive, ak::uint32_t lba, ak::uint8_t* buf);
+        virtual char writeSector(ak::uint16_t drive, ak::uint32_t lba, ak::uint8_t* buf);
+
+        virtual char readSectors(ak::uint16_t drive, ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf);
+        virtual char writeSectors(ak::uint16_t drive, ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf);
+
+        virtual bool ejectDrive(ak::uint8_t drive);
+
+        // Controllers that keep many commands in flight and let the drive order them skip the software queue
+        virtual bool queuesCommands(ak::uint16_t drive);
     };
 }
\ No newline at end of file
@@ -0,0 +1,37 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#include "dmabuffer.h"
+#include <ak/memoperator.h>
+#include <memory/virtualmemory.h>
+
+using namespace Kernel::ak;
+using namespace Kernel;
+
+dmaBuffer::dmaBuffer(uint8_t* buf, uint32_t bytes, uint32_t alignment) {
+    this->bounce = reachable(buf, alignment) ? 0 : new uint8_t[bytes];
+}
+
+dmaBuffer::~dmaBuffer() {
+    delete[] this->bounce;
+}
+
+bool dmaBuffer::reachable(uint8_t* buf, uint32_t alignment) {
+    // User memory is only mapped in its own process, the controller may finish while another one runs
+    return ((uint32_t)buf & (alignment - 1)) == 0 && (uint32_t)buf >= KERNEL_VIRT_ADDR;
+}
+
+uint8_t* dmaBuffer::begin(uint8_t* part, uint32_t bytes, bool write) {
+    if(this->bounce == 0)
+        return part;
+
+    if(write)
+        memOperator::memcpy(this->bounce, part, bytes);
+    return this->bounce;
+}
+
+void dmaBuffer::end(uint8_t* part, uint32_t bytes, bool write, bool success) {
+    if(this->bounce != 0 && !write && success)
+        memOperator::memcpy(part, this->bounce, bytes);
+}
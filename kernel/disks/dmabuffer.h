@@ -0,0 +1,26 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#pragma once
+
+#include <ak/types.h>
+
+namespace Kernel {
+    /**
+     * @brief dmaBuffer[reachable, begin, end] kernel copy of a caller buffer a controller can not transfer into directly
+     */
+    class dmaBuffer {
+      public:
+        dmaBuffer(ak::uint8_t* buf, ak::uint32_t bytes, ak::uint32_t alignment);
+        ~dmaBuffer();
+
+        static bool reachable(ak::uint8_t* buf, ak::uint32_t alignment);
+
+        ak::uint8_t* begin(ak::uint8_t* part, ak::uint32_t bytes, bool write);
+        void end(ak::uint8_t* part, ak::uint32_t bytes, bool write, bool success);
+
+      private:
+        ak::uint8_t* bounce;
+    };
+}
@@ -0,0 +1,351 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#include "ioqueue.h"
+#include "disk.h"
+#include <ak/memoperator.h>
+#include <cpu/idt.h>
+#include <tasking/scheduler.h>
+#include <kernel/system/log.h>
+
+using namespace Kernel::ak;
+using namespace Kernel;
+
+ioQueue* ioQueue::queues = 0;
+mutexLock ioQueue::queuesLock;
+
+static Thread* dispatcher = 0;
+
+static bool expired(ioRequest* request, uint32_t now) {
+    return request != 0 && (int32_t)(now - request->deadline) >= 0;
+}
+
+ioQueue::ioQueue(Disk* disk) {
+    this->disk = disk;
+    memOperator::memset(&this->stats, 0, sizeof(ioQueueStats));
+    memOperator::memset(this->sorted, 0, sizeof(this->sorted));
+    memOperator::memset(this->fifoHead, 0, sizeof(this->fifoHead));
+    memOperator::memset(this->fifoTail, 0, sizeof(this->fifoTail));
+
+    queuesLock.lock();
+    this->nextQueue = queues;
+    queues = this;
+    queuesLock.unlock();
+}
+
+ioQueue::~ioQueue() {
+    queuesLock.lock();
+    ioQueue** link = &queues;
+    while(*link != 0 && *link != this)
+        link = &(*link)->nextQueue;
+    if(*link != 0)
+        *link = this->nextQueue;
+    this->unlinked = true;
+    queuesLock.unlock();
+
+    // The batch in flight finishes on its own, everything still queued fails
+    while(this->dispatching)
+        scheduler::yield();
+
+    this->lock.lock();
+    for(int direction = ioRead; direction <= ioWrite; direction++)
+        while(this->sorted[direction] != 0) {
+            ioRequest* request = this->sorted[direction];
+            remove(request);
+            complete(request, DISK_ERROR);
+        }
+    this->lock.unlock();
+
+    if(this->bounce)
+        delete[] this->bounce;
+}
+
+void ioQueue::initialize() {
+    dispatcher = threadHelper::createFromFunction(dispatcherThread, true);
+}
+
+bool ioQueue::running() {
+    // The dispatcher itself and anything before it exists talk to the controller directly
+    return dispatcher != 0 && scheduler::currentThread() != dispatcher;
+}
+
+void ioQueue::insert(ioRequest* request) {
+    int direction = request->direction;
+
+    ioRequest* previous = 0;
+    ioRequest* next = this->sorted[direction];
+    while(next != 0 && next->lba <= request->lba) {
+        previous = next;
+        next = next->nextSorted;
+    }
+
+    request->prevSorted = previous;
+    request->nextSorted = next;
+    if(previous)
+        previous->nextSorted = request;
+    else
+        this->sorted[direction] = request;
+    if(next)
+        next->prevSorted = request;
+
+    request->prevFifo = this->fifoTail[direction];
+    request->nextFifo = 0;
+    if(this->fifoTail[direction])
+        this->fifoTail[direction]->nextFifo = request;
+    else
+        this->fifoHead[direction] = request;
+    this->fifoTail[direction] = request;
+
+    this->depth++;
+}
+
+void ioQueue::remove(ioRequest* request) {
+    // The request keeps its own links, dispatch() walks a removed run through them
+    int direction = request->direction;
+
+    if(request->prevSorted)
+        request->prevSorted->nextSorted = request->nextSorted;
+    else
+        this->sorted[direction] = request->nextSorted;
+    if(request->nextSorted)
+        request->nextSorted->prevSorted = request->prevSorted;
+
+    if(request->prevFifo)
+        request->prevFifo->nextFifo = request->nextFifo;
+    else
+        this->fifoHead[direction] = request->nextFifo;
+    if(request->nextFifo)
+        request->nextFifo->prevFifo = request->prevFifo;
+    else
+        this->fifoTail[direction] = request->prevFifo;
+
+    this->depth--;
+}
+
+ioRequest* ioQueue::pickNext() {
+    uint32_t now = scheduler::ticks();
+
+    // Anything waiting past its deadline goes first, reads before writes
+    if(expired(this->fifoHead[ioRead], now) || expired(this->fifoHead[ioWrite], now)) {
+        this->stats.expired++;
+        return expired(this->fifoHead[ioRead], now) ? this->fifoHead[ioRead] : this->fifoHead[ioWrite];
+    }
+
+    // Readers wait on the result, writes only get a turn when no reads are queued or they were passed over too often
+    ioDirection direction = ioRead;
+    if(this->sorted[ioRead] == 0 || (this->sorted[ioWrite] != 0 && this->writesStarved >= IOQUEUE_WRITES_STARVED))
+        direction = ioWrite;
+
+    if(this->sorted[direction] == 0)
+        return 0;
+
+    if(direction == ioWrite)
+        this->writesStarved = 0;
+    else if(this->sorted[ioWrite] != 0)
+        this->writesStarved++;
+
+    // One way elevator, continue from the head position and start over at the lowest LBA
+    for(ioRequest* request = this->sorted[direction]; request != 0; request = request->nextSorted)
+        if(request->lba >= this->headPosition)
+            return request;
+
+    return this->sorted[direction];
+}
+
+void ioQueue::submit(ioRequest* request) {
+    completionHelper::reset(&request->completed);
+    request->result = DISK_ERROR;
+    request->deadline = scheduler::ticks() + (request->direction == ioRead ? IOQUEUE_READ_DEADLINE_MS : IOQUEUE_WRITE_DEADLINE_MS);
+
+    this->lock.lock();
+    insert(request);
+    this->stats.submitted++;
+    this->stats.depthSum += this->depth;
+    this->lock.unlock();
+
+    if(dispatcher)
+        scheduler::unblock(dispatcher);
+}
+
+char ioQueue::wait(ioRequest* request) {
+    completionHelper::wait(&request->completed);
+    return request->result;
+}
+
+char ioQueue::transfer(ioDirection direction, uint32_t lba, uint32_t count, uint8_t* buffer) {
+    ioRequest request;
+    memOperator::memset(&request, 0, sizeof(ioRequest));
+    request.direction = direction;
+    request.lba = lba;
+    request.count = count;
+    request.buffer = buffer;
+
+    submit(&request);
+    return wait(&request);
+}
+
+bool ioQueue::reserveBounce(uint32_t size) {
+    if(this->bounceSize >= size)
+        return true;
+
+    // Sized for the largest batch once, the block size is only known after the disk is set up
+    if(this->bounce)
+        delete[] this->bounce;
+    this->bounce = new uint8_t[size];
+    this->bounceSize = this->bounce ? size : 0;
+
+    return this->bounce != 0;
+}
+
+char ioQueue::issue(ioDirection direction, uint32_t lba, uint32_t count, uint8_t* buffer) {
+    return direction == ioRead ? this->disk->readController(lba, count, buffer) : this->disk->writeController(lba, count, buffer);
+}
+
+void ioQueue::complete(ioRequest* request, char result) {
+    request->result = result;
+    if(request->callback)
+        request->callback(request);
+
+    // Once signalled the request may be gone
+    interruptDescriptorTable::disableInterrupts();
+    completionHelper::signal(&request->completed);
+    interruptDescriptorTable::enableInterrupts();
+}
+
+bool ioQueue::dispatch() {
+    this->lock.lock();
+    ioRequest* first = pickNext();
+    if(first == 0) {
+        this->lock.unlock();
+        return false;
+    }
+
+    // Grow the batch over the requests of the same direction that continue it on disk
+    ioRequest* last = first;
+    uint32_t sectors = first->count;
+    while(first->prevSorted != 0 && first->prevSorted->lba + first->prevSorted->count == first->lba && sectors + first->prevSorted->count <= IOQUEUE_MAX_SECTORS) {
+        first = first->prevSorted;
+        sectors += first->count;
+    }
+    while(last->nextSorted != 0 && last->lba + last->count == last->nextSorted->lba && sectors + last->nextSorted->count <= IOQUEUE_MAX_SECTORS) {
+        last = last->nextSorted;
+        sectors += last->count;
+    }
+
+    uint32_t requests = 0;
+    for(ioRequest* request = first; ; request = request->nextSorted) {
+        remove(request);
+        requests++;
+        if(request == last)
+            break;
+    }
+
+    this->stats.dispatched++;
+    this->stats.merged += requests - 1;
+    this->headPosition = last->lba + last->count;
+    this->lock.unlock();
+
+    ioDirection direction = first->direction;
+    uint32_t lba = first->lba;
+    uint32_t blockSize = this->disk->blockSize;
+
+    // Without memory for the bounce buffer the batch still goes out, one request at a time
+    if(requests > 1 && !reserveBounce(IOQUEUE_MAX_SECTORS * blockSize)) {
+        for(ioRequest* request = first; ; ) {
+            ioRequest* next = request->nextSorted;
+            bool end = request == last;
+            complete(request, issue(direction, request->lba, request->count, request->buffer));
+            if(end)
+                break;
+            request = next;
+        }
+
+        return true;
+    }
+
+    char result;
+    if(requests == 1) {
+        result = issue(direction, lba, sectors, first->buffer);
+    }
+    else {
+        if(direction == ioWrite)
+            for(ioRequest* request = first; ; request = request->nextSorted) {
+                memOperator::memcpy(this->bounce + (request->lba - lba) * blockSize, request->buffer, request->count * blockSize);
+                if(request == last)
+                    break;
+            }
+
+        result = issue(direction, lba, sectors, this->bounce);
+
+        if(direction == ioRead && result == DISK_SUCCESS)
+            for(ioRequest* request = first; ; request = request->nextSorted) {
+                memOperator::memcpy(request->buffer, this->bounce + (request->lba - lba) * blockSize, request->count * blockSize);
+                if(request == last)
+                    break;
+            }
+    }
+
+    for(ioRequest* request = first; ; ) {
+        ioRequest* next = request->nextSorted;
+        bool end = request == last;
+        complete(request, result);
+        if(end)
+            break;
+        request = next;
+    }
+
+    return true;
+}
+
+void ioQueue::logStats() {
+    uint32_t averageDepth = this->stats.submitted ? (this->stats.depthSum * 10) / this->stats.submitted : 0;
+    uint32_t mergeRate = this->stats.submitted ? (this->stats.merged * 100) / this->stats.submitted : 0;
+
+    Log(Info, "IO queue %s: %d requests in %d dispatches, average depth %d.%d, %d%% merged, %d past their deadline",
+        this->disk->identifier ? this->disk->identifier : "disk", this->stats.submitted, this->stats.dispatched, averageDepth / 10, averageDepth % 10, mergeRate, this->stats.expired);
+}
+
+void ioQueue::dispatcherThread() {
+    while(true) {
+        bool busy = false;
+
+        // One batch per disk and round, so a busy disk does not hold up the others
+        queuesLock.lock();
+        for(ioQueue* queue = queues; queue != 0; ) {
+            // The controller is not called with the list locked, a queue being destroyed waits for its batch instead
+            queue->dispatching = true;
+            queuesLock.unlock();
+
+            if(queue->dispatch())
+                busy = true;
+
+            // Read before letting go, a destructor waiting for the batch frees the queue right after
+            queuesLock.lock();
+            bool removed = queue->unlinked;
+            ioQueue* next = queue->nextQueue;
+            queue->dispatching = false;
+
+            // Its link went stale when it was removed meanwhile, the next round starts over
+            if(removed) {
+                busy = true;
+                break;
+            }
+            queue = next;
+        }
+        queuesLock.unlock();
+
+        if(busy)
+            continue;
+
+        interruptDescriptorTable::disableInterrupts();
+        bool pending = false;
+        for(ioQueue* queue = queues; queue != 0; queue = queue->nextQueue)
+            if(queue->depth > 0)
+                pending = true;
+
+        if(!pending)
+            scheduler::block(dispatcher, Sleep);
+        interruptDescriptorTable::enableInterrupts();
+    }
+}
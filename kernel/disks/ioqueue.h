@@ -0,0 +1,111 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#pragma once
+
+#include <ak/types.h>
+#include <tasking/lock.h>
+#include <tasking/completion.h>
+
+namespace Kernel {
+
+    #define IOQUEUE_READ_DEADLINE_MS    500
+    #define IOQUEUE_WRITE_DEADLINE_MS   5000
+    #define IOQUEUE_WRITES_STARVED      2
+    #define IOQUEUE_MAX_SECTORS         256
+
+    class Disk;
+    struct ioRequest;
+
+    enum ioDirection {
+        ioRead,
+        ioWrite
+    };
+
+    typedef void (*ioCallback)(ioRequest* request);
+
+    /**
+     * @brief one transfer of a caller, completed with result set, the callback run and the waiter woken
+     */
+    struct ioRequest {
+        ioDirection direction;
+        ak::uint32_t lba;
+        ak::uint32_t count;
+        ak::uint8_t* buffer;
+
+        ioCallback callback;
+        void* context;
+
+        completion completed;
+        char result;
+
+        ak::uint32_t deadline;
+
+        ioRequest* prevSorted;
+        ioRequest* nextSorted;
+        ioRequest* prevFifo;
+        ioRequest* nextFifo;
+    };
+
+    struct ioQueueStats {
+        ak::uint32_t submitted;
+        ak::uint32_t dispatched;
+        ak::uint32_t merged;
+        ak::uint32_t expired;
+        ak::uint32_t depthSum;
+    };
+
+    /**
+     * @brief ioQueue[submit, wait, transfer] per disk request queue, served in LBA order with read and write deadlines by one dispatcher thread
+     */
+    class ioQueue {
+      public:
+        ioQueueStats stats;
+
+        ioQueue(Disk* disk);
+        ~ioQueue();
+
+        static void initialize();
+        static bool running();
+
+        void submit(ioRequest* request);
+        char wait(ioRequest* request);
+        char transfer(ioDirection direction, ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buffer);
+
+        void logStats();
+
+      private:
+        Disk* disk;
+        mutexLock lock;
+
+        ioRequest* sorted[2];
+        ioRequest* fifoHead[2];
+        ioRequest* fifoTail[2];
+        ak::uint32_t depth = 0;
+
+        ak::uint32_t headPosition = 0;
+        ak::uint32_t writesStarved = 0;
+
+        // Merged batches go through here, only the dispatcher thread touches it
+        ak::uint8_t* bounce = 0;
+        ak::uint32_t bounceSize = 0;
+
+        ioQueue* nextQueue = 0;
+        volatile bool dispatching = false;
+        bool unlinked = false;
+
+        static ioQueue* queues;
+        static mutexLock queuesLock;
+
+        void insert(ioRequest* request);
+        void remove(ioRequest* request);
+        ioRequest* pickNext();
+        bool dispatch();
+        bool reserveBounce(ak::uint32_t size);
+        char issue(ioDirection direction, ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buffer);
+        void complete(ioRequest* request, char result);
+
+        static void dispatcherThread();
+    };
+}
@@ -0,0 +1,71 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#include "partition.h"
+#include <kernel/filesystem/fat.h>
+#include <kernel/filesystem/iso.h>
+#include <kernel/filesystem/ext2.h>
+#include <kernel/system/log.h>
+
+using namespace Kernel::ak;
+using namespace Kernel;
+
+void partitionManager::detectFileSystem(Disk* disk, vfsManager* vfs) {
+    // CD's have no partition table, the whole disc is one ISO9660 filesystem
+    if(disk->type == cdROM) {
+        isoFS* fs = new isoFS(disk, 0, disk->numBlocks);
+        if(fs->initialize())
+            vfs->mount(fs);
+        else
+            delete fs;
+        return;
+    }
+
+    masterBootRecord mbr;
+    if(disk->readSector(0, (uint8_t*)&mbr) != 0) {
+        Log(Error, "Could not read the MBR of disk %s", disk->identifier);
+        return;
+    }
+
+    if(mbr.magicnumber != MBR_MAGIC) {
+        Log(Warning, "Disk %s has no valid MBR", disk->identifier);
+        return;
+    }
+
+    for(int i = 0; i < 4; i++) {
+        partitionTableEntry partition = mbr.primaryPartitions[i];
+        if(partition.partitionId == PARTITION_ID_EMPTY || partition.length == 0)
+            continue;
+
+        assignVFS(partition, disk, vfs);
+    }
+}
+
+void partitionManager::assignVFS(partitionTableEntry partition, Disk* disk, vfsManager* vfs) {
+    virtualFileSystem* fs = 0;
+
+    switch(partition.partitionId) {
+        case 0x01:
+        case 0x04:
+        case 0x06:
+        case 0x0B:
+        case 0x0C:
+        case 0x0E:
+            fs = new fat(disk, partition.startLba, partition.length);
+            break;
+        case PARTITION_ID_LINUX:
+            fs = new ext2(disk, partition.startLba, partition.length);
+            break;
+        default:
+            Log(Info, "Unknown partition type %x at %d", partition.partitionId, partition.startLba);
+            return;
+    }
+
+    if(fs->initialize())
+        vfs->mount(fs);
+    else {
+        Log(Warning, "Could not mount partition of type %x at %d", partition.partitionId, partition.startLba);
+        delete fs;
+    }
+}
@@ -9,6 +9,10 @@
 
 namespace Kernel {
 
+    #define MBR_MAGIC                   0xAA55
+    #define PARTITION_ID_EMPTY          0x00
+    #define PARTITION_ID_LINUX          0x83
+
     struct partitionTableEntry {
         ak::uint8_t bootable;
 
@@ -38,9 +42,9 @@ namespace Kernel {
 
     class partitionManager {
       public:
-        static void detectFileSystem(Disk* disk);
+        static void detectFileSystem(Disk* disk, vfsManager* vfs);
 
       private:
-        static void assignVFS(partitionTableEntry partition, Disk* disk);
+        static void assignVFS(partitionTableEntry partition, Disk* disk, vfsManager* vfs);
     };
 }
\ No newline at end of file
@@ -0,0 +1,132 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#include "ramdisk.h"
+#include "partition.h"
+#include <kernel/memory/virtualmemory.h>
+#include <kernel/filesystem/fat.h>
+#include <kernel/system/log.h>
+
+using namespace Kernel::ak;
+using namespace Kernel;
+
+mutexLock ramDisk::windowLock;
+
+ramDisk::ramDisk(uint8_t* image, uint32_t size)
+: Disk(0, 0, memoryDisk, size, size / RAMDISK_BLOCK_SIZE, RAMDISK_BLOCK_SIZE) {
+    this->image = image;
+}
+
+ramDisk::~ramDisk() {
+    if(this->pages == 0)
+        return;
+
+    for(uint32_t i = 0; i < this->pageCount; i++)
+        physicalMemoryManager::freeBlock((void*)this->pages[i]);
+    delete[] this->pages;
+}
+
+ramDisk* ramDisk::create(uint32_t size) {
+    uint32_t pageCount = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint32_t* pages = new uint32_t[pageCount];
+
+    // The pages do not need to be contiguous or mapped, they are reached through the window one at a time
+    for(uint32_t i = 0; i < pageCount; i++) {
+        pages[i] = (uint32_t)physicalMemoryManager::allocateBlock();
+        if(pages[i] != 0)
+            continue;
+
+        Log(Error, "Not enough memory for a %d KB RAM disk", size / 1024);
+        while(i > 0)
+            physicalMemoryManager::freeBlock((void*)pages[--i]);
+        delete[] pages;
+        return 0;
+    }
+
+    ramDisk* disk = new ramDisk(0, pageCount * PAGE_SIZE);
+    disk->pages = pages;
+    disk->pageCount = pageCount;
+
+    uint8_t* zero = new uint8_t[RAMDISK_BLOCK_SIZE];
+    memOperator::memset(zero, 0, RAMDISK_BLOCK_SIZE);
+    for(uint32_t i = 0; i < disk->numBlocks; i++)
+        disk->copy(i, 1, zero, true);
+    delete[] zero;
+
+    return disk;
+}
+
+char ramDisk::copy(uint32_t lba, uint32_t count, uint8_t* buf, bool write) {
+    if(lba + count > this->numBlocks || lba + count < lba)
+        return DISK_ERROR;
+
+    uint32_t offset = lba * RAMDISK_BLOCK_SIZE;
+    uint32_t length = count * RAMDISK_BLOCK_SIZE;
+
+    if(this->image) {
+        if(write)
+            memOperator::memcpy(this->image + offset, buf, length);
+        else
+            memOperator::memcpy(buf, this->image + offset, length);
+        return DISK_SUCCESS;
+    }
+
+    windowLock.lock();
+    while(length > 0) {
+        uint32_t pageOffset = offset % PAGE_SIZE;
+        uint32_t part = PAGE_SIZE - pageOffset < length ? PAGE_SIZE - pageOffset : length;
+
+        virtualMemoryManager::mapVirtualToPhysical((void*)this->pages[offset / PAGE_SIZE], (void*)RAMDISK_WINDOW, true, true);
+        virtualMemoryManager::invalidatePage(RAMDISK_WINDOW);
+
+        uint8_t* window = (uint8_t*)RAMDISK_WINDOW + pageOffset;
+        if(write)
+            memOperator::memcpy(window, buf, part);
+        else
+            memOperator::memcpy(buf, window, part);
+
+        offset += part;
+        buf += part;
+        length -= part;
+    }
+    windowLock.unlock();
+
+    return DISK_SUCCESS;
+}
+
+char ramDisk::readSector(uint32_t lba, uint8_t* buf) {
+    return copy(lba, 1, buf, false);
+}
+
+char ramDisk::writeSector(uint32_t lba, uint8_t* buf) {
+    return copy(lba, 1, buf, true);
+}
+
+char ramDisk::readSectors(uint32_t lba, uint32_t count, uint8_t* buf) {
+    return copy(lba, count, buf, false);
+}
+
+char ramDisk::writeSectors(uint32_t lba, uint32_t count, uint8_t* buf) {
+    return copy(lba, count, buf, true);
+}
+
+bool ramDisk::createFatPartition(const char* label) {
+    if(this->numBlocks <= RAMDISK_PARTITION_START)
+        return false;
+
+    uint32_t length = this->numBlocks - RAMDISK_PARTITION_START;
+    if(!fat::format(this, RAMDISK_PARTITION_START, length, label))
+        return false;
+
+    // One primary partition over the rest of the disk, so partitionManager::detectFileSystem finds it like on any other disk
+    masterBootRecord mbr;
+    memOperator::memset(&mbr, 0, sizeof(masterBootRecord));
+    fatType type = fat::formatType(length);
+    mbr.primaryPartitions[0].partitionId = type == FAT12 ? RAMDISK_PARTITION_FAT12 : (type == FAT16 ? RAMDISK_PARTITION_FAT16 : RAMDISK_PARTITION_FAT32);
+    mbr.primaryPartitions[0].startLba = RAMDISK_PARTITION_START;
+    mbr.primaryPartitions[0].length = length;
+    mbr.magicnumber = MBR_MAGIC;
+
+    return writeSector(0, (uint8_t*)&mbr) == DISK_SUCCESS;
+}
@@ -0,0 +1,46 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#pragma once
+
+#include <ak/types.h>
+#include <tasking/lock.h>
+#include "disk.h"
+
+namespace Kernel {
+    #define RAMDISK_BLOCK_SIZE          512
+    #define RAMDISK_WINDOW              0xFFBFE000
+    #define RAMDISK_PARTITION_START     8
+    #define RAMDISK_PARTITION_FAT12     0x01
+    #define RAMDISK_PARTITION_FAT16     0x0E
+    #define RAMDISK_PARTITION_FAT32     0x0C
+
+    /**
+     * @brief ramDisk[read, write, create fat partition] disk kept in memory, either physical pages of its own or a boot module image used in place
+     */
+    class ramDisk : public Disk {
+      public:
+        ramDisk(ak::uint8_t* image, ak::uint32_t size);
+        ~ramDisk();
+
+        static ramDisk* create(ak::uint32_t size);
+
+        char readSector(ak::uint32_t lba, ak::uint8_t* buf);
+        char writeSector(ak::uint32_t lba, ak::uint8_t* buf);
+
+        char readSectors(ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf);
+        char writeSectors(ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf);
+
+        bool createFatPartition(const char* label = "SCRATCH");
+
+      private:
+        ak::uint8_t* image = 0;
+        ak::uint32_t* pages = 0;
+        ak::uint32_t pageCount = 0;
+
+        static mutexLock windowLock;
+
+        char copy(ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf, bool write);
+    };
+}
@@ -0,0 +1,331 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#include "writeback.h"
+#include <ak/memoperator.h>
+#include <cpu/idt.h>
+#include <tasking/scheduler.h>
+#include <kernel/system/log.h>
+
+using namespace Kernel::ak;
+using namespace Kernel;
+
+writeBackStats writeBack::stats = {0, 0, 0, 0, 0};
+dirtySector* writeBack::buckets[WRITEBACK_BUCKETS];
+uint32_t writeBack::dirtyCount = 0;
+volatile uint32_t writeBack::cleaned = 0;
+mutexLock writeBack::lock;
+mutexLock writeBack::flushLock;
+
+static Thread* flusher = 0;
+
+static bool sectorBefore(dirtySector* a, dirtySector* b) {
+    return a->disk < b->disk || (a->disk == b->disk && a->lba < b->lba);
+}
+
+void writeBack::initialize() {
+    memOperator::memset(buckets, 0, sizeof(buckets));
+    flusher = threadHelper::createFromFunction(flusherThread, true);
+}
+
+bool writeBack::caching(Disk* disk) {
+    // Media that can not be written or that may disappear without an eject is written through
+    return flusher != 0 && disk->controller != 0 && disk->type != cdROM && disk->type != usbDisk && disk->type != floppy;
+}
+
+dirtySector** writeBack::lookup(Disk* disk, uint32_t lba) {
+    dirtySector** link = &buckets[lba % WRITEBACK_BUCKETS];
+    while(*link != 0 && ((*link)->disk != disk || (*link)->lba != lba))
+        link = &(*link)->nextInBucket;
+
+    return link;
+}
+
+char writeBack::write(Disk* disk, uint32_t lba, uint32_t count, uint8_t* buf) {
+    // Too large to ever fit, older dirty sectors of the disk go first so they can not overwrite it later
+    if(count * disk->blockSize > WRITEBACK_DIRTY_LIMIT) {
+        if(flush(disk) != 0)
+            return DISK_ERROR;
+        return disk->writeDirect(lba, count, buf);
+    }
+
+    // Writers that outrun the disk wait for the flusher instead of filling memory
+    bool throttled = false;
+    while(stats.dirtyBytes > 0 && stats.dirtyBytes + count * disk->blockSize > WRITEBACK_DIRTY_LIMIT && scheduler::currentThread() != flusher) {
+        if(!throttled)
+            stats.throttledWrites++;
+        throttled = true;
+
+        scheduler::unblock(flusher);
+        scheduler::yield();
+    }
+
+    lock.lock();
+    for(uint32_t i = 0; i < count; i++) {
+        dirtySector** link = lookup(disk, lba + i);
+        dirtySector* sector = *link;
+
+        if(sector == 0) {
+            sector = new dirtySector;
+            sector->disk = disk;
+            sector->lba = lba + i;
+            sector->generation = 0;
+            sector->failures = 0;
+            sector->data = new uint8_t[disk->blockSize];
+            sector->nextInBucket = 0;
+            *link = sector;
+
+            dirtyCount++;
+            stats.dirtyBytes += disk->blockSize;
+        }
+
+        sector->dirtiedAt = scheduler::ticks();
+        sector->generation++;
+        memOperator::memcpy(sector->data, buf + i * disk->blockSize, disk->blockSize);
+    }
+    lock.unlock();
+
+    if(stats.dirtyBytes > WRITEBACK_BACKGROUND_LIMIT)
+        scheduler::unblock(flusher);
+
+    return DISK_SUCCESS;
+}
+
+bool writeBack::overlay(Disk* disk, uint32_t lba, uint32_t count, uint8_t* buf, uint32_t cleanedBefore) {
+    if(stats.dirtyBytes == 0 && cleaned == cleanedBefore)
+        return true;
+
+    lock.lock();
+
+    // A sector cleaned after the read started may have been read before it reached the disk
+    if(cleaned != cleanedBefore) {
+        lock.unlock();
+        return false;
+    }
+
+    for(uint32_t i = 0; i < count; i++) {
+        dirtySector* sector = *lookup(disk, lba + i);
+        if(sector != 0)
+            memOperator::memcpy(buf + i * disk->blockSize, sector->data, disk->blockSize);
+    }
+    lock.unlock();
+    return true;
+}
+
+uint32_t writeBack::cleanedCount() {
+    return cleaned;
+}
+
+void writeBack::holdFlushes() {
+    flushLock.lock();
+}
+
+void writeBack::releaseFlushes() {
+    flushLock.unlock();
+}
+
+void writeBack::removeSector(dirtySector* sector) {
+    *lookup(sector->disk, sector->lba) = sector->nextInBucket;
+    dirtyCount--;
+    stats.dirtyBytes -= sector->disk->blockSize;
+    delete[] sector->data;
+    delete sector;
+}
+
+static void siftDown(dirtySector** sectors, int root, int end) {
+    while(2 * root + 1 < end) {
+        int child = 2 * root + 1;
+        if(child + 1 < end && sectorBefore(sectors[child], sectors[child + 1]))
+            child++;
+
+        if(!sectorBefore(sectors[root], sectors[child]))
+            return;
+
+        dirtySector* tmp = sectors[root];
+        sectors[root] = sectors[child];
+        sectors[child] = tmp;
+        root = child;
+    }
+}
+
+void writeBack::sortByLocation(dirtySector** sectors, int count) {
+    // Heapsort, a flush can hold a few thousand sectors and needs no extra memory this way
+    for(int i = count / 2 - 1; i >= 0; i--)
+        siftDown(sectors, i, count);
+
+    for(int end = count - 1; end > 0; end--) {
+        dirtySector* tmp = sectors[0];
+        sectors[0] = sectors[end];
+        sectors[end] = tmp;
+        siftDown(sectors, 0, end);
+    }
+}
+
+int writeBack::flush(Disk* disk) {
+    flushLock.lock();
+
+    lock.lock();
+    int count = 0;
+    dirtySector** sectors = dirtyCount > 0 ? new dirtySector*[dirtyCount] : 0;
+    for(int b = 0; b < WRITEBACK_BUCKETS; b++)
+        for(dirtySector* sector = buckets[b]; sector != 0; sector = sector->nextInBucket)
+            if(disk == 0 || sector->disk == disk)
+                sectors[count++] = sector;
+    lock.unlock();
+
+    if(count == 0) {
+        if(sectors)
+            delete[] sectors;
+        flushLock.unlock();
+        return 0;
+    }
+
+    sortByLocation(sectors, count);
+
+    // Sectors are only freed by us or dropDisk(), both under flushLock, so the pointers stay valid
+    int result = 0;
+    uint32_t generations[WRITEBACK_MAX_BATCH];
+    for(int first = 0; first < count;) {
+        Disk* target = sectors[first]->disk;
+        int run = 1;
+        while(first + run < count && run < WRITEBACK_MAX_BATCH && sectors[first + run]->disk == target && sectors[first + run]->lba == sectors[first]->lba + run)
+            run++;
+
+        uint8_t* batch = new uint8_t[run * target->blockSize];
+        lock.lock();
+        for(int i = 0; i < run; i++) {
+            memOperator::memcpy(batch + i * target->blockSize, sectors[first + i]->data, target->blockSize);
+            generations[i] = sectors[first + i]->generation;
+        }
+        lock.unlock();
+
+        bool written = target->writeDirect(sectors[first]->lba, run, batch) == DISK_SUCCESS;
+        delete[] batch;
+
+        lock.lock();
+        if(written) {
+            stats.writeRequests++;
+            stats.writtenBytes += run * target->blockSize;
+
+            // A sector rewritten while we were busy stays dirty for the next round
+            for(int i = 0; i < run; i++) {
+                dirtySector* sector = sectors[first + i];
+                if(sector->generation != generations[i])
+                    continue;
+
+                removeSector(sector);
+                cleaned++;
+            }
+        }
+        else {
+            result = -1;
+
+            // Retried on the next rounds, a disk that keeps failing must not pin the memory forever
+            int dropped = 0;
+            for(int i = 0; i < run; i++) {
+                dirtySector* sector = sectors[first + i];
+                if(++sector->failures < WRITEBACK_MAX_RETRIES)
+                    continue;
+
+                removeSector(sector);
+                dropped++;
+            }
+
+            if(dropped > 0)
+                Log(Error, "Writeback: Giving up on %d sectors at %d after %d failed writes, their data is lost", dropped, sectors[first]->lba, WRITEBACK_MAX_RETRIES);
+            else
+                Log(Error, "Writeback: Could not write %d sectors at %d", run, sectors[first]->lba);
+        }
+        lock.unlock();
+
+        first += run;
+    }
+
+    delete[] sectors;
+    flushLock.unlock();
+    return result;
+}
+
+int writeBack::flushDisk(Disk* disk) {
+    return flush(disk);
+}
+
+int writeBack::flushAll() {
+    return flush(0);
+}
+
+void writeBack::dropDisk(Disk* disk) {
+    flushLock.lock();
+    lock.lock();
+    uint32_t dropped = 0;
+    for(int b = 0; b < WRITEBACK_BUCKETS; b++) {
+        dirtySector** link = &buckets[b];
+        while(*link != 0) {
+            dirtySector* sector = *link;
+            if(sector->disk != disk) {
+                link = &sector->nextInBucket;
+                continue;
+            }
+
+            removeSector(sector);
+            dropped++;
+        }
+    }
+    lock.unlock();
+    flushLock.unlock();
+
+    if(dropped > 0)
+        Log(Warning, "Writeback: Disk removed with %d unwritten sectors", dropped);
+}
+
+uint32_t writeBack::oldestDirty() {
+    uint32_t oldest = scheduler::ticks();
+
+    lock.lock();
+    for(int b = 0; b < WRITEBACK_BUCKETS; b++)
+        for(dirtySector* sector = buckets[b]; sector != 0; sector = sector->nextInBucket)
+            if(sector->dirtiedAt < oldest)
+                oldest = sector->dirtiedAt;
+    lock.unlock();
+
+    return oldest;
+}
+
+void writeBack::logStats() {
+    Log(Info, "Writeback: %d KB dirty, %d KB written in %d requests (%d KB/s), %d writers throttled",
+        stats.dirtyBytes / 1_KB, stats.writtenBytes / 1_KB, stats.writeRequests, stats.bytesPerSecond / 1_KB, stats.throttledWrites);
+}
+
+void writeBack::flusherThread() {
+    uint32_t rateStart = scheduler::ticks();
+    uint32_t rateBytes = 0;
+
+    while(true) {
+        uint32_t now = scheduler::ticks();
+
+        if(stats.dirtyBytes > WRITEBACK_BACKGROUND_LIMIT || (stats.dirtyBytes > 0 && now - oldestDirty() >= WRITEBACK_MAX_AGE_MS))
+            flushAll();
+
+        if(now - rateStart >= 1000) {
+            stats.bytesPerSecond = (stats.writtenBytes - rateBytes) * 1000 / (now - rateStart);
+            rateStart = now;
+            rateBytes = stats.writtenBytes;
+        }
+
+        if(stats.dirtyBytes > 0) {
+            // Nothing old enough yet, look again after the interval
+            while(scheduler::ticks() - now < WRITEBACK_INTERVAL_MS && stats.dirtyBytes <= WRITEBACK_BACKGROUND_LIMIT)
+                scheduler::yield();
+            continue;
+        }
+
+        // Check again with interrupts off so a write() can not slip in before we block
+        interruptDescriptorTable::disableInterrupts();
+        if(stats.dirtyBytes == 0) {
+            stats.bytesPerSecond = 0;
+            scheduler::block(flusher, Sleep);
+        }
+        interruptDescriptorTable::enableInterrupts();
+    }
+}
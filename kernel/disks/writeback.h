@@ -0,0 +1,79 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#pragma once
+
+#include <ak/types.h>
+#include <tasking/lock.h>
+#include "disk.h"
+
+namespace Kernel {
+
+    #define WRITEBACK_BUCKETS           1024
+    #define WRITEBACK_DIRTY_LIMIT       4_MB
+    #define WRITEBACK_BACKGROUND_LIMIT  1_MB
+    #define WRITEBACK_MAX_AGE_MS        3000
+    #define WRITEBACK_INTERVAL_MS       500
+    #define WRITEBACK_MAX_BATCH         128
+    #define WRITEBACK_MAX_RETRIES       5
+
+    /**
+     * @brief sector written by a filesystem but not yet by the controller, generation changes on every rewrite
+     */
+    struct dirtySector {
+        Disk* disk;
+        ak::uint32_t lba;
+        ak::uint32_t dirtiedAt;
+        ak::uint32_t generation;
+        ak::uint32_t failures;
+        ak::uint8_t* data;
+        dirtySector* nextInBucket;
+    };
+
+    struct writeBackStats {
+        ak::uint32_t dirtyBytes;
+        ak::uint32_t writtenBytes;
+        ak::uint32_t writeRequests;
+        ak::uint32_t throttledWrites;
+        ak::uint32_t bytesPerSecond;
+    };
+
+    /**
+     * @brief writeBack[write, overlay, flush, drop] caches sector writes and writes them back in LBA order from a flusher thread
+     */
+    class writeBack {
+      public:
+        static writeBackStats stats;
+
+        static void initialize();
+        static bool caching(Disk* disk);
+
+        static char write(Disk* disk, ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf);
+        static bool overlay(Disk* disk, ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf, ak::uint32_t cleanedBefore);
+        static ak::uint32_t cleanedCount();
+        static void holdFlushes();
+        static void releaseFlushes();
+
+        static int flushDisk(Disk* disk);
+        static int flushAll();
+        static void dropDisk(Disk* disk);
+
+        static void logStats();
+
+      private:
+        static dirtySector* buckets[WRITEBACK_BUCKETS];
+        static ak::uint32_t dirtyCount;
+        static volatile ak::uint32_t cleaned;
+        static mutexLock lock;
+        static mutexLock flushLock;
+
+        static dirtySector** lookup(Disk* disk, ak::uint32_t lba);
+        static void sortByLocation(dirtySector** sectors, int count);
+        static void removeSector(dirtySector* sector);
+        static int flush(Disk* disk);
+        static ak::uint32_t oldestDirty();
+
+        static void flusherThread();
+    };
+}
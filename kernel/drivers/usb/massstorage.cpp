@@ -0,0 +1,245 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#include "massstorage.h"
+#include <kernel/usb/usbcontroller.h>
+#include <kernel/system/log.h>
+
+using namespace Kernel::ak;
+using namespace Kernel;
+
+usbMassStorage::usbMassStorage(usbDevice* dev, diskManager* disks, vfsManager* vfs)
+: usbDriver(dev, (char*)"USB Mass Storage"), diskController() {
+    this->disks = disks;
+    this->vfs = vfs;
+    this->cbw = new commandBlockWrapper;
+    this->csw = new commandStatusWrapper;
+    memOperator::memset(this->luns, 0, sizeof(this->luns));
+}
+
+bool usbMassStorage::supports(usbDevice* dev) {
+    // Only the bulk-only transport with the transparent SCSI command set, UFI floppies and CBI devices are left out
+    return dev->classID == USB_CLASS_MASS_STORAGE && dev->subClassID == USB_SUBCLASS_SCSI;
+}
+
+bool usbMassStorage::findEndpoints() {
+    for(int i = 0; i < this->device->endpoints.size(); i++) {
+        usbEndpoint* endpoint = this->device->endpoints[i];
+        if(endpoint->type != endpointType::Bulk)
+            continue;
+
+        if(endpoint->dir == endpointDirection::In && this->bulkInEndpoint < 0)
+            this->bulkInEndpoint = endpoint->endpointNumber;
+        else if(endpoint->dir == endpointDirection::Out && this->bulkOutEndpoint < 0)
+            this->bulkOutEndpoint = endpoint->endpointNumber;
+    }
+
+    return this->bulkInEndpoint >= 0 && this->bulkOutEndpoint >= 0;
+}
+
+void usbMassStorage::initialize() {
+    if(!findEndpoints()) {
+        Log(Error, "USB mass storage device without bulk endpoints");
+        return;
+    }
+
+    // GET MAX LUN answers with the highest LUN index, devices with just one are allowed to stall it
+    int maxLun = this->device->controller->getMaxLuns(this->device);
+    this->lunCount = maxLun < 0 || maxLun >= USB_MSC_MAX_LUNS ? 1 : maxLun + 1;
+
+    for(int lun = 0; lun < this->lunCount; lun++) {
+        usbMassStorageLun* info = &this->luns[lun];
+        inquiry(lun);
+
+        if(!waitReady(lun) || !readCapacity(lun)) {
+            Log(Info, "USB mass storage LUN %d has no medium", lun);
+            continue;
+        }
+
+        info->present = true;
+        info->disk = new Disk(lun, this, usbDisk, (uint64_t)info->blocks * info->blockSize, info->blocks, info->blockSize);
+        info->disk->identifier = info->name;
+        this->disks->addDisk(info->disk);
+
+        Log(Info, "USB disk %d: %s, %d MB", lun, info->name, (uint32_t)(((uint64_t)info->blocks * info->blockSize) / 1_MB));
+    }
+}
+
+void usbMassStorage::deInitialize() {
+    for(int lun = 0; lun < this->lunCount; lun++) {
+        usbMassStorageLun* info = &this->luns[lun];
+        if(!info->present)
+            continue;
+
+        // Unmounting flushes and drops the write-back sectors of the disk while the device may still take them
+        if(this->vfs)
+            this->vfs->unmountByDisk(info->disk);
+
+        // Taken under the lock so the command in flight finishes first, later ones and the queued requests fail
+        this->lock.lock();
+        info->present = false;
+        this->lock.unlock();
+
+        this->disks->removeDisk(info->disk);
+        delete info->disk;
+        info->disk = 0;
+    }
+
+    delete this->cbw;
+    delete this->csw;
+}
+
+bool usbMassStorage::clearHalt(int endpoint) {
+    return this->device->controller->controlOut(this->device, 0, HOST_TO_DEV | REQ_TYPE_STNDRD | RECPT_ENDPOINT, CLEAR_FEATURE, 0, USB_MSC_FEATURE_HALT, endpoint);
+}
+
+void usbMassStorage::resetRecovery() {
+    // Bulk-only mass storage reset, then both pipes lose their halt and the data toggle starts over
+    this->device->controller->controlOut(this->device, 0, HOST_TO_DEV | REQ_TYPE_CLASS | RECPT_INTERFACE, USB_MSC_REQUEST_RESET, 0, 0, 0);
+    clearHalt(this->bulkInEndpoint | 0x80);
+    clearHalt(this->bulkOutEndpoint);
+}
+
+char usbMassStorage::command(uint8_t lun, uint8_t* cdb, uint8_t cdbLength, uint8_t* buf, uint32_t length, bool in) {
+    usbController* controller = this->device->controller;
+
+    memOperator::memset(this->cbw, 0, sizeof(commandBlockWrapper));
+    this->cbw->signature = USB_MSC_CBW_SIGNATURE;
+    this->cbw->tag = this->nextTag++;
+    this->cbw->transferLength = length;
+    this->cbw->flags = in ? USB_MSC_CBW_DATA_IN : 0;
+    this->cbw->lun = lun;
+    this->cbw->commandLength = cdbLength;
+    memOperator::memcpy(this->cbw->command, cdb, cdbLength);
+
+    if(!controller->bulkOut(this->device, this->cbw, sizeof(commandBlockWrapper), this->bulkOutEndpoint)) {
+        resetRecovery();
+        return DISK_ERROR;
+    }
+
+    // A stalled data stage still ends with a status wrapper once the pipe is cleared
+    if(length > 0) {
+        bool moved = in ? controller->bulkIn(this->device, buf, length, this->bulkInEndpoint)
+                        : controller->bulkOut(this->device, buf, length, this->bulkOutEndpoint);
+        if(!moved)
+            clearHalt(in ? (this->bulkInEndpoint | 0x80) : this->bulkOutEndpoint);
+    }
+
+    bool status = controller->bulkIn(this->device, this->csw, sizeof(commandStatusWrapper), this->bulkInEndpoint);
+    if(!status) {
+        clearHalt(this->bulkInEndpoint | 0x80);
+        status = controller->bulkIn(this->device, this->csw, sizeof(commandStatusWrapper), this->bulkInEndpoint);
+    }
+
+    if(!status || this->csw->signature != USB_MSC_CSW_SIGNATURE || this->csw->tag != this->cbw->tag || this->csw->status == USB_MSC_CSW_PHASE_ERROR) {
+        resetRecovery();
+        return DISK_ERROR;
+    }
+
+    // A residue is fine for INQUIRY and sense data, block transfers either move everything or fail in the data stage
+    return this->csw->status == USB_MSC_CSW_PASSED ? DISK_SUCCESS : DISK_ERROR;
+}
+
+bool usbMassStorage::waitReady(uint8_t lun) {
+    uint8_t cdb[6] = { SCSI_TEST_UNIT_READY, 0, 0, 0, 0, 0 };
+    uint8_t sense[18];
+
+    // Freshly attached devices report a unit attention first, the sense data has to be collected to clear it
+    for(int i = 0; i < USB_MSC_READY_RETRIES; i++) {
+        if(command(lun, cdb, 6, 0, 0, false) == DISK_SUCCESS)
+            return true;
+
+        uint8_t senseCdb[6] = { SCSI_REQUEST_SENSE, 0, 0, 0, sizeof(sense), 0 };
+        command(lun, senseCdb, 6, sense, sizeof(sense), true);
+    }
+
+    return false;
+}
+
+bool usbMassStorage::readCapacity(uint8_t lun) {
+    uint8_t cdb[10] = { SCSI_READ_CAPACITY, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+    uint8_t data[8];
+
+    if(command(lun, cdb, 10, data, sizeof(data), true) != DISK_SUCCESS)
+        return false;
+
+    // Both fields are big endian, the first one is the last LBA
+    usbMassStorageLun* info = &this->luns[lun];
+    info->blocks = ((data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3]) + 1;
+    info->blockSize = (data[4] << 24) | (data[5] << 16) | (data[6] << 8) | data[7];
+
+    // Partition tables and filesystems are read in 512 byte sectors
+    return info->blocks > 1 && info->blockSize == USB_MSC_BLOCK_SIZE;
+}
+
+void usbMassStorage::inquiry(uint8_t lun) {
+    uint8_t cdb[6] = { SCSI_INQUIRY, 0, 0, 0, 36, 0 };
+    uint8_t data[36];
+
+    usbMassStorageLun* info = &this->luns[lun];
+    if(command(lun, cdb, 6, data, sizeof(data), true) != DISK_SUCCESS) {
+        memOperator::memcpy(info->name, "USB Disk", 9);
+        return;
+    }
+
+    // Vendor and product are space padded ASCII fields, joined with a single space
+    int length = 0;
+    for(int i = 8; i < 16; i++)
+        info->name[length++] = data[i];
+    while(length > 0 && info->name[length - 1] == ' ')
+        length--;
+    info->name[length++] = ' ';
+    for(int i = 16; i < 32; i++)
+        info->name[length++] = data[i];
+    while(length > 0 && info->name[length - 1] == ' ')
+        length--;
+    info->name[length] = '\0';
+}
+
+char usbMassStorage::transfer(uint16_t drive, bool write, uint32_t lba, uint32_t count, uint8_t* buf) {
+    if(drive >= this->lunCount || !this->luns[drive].present)
+        return DISK_ERROR;
+
+    usbMassStorageLun* info = &this->luns[drive];
+    if(lba + count > info->blocks)
+        return DISK_ERROR;
+
+    // One CBW per 64 KB keeps the command, data and status phases back to back without anything in between
+    uint32_t maxBlocks = USB_MSC_MAX_TRANSFER / info->blockSize;
+
+    this->lock.lock();
+    char result = info->present ? DISK_SUCCESS : DISK_ERROR;
+    for(uint32_t done = 0; done < count && result == DISK_SUCCESS; ) {
+        uint32_t blocks = count - done > maxBlocks ? maxBlocks : count - done;
+        uint32_t sector = lba + done;
+
+        uint8_t cdb[10] = { write ? SCSI_WRITE_10 : SCSI_READ_10, 0,
+            (uint8_t)(sector >> 24), (uint8_t)(sector >> 16), (uint8_t)(sector >> 8), (uint8_t)sector,
+            0, (uint8_t)(blocks >> 8), (uint8_t)blocks, 0 };
+
+        result = command(drive, cdb, 10, buf + done * info->blockSize, blocks * info->blockSize, !write);
+        done += blocks;
+    }
+    this->lock.unlock();
+
+    if(result != DISK_SUCCESS)
+        Log(Error, "USB disk %d: %s of %d blocks at %d failed", drive, write ? "write" : "read", count, lba);
+    return result;
+}
+
+char usbMassStorage::readSector(uint16_t drive, uint32_t lba, uint8_t* buf) {
+    return transfer(drive, false, lba, 1, buf);
+}
+
+char usbMassStorage::writeSector(uint16_t drive, uint32_t lba, uint8_t* buf) {
+    return transfer(drive, true, lba, 1, buf);
+}
+
+char usbMassStorage::readSectors(uint16_t drive, uint32_t lba, uint32_t count, uint8_t* buf) {
+    return transfer(drive, false, lba, count, buf);
+}
+
+char usbMassStorage::writeSectors(uint16_t drive, uint32_t lba, uint32_t count, uint8_t* buf) {
+    return transfer(drive, true, lba, count, buf);
+}
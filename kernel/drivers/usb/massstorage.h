@@ -0,0 +1,107 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#pragma once
+
+#include <ak/types.h>
+#include <tasking/lock.h>
+#include <kernel/disks/diskcontroller.h>
+#include <kernel/filesystem/vfsmanager.h>
+#include "usbdriver.h"
+
+namespace Kernel {
+    #define USB_CLASS_MASS_STORAGE      0x08
+    #define USB_SUBCLASS_SCSI           0x06
+
+    #define USB_MSC_REQUEST_RESET       0xFF
+    #define USB_MSC_FEATURE_HALT        0x00
+
+    #define USB_MSC_CBW_SIGNATURE       0x43425355
+    #define USB_MSC_CSW_SIGNATURE       0x53425355
+    #define USB_MSC_CBW_DATA_IN         0x80
+    #define USB_MSC_CSW_PASSED          0
+    #define USB_MSC_CSW_FAILED          1
+    #define USB_MSC_CSW_PHASE_ERROR     2
+
+    #define SCSI_TEST_UNIT_READY        0x00
+    #define SCSI_REQUEST_SENSE          0x03
+    #define SCSI_INQUIRY                0x12
+    #define SCSI_READ_CAPACITY          0x25
+    #define SCSI_READ_10                0x28
+    #define SCSI_WRITE_10               0x2A
+
+    #define USB_MSC_MAX_LUNS            16
+    #define USB_MSC_MAX_TRANSFER        64_KB
+    #define USB_MSC_BLOCK_SIZE          512
+    #define USB_MSC_READY_RETRIES       10
+
+    struct commandBlockWrapper {
+        ak::uint32_t signature;
+        ak::uint32_t tag;
+        ak::uint32_t transferLength;
+        ak::uint8_t flags;
+        ak::uint8_t lun;
+        ak::uint8_t commandLength;
+        ak::uint8_t command[16];
+    } __attribute__((packed));
+
+    struct commandStatusWrapper {
+        ak::uint32_t signature;
+        ak::uint32_t tag;
+        ak::uint32_t residue;
+        ak::uint8_t status;
+    } __attribute__((packed));
+
+    struct usbMassStorageLun {
+        bool present;
+        ak::uint32_t blocks;
+        ak::uint32_t blockSize;
+        char name[25];
+        Disk* disk;
+    };
+
+    /**
+     * @brief usbMassStorage[read, write] bulk-only transport SCSI devices, every LUN becomes a disk and a command moves up to 64 KB
+     */
+    class usbMassStorage : public usbDriver, public diskController {
+      public:
+        usbMassStorage(usbDevice* dev, diskManager* disks, vfsManager* vfs);
+
+        static bool supports(usbDevice* dev);
+
+        void initialize();
+        void deInitialize();
+
+        char readSector(ak::uint16_t drive, ak::uint32_t lba, ak::uint8_t* buf);
+        char writeSector(ak::uint16_t drive, ak::uint32_t lba, ak::uint8_t* buf);
+
+        char readSectors(ak::uint16_t drive, ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf);
+        char writeSectors(ak::uint16_t drive, ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf);
+
+      private:
+        diskManager* disks;
+        vfsManager* vfs;
+        int bulkInEndpoint = -1;
+        int bulkOutEndpoint = -1;
+        ak::uint32_t nextTag = 1;
+        mutexLock lock;
+
+        usbMassStorageLun luns[USB_MSC_MAX_LUNS];
+        int lunCount = 0;
+
+        commandBlockWrapper* cbw;
+        commandStatusWrapper* csw;
+
+        bool findEndpoints();
+        void resetRecovery();
+        bool clearHalt(int endpoint);
+
+        char command(ak::uint8_t lun, ak::uint8_t* cdb, ak::uint8_t cdbLength, ak::uint8_t* buf, ak::uint32_t length, bool in);
+        bool waitReady(ak::uint8_t lun);
+        bool readCapacity(ak::uint8_t lun);
+        void inquiry(ak::uint8_t lun);
+
+        char transfer(ak::uint16_t drive, bool write, ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf);
+    };
+}
@@ -0,0 +1,368 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#include "boottrace.h"
+#include "vfsmanager.h"
+#include <ak/string.h>
+#include <ak/memoperator.h>
+#include <tasking/scheduler.h>
+#include <cpu/idt.h>
+#include <kernel/system/log.h>
+
+using namespace Kernel::ak;
+using namespace Kernel;
+
+virtualFileSystem* bootTrace::fs = 0;
+vfsManager* bootTrace::vfs = 0;
+mutexLock bootTrace::lock;
+bool bootTrace::recording = false;
+
+bootTraceEntry bootTrace::recorded[BOOTTRACE_MAX_ENTRIES];
+uint32_t bootTrace::recordedCount = 0;
+
+bootTraceEntry* bootTrace::replayed = 0;
+bootTraceBuffer* bootTrace::buffers = 0;
+uint32_t bootTrace::replayedCount = 0;
+
+uint32_t bootTrace::startTime = 0;
+uint32_t bootTrace::lastRead = 0;
+uint32_t bootTrace::previousBootTime = 0;
+uint32_t bootTrace::hits = 0;
+
+static bool rangeContains(uint32_t start, uint32_t length, bool endOfFile, uint32_t offset, uint32_t len) {
+    if(offset < start)
+        return false;
+
+    if(length == BOOTTRACE_WHOLE_FILE)
+        return true;
+
+    if(offset > start + length)
+        return false;
+
+    if(endOfFile)
+        return true;
+
+    return len != BOOTTRACE_WHOLE_FILE && offset + len <= start + length;
+}
+
+bool bootTrace::samePath(const char* a, const char* b) {
+    // Traced paths are compared the way the boot filesystem compares names
+    if(fs == 0 || fs->caseSensitive)
+        return String::strcmp(a, b);
+
+    for(; *a != '\0' && *b != '\0'; a++, b++)
+        if(String::uppercase(*a) != String::uppercase(*b))
+            return false;
+
+    return *a == *b;
+}
+
+void bootTrace::start(virtualFileSystem* bootFs, vfsManager* vfs) {
+    fs = bootFs;
+    bootTrace::vfs = vfs;
+    startTime = scheduler::ticks();
+    lastRead = startTime;
+    recordedCount = 0;
+    hits = 0;
+    recording = true;
+
+    if(load())
+        Log(Info, "Boot trace: Replaying %d reads recorded on the previous boot", replayedCount);
+
+    // Also needed without a trace, it saves the one recorded now once boot is over
+    threadHelper::createFromFunction(workerThread, true);
+}
+
+bool bootTrace::load() {
+    fs->lock.lock();
+    uint32_t size = fs->getFileSize(BOOTTRACE_FILE);
+    if(size == (uint32_t)-1 || size < sizeof(bootTraceHeader)) {
+        fs->lock.unlock();
+        return false;
+    }
+
+    uint8_t* data = new uint8_t[size];
+    bootTraceHeader* header = (bootTraceHeader*)data;
+    int read = fs->readFile(BOOTTRACE_FILE, data, 0, size);
+    fs->lock.unlock();
+
+    if(read != (int)size || header->magic != BOOTTRACE_MAGIC || header->version != BOOTTRACE_VERSION
+        || header->entryCount > BOOTTRACE_MAX_ENTRIES || size != sizeof(bootTraceHeader) + header->entryCount * sizeof(bootTraceEntry)) {
+        Log(Warning, "Boot trace: Ignoring invalid %s", BOOTTRACE_FILE);
+        delete[] data;
+        return false;
+    }
+
+    replayedCount = header->entryCount;
+    previousBootTime = header->bootTime;
+    replayed = new bootTraceEntry[replayedCount];
+    buffers = new bootTraceBuffer[replayedCount];
+    memOperator::memcpy(replayed, data + sizeof(bootTraceHeader), replayedCount * sizeof(bootTraceEntry));
+    memOperator::memset(buffers, 0, replayedCount * sizeof(bootTraceBuffer));
+    delete[] data;
+
+    sortByLocation(replayed, replayedCount);
+    for(uint32_t i = 0; i < replayedCount; i++) {
+        replayed[i].path[BOOTTRACE_PATH_LENGTH - 1] = '\0';
+        buffers[i].entry = &replayed[i];
+    }
+
+    return replayedCount > 0;
+}
+
+void bootTrace::save() {
+    lock.lock();
+    virtualFileSystem* target = fs;
+    lock.unlock();
+
+    if(target == 0 || recordedCount == 0)
+        return;
+
+    target->lock.lock();
+    for(uint32_t i = 0; i < recordedCount; i++)
+        recorded[i].sector = target->fileLocation(recorded[i].path);
+    target->lock.unlock();
+
+    uint32_t size = sizeof(bootTraceHeader) + recordedCount * sizeof(bootTraceEntry);
+    uint8_t* data = new uint8_t[size];
+
+    bootTraceHeader* header = (bootTraceHeader*)data;
+    header->magic = BOOTTRACE_MAGIC;
+    header->version = BOOTTRACE_VERSION;
+    header->entryCount = recordedCount;
+    header->bootTime = lastRead - startTime;
+    memOperator::memcpy(data + sizeof(bootTraceHeader), recorded, recordedCount * sizeof(bootTraceEntry));
+
+    // Through the vfsManager, the page cache and readahead must learn about the new contents
+    if(vfs->writeFile(BOOTTRACE_SAVE_PATH, data, size, true) != (int)size || vfs->fsync(BOOTTRACE_SAVE_PATH) != 0)
+        Log(Info, "Boot trace: Could not save %s, boot filesystem is read-only", BOOTTRACE_FILE);
+
+    delete[] data;
+}
+
+void bootTrace::sortByLocation(bootTraceEntry* entries, uint32_t count) {
+    // Never more than a few hundred entries, insertion sort is plenty
+    for(uint32_t i = 1; i < count; i++) {
+        bootTraceEntry entry = entries[i];
+        int j = i - 1;
+        while(j >= 0 && (entries[j].sector > entry.sector || (entries[j].sector == entry.sector && entries[j].offset > entry.offset))) {
+            entries[j + 1] = entries[j];
+            j--;
+        }
+        entries[j + 1] = entry;
+    }
+}
+
+void bootTrace::record(virtualFileSystem* fs, const char* path, uint32_t offset, uint32_t len) {
+    if(!recording || fs != bootTrace::fs || String::strlen(path) >= BOOTTRACE_PATH_LENGTH)
+        return;
+
+    lock.lock();
+    lastRead = scheduler::ticks();
+
+    // A sequential read continues the previous entry of the same file
+    if(recordedCount > 0) {
+        bootTraceEntry* last = &recorded[recordedCount - 1];
+        if(last->length != BOOTTRACE_WHOLE_FILE && len != BOOTTRACE_WHOLE_FILE && last->offset + last->length == offset && samePath(last->path, path)) {
+            last->length += len;
+            lock.unlock();
+            return;
+        }
+    }
+
+    for(uint32_t i = 0; i < recordedCount; i++)
+        if(samePath(recorded[i].path, path) && rangeContains(recorded[i].offset, recorded[i].length, false, offset, len)) {
+            lock.unlock();
+            return;
+        }
+
+    if(recordedCount < BOOTTRACE_MAX_ENTRIES) {
+        bootTraceEntry* entry = &recorded[recordedCount++];
+        memOperator::memset(entry, 0, sizeof(bootTraceEntry));
+        entry->offset = offset;
+        entry->length = len;
+        String::strcpy(entry->path, path);
+    }
+    lock.unlock();
+}
+
+bootTraceBuffer* bootTrace::findBuffer(const char* path, uint32_t offset, uint32_t len) {
+    for(uint32_t i = 0; i < replayedCount; i++) {
+        bootTraceBuffer* buffer = &buffers[i];
+        if(buffer->stale || !(buffer->pending || buffer->ready) || !samePath(buffer->entry->path, path))
+            continue;
+
+        // While pending only the traced range is known, not how much of it exists
+        bool found = buffer->pending
+            ? rangeContains(buffer->entry->offset, buffer->entry->length, false, offset, len)
+            : rangeContains(buffer->entry->offset, buffer->length, buffer->endOfFile, offset, len);
+
+        if(found)
+            return buffer;
+    }
+
+    return 0;
+}
+
+int bootTrace::read(virtualFileSystem* fs, const char* path, uint8_t* buffer, uint32_t offset, uint32_t len) {
+    if(fs != bootTrace::fs)
+        return -1;
+
+    lock.lock();
+    bootTraceBuffer* traced = findBuffer(path, offset, len);
+
+    // Already on its way from the replay thread, waiting beats a second read of the same sectors
+    while(traced != 0 && traced->pending) {
+        // The completion wakes a single waiter, anyone else sharing the buffer looks again after the short timeout
+        lock.unlock();
+        completionHelper::wait(&traced->filled, BOOTTRACE_WAIT_MS);
+        lock.lock();
+        traced = findBuffer(path, offset, len);
+    }
+
+    if(traced == 0) {
+        lock.unlock();
+        return -1;
+    }
+
+    uint32_t start = offset - traced->entry->offset;
+    if(len > traced->length - start)
+        len = traced->length - start;
+
+    memOperator::memcpy(buffer, traced->data + start, len);
+    hits++;
+    lock.unlock();
+    return len;
+}
+
+void bootTrace::invalidate(virtualFileSystem* fs, const char* path) {
+    if(fs != bootTrace::fs)
+        return;
+
+    lock.lock();
+    for(uint32_t i = 0; i < replayedCount; i++) {
+        bootTraceBuffer* buffer = &buffers[i];
+        if(!samePath(buffer->entry->path, path))
+            continue;
+
+        if(buffer->ready)
+            delete[] buffer->data;
+
+        buffer->data = 0;
+        buffer->ready = false;
+        buffer->stale = true;
+    }
+    lock.unlock();
+}
+
+void bootTrace::invalidateAll(virtualFileSystem* fs) {
+    if(fs != bootTrace::fs)
+        return;
+
+    lock.lock();
+    recording = false;
+    bootTrace::fs = 0;
+    for(uint32_t i = 0; i < replayedCount; i++) {
+        if(buffers[i].ready)
+            delete[] buffers[i].data;
+
+        buffers[i].data = 0;
+        buffers[i].ready = false;
+        buffers[i].stale = true;
+    }
+    lock.unlock();
+}
+
+void bootTrace::releaseBuffers() {
+    for(uint32_t i = 0; i < replayedCount; i++)
+        if(buffers[i].ready)
+            delete[] buffers[i].data;
+
+    if(buffers)
+        delete[] buffers;
+    if(replayed)
+        delete[] replayed;
+
+    buffers = 0;
+    replayed = 0;
+    replayedCount = 0;
+}
+
+void bootTrace::workerThread() {
+    uint32_t prefetched = 0;
+
+    // Entries are sorted by their place on disk, so this walks the disk in one direction
+    for(uint32_t i = 0; i < replayedCount; i++) {
+        lock.lock();
+        bootTraceBuffer* buffer = &buffers[i];
+        virtualFileSystem* target = fs;
+        if(target == 0 || buffer->stale || prefetched >= BOOTTRACE_MAX_BYTES) {
+            lock.unlock();
+            continue;
+        }
+        completionHelper::reset(&buffer->filled);
+        buffer->pending = true;
+        lock.unlock();
+
+        bootTraceEntry* entry = buffer->entry;
+        uint32_t length = entry->length;
+        target->lock.lock();
+        if(length == BOOTTRACE_WHOLE_FILE) {
+            uint32_t size = target->getFileSize(entry->path);
+            length = (size == (uint32_t)-1 || size <= entry->offset) ? 0 : size - entry->offset;
+        }
+
+        if(length > BOOTTRACE_MAX_BYTES - prefetched)
+            length = 0;
+
+        uint8_t* data = length > 0 ? new uint8_t[length] : 0;
+        int result = length > 0 ? target->readFile(entry->path, data, entry->offset, length) : -1;
+        target->lock.unlock();
+
+        lock.lock();
+        if(result < 0 || buffer->stale) {
+            if(data)
+                delete[] data;
+        }
+        else {
+            buffer->data = data;
+            buffer->length = result;
+            buffer->endOfFile = entry->length == BOOTTRACE_WHOLE_FILE || (uint32_t)result < length;
+            buffer->ready = true;
+            prefetched += result;
+        }
+        buffer->pending = false;
+
+        interruptDescriptorTable::disableInterrupts();
+        completionHelper::signal(&buffer->filled);
+        interruptDescriptorTable::enableInterrupts();
+        lock.unlock();
+    }
+
+    // Reads keep being recorded until the end of the window, nothing else is left to do until then
+    Thread* current = scheduler::currentThread();
+    for(uint32_t elapsed = scheduler::ticks() - startTime; elapsed < BOOTTRACE_RECORD_MS; elapsed = scheduler::ticks() - startTime)
+        scheduler::sleep(current, BOOTTRACE_RECORD_MS - elapsed);
+
+    lock.lock();
+    recording = false;
+    uint32_t replayCount = replayedCount;
+    releaseBuffers();
+    lock.unlock();
+
+    uint32_t bootTime = lastRead - startTime;
+    if(replayCount > 0)
+        Log(Info, "Boot trace: %d reads served from %d KB prefetched, boot reads took %d ms against %d ms without replay, %d ms saved",
+            hits, prefetched / 1_KB, bootTime, previousBootTime, (int)previousBootTime - (int)bootTime);
+
+    // Only keep the time of a boot without replay, otherwise the saving is measured against itself
+    if(replayCount > 0)
+        bootTime = previousBootTime;
+
+    lastRead = startTime + bootTime;
+    save();
+
+    // Tracing is over for this boot, nothing will wake this thread again
+    threadHelper::removeThread(scheduler::currentThread());
+}
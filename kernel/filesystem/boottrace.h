@@ -0,0 +1,100 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#pragma once
+
+#include <ak/types.h>
+#include <tasking/lock.h>
+#include <tasking/completion.h>
+#include "virtualfilesystem.h"
+
+namespace Kernel {
+    class vfsManager;
+
+    #define BOOTTRACE_FILE          "boottrace.bin"
+    #define BOOTTRACE_SAVE_PATH     "boot" PATH_SEPERATOR_S BOOTTRACE_FILE
+    #define BOOTTRACE_MAGIC         0x45435254
+    #define BOOTTRACE_VERSION       1
+    #define BOOTTRACE_MAX_ENTRIES   256
+    #define BOOTTRACE_PATH_LENGTH   96
+    #define BOOTTRACE_RECORD_MS     20000
+    #define BOOTTRACE_WAIT_MS       50
+    #define BOOTTRACE_MAX_BYTES     16_MB
+    #define BOOTTRACE_WHOLE_FILE    0xFFFFFFFF
+
+    /**
+     * @brief start of the trace file, bootTime is how long the recorded boot kept reading
+     */
+    struct bootTraceHeader {
+        ak::uint32_t magic;
+        ak::uint32_t version;
+        ak::uint32_t entryCount;
+        ak::uint32_t bootTime;
+    } __attribute__((packed));
+
+    /**
+     * @brief one read done during boot, sector is where the file starts on disk
+     */
+    struct bootTraceEntry {
+        ak::uint32_t sector;
+        ak::uint32_t offset;
+        ak::uint32_t length;
+        char path[BOOTTRACE_PATH_LENGTH];
+    } __attribute__((packed));
+
+    /**
+     * @brief data of a replayed entry, filled by the replay thread which signals filled once it is no longer pending
+     */
+    struct bootTraceBuffer {
+        bootTraceEntry* entry;
+        completion filled;
+        ak::uint8_t* data;
+        ak::uint32_t length;
+        bool endOfFile;
+        bool pending;
+        bool ready;
+        bool stale;
+    };
+
+    /**
+     * @brief bootTrace[start, record, read, invalidate] records the reads of one boot and prefetches them on the next
+     */
+    class bootTrace {
+      public:
+        static void start(virtualFileSystem* bootFs, vfsManager* vfs);
+
+        static void record(virtualFileSystem* fs, const char* path, ak::uint32_t offset, ak::uint32_t len);
+        static int read(virtualFileSystem* fs, const char* path, ak::uint8_t* buffer, ak::uint32_t offset, ak::uint32_t len);
+
+        static void invalidate(virtualFileSystem* fs, const char* path);
+        static void invalidateAll(virtualFileSystem* fs);
+
+      private:
+        static virtualFileSystem* fs;
+        static vfsManager* vfs;
+        static mutexLock lock;
+        static bool recording;
+
+        static bootTraceEntry recorded[BOOTTRACE_MAX_ENTRIES];
+        static ak::uint32_t recordedCount;
+
+        static bootTraceEntry* replayed;
+        static bootTraceBuffer* buffers;
+        static ak::uint32_t replayedCount;
+
+        static ak::uint32_t startTime;
+        static ak::uint32_t lastRead;
+        static ak::uint32_t previousBootTime;
+        static ak::uint32_t hits;
+
+        static bool samePath(const char* a, const char* b);
+        static bool load();
+        static void save();
+        static void sortByLocation(bootTraceEntry* entries, ak::uint32_t count);
+        static bootTraceBuffer* findBuffer(const char* path, ak::uint32_t offset, ak::uint32_t len);
+        static void releaseBuffers();
+
+        static void workerThread();
+    };
+}
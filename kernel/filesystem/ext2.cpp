@@ -0,0 +1,933 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#include "ext2.h"
+#include <ak/memoperator.h>
+#include <ak/string.h>
+#include <kernel/system/log.h>
+
+using namespace Kernel::ak;
+using namespace Kernel;
+
+#define EXT2_MAX_RUN_SECTORS 256
+
+static uint32_t recordSize(uint32_t nameLength) {
+    return (8 + nameLength + 3) & ~3;
+}
+
+ext2::ext2(Disk* disk, uint32_t start, uint32_t size)
+: virtualFileSystem(disk, start, size) {
+    this->Name = "Ext2 Filesystem";
+    this->caseSensitive = true;
+    memOperator::memset(this->cache, 0, sizeof(this->cache));
+}
+
+ext2::~ext2() {
+    commit();
+
+    for(int i = 0; i < EXT2_CACHE_BLOCKS; i++)
+        if(this->cache[i].data)
+            delete[] this->cache[i].data;
+    if(this->bounceBuffer)
+        delete[] this->bounceBuffer;
+}
+
+bool ext2::initialize() {
+    if(this->disk->readSectors(this->startLBA + EXT2_SUPERBLOCK_OFFSET / 512, sizeof(ext2SuperBlock) / 512, (uint8_t*)&this->superBlock) != 0)
+        return false;
+
+    if(this->superBlock.magic != EXT2_MAGIC || this->superBlock.blocksPerGroup == 0 || this->superBlock.inodesPerGroup == 0)
+        return false;
+
+    this->blockSize = 1024 << this->superBlock.logBlockSize;
+    this->sectorsPerBlock = this->blockSize / 512;
+    this->pointersPerBlock = this->blockSize / sizeof(uint32_t);
+    this->groupCount = (this->superBlock.blocksCount - this->superBlock.firstDataBlock + this->superBlock.blocksPerGroup - 1) / this->superBlock.blocksPerGroup;
+
+    if(this->superBlock.revLevel >= 1) {
+        this->inodeSize = this->superBlock.inodeSize;
+        this->firstInode = this->superBlock.firstInode;
+    }
+
+    if(this->superBlock.featureIncompat & ~EXT2_FEATURE_INCOMPAT_FILETYPE) {
+        Log(Error, "Ext2: Unsupported incompatible features %x", this->superBlock.featureIncompat);
+        return false;
+    }
+
+    if(this->superBlock.featureRoCompat & ~(EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER | EXT2_FEATURE_RO_COMPAT_LARGE_FILE)) {
+        Log(Warning, "Ext2: Unsupported features %x, mounting read-only", this->superBlock.featureRoCompat);
+        this->readOnly = true;
+    }
+
+    for(int i = 0; i < EXT2_CACHE_BLOCKS; i++)
+        this->cache[i].data = new uint8_t[this->blockSize];
+    this->bounceBuffer = new uint8_t[this->blockSize];
+
+    Log(Info, "Ext2: %d blocks of %d bytes in %d groups, %d free", this->superBlock.blocksCount, this->blockSize, this->groupCount, this->superBlock.freeBlocksCount);
+    return true;
+}
+
+/*///////////////
+// Block cache
+/*///////////////
+
+uint8_t* ext2::cachedBlock(uint32_t block, bool load) {
+    ext2CachedBlock* victim = 0;
+    for(int i = 0; i < EXT2_CACHE_BLOCKS; i++) {
+        ext2CachedBlock* entry = &this->cache[i];
+        if(entry->valid && entry->block == block) {
+            entry->lastUse = ++this->cacheUseCounter;
+            return entry->data;
+        }
+
+        if(victim == 0 || (victim->valid && (!entry->valid || entry->lastUse < victim->lastUse)))
+            victim = entry;
+    }
+
+    if(victim->valid && victim->dirty && !writeCachedBlock(victim))
+        return 0;
+    victim->valid = false;
+
+    if(!load)
+        memOperator::memset(victim->data, 0, this->blockSize);
+    else if(this->disk->readSectors(this->startLBA + block * this->sectorsPerBlock, this->sectorsPerBlock, victim->data) != 0)
+        return 0;
+
+    victim->block = block;
+    victim->valid = true;
+    victim->dirty = false;
+    victim->lastUse = ++this->cacheUseCounter;
+    return victim->data;
+}
+
+void ext2::markDirty(uint32_t block) {
+    for(int i = 0; i < EXT2_CACHE_BLOCKS; i++)
+        if(this->cache[i].valid && this->cache[i].block == block)
+            this->cache[i].dirty = true;
+}
+
+void ext2::dropCached(uint32_t block) {
+    for(int i = 0; i < EXT2_CACHE_BLOCKS; i++)
+        if(this->cache[i].valid && this->cache[i].block == block) {
+            this->cache[i].valid = false;
+            this->cache[i].dirty = false;
+        }
+}
+
+bool ext2::writeCachedBlock(ext2CachedBlock* entry) {
+    if(this->disk->writeSectors(this->startLBA + entry->block * this->sectorsPerBlock, this->sectorsPerBlock, entry->data) != 0)
+        return false;
+
+    entry->dirty = false;
+    return true;
+}
+
+bool ext2::commit() {
+    if(this->readOnly)
+        return true;
+
+    bool result = true;
+    for(int i = 0; i < EXT2_CACHE_BLOCKS; i++)
+        if(this->cache[i].valid && this->cache[i].dirty && !writeCachedBlock(&this->cache[i]))
+            result = false;
+
+    // Only the primary copy, the backups in other groups are left to fsck
+    if(this->superBlockDirty) {
+        if(this->disk->writeSectors(this->startLBA + EXT2_SUPERBLOCK_OFFSET / 512, sizeof(ext2SuperBlock) / 512, (uint8_t*)&this->superBlock) != 0)
+            result = false;
+        else
+            this->superBlockDirty = false;
+    }
+
+    return result;
+}
+
+/*///////////////
+// Groups and inodes
+/*///////////////
+
+ext2GroupDescriptor* ext2::groupDescriptor(uint32_t group) {
+    uint32_t perBlock = this->blockSize / sizeof(ext2GroupDescriptor);
+    uint8_t* data = cachedBlock(this->superBlock.firstDataBlock + 1 + group / perBlock);
+    if(data == 0)
+        return 0;
+
+    return (ext2GroupDescriptor*)data + group % perBlock;
+}
+
+void ext2::markGroupDirty(uint32_t group) {
+    markDirty(this->superBlock.firstDataBlock + 1 + group / (this->blockSize / sizeof(ext2GroupDescriptor)));
+}
+
+bool ext2::readInode(uint32_t number, ext2Inode* inode) {
+    uint32_t group = (number - 1) / this->superBlock.inodesPerGroup;
+    uint32_t index = (number - 1) % this->superBlock.inodesPerGroup;
+
+    ext2GroupDescriptor* descriptor = groupDescriptor(group);
+    if(number == 0 || group >= this->groupCount || descriptor == 0)
+        return false;
+
+    uint32_t block = descriptor->inodeTable + (index * this->inodeSize) / this->blockSize;
+    uint8_t* data = cachedBlock(block);
+    if(data == 0)
+        return false;
+
+    memOperator::memcpy(inode, data + (index * this->inodeSize) % this->blockSize, sizeof(ext2Inode));
+    return true;
+}
+
+bool ext2::writeInode(uint32_t number, ext2Inode* inode) {
+    uint32_t group = (number - 1) / this->superBlock.inodesPerGroup;
+    uint32_t index = (number - 1) % this->superBlock.inodesPerGroup;
+
+    ext2GroupDescriptor* descriptor = groupDescriptor(group);
+    if(number == 0 || group >= this->groupCount || descriptor == 0)
+        return false;
+
+    uint32_t block = descriptor->inodeTable + (index * this->inodeSize) / this->blockSize;
+    uint8_t* data = cachedBlock(block);
+    if(data == 0)
+        return false;
+
+    memOperator::memcpy(data + (index * this->inodeSize) % this->blockSize, inode, sizeof(ext2Inode));
+    markDirty(block);
+    return true;
+}
+
+/*///////////////
+// Allocation
+/*///////////////
+
+uint32_t ext2::allocateBlock(uint32_t goal) {
+    if(this->readOnly || this->superBlock.freeBlocksCount == 0)
+        return 0;
+
+    uint32_t firstBlock = this->superBlock.firstDataBlock;
+    uint32_t perGroup = this->superBlock.blocksPerGroup;
+    if(goal < firstBlock || goal >= this->superBlock.blocksCount)
+        goal = firstBlock;
+
+    // First fit from the goal, in its own group before moving on to the next ones
+    uint32_t goalGroup = (goal - firstBlock) / perGroup;
+    for(uint32_t n = 0; n < this->groupCount; n++) {
+        uint32_t group = (goalGroup + n) % this->groupCount;
+        ext2GroupDescriptor* descriptor = groupDescriptor(group);
+        if(descriptor == 0 || descriptor->freeBlocksCount == 0)
+            continue;
+
+        uint32_t bitmapBlock = descriptor->blockBitmap;
+        uint32_t groupBlocks = this->superBlock.blocksCount - firstBlock - group * perGroup;
+        if(groupBlocks > perGroup)
+            groupBlocks = perGroup;
+
+        uint8_t* bitmap = cachedBlock(bitmapBlock);
+        if(bitmap == 0)
+            continue;
+
+        uint32_t start = n == 0 ? (goal - firstBlock) % perGroup : 0;
+        for(uint32_t i = 0; i < groupBlocks; i++) {
+            uint32_t bit = (start + i) % groupBlocks;
+            if(bitmap[bit / 8] & (1 << (bit % 8)))
+                continue;
+
+            bitmap[bit / 8] |= 1 << (bit % 8);
+            markDirty(bitmapBlock);
+
+            descriptor = groupDescriptor(group);
+            descriptor->freeBlocksCount--;
+            markGroupDirty(group);
+
+            this->superBlock.freeBlocksCount--;
+            this->superBlockDirty = true;
+            return firstBlock + group * perGroup + bit;
+        }
+    }
+
+    return 0;
+}
+
+void ext2::freeBlock(uint32_t block) {
+    uint32_t group = (block - this->superBlock.firstDataBlock) / this->superBlock.blocksPerGroup;
+    uint32_t bit = (block - this->superBlock.firstDataBlock) % this->superBlock.blocksPerGroup;
+
+    ext2GroupDescriptor* descriptor = groupDescriptor(group);
+    if(descriptor == 0)
+        return;
+
+    uint32_t bitmapBlock = descriptor->blockBitmap;
+    uint8_t* bitmap = cachedBlock(bitmapBlock);
+    if(bitmap == 0)
+        return;
+
+    bitmap[bit / 8] &= ~(1 << (bit % 8));
+    markDirty(bitmapBlock);
+
+    descriptor = groupDescriptor(group);
+    descriptor->freeBlocksCount++;
+    markGroupDirty(group);
+
+    this->superBlock.freeBlocksCount++;
+    this->superBlockDirty = true;
+
+    // A stale copy must not be written over whatever the block is used for next
+    dropCached(block);
+}
+
+uint32_t ext2::allocateInode(uint32_t parent, bool directory) {
+    if(this->readOnly || this->superBlock.freeInodesCount == 0)
+        return 0;
+
+    uint32_t startGroup = (parent - 1) / this->superBlock.inodesPerGroup;
+
+    // Files stay with their directory, new directories go to a roomy group so their files have space to grow
+    if(directory) {
+        uint32_t averageFree = this->superBlock.freeInodesCount / this->groupCount;
+        int best = -1;
+        uint32_t bestBlocks = 0;
+        for(uint32_t group = 0; group < this->groupCount; group++) {
+            ext2GroupDescriptor* descriptor = groupDescriptor(group);
+            if(descriptor == 0 || descriptor->freeInodesCount == 0 || descriptor->freeInodesCount < averageFree)
+                continue;
+
+            if(best == -1 || descriptor->freeBlocksCount > bestBlocks) {
+                best = group;
+                bestBlocks = descriptor->freeBlocksCount;
+            }
+        }
+
+        if(best != -1)
+            startGroup = best;
+    }
+
+    for(uint32_t n = 0; n < this->groupCount; n++) {
+        uint32_t group = (startGroup + n) % this->groupCount;
+        ext2GroupDescriptor* descriptor = groupDescriptor(group);
+        if(descriptor == 0 || descriptor->freeInodesCount == 0)
+            continue;
+
+        uint32_t bitmapBlock = descriptor->inodeBitmap;
+        uint8_t* bitmap = cachedBlock(bitmapBlock);
+        if(bitmap == 0)
+            continue;
+
+        for(uint32_t bit = 0; bit < this->superBlock.inodesPerGroup; bit++) {
+            uint32_t number = group * this->superBlock.inodesPerGroup + bit + 1;
+            if(number < this->firstInode || (bitmap[bit / 8] & (1 << (bit % 8))))
+                continue;
+
+            bitmap[bit / 8] |= 1 << (bit % 8);
+            markDirty(bitmapBlock);
+
+            descriptor = groupDescriptor(group);
+            descriptor->freeInodesCount--;
+            if(directory)
+                descriptor->usedDirsCount++;
+            markGroupDirty(group);
+
+            this->superBlock.freeInodesCount--;
+            this->superBlockDirty = true;
+            return number;
+        }
+    }
+
+    return 0;
+}
+
+uint32_t ext2::allocateZeroedBlock(ext2Inode* inode, uint32_t goal) {
+    uint32_t block = allocateBlock(goal);
+    if(block == 0 || cachedBlock(block, false) == 0)
+        return 0;
+
+    markDirty(block);
+    inode->sectors += this->sectorsPerBlock;
+    return block;
+}
+
+uint32_t ext2::dataGoal(uint32_t inodeNumber, ext2Inode* inode, uint32_t index) {
+    // Right behind the previous block of the file, or else the start of the inode's group
+    if(index > 0) {
+        uint32_t previous = mapBlock(inode, index - 1);
+        if(previous != 0)
+            return previous + 1;
+    }
+
+    return this->superBlock.firstDataBlock + ((inodeNumber - 1) / this->superBlock.inodesPerGroup) * this->superBlock.blocksPerGroup;
+}
+
+/*///////////////
+// Block mapping
+/*///////////////
+
+uint32_t ext2::mapBlock(ext2Inode* inode, uint32_t index, bool allocate, uint32_t goal) {
+    if(index < EXT2_DIRECT_BLOCKS) {
+        if(inode->block[index] == 0 && allocate) {
+            inode->block[index] = allocateBlock(goal);
+            if(inode->block[index] != 0)
+                inode->sectors += this->sectorsPerBlock;
+        }
+        return inode->block[index];
+    }
+
+    index -= EXT2_DIRECT_BLOCKS;
+    uint32_t span = this->pointersPerBlock;
+    for(int depth = 1; depth <= 3; depth++) {
+        if(index < span) {
+            // Inodes are packed, the pointer is copied out instead of taking its address
+            uint32_t table = inode->block[EXT2_DIRECT_BLOCKS - 1 + depth];
+            if(table == 0) {
+                if(!allocate || (table = allocateZeroedBlock(inode, goal)) == 0)
+                    return 0;
+                inode->block[EXT2_DIRECT_BLOCKS - 1 + depth] = table;
+            }
+
+            return mapIndirect(inode, table, depth, index, allocate, goal);
+        }
+
+        index -= span;
+        span *= this->pointersPerBlock;
+    }
+
+    return 0;
+}
+
+uint32_t ext2::mapIndirect(ext2Inode* inode, uint32_t table, int depth, uint32_t index, bool allocate, uint32_t goal) {
+    uint32_t span = 1;
+    for(int d = 1; d < depth; d++)
+        span *= this->pointersPerBlock;
+
+    // Indirect blocks come from the cache, sequential access maps a whole table from one read
+    uint32_t* entries = (uint32_t*)cachedBlock(table);
+    if(entries == 0)
+        return 0;
+
+    uint32_t slot = index / span;
+    uint32_t child = entries[slot];
+    if(child == 0) {
+        if(!allocate)
+            return 0;
+
+        if(depth == 1) {
+            child = allocateBlock(goal);
+            if(child != 0)
+                inode->sectors += this->sectorsPerBlock;
+        }
+        else
+            child = allocateZeroedBlock(inode, goal);
+
+        if(child == 0)
+            return 0;
+
+        // The allocation may have pushed the table out of the cache
+        entries = (uint32_t*)cachedBlock(table);
+        if(entries == 0)
+            return 0;
+
+        entries[slot] = child;
+        markDirty(table);
+    }
+
+    if(depth == 1)
+        return child;
+
+    return mapIndirect(inode, child, depth - 1, index % span, allocate, goal);
+}
+
+bool ext2::truncateTree(ext2Inode* inode, uint32_t table, int depth, uint32_t first) {
+    uint32_t span = 1;
+    for(int d = 1; d < depth; d++)
+        span *= this->pointersPerBlock;
+
+    for(uint32_t i = first / span; i < this->pointersPerBlock; i++) {
+        uint32_t* entries = (uint32_t*)cachedBlock(table);
+        if(entries == 0)
+            return false;
+
+        uint32_t child = entries[i];
+        if(child == 0)
+            continue;
+
+        uint32_t childFirst = i * span >= first ? 0 : first - i * span;
+        if(depth > 1 && !truncateTree(inode, child, depth - 1, childFirst))
+            continue;
+
+        freeBlock(child);
+        inode->sectors -= this->sectorsPerBlock;
+
+        entries = (uint32_t*)cachedBlock(table);
+        if(entries == 0)
+            return false;
+
+        entries[i] = 0;
+        markDirty(table);
+    }
+
+    return first == 0;
+}
+
+void ext2::truncate(ext2Inode* inode, uint32_t blocks) {
+    for(uint32_t i = blocks; i < EXT2_DIRECT_BLOCKS; i++)
+        if(inode->block[i] != 0) {
+            freeBlock(inode->block[i]);
+            inode->block[i] = 0;
+            inode->sectors -= this->sectorsPerBlock;
+        }
+
+    uint32_t first = blocks > EXT2_DIRECT_BLOCKS ? blocks - EXT2_DIRECT_BLOCKS : 0;
+    uint32_t span = this->pointersPerBlock;
+    for(int depth = 1; depth <= 3; depth++) {
+        uint32_t table = inode->block[EXT2_DIRECT_BLOCKS - 1 + depth];
+        if(table != 0 && first < span && truncateTree(inode, table, depth, first)) {
+            freeBlock(table);
+            inode->block[EXT2_DIRECT_BLOCKS - 1 + depth] = 0;
+            inode->sectors -= this->sectorsPerBlock;
+        }
+
+        first = first > span ? first - span : 0;
+        span *= this->pointersPerBlock;
+    }
+}
+
+/*///////////////
+// Directories
+/*///////////////
+
+uint32_t ext2::findInDirectory(ext2Inode* directory, const char* name, int length, uint8_t* fileType) {
+    uint32_t blocks = (directory->size + this->blockSize - 1) / this->blockSize;
+    for(uint32_t i = 0; i < blocks; i++) {
+        uint32_t block = mapBlock(directory, i);
+        if(block == 0)
+            continue;
+
+        uint8_t* data = cachedBlock(block);
+        if(data == 0)
+            return 0;
+
+        for(uint32_t offset = 0; offset + 8 <= this->blockSize;) {
+            ext2DirectoryEntry* entry = (ext2DirectoryEntry*)(data + offset);
+            if(entry->recordLength < 8)
+                break;
+
+            if(entry->inode != 0 && entry->nameLength == length && memOperator::memcmp(entry->name, name, length) == 0) {
+                if(fileType)
+                    *fileType = entry->fileType;
+                return entry->inode;
+            }
+
+            offset += entry->recordLength;
+        }
+    }
+
+    return 0;
+}
+
+uint32_t ext2::lookup(const char* path, ext2Inode* inode, const char** lastName, uint32_t* parent) {
+    while(*path == PATH_SEPERATOR_C)
+        path++;
+
+    uint32_t current = EXT2_ROOT_INODE;
+    if(!readInode(current, inode))
+        return 0;
+
+    if(parent)
+        *parent = 0;
+
+    while(*path != '\0') {
+        int length = 0;
+        while(path[length] != '\0' && path[length] != PATH_SEPERATOR_C)
+            length++;
+
+        if((inode->mode & EXT2_S_IFMT) != EXT2_S_IFDIR)
+            return 0;
+
+        // On a miss in the last component the caller gets the directory it would live in
+        if(lastName)
+            *lastName = path;
+        if(parent)
+            *parent = current;
+
+        uint32_t child = findInDirectory(inode, path, length);
+        if(child == 0)
+            return 0;
+
+        ext2Inode childInode;
+        if(!readInode(child, &childInode))
+            return 0;
+
+        *inode = childInode;
+        current = child;
+        path += length;
+        while(*path == PATH_SEPERATOR_C)
+            path++;
+    }
+
+    return current;
+}
+
+bool ext2::addDirectoryEntry(uint32_t directoryNumber, ext2Inode* directory, const char* name, int length, uint32_t inode, uint8_t fileType) {
+    uint32_t needed = recordSize(length);
+    if(!(this->superBlock.featureIncompat & EXT2_FEATURE_INCOMPAT_FILETYPE))
+        fileType = 0;
+
+    uint32_t blocks = directory->size / this->blockSize;
+    for(uint32_t i = 0; i < blocks; i++) {
+        uint32_t block = mapBlock(directory, i);
+        uint8_t* data = block ? cachedBlock(block) : 0;
+        if(data == 0)
+            continue;
+
+        for(uint32_t offset = 0; offset + 8 <= this->blockSize;) {
+            ext2DirectoryEntry* entry = (ext2DirectoryEntry*)(data + offset);
+            if(entry->recordLength < 8)
+                break;
+
+            // Any entry with enough slack behind its name can be split
+            uint32_t used = entry->inode ? recordSize(entry->nameLength) : 0;
+            if(entry->recordLength - used >= needed) {
+                ext2DirectoryEntry* target = entry;
+                if(used != 0) {
+                    target = (ext2DirectoryEntry*)(data + offset + used);
+                    target->recordLength = entry->recordLength - used;
+                    entry->recordLength = used;
+                }
+
+                target->inode = inode;
+                target->nameLength = length;
+                target->fileType = fileType;
+                memOperator::memcpy(target->name, name, length);
+                markDirty(block);
+                return true;
+            }
+
+            offset += entry->recordLength;
+        }
+    }
+
+    uint32_t block = mapBlock(directory, blocks, true, dataGoal(directoryNumber, directory, blocks));
+    uint8_t* data = block ? cachedBlock(block, false) : 0;
+    if(data == 0)
+        return false;
+
+    ext2DirectoryEntry* entry = (ext2DirectoryEntry*)data;
+    entry->inode = inode;
+    entry->recordLength = this->blockSize;
+    entry->nameLength = length;
+    entry->fileType = fileType;
+    memOperator::memcpy(entry->name, name, length);
+    markDirty(block);
+
+    directory->size += this->blockSize;
+    return writeInode(directoryNumber, directory);
+}
+
+int ext2::createEntry(const char* path, bool directory) {
+    if(this->readOnly)
+        return -1;
+
+    ext2Inode parent;
+    const char* name = 0;
+    uint32_t parentNumber = 0;
+    if(lookup(path, &parent, &name, &parentNumber) != 0 || parentNumber == 0 || name == 0 || String::contains(name, PATH_SEPERATOR_C))
+        return -1;
+
+    int length = String::strlen(name);
+    if(length > 255)
+        return -1;
+
+    uint32_t number = allocateInode(parentNumber, directory);
+    if(number == 0)
+        return -1;
+
+    ext2Inode inode;
+    memOperator::memset(&inode, 0, sizeof(ext2Inode));
+    inode.mode = directory ? (EXT2_S_IFDIR | 0755) : (EXT2_S_IFREG | 0644);
+    inode.linksCount = directory ? 2 : 1;
+
+    if(directory) {
+        uint32_t block = mapBlock(&inode, 0, true, dataGoal(number, &inode, 0));
+        uint8_t* data = block ? cachedBlock(block, false) : 0;
+        if(data == 0)
+            return -1;
+
+        bool types = this->superBlock.featureIncompat & EXT2_FEATURE_INCOMPAT_FILETYPE;
+        ext2DirectoryEntry* dot = (ext2DirectoryEntry*)data;
+        dot->inode = number;
+        dot->recordLength = recordSize(1);
+        dot->nameLength = 1;
+        dot->fileType = types ? EXT2_FT_DIR : 0;
+        dot->name[0] = '.';
+
+        ext2DirectoryEntry* dotdot = (ext2DirectoryEntry*)(data + dot->recordLength);
+        dotdot->inode = parentNumber;
+        dotdot->recordLength = this->blockSize - dot->recordLength;
+        dotdot->nameLength = 2;
+        dotdot->fileType = types ? EXT2_FT_DIR : 0;
+        dotdot->name[0] = '.';
+        dotdot->name[1] = '.';
+
+        markDirty(block);
+        inode.size = this->blockSize;
+    }
+
+    if(!writeInode(number, &inode) || !addDirectoryEntry(parentNumber, &parent, name, length, number, directory ? EXT2_FT_DIR : EXT2_FT_REG_FILE))
+        return -1;
+
+    // The ".." entry of the new directory links back to the parent
+    if(directory) {
+        parent.linksCount++;
+        writeInode(parentNumber, &parent);
+    }
+
+    return commit() ? 0 : -1;
+}
+
+/*///////////////
+// virtualFileSystem
+/*///////////////
+
+int ext2::readFile(const char* filename, uint8_t* buffer, uint32_t offset, uint32_t len) {
+    ext2Inode inode;
+    if(lookup(filename, &inode) == 0 || (inode.mode & EXT2_S_IFMT) != EXT2_S_IFREG)
+        return -1;
+
+    if(offset >= inode.size)
+        return 0;
+    if(len > inode.size - offset)
+        len = inode.size - offset;
+
+    uint32_t copied = 0;
+    while(copied < len) {
+        uint32_t position = offset + copied;
+        uint32_t index = position / this->blockSize;
+        uint32_t inBlock = position % this->blockSize;
+        uint32_t block = mapBlock(&inode, index);
+
+        // Whole blocks go straight into the caller's buffer, as one request while they are contiguous on disk
+        if(inBlock == 0 && len - copied >= this->blockSize) {
+            uint32_t run = 1;
+            while(block != 0 && (run + 1) * this->blockSize <= len - copied && (run + 1) * this->sectorsPerBlock <= EXT2_MAX_RUN_SECTORS && mapBlock(&inode, index + run) == block + run)
+                run++;
+
+            if(block == 0)
+                memOperator::memset(buffer + copied, 0, this->blockSize);
+            else if(this->disk->readSectors(this->startLBA + block * this->sectorsPerBlock, run * this->sectorsPerBlock, buffer + copied) != 0)
+                return copied > 0 ? (int)copied : -1;
+
+            copied += run * this->blockSize;
+            continue;
+        }
+
+        uint32_t part = this->blockSize - inBlock;
+        if(part > len - copied)
+            part = len - copied;
+
+        if(block == 0)
+            memOperator::memset(buffer + copied, 0, part);
+        else {
+            if(this->disk->readSectors(this->startLBA + block * this->sectorsPerBlock, this->sectorsPerBlock, this->bounceBuffer) != 0)
+                return copied > 0 ? (int)copied : -1;
+            memOperator::memcpy(buffer + copied, this->bounceBuffer + inBlock, part);
+        }
+
+        copied += part;
+    }
+
+    return copied;
+}
+
+int ext2::writeFile(const char* filename, uint8_t* buffer, uint32_t len, bool create) {
+    if(this->readOnly)
+        return -1;
+
+    ext2Inode inode;
+    uint32_t number = lookup(filename, &inode);
+    if(number == 0) {
+        if(!create || createEntry(filename, false) != 0)
+            return -1;
+
+        number = lookup(filename, &inode);
+        if(number == 0)
+            return -1;
+    }
+
+    if((inode.mode & EXT2_S_IFMT) != EXT2_S_IFREG)
+        return -1;
+
+    uint32_t blocks = (len + this->blockSize - 1) / this->blockSize;
+    truncate(&inode, blocks);
+
+    int result = len;
+    for(uint32_t index = 0; index < blocks;) {
+        uint32_t block = mapBlock(&inode, index, true, dataGoal(number, &inode, index));
+        if(block == 0) {
+            Log(Error, "Ext2: Out of space writing %s", filename);
+            result = -1;
+            break;
+        }
+
+        uint32_t remaining = len - index * this->blockSize;
+        if(remaining < this->blockSize) {
+            memOperator::memset(this->bounceBuffer, 0, this->blockSize);
+            memOperator::memcpy(this->bounceBuffer, buffer + index * this->blockSize, remaining);
+            if(this->disk->writeSectors(this->startLBA + block * this->sectorsPerBlock, this->sectorsPerBlock, this->bounceBuffer) != 0)
+                result = -1;
+            index++;
+            continue;
+        }
+
+        // Blocks are allocated behind each other, so most of the file goes out in long runs
+        uint32_t run = 1;
+        while(index + run < blocks && (index + run + 1) * this->blockSize <= len && (run + 1) * this->sectorsPerBlock <= EXT2_MAX_RUN_SECTORS
+            && mapBlock(&inode, index + run, true, block + run) == block + run)
+            run++;
+
+        if(this->disk->writeSectors(this->startLBA + block * this->sectorsPerBlock, run * this->sectorsPerBlock, buffer + index * this->blockSize) != 0)
+            result = -1;
+        index += run;
+    }
+
+    if(result >= 0)
+        inode.size = len;
+
+    writeInode(number, &inode);
+    if(!commit())
+        result = -1;
+
+    return result;
+}
+
+int ext2::fsync(const char* filename) {
+    return commit() ? 0 : -1;
+}
+
+bool ext2::fileExists(const char* filename) {
+    ext2Inode inode;
+    return lookup(filename, &inode) != 0 && (inode.mode & EXT2_S_IFMT) == EXT2_S_IFREG;
+}
+
+bool ext2::directoryExists(const char* filename) {
+    ext2Inode inode;
+    return lookup(filename, &inode) != 0 && (inode.mode & EXT2_S_IFMT) == EXT2_S_IFDIR;
+}
+
+int ext2::createFile(const char* path) {
+    return createEntry(path, false);
+}
+
+int ext2::createDirectory(const char* path) {
+    return createEntry(path, true);
+}
+
+uint32_t ext2::getFileSize(const char* filename) {
+    ext2Inode inode;
+    if(lookup(filename, &inode) == 0)
+        return -1;
+
+    return inode.size;
+}
+
+uint32_t ext2::fileLocation(const char* path) {
+    ext2Inode inode;
+    if(lookup(path, &inode) == 0)
+        return 0;
+
+    uint32_t block = mapBlock(&inode, 0);
+    return block ? this->startLBA + block * this->sectorsPerBlock : 0;
+}
+
+List<LibC::vfsEntry>* ext2::directoryList(const char* path) {
+    ext2Inode directory;
+    if(lookup(path, &directory) == 0 || (directory.mode & EXT2_S_IFMT) != EXT2_S_IFDIR)
+        return 0;
+
+    List<LibC::vfsEntry>* result = new List<LibC::vfsEntry>();
+    uint32_t blocks = directory.size / this->blockSize;
+    for(uint32_t i = 0; i < blocks; i++) {
+        uint32_t block = mapBlock(&directory, i);
+        uint8_t* data = block ? cachedBlock(block) : 0;
+        if(data == 0)
+            continue;
+
+        // Reading the inodes below goes through the cache, so work on a copy of the block
+        memOperator::memcpy(this->bounceBuffer, data, this->blockSize);
+
+        for(uint32_t offset = 0; offset + 8 <= this->blockSize;) {
+            ext2DirectoryEntry* entry = (ext2DirectoryEntry*)(this->bounceBuffer + offset);
+            if(entry->recordLength < 8)
+                break;
+            offset += entry->recordLength;
+
+            if(entry->inode == 0 || (entry->nameLength <= 2 && entry->name[0] == '.' && (entry->nameLength == 1 || entry->name[1] == '.')))
+                continue;
+
+            ext2Inode inode;
+            if(!readInode(entry->inode, &inode))
+                continue;
+
+            LibC::vfsEntry item;
+            memOperator::memset(&item, 0, sizeof(LibC::vfsEntry));
+            int length = entry->nameLength < VFS_NAME_LENGTH - 1 ? entry->nameLength : VFS_NAME_LENGTH - 1;
+            memOperator::memcpy(item.name, entry->name, length);
+            item.size = inode.size;
+            item.isDir = (inode.mode & EXT2_S_IFMT) == EXT2_S_IFDIR;
+            result->push_back(item);
+        }
+    }
+
+    return result;
+}
+
+int ext2::readDirectory(const char* path, uint32_t* cookie, uint8_t* buffer, uint32_t size) {
+    ext2Inode directory;
+    if(lookup(path, &directory) == 0 || (directory.mode & EXT2_S_IFMT) != EXT2_S_IFDIR)
+        return -1;
+
+    // The cookie is the byte offset of the next entry inside the directory
+    uint32_t used = 0;
+    uint32_t position = *cookie;
+    bool full = false;
+    while(position < directory.size && !full) {
+        uint32_t blockStart = position - (position % this->blockSize);
+        uint32_t block = mapBlock(&directory, position / this->blockSize);
+        uint8_t* data = block ? cachedBlock(block) : 0;
+        if(data == 0) {
+            position = blockStart + this->blockSize;
+            continue;
+        }
+
+        // Reading the inodes below goes through the cache, so work on a copy of the block
+        memOperator::memcpy(this->bounceBuffer, data, this->blockSize);
+
+        uint32_t offset = position - blockStart;
+        while(offset + 8 <= this->blockSize) {
+            ext2DirectoryEntry* entry = (ext2DirectoryEntry*)(this->bounceBuffer + offset);
+            if(entry->recordLength < 8)
+                break;
+
+            uint32_t next = offset + entry->recordLength;
+            ext2Inode inode;
+            if(entry->inode == 0 || (entry->nameLength <= 2 && entry->name[0] == '.' && (entry->nameLength == 1 || entry->name[1] == '.')) || !readInode(entry->inode, &inode)) {
+                offset = next;
+                continue;
+            }
+
+            LibC::vfsDirectoryRecord* record = addDirectoryRecord(buffer, size, &used, entry->name, entry->nameLength);
+            if(record == 0) {
+                full = true;
+                break;
+            }
+
+            record->size = inode.size;
+            record->isDir = (inode.mode & EXT2_S_IFMT) == EXT2_S_IFDIR;
+            record->nextCookie = blockStart + next;
+            offset = next;
+        }
+
+        position = full ? blockStart + offset : blockStart + this->blockSize;
+    }
+
+    *cookie = position;
+    if(used == 0 && full)
+        return VFS_BUFFER_TOO_SMALL;
+    return used;
+}
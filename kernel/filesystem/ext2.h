@@ -0,0 +1,186 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#pragma once
+
+#include "virtualfilesystem.h"
+
+namespace Kernel {
+
+    #define EXT2_MAGIC                  0xEF53
+    #define EXT2_SUPERBLOCK_OFFSET      1024
+    #define EXT2_ROOT_INODE             2
+    #define EXT2_GOOD_OLD_INODE_SIZE    128
+    #define EXT2_GOOD_OLD_FIRST_INODE   11
+    #define EXT2_DIRECT_BLOCKS          12
+    #define EXT2_CACHE_BLOCKS           64
+
+    #define EXT2_S_IFMT                 0xF000
+    #define EXT2_S_IFREG                0x8000
+    #define EXT2_S_IFDIR                0x4000
+
+    #define EXT2_FT_REG_FILE            1
+    #define EXT2_FT_DIR                 2
+
+    #define EXT2_FEATURE_INCOMPAT_FILETYPE      0x0002
+    #define EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER 0x0001
+    #define EXT2_FEATURE_RO_COMPAT_LARGE_FILE   0x0002
+
+    struct ext2SuperBlock {
+        ak::uint32_t inodesCount;
+        ak::uint32_t blocksCount;
+        ak::uint32_t reservedBlocksCount;
+        ak::uint32_t freeBlocksCount;
+        ak::uint32_t freeInodesCount;
+        ak::uint32_t firstDataBlock;
+        ak::uint32_t logBlockSize;
+        ak::uint32_t logFragSize;
+        ak::uint32_t blocksPerGroup;
+        ak::uint32_t fragsPerGroup;
+        ak::uint32_t inodesPerGroup;
+        ak::uint32_t mountTime;
+        ak::uint32_t writeTime;
+        ak::uint16_t mountCount;
+        ak::uint16_t maxMountCount;
+        ak::uint16_t magic;
+        ak::uint16_t state;
+        ak::uint16_t errors;
+        ak::uint16_t minorRevLevel;
+        ak::uint32_t lastCheck;
+        ak::uint32_t checkInterval;
+        ak::uint32_t creatorOS;
+        ak::uint32_t revLevel;
+        ak::uint16_t defResuid;
+        ak::uint16_t defResgid;
+        ak::uint32_t firstInode;
+        ak::uint16_t inodeSize;
+        ak::uint16_t blockGroupNumber;
+        ak::uint32_t featureCompat;
+        ak::uint32_t featureIncompat;
+        ak::uint32_t featureRoCompat;
+        ak::uint8_t  uuid[16];
+        char         volumeName[16];
+        char         lastMounted[64];
+        ak::uint32_t algorithmBitmap;
+        ak::uint8_t  reserved[820];
+    } __attribute__((packed));
+
+    struct ext2GroupDescriptor {
+        ak::uint32_t blockBitmap;
+        ak::uint32_t inodeBitmap;
+        ak::uint32_t inodeTable;
+        ak::uint16_t freeBlocksCount;
+        ak::uint16_t freeInodesCount;
+        ak::uint16_t usedDirsCount;
+        ak::uint16_t pad;
+        ak::uint8_t  reserved[12];
+    } __attribute__((packed));
+
+    struct ext2Inode {
+        ak::uint16_t mode;
+        ak::uint16_t uid;
+        ak::uint32_t size;
+        ak::uint32_t accessTime;
+        ak::uint32_t changeTime;
+        ak::uint32_t modifyTime;
+        ak::uint32_t deleteTime;
+        ak::uint16_t gid;
+        ak::uint16_t linksCount;
+        ak::uint32_t sectors;
+        ak::uint32_t flags;
+        ak::uint32_t osd1;
+        ak::uint32_t block[15];
+        ak::uint32_t generation;
+        ak::uint32_t fileACL;
+        ak::uint32_t sizeHigh;
+        ak::uint32_t fragmentAddress;
+        ak::uint8_t  osd2[12];
+    } __attribute__((packed));
+
+    struct ext2DirectoryEntry {
+        ak::uint32_t inode;
+        ak::uint16_t recordLength;
+        ak::uint8_t  nameLength;
+        ak::uint8_t  fileType;
+        char         name[];
+    } __attribute__((packed));
+
+    /**
+     * @brief filesystem block held in memory, metadata only, file data goes straight to the disk
+     */
+    struct ext2CachedBlock {
+        ak::uint32_t block;
+        ak::uint32_t lastUse;
+        bool valid;
+        bool dirty;
+        ak::uint8_t* data;
+    };
+
+    class ext2 : public virtualFileSystem {
+    private:
+        ext2SuperBlock superBlock;
+        bool superBlockDirty = false;
+        bool readOnly = false;
+
+        ak::uint32_t blockSize = 0;
+        ak::uint32_t sectorsPerBlock = 0;
+        ak::uint32_t pointersPerBlock = 0;
+        ak::uint32_t groupCount = 0;
+        ak::uint32_t inodeSize = EXT2_GOOD_OLD_INODE_SIZE;
+        ak::uint32_t firstInode = EXT2_GOOD_OLD_FIRST_INODE;
+
+        ext2CachedBlock cache[EXT2_CACHE_BLOCKS];
+        ak::uint32_t cacheUseCounter = 0;
+        ak::uint8_t* bounceBuffer = 0;
+
+        ak::uint8_t* cachedBlock(ak::uint32_t block, bool load = true);
+        void markDirty(ak::uint32_t block);
+        void dropCached(ak::uint32_t block);
+        bool writeCachedBlock(ext2CachedBlock* entry);
+        bool commit();
+
+        ext2GroupDescriptor* groupDescriptor(ak::uint32_t group);
+        void markGroupDirty(ak::uint32_t group);
+
+        bool readInode(ak::uint32_t number, ext2Inode* inode);
+        bool writeInode(ak::uint32_t number, ext2Inode* inode);
+
+        ak::uint32_t allocateBlock(ak::uint32_t goal);
+        void freeBlock(ak::uint32_t block);
+        ak::uint32_t allocateInode(ak::uint32_t parent, bool directory);
+        ak::uint32_t allocateZeroedBlock(ext2Inode* inode, ak::uint32_t goal);
+
+        ak::uint32_t mapBlock(ext2Inode* inode, ak::uint32_t index, bool allocate = false, ak::uint32_t goal = 0);
+        ak::uint32_t mapIndirect(ext2Inode* inode, ak::uint32_t table, int depth, ak::uint32_t index, bool allocate, ak::uint32_t goal);
+        bool truncateTree(ext2Inode* inode, ak::uint32_t table, int depth, ak::uint32_t first);
+        void truncate(ext2Inode* inode, ak::uint32_t blocks);
+        ak::uint32_t dataGoal(ak::uint32_t inodeNumber, ext2Inode* inode, ak::uint32_t index);
+
+        ak::uint32_t findInDirectory(ext2Inode* directory, const char* name, int length, ak::uint8_t* fileType = 0);
+        ak::uint32_t lookup(const char* path, ext2Inode* inode, const char** lastName = 0, ak::uint32_t* parent = 0);
+        bool addDirectoryEntry(ak::uint32_t directoryNumber, ext2Inode* directory, const char* name, int length, ak::uint32_t inode, ak::uint8_t fileType);
+        int createEntry(const char* path, bool directory);
+
+    public:
+        ext2(Disk* disk, ak::uint32_t start, ak::uint32_t size);
+        ~ext2();
+
+        bool initialize();
+
+        int readFile(const char* filename, uint8_t* buffer, uint32_t offset = 0, uint32_t len = -1);
+        int writeFile(const char* filename, uint8_t* buffer, uint32_t len, bool create = true);
+        int fsync(const char* filename = 0);
+
+        bool fileExists(const char* filename);
+        bool directoryExists(const char* filename);
+
+        int createFile(const char* path);
+        int createDirectory(const char* path);
+
+        uint32_t getFileSize(const char* filename);
+        List<LibC::vfsEntry>* directoryList(const char* path);
+        int readDirectory(const char* path, ak::uint32_t* cookie, ak::uint8_t* buffer, ak::uint32_t size);
+        ak::uint32_t fileLocation(const char* path);
+    };
+}
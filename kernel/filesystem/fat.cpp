@@ -0,0 +1,1586 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#include "fat.h"
+#include <ak/memoperator.h>
+#include <ak/string.h>
+#include <cpu/idt.h>
+#include <tasking/scheduler.h>
+#include <kernel/system/log.h>
+
+using namespace Kernel::ak;
+using namespace Kernel;
+
+List<fat*> fat::volumes;
+mutexLock fat::volumesLock;
+
+static Thread* flusher = 0;
+static volatile uint32_t pendingFiles = 0;
+
+fat::fat(Disk* disk, uint32_t start, uint32_t size)
+: virtualFileSystem(disk, start, size) {
+    this->Name = "FAT Filesystem";
+}
+
+fat::~fat() {
+    volumesLock.lock();
+    volumes.remove(this);
+    volumesLock.unlock();
+
+    fsync();
+    flushFsInfo();
+
+    if(this->readBuffer)
+        delete[] this->readBuffer;
+    if(this->fatBuffer)
+        delete[] this->fatBuffer;
+    if(this->dirBuffer)
+        delete[] this->dirBuffer;
+    if(this->freeClusterMap)
+        delete[] this->freeClusterMap;
+}
+
+bool fat::initialize() {
+    fat32 bpb;
+    if(this->disk->readSector(this->startLBA, (uint8_t*)&bpb) != 0)
+        return false;
+
+    if(bpb.bytesPerSector == 0 || bpb.sectorsPerCluster == 0 || bpb.numOfFats == 0)
+        return false;
+
+    uint32_t totalSectors = bpb.totalSectorsSmall == 0 ? bpb.totalSectorsBig : bpb.totalSectorsSmall;
+
+    this->bytesPerSector = bpb.bytesPerSector;
+    this->sectorsPerCluster = bpb.sectorsPerCluster;
+    this->clusterSize = this->bytesPerSector * this->sectorsPerCluster;
+    this->numberOfFats = bpb.numOfFats;
+    this->sectorsPerFat = bpb.sectorsPerFat12_16 == 0 ? bpb.sectorsPerFat32 : bpb.sectorsPerFat12_16;
+    this->rootDirSectors = ((bpb.numDirEntries * 32) + (this->bytesPerSector - 1)) / this->bytesPerSector;
+
+    this->firstFatSector = bpb.reservedSectors;
+    this->firstDataSector = bpb.reservedSectors + (this->numberOfFats * this->sectorsPerFat) + this->rootDirSectors;
+    this->totalClusters = (totalSectors - this->firstDataSector) / this->sectorsPerCluster;
+
+    if(this->totalClusters < 4085) {
+        this->FatType = FAT12;
+        this->FatTypeString = "FAT12";
+    }
+    else if(this->totalClusters < 65525) {
+        this->FatType = FAT16;
+        this->FatTypeString = "FAT16";
+    }
+    else {
+        this->FatType = FAT32;
+        this->FatTypeString = "FAT32";
+    }
+
+    this->rootDirCluster = this->FatType == FAT32 ? bpb.rootDirCluster : 0;
+    this->readBuffer = new uint8_t[this->clusterSize];
+    this->fatBuffer = new uint8_t[this->bytesPerSector * 2];
+    this->fatBufferSector = FAT_NO_SECTOR;
+    this->dirBuffer = new uint8_t[this->bytesPerSector];
+
+    if(this->FatType == FAT32) {
+        this->fsInfoSector = bpb.fsInfoSector;
+        if(this->disk->readSector(this->startLBA + this->fsInfoSector, (uint8_t*)&this->fsInfo) != 0)
+            return false;
+
+        if(this->fsInfo.signature1 != FSINFO_SIGNATURE_1 || this->fsInfo.signature2 != FSINFO_SIGNATURE_2) {
+            Log(Warning, "FAT: Invalid FSInfo sector, ignoring allocation hints");
+            this->fsInfo.lastFreeCluster = FSINFO_UNKNOWN;
+            this->fsInfo.startSearchCluster = FSINFO_UNKNOWN;
+        }
+    }
+
+    if(!loadFreeClusterMap())
+        return false;
+
+    volumesLock.lock();
+    volumes.push_back(this);
+    volumesLock.unlock();
+
+    if(flusher == 0)
+        flusher = threadHelper::createFromFunction(flusherThread, true);
+
+    Log(Info, "FAT: %s volume with %d clusters of %d bytes, %d free", this->FatTypeString, this->totalClusters, this->clusterSize, this->freeClusterCount);
+    return true;
+}
+
+fatType fat::formatType(uint32_t size) {
+    // Same split as the Microsoft volume size tables, below 4 MB FAT12 and up to 512 MB FAT16
+    if(size < 8400)
+        return FAT12;
+    if(size <= 1048576)
+        return FAT16;
+    return FAT32;
+}
+
+bool fat::format(Disk* disk, uint32_t start, uint32_t size, const char* label) {
+    if(disk->blockSize != FAT_FORMAT_SECTOR_SIZE || size < 128 || start + size > disk->numBlocks)
+        return false;
+
+    fatType type = formatType(size);
+    uint8_t sectorsPerCluster = 1;
+    if(type == FAT12)
+        while(size / sectorsPerCluster >= 4000)
+            sectorsPerCluster *= 2;
+    else if(type == FAT16)
+        sectorsPerCluster = size <= 32680 ? 2 : (size <= 262144 ? 4 : (size <= 524288 ? 8 : 16));
+    else
+        sectorsPerCluster = size <= 16777216 ? 8 : (size <= 33554432 ? 16 : (size <= 67108864 ? 32 : 64));
+
+    uint32_t reservedSectors = type == FAT32 ? 32 : 1;
+    uint32_t rootSectors = type == FAT32 ? 0 : (FAT_FORMAT_ROOT_ENTRIES * 32) / FAT_FORMAT_SECTOR_SIZE;
+    uint32_t entryBits = type == FAT12 ? 12 : (type == FAT16 ? 16 : 32);
+
+    // Sizing the table for every sector as a cluster overshoots a little, the slack just stays unused
+    uint32_t maxClusters = (size - reservedSectors - rootSectors) / sectorsPerCluster;
+    uint32_t sectorsPerFat = (((maxClusters + 2) * entryBits / 8) + FAT_FORMAT_SECTOR_SIZE - 1) / FAT_FORMAT_SECTOR_SIZE;
+    uint32_t firstDataSector = reservedSectors + 2 * sectorsPerFat + rootSectors;
+    if(firstDataSector >= size)
+        return false;
+
+    // initialize() picks the type from the cluster count, it has to land in the same range
+    uint32_t clusters = (size - firstDataSector) / sectorsPerCluster;
+    if((type == FAT12 && clusters >= 4085) || (type == FAT16 && (clusters < 4085 || clusters >= 65525)) || (type == FAT32 && clusters < 65525))
+        return false;
+
+    uint8_t* buffer = new uint8_t[FAT_FORMAT_CHUNK * FAT_FORMAT_SECTOR_SIZE];
+    memOperator::memset(buffer, 0, FAT_FORMAT_CHUNK * FAT_FORMAT_SECTOR_SIZE);
+
+    // Reserved area, both tables, the root directory and for FAT32 the root cluster all start out zero
+    uint32_t clearSectors = firstDataSector + (type == FAT32 ? sectorsPerCluster : 0);
+    for(uint32_t sector = 0; sector < clearSectors; sector += FAT_FORMAT_CHUNK) {
+        uint32_t count = clearSectors - sector < FAT_FORMAT_CHUNK ? clearSectors - sector : FAT_FORMAT_CHUNK;
+        if(disk->writeSectors(start + sector, count, buffer) != 0) {
+            delete[] buffer;
+            return false;
+        }
+    }
+
+    fat32* bpb = (fat32*)buffer;
+    bpb->bootCode[0] = 0xEB;
+    bpb->bootCode[1] = type == FAT32 ? 0x58 : 0x3C;
+    bpb->bootCode[2] = 0x90;
+    memOperator::memcpy(bpb->oemId, "PRANAOS ", 8);
+    bpb->bytesPerSector = FAT_FORMAT_SECTOR_SIZE;
+    bpb->sectorsPerCluster = sectorsPerCluster;
+    bpb->reservedSectors = reservedSectors;
+    bpb->numOfFats = 2;
+    bpb->numDirEntries = type == FAT32 ? 0 : FAT_FORMAT_ROOT_ENTRIES;
+    bpb->totalSectorsSmall = size < 65536 && type != FAT32 ? size : 0;
+    bpb->mediaDescriptorType = 0xF8;
+    bpb->sectorsPerFat12_16 = type == FAT32 ? 0 : sectorsPerFat;
+    bpb->sectorsPerTrack = 63;
+    bpb->numHeads = 255;
+    bpb->hiddenSectors = start;
+    bpb->totalSectorsBig = bpb->totalSectorsSmall == 0 ? size : 0;
+
+    uint8_t labelField[11];
+    memOperator::memset(labelField, ' ', 11);
+    for(int i = 0; i < 11 && label[i]; i++)
+        labelField[i] = String::uppercase(label[i]);
+    uint32_t serial = scheduler::ticks() ^ (start << 8) ^ size;
+
+    if(type == FAT32) {
+        bpb->sectorsPerFat32 = sectorsPerFat;
+        bpb->rootDirCluster = 2;
+        bpb->fsInfoSector = 1;
+        bpb->backupBootSector = 6;
+        bpb->driveNum = 0x80;
+        bpb->signature = 0x29;
+        bpb->volumeIDSerial = serial;
+        memOperator::memcpy(bpb->volumeLabel, labelField, 11);
+        memOperator::memcpy(bpb->systemIDString, "FAT32   ", 8);
+    }
+    else {
+        // FAT12 and FAT16 keep their extended boot record right after the common fields, at offset 36
+        buffer[36] = 0x80;
+        buffer[38] = 0x29;
+        memOperator::memcpy(buffer + 39, &serial, 4);
+        memOperator::memcpy(buffer + 43, labelField, 11);
+        memOperator::memcpy(buffer + 54, type == FAT12 ? "FAT12   " : "FAT16   ", 8);
+    }
+    bpb->bootSignature = 0xAA55;
+
+    bool success = disk->writeSector(start, buffer) == 0;
+    if(type == FAT32) {
+        fat32Info* info = (fat32Info*)(buffer + FAT_FORMAT_SECTOR_SIZE);
+        info->signature1 = FSINFO_SIGNATURE_1;
+        info->signature2 = FSINFO_SIGNATURE_2;
+        info->lastFreeCluster = clusters - 1;
+        info->startSearchCluster = 3;
+        info->signature3 = 0xAA550000;
+
+        success = success && disk->writeSector(start + 1, (uint8_t*)info) == 0;
+        success = success && disk->writeSectors(start + 6, 2, buffer) == 0;
+    }
+
+    // First sector of each table, the media byte, the end of chain marker and for FAT32 the root directory chain
+    memOperator::memset(buffer, 0, 2 * FAT_FORMAT_SECTOR_SIZE);
+    if(type == FAT12) {
+        buffer[0] = 0xF8; buffer[1] = 0xFF; buffer[2] = 0xFF;
+    }
+    else if(type == FAT16) {
+        buffer[0] = 0xF8; buffer[1] = 0xFF; buffer[2] = 0xFF; buffer[3] = 0xFF;
+    }
+    else {
+        uint32_t* entries = (uint32_t*)buffer;
+        entries[0] = 0x0FFFFFF8;
+        entries[1] = 0x0FFFFFFF;
+        entries[2] = 0x0FFFFFFF;
+    }
+
+    for(int i = 0; i < 2; i++)
+        success = success && disk->writeSector(start + reservedSectors + i * sectorsPerFat, buffer) == 0;
+
+    delete[] buffer;
+    if(success)
+        Log(Info, "FAT: Formatted %d sectors at %d as %s", size, start, type == FAT12 ? "FAT12" : (type == FAT16 ? "FAT16" : "FAT32"));
+    return success;
+}
+
+uint32_t fat::clusterToSector(uint32_t cluster) {
+    return ((cluster - 2) * this->sectorsPerCluster) + this->firstDataSector;
+}
+
+bool fat::loadFatSector(uint32_t sector) {
+    if(this->fatBufferSector == sector)
+        return true;
+
+    if(!flushFatSector())
+        return false;
+
+    // A FAT12 entry at the last byte of a sector ends in the next one, only there the buffer holds both
+    this->fatBufferSector = FAT_NO_SECTOR;
+    if(this->disk->readSector(this->startLBA + sector, this->fatBuffer) != 0)
+        return false;
+    if(this->FatType == FAT12 && this->disk->readSector(this->startLBA + sector + 1, this->fatBuffer + this->bytesPerSector) != 0)
+        return false;
+
+    this->fatBufferSector = sector;
+    return true;
+}
+
+bool fat::flushFatSector() {
+    if(this->fatBufferDirty == 0)
+        return true;
+
+    // Every copy of the FAT gets the sector, the second one only if a straddling FAT12 entry changed it
+    for(int i = 0; i < this->numberOfFats; i++) {
+        uint32_t lba = this->startLBA + this->fatBufferSector + (i * this->sectorsPerFat);
+        if((this->fatBufferDirty & 1) && this->disk->writeSector(lba, this->fatBuffer) != 0)
+            return false;
+        if((this->fatBufferDirty & 2) && this->disk->writeSector(lba + 1, this->fatBuffer + this->bytesPerSector) != 0)
+            return false;
+    }
+
+    this->fatBufferDirty = 0;
+    return true;
+}
+
+uint32_t fat::readTable(uint32_t cluster) {
+    uint32_t offset = 0;
+    if(this->FatType == FAT32)
+        offset = cluster * 4;
+    else if(this->FatType == FAT16)
+        offset = cluster * 2;
+    else
+        offset = cluster + (cluster / 2);
+
+    uint32_t sector = this->firstFatSector + (offset / this->bytesPerSector);
+    uint32_t entryOffset = offset % this->bytesPerSector;
+
+    if(!loadFatSector(sector))
+        return CLUSTER_BAD;
+
+    if(this->FatType == FAT32)
+        return *(uint32_t*)(this->fatBuffer + entryOffset) & 0x0FFFFFFF;
+    if(this->FatType == FAT16)
+        return *(uint16_t*)(this->fatBuffer + entryOffset);
+
+    uint16_t value = *(uint16_t*)(this->fatBuffer + entryOffset);
+    return (cluster & 1) ? (value >> 4) : (value & 0x0FFF);
+}
+
+void fat::writeTable(uint32_t cluster, uint32_t value) {
+    uint32_t offset = 0;
+    if(this->FatType == FAT32)
+        offset = cluster * 4;
+    else if(this->FatType == FAT16)
+        offset = cluster * 2;
+    else
+        offset = cluster + (cluster / 2);
+
+    uint32_t sector = this->firstFatSector + (offset / this->bytesPerSector);
+    uint32_t entryOffset = offset % this->bytesPerSector;
+
+    if(!loadFatSector(sector))
+        return;
+
+    if(this->FatType == FAT32) {
+        uint32_t* entry = (uint32_t*)(this->fatBuffer + entryOffset);
+        *entry = (*entry & 0xF0000000) | (value & 0x0FFFFFFF);
+    }
+    else if(this->FatType == FAT16) {
+        *(uint16_t*)(this->fatBuffer + entryOffset) = value;
+    }
+    else {
+        uint16_t* entry = (uint16_t*)(this->fatBuffer + entryOffset);
+        if(cluster & 1)
+            *entry = (*entry & 0x000F) | (value << 4);
+        else
+            *entry = (*entry & 0xF000) | (value & 0x0FFF);
+    }
+
+    // Written out when another FAT sector is needed or the chain is complete
+    this->fatBufferDirty |= 1;
+    if(this->FatType == FAT12 && entryOffset == (uint32_t)(this->bytesPerSector - 1))
+        this->fatBufferDirty |= 2;
+}
+
+void fat::markCluster(uint32_t cluster, bool used) {
+    bool wasUsed = this->freeClusterMap[cluster / 32] & (1 << (cluster % 32));
+    if(used == wasUsed)
+        return;
+
+    if(used) {
+        this->freeClusterMap[cluster / 32] |= (1 << (cluster % 32));
+        this->freeClusterCount--;
+    }
+    else {
+        this->freeClusterMap[cluster / 32] &= ~(1 << (cluster % 32));
+        this->freeClusterCount++;
+    }
+}
+
+bool fat::loadFreeClusterMap() {
+    uint32_t words = (this->totalClusters + 2 + 31) / 32;
+    this->freeClusterMap = new uint32_t[words];
+    memOperator::memset(this->freeClusterMap, 0, words * sizeof(uint32_t));
+
+    // Cluster 0 and 1 are reserved, as are the bits past the end of the volume
+    this->freeClusterMap[0] |= 0x3;
+    for(uint32_t c = this->totalClusters + 2; c < words * 32; c++)
+        this->freeClusterMap[c / 32] |= (1 << (c % 32));
+
+    // readTable walks the FAT in order, so this is one disk read per FAT sector
+    this->freeClusterCount = 0;
+    for(uint32_t c = 2; c < this->totalClusters + 2; c++) {
+        if(readTable(c) == CLUSTER_FREE)
+            this->freeClusterCount++;
+        else
+            this->freeClusterMap[c / 32] |= (1 << (c % 32));
+    }
+
+    this->nextFreeCluster = 2;
+    if(this->FatType == FAT32) {
+        uint32_t hint = this->fsInfo.startSearchCluster;
+        if(hint >= 2 && hint < this->totalClusters + 2)
+            this->nextFreeCluster = hint;
+
+        if(this->fsInfo.lastFreeCluster != this->freeClusterCount) {
+            this->fsInfo.lastFreeCluster = this->freeClusterCount;
+            this->fsInfoDirty = true;
+        }
+    }
+
+    return true;
+}
+
+uint32_t fat::findFreeRun(uint32_t wanted, uint32_t* runLength) {
+    uint32_t end = this->totalClusters + 2;
+    uint32_t cluster = this->nextFreeCluster;
+    uint32_t scanned = 0;
+    uint32_t best = 0;
+    uint32_t bestLength = 0;
+
+    while(scanned < this->totalClusters) {
+        if(cluster >= end)
+            cluster = 2;
+
+        // Skip full words at once, this is what keeps allocation fast on a nearly full volume
+        if((cluster % 32) == 0 && this->freeClusterMap[cluster / 32] == 0xFFFFFFFF) {
+            cluster += 32;
+            scanned += 32;
+            continue;
+        }
+
+        if(this->freeClusterMap[cluster / 32] & (1 << (cluster % 32))) {
+            cluster++;
+            scanned++;
+            continue;
+        }
+
+        uint32_t start = cluster;
+        uint32_t length = 0;
+        while(cluster < end && length < wanted && !(this->freeClusterMap[cluster / 32] & (1 << (cluster % 32)))) {
+            cluster++;
+            length++;
+        }
+        scanned += length;
+
+        if(length >= wanted) {
+            *runLength = length;
+            return start;
+        }
+
+        if(length > bestLength) {
+            best = start;
+            bestLength = length;
+        }
+    }
+
+    *runLength = bestLength;
+    return best;
+}
+
+uint32_t fat::allocateCluster() {
+    return allocateClusterChain(1);
+}
+
+uint32_t fat::allocateClusterChain(uint32_t count, uint32_t previousCluster) {
+    if(count == 0 || this->freeClusterMap == 0 || this->freeClusterCount < count)
+        return 0;
+
+    uint32_t first = 0;
+    uint32_t remaining = count;
+
+    while(remaining > 0) {
+        uint32_t length = 0;
+        uint32_t start = findFreeRun(remaining, &length);
+        if(length == 0)
+            break;
+
+        for(uint32_t i = 0; i < length; i++) {
+            uint32_t cluster = start + i;
+            markCluster(cluster, true);
+            writeTable(cluster, i + 1 < length ? cluster + 1 : CLUSTER_END);
+        }
+
+        if(previousCluster != 0)
+            writeTable(previousCluster, start);
+        if(first == 0)
+            first = start;
+
+        previousCluster = start + length - 1;
+        remaining -= length;
+        this->nextFreeCluster = start + length;
+    }
+
+    if(this->FatType == FAT32) {
+        this->fsInfo.lastFreeCluster = this->freeClusterCount;
+        this->fsInfo.startSearchCluster = this->nextFreeCluster;
+        this->fsInfoDirty = true;
+
+        this->allocationsSinceFlush += count - remaining;
+        if(this->allocationsSinceFlush >= FSINFO_FLUSH_INTERVAL)
+            flushFsInfo();
+    }
+
+    if(!flushFatSector())
+        return 0;
+
+    return remaining == 0 ? first : 0;
+}
+
+bool fat::freeClusterChain(uint32_t cluster) {
+    // The cached directory sector may belong to the chain and get reused for file data
+    this->dirBufferSector = FAT_NO_SECTOR;
+
+    while(cluster >= 2 && cluster < this->totalClusters + 2) {
+        uint32_t next = readTable(cluster);
+        writeTable(cluster, CLUSTER_FREE);
+        markCluster(cluster, false);
+
+        if(cluster < this->nextFreeCluster)
+            this->nextFreeCluster = cluster;
+
+        cluster = next;
+    }
+
+    if(this->FatType == FAT32) {
+        this->fsInfo.lastFreeCluster = this->freeClusterCount;
+        this->fsInfo.startSearchCluster = this->nextFreeCluster;
+        this->fsInfoDirty = true;
+    }
+
+    return flushFatSector();
+}
+
+bool fat::flushFsInfo() {
+    if(this->FatType != FAT32 || !this->fsInfoDirty)
+        return true;
+
+    if(this->disk->writeSector(this->startLBA + this->fsInfoSector, (uint8_t*)&this->fsInfo) != 0)
+        return false;
+
+    this->fsInfoDirty = false;
+    this->allocationsSinceFlush = 0;
+    return true;
+}
+
+void fat::clearCluster(uint32_t cluster) {
+    memOperator::memset(this->readBuffer, 0, this->bytesPerSector);
+
+    uint32_t sector = clusterToSector(cluster);
+    if(this->dirBufferSector >= sector && this->dirBufferSector < sector + this->sectorsPerCluster)
+        this->dirBufferSector = FAT_NO_SECTOR;
+
+    for(uint16_t i = 0; i < this->sectorsPerCluster; i++)
+        this->disk->writeSector(this->startLBA + sector + i, this->readBuffer);
+}
+
+bool fat::openCursor(uint32_t dirCluster, bool rootDirectory, uint32_t startIndex, fatDirectoryCursor* cursor) {
+    uint32_t entriesPerSector = this->bytesPerSector / sizeof(directoryEntry);
+    uint32_t sectorIndex = startIndex / entriesPerSector;
+
+    cursor->index = startIndex;
+    cursor->entryInSector = startIndex % entriesPerSector;
+    cursor->rootDirectory = rootDirectory && this->FatType != FAT32;
+
+    // The FAT12/16 root directory is a fixed region right in front of the data area
+    if(cursor->rootDirectory) {
+        if(sectorIndex >= this->rootDirSectors)
+            return false;
+
+        cursor->cluster = 0;
+        cursor->sectorInCluster = sectorIndex;
+        cursor->sector = this->firstDataSector - this->rootDirSectors + sectorIndex;
+        return true;
+    }
+
+    uint32_t cluster = rootDirectory ? this->rootDirCluster : dirCluster;
+    for(uint32_t i = 0; i < sectorIndex / this->sectorsPerCluster && cluster >= 2 && cluster < this->totalClusters + 2; i++)
+        cluster = readTable(cluster);
+
+    if(cluster < 2 || cluster >= this->totalClusters + 2)
+        return false;
+
+    cursor->cluster = cluster;
+    cursor->sectorInCluster = sectorIndex % this->sectorsPerCluster;
+    cursor->sector = clusterToSector(cluster) + cursor->sectorInCluster;
+    return true;
+}
+
+directoryEntry* fat::nextEntry(fatDirectoryCursor* cursor) {
+    uint32_t entriesPerSector = this->bytesPerSector / sizeof(directoryEntry);
+
+    if(!cursor->rootDirectory && cursor->cluster == 0)
+        return 0;
+
+    if(cursor->entryInSector >= entriesPerSector) {
+        cursor->entryInSector = 0;
+        cursor->sectorInCluster++;
+        cursor->sector++;
+
+        if(cursor->rootDirectory) {
+            if(cursor->sectorInCluster >= this->rootDirSectors)
+                return 0;
+        }
+        else if(cursor->sectorInCluster >= this->sectorsPerCluster) {
+            uint32_t next = readTable(cursor->cluster);
+            if(next < 2 || next >= this->totalClusters + 2) {
+                cursor->cluster = 0;
+                return 0;
+            }
+
+            cursor->cluster = next;
+            cursor->sectorInCluster = 0;
+            cursor->sector = clusterToSector(next);
+        }
+    }
+
+    if(this->dirBufferSector != cursor->sector) {
+        if(this->disk->readSector(this->startLBA + cursor->sector, this->dirBuffer) != 0) {
+            this->dirBufferSector = FAT_NO_SECTOR;
+            return 0;
+        }
+        this->dirBufferSector = cursor->sector;
+    }
+
+    directoryEntry* entry = (directoryEntry*)this->dirBuffer + cursor->entryInSector;
+    cursor->entryInSector++;
+    cursor->index++;
+    return entry;
+}
+
+uint8_t fat::checksum(char* filename) {
+    uint8_t sum = 0;
+    for(int i = 0; i < 11; i++)
+        sum = ((sum & 1) << 7) + (sum >> 1) + (uint8_t)filename[i];
+
+    return sum;
+}
+
+// Copy the 13 UCS-2 characters of one LFN entry, anything outside ASCII becomes '?'
+static void copyLFNCharacters(lfnEntry* lfn, char* target) {
+    uint8_t* parts[3] = { lfn->namePart1, lfn->namePart2, lfn->namePart3 };
+    int lengths[3] = { 5, 6, 2 };
+
+    int pos = 0;
+    for(int p = 0; p < 3; p++)
+        for(int i = 0; i < lengths[p]; i++) {
+            uint16_t c = parts[p][i * 2] | (parts[p][i * 2 + 1] << 8);
+            if(c == 0x0000 || c == 0xFFFF)
+                target[pos++] = '\0';
+            else
+                target[pos++] = c > 0x7F ? '?' : (char)c;
+        }
+}
+
+// Turn "NAME    EXT" into "name.ext" in place, the reserved byte says which half was lowercase
+static int buildShortName(directoryEntry* entry, char* target) {
+    int length = 0;
+    for(int i = 0; i < 8 && entry->fileName[i] != ' '; i++) {
+        char c = (i == 0 && entry->fileName[0] == ENTRY_KANJI_E5) ? (char)ENTRY_UNUSED : entry->fileName[i];
+        target[length++] = (entry->reserved & SFN_LOWER_BASE) && c >= 'A' && c <= 'Z' ? c + 32 : c;
+    }
+
+    if(entry->fileName[8] != ' ') {
+        target[length++] = '.';
+        for(int i = 8; i < 11 && entry->fileName[i] != ' '; i++) {
+            char c = entry->fileName[i];
+            target[length++] = (entry->reserved & SFN_LOWER_EXT) && c >= 'A' && c <= 'Z' ? c + 32 : c;
+        }
+    }
+
+    target[length] = '\0';
+    return length;
+}
+
+template<typename T>
+static void setCreationTime(T* target, directoryEntry* entry) {
+    target->creationTime.hour = entry->creationTime >> 11;
+    target->creationTime.min = (entry->creationTime >> 5) & 0x3F;
+    target->creationTime.sec = (entry->creationTime & 0x1F) * 2;
+    target->creationDate.year = 1980 + (entry->creationDate >> 9);
+    target->creationDate.month = (entry->creationDate >> 5) & 0x0F;
+    target->creationDate.day = entry->creationDate & 0x1F;
+}
+
+static bool namesEqual(const char* a, int aLength, const char* b, int bLength) {
+    if(aLength != bLength)
+        return false;
+
+    for(int i = 0; i < aLength; i++)
+        if(String::uppercase(a[i]) != String::uppercase(b[i]))
+            return false;
+
+    return true;
+}
+
+// Fill one LFN entry with its part of the name, order counts from 1 at the start of the name
+static void fillLFNEntry(lfnEntry* lfn, const char* name, int length, int order, int count, uint8_t checksum) {
+    memOperator::memset(lfn, 0, sizeof(lfnEntry));
+    lfn->entryIndex = order | (order == count ? LFN_ENTRY_END : 0);
+    lfn->Attributes = ATTR_LONG_NAME;
+    lfn->checksum = checksum;
+
+    uint8_t* parts[3] = { lfn->namePart1, lfn->namePart2, lfn->namePart3 };
+    int lengths[3] = { 5, 6, 2 };
+    int pos = (order - 1) * LFN_CHARS;
+    for(int p = 0; p < 3; p++)
+        for(int i = 0; i < lengths[p]; i++, pos++) {
+            uint16_t c = pos < length ? (uint8_t)name[pos] : (pos == length ? 0x0000 : 0xFFFF);
+            parts[p][i * 2] = c & 0xFF;
+            parts[p][i * 2 + 1] = c >> 8;
+        }
+}
+
+// Put numeric tail n on the short name created from base, "~10" and up eat into the base name
+static void applyNumericTail(char* shortName, const char* baseName, int tildePos, int n) {
+    memOperator::memcpy(shortName, baseName, 11);
+
+    char tail[8];
+    int digits = 0;
+    for(int v = n; v > 0; v /= 10)
+        tail[digits++] = '0' + v % 10;
+
+    int start = tildePos + digits + 1 > 8 ? 7 - digits : tildePos;
+    shortName[start] = '~';
+    for(int i = 0; i < digits; i++)
+        shortName[start + 1 + i] = tail[digits - 1 - i];
+}
+
+// Number behind the '~' in the base of a short name, 0 when it has none
+static int numericTail(uint8_t* fileName) {
+    int n = 0;
+    bool tilde = false;
+    for(int i = 0; i < 8 && fileName[i] != ' '; i++) {
+        if(fileName[i] == '~')
+            tilde = true;
+        else if(tilde && fileName[i] >= '0' && fileName[i] <= '9')
+            n = n * 10 + fileName[i] - '0';
+        else if(tilde)
+            return 0;
+    }
+
+    return n;
+}
+
+void fat::seekCursor(uint32_t cluster, uint32_t sector, uint32_t sectorOffset, bool rootDirectory, fatDirectoryCursor* cursor) {
+    cursor->rootDirectory = rootDirectory && this->FatType != FAT32;
+    cursor->cluster = cluster;
+    cursor->sector = sector;
+    cursor->sectorInCluster = cursor->rootDirectory ? sector - (this->firstDataSector - this->rootDirSectors) : sector - clusterToSector(cluster);
+    cursor->entryInSector = sectorOffset / sizeof(directoryEntry);
+    cursor->index = 0;
+}
+
+bool fat::writeCurrentSector() {
+    return this->disk->writeSector(this->startLBA + this->dirBufferSector, this->dirBuffer) == 0;
+}
+
+directoryEntry* fat::nextNamedEntry(fatDirectoryCursor* cursor, char* name, int* nameLength, uint32_t* firstIndex) {
+    bool lfnValid = false;
+    uint8_t lfnChecksum = 0;
+    uint32_t lfnExpected = 0;
+    uint32_t lfnStart = 0;
+
+    while(true) {
+        uint32_t entryIndex = cursor->index;
+        directoryEntry* entry = nextEntry(cursor);
+        if(entry == 0)
+            return 0;
+
+        if(entry->fileName[0] == ENTRY_END) {
+            // Leave the cursor on the end marker, entries added later are found from there
+            cursor->entryInSector--;
+            cursor->index--;
+            return 0;
+        }
+
+        if(entry->fileName[0] == ENTRY_UNUSED) {
+            lfnValid = false;
+            continue;
+        }
+
+        // The parts come last part first, each one is decoded straight to its place in the name
+        if((entry->attributes & ATTR_LONG_NAME) == ATTR_LONG_NAME) {
+            lfnEntry* lfn = (lfnEntry*)entry;
+            uint32_t order = lfn->entryIndex & LFN_ORDER_MASK;
+
+            if(lfn->entryIndex & LFN_ENTRY_END) {
+                lfnValid = order > 0 && order <= LFN_MAX_ENTRIES;
+                lfnChecksum = lfn->checksum;
+                lfnStart = entryIndex;
+                if(lfnValid)
+                    name[order * LFN_CHARS] = '\0';
+            }
+            else if(!lfnValid || order != lfnExpected || lfn->checksum != lfnChecksum) {
+                lfnValid = false;
+            }
+
+            if(lfnValid) {
+                copyLFNCharacters(lfn, name + (order - 1) * LFN_CHARS);
+                lfnExpected = order - 1;
+            }
+            continue;
+        }
+
+        if(entry->attributes & ATTR_VOLUME_ID) {
+            lfnValid = false;
+            continue;
+        }
+
+        if(lfnValid && lfnExpected == 0 && checksum((char*)entry->fileName) == lfnChecksum) {
+            *nameLength = String::strlen(name);
+            if(firstIndex)
+                *firstIndex = lfnStart;
+        }
+        else {
+            *nameLength = buildShortName(entry, name);
+            if(firstIndex)
+                *firstIndex = entryIndex;
+        }
+
+        return entry;
+    }
+}
+
+bool fat::seachInDirectory(const char* name, int length, uint32_t dirCluster, bool rootDirectory, fatEntryInfo* result) {
+    fatDirectoryCursor cursor;
+    if(!openCursor(dirCluster, rootDirectory, 0, &cursor))
+        return false;
+
+    char entryName[FAT_NAME_BUFFER];
+    int entryLength = 0;
+    directoryEntry* entry = 0;
+    while((entry = nextNamedEntry(&cursor, entryName, &entryLength)) != 0) {
+        if(!namesEqual(entryName, entryLength, name, length))
+            continue;
+
+        result->entry = *entry;
+        result->sector = cursor.sector;
+        result->offsetInSector = (cursor.entryInSector - 1) * sizeof(directoryEntry);
+        return true;
+    }
+
+    return false;
+}
+
+bool fat::shortNameExists(uint32_t dirCluster, bool rootDirectory, const char* shortName) {
+    fatDirectoryCursor cursor;
+    if(!openCursor(dirCluster, rootDirectory, 0, &cursor))
+        return false;
+
+    directoryEntry* entry = 0;
+    while((entry = nextEntry(&cursor)) != 0 && entry->fileName[0] != ENTRY_END)
+        if((entry->attributes & ATTR_LONG_NAME) != ATTR_LONG_NAME && memOperator::memcmp(entry->fileName, shortName, 11) == 0)
+            return true;
+
+    return false;
+}
+
+bool fat::getEntryByPath(const char* path, fatEntryInfo* result, int length) {
+    const char* end = path + (length < 0 ? String::strlen(path) : length);
+    while(path < end && *path == PATH_SEPERATOR_C)
+        path++;
+    if(path == end)
+        return false;
+
+    uint32_t dirCluster = this->rootDirCluster;
+    bool rootDirectory = true;
+
+    while(true) {
+        const char* component = path;
+        while(path < end && *path != PATH_SEPERATOR_C)
+            path++;
+        int componentLength = path - component;
+        while(path < end && *path == PATH_SEPERATOR_C)
+            path++;
+
+        if(!seachInDirectory(component, componentLength, dirCluster, rootDirectory, result))
+            return false;
+        if(path == end)
+            return true;
+
+        if(!(result->entry.attributes & ATTR_DIRECTORY))
+            return false;
+
+        dirCluster = GET_CLUSTER(result->entry);
+        rootDirectory = dirCluster == 0;
+        if(rootDirectory)
+            dirCluster = this->rootDirCluster;
+    }
+}
+
+void fat::createShortFilename(const char* name, char* result) {
+    memOperator::memset(result, ' ', 11);
+    result[11] = '\0';
+
+    while(*name == '.' || *name == ' ')
+        name++;
+
+    int length = String::strlen(name);
+    int dot = -1;
+    for(int i = 0; i < length; i++)
+        if(name[i] == '.')
+            dot = i;
+
+    int baseLength = dot == -1 ? length : dot;
+    int extLength = dot == -1 ? 0 : length - dot - 1;
+    bool lossy = baseLength > 8 || extLength > 3;
+
+    int out = 0;
+    for(int i = 0; i < baseLength && out < 8; i++) {
+        char c = String::uppercase(name[i]);
+        if(c == ' ' || c == '.') {
+            lossy = true;
+            continue;
+        }
+        if(String::contains("\"*+,/:;<=>?[\\]|", c)) {
+            c = '_';
+            lossy = true;
+        }
+        result[out++] = c;
+    }
+
+    for(int i = 0; i < extLength && i < 3; i++) {
+        char c = String::uppercase(name[dot + 1 + i]);
+        result[8 + i] = String::contains("\"*+,/:;<=>?[\\]| ", c) ? '_' : c;
+    }
+
+    // Names that do not fit get a numeric tail, createEntry bumps it when it collides
+    if(lossy) {
+        int tail = out > 6 ? 6 : out;
+        result[tail] = '~';
+        result[tail + 1] = '1';
+        for(int i = tail + 2; i < 8; i++)
+            result[i] = ' ';
+    }
+}
+
+bool fat::findEntryStartpoint(uint32_t cluster, uint32_t entryCount, bool rootdir, uint32_t* targetCluster, uint32_t* targetSector, uint32_t* sectorOffset) {
+    fatDirectoryCursor cursor;
+    if(!openCursor(cluster, rootdir, 0, &cursor))
+        return false;
+
+    uint32_t run = 0;
+    uint32_t lastCluster = cursor.cluster;
+    directoryEntry* entry = 0;
+    while((entry = nextEntry(&cursor)) != 0) {
+        if(cursor.cluster != 0)
+            lastCluster = cursor.cluster;
+
+        if(entry->fileName[0] != ENTRY_END && entry->fileName[0] != ENTRY_UNUSED) {
+            run = 0;
+            continue;
+        }
+
+        if(run++ == 0) {
+            *targetCluster = cursor.cluster;
+            *targetSector = cursor.sector;
+            *sectorOffset = (cursor.entryInSector - 1) * sizeof(directoryEntry);
+        }
+
+        if(run == entryCount)
+            return true;
+    }
+
+    // The FAT12/16 root directory cannot grow
+    if(cursor.rootDirectory)
+        return false;
+
+    uint32_t newCluster = allocateClusterChain(1, lastCluster);
+    if(newCluster == 0)
+        return false;
+    clearCluster(newCluster);
+
+    if(run == 0) {
+        *targetCluster = newCluster;
+        *targetSector = clusterToSector(newCluster);
+        *sectorOffset = 0;
+    }
+
+    return run + (this->clusterSize / sizeof(directoryEntry)) >= entryCount;
+}
+
+bool fat::writeLongFilenameEntries(const char* name, int count, uint8_t checksum, uint32_t targetCluster, uint32_t targetSector, uint32_t sectorOffset, bool rootDirectory) {
+    fatDirectoryCursor cursor;
+    seekCursor(targetCluster, targetSector, sectorOffset, rootDirectory, &cursor);
+
+    int length = String::strlen(name);
+    uint32_t entriesPerSector = this->bytesPerSector / sizeof(directoryEntry);
+    for(int i = 0; i < count; i++) {
+        // Write the sector back before the cursor loads the next one over it
+        if(i > 0 && cursor.entryInSector >= entriesPerSector && !writeCurrentSector())
+            return false;
+
+        directoryEntry* slot = nextEntry(&cursor);
+        if(slot == 0)
+            return false;
+
+        // On disk the entries are stored last part first
+        fillLFNEntry((lfnEntry*)slot, name, length, count - i, count, checksum);
+    }
+
+    return writeCurrentSector();
+}
+
+bool fat::writeDirectoryEntry(directoryEntry entry, uint32_t targetSector, uint32_t sectorOffset, bool rootDirectory) {
+    if(this->dirBufferSector != targetSector) {
+        if(this->disk->readSector(this->startLBA + targetSector, this->dirBuffer) != 0) {
+            this->dirBufferSector = FAT_NO_SECTOR;
+            return false;
+        }
+        this->dirBufferSector = targetSector;
+    }
+
+    memOperator::memcpy(this->dirBuffer + sectorOffset, &entry, sizeof(directoryEntry));
+    return writeCurrentSector();
+}
+
+bool fat::createEntry(uint32_t parentCluster, const char* name, uint8_t attr, bool rootdir, uint32_t targetCluster, directoryEntry* entry) {
+    char baseName[12];
+    createShortFilename(name, baseName);
+
+    char shortName[12];
+    memOperator::memcpy(shortName, baseName, sizeof(shortName));
+
+    int tildePos = -1;
+    for(int i = 0; i < 8; i++)
+        if(baseName[i] == '~')
+            tildePos = i;
+
+    // One walk marks which of the low tails are taken, only a crowded directory needs a walk per candidate after that
+    if(tildePos != -1) {
+        uint8_t taken[FAT_TAIL_CANDIDATES / 8];
+        memOperator::memset(taken, 0, sizeof(taken));
+
+        fatDirectoryCursor cursor;
+        directoryEntry* existing = 0;
+        if(openCursor(parentCluster, rootdir, 0, &cursor))
+            while((existing = nextEntry(&cursor)) != 0 && existing->fileName[0] != ENTRY_END) {
+                if((existing->attributes & ATTR_LONG_NAME) == ATTR_LONG_NAME)
+                    continue;
+
+                int n = numericTail(existing->fileName);
+                if(n <= 0 || n >= FAT_TAIL_CANDIDATES)
+                    continue;
+
+                applyNumericTail(shortName, baseName, tildePos, n);
+                if(memOperator::memcmp(existing->fileName, shortName, 11) == 0)
+                    taken[n / 8] |= 1 << (n % 8);
+            }
+
+        int n = 1;
+        while(n < FAT_TAIL_CANDIDATES && (taken[n / 8] & (1 << (n % 8))))
+            n++;
+
+        applyNumericTail(shortName, baseName, tildePos, n);
+        while(n >= FAT_TAIL_CANDIDATES && n < 999999 && shortNameExists(parentCluster, rootdir, shortName))
+            applyNumericTail(shortName, baseName, tildePos, ++n);
+    }
+
+    memOperator::memset(entry, 0, sizeof(directoryEntry));
+    memOperator::memcpy(entry->fileName, shortName, 11);
+    entry->attributes = attr;
+    entry->creationTime = entry->modifyTime = fatTime();
+    entry->creationDate = entry->modifyDate = entry->accessDate = fatDate();
+    entry->lowFirstCluster = targetCluster & 0xFFFF;
+    entry->highFirstCluster = targetCluster >> 16;
+
+    // A long name is only needed when the short name does not round trip
+    char rendered[13];
+    buildShortName(entry, rendered);
+    int lfnCount = String::strcmp(rendered, name) ? 0 : (String::strlen(name) + LFN_CHARS - 1) / LFN_CHARS;
+
+    uint32_t cluster = 0, sector = 0, offset = 0;
+    if(lfnCount > LFN_MAX_ENTRIES || !findEntryStartpoint(parentCluster, lfnCount + 1, rootdir, &cluster, &sector, &offset))
+        return false;
+
+    if(lfnCount > 0 && !writeLongFilenameEntries(name, lfnCount, checksum((char*)entry->fileName), cluster, sector, offset, rootdir))
+        return false;
+
+    // The short entry follows right behind the long name parts
+    fatDirectoryCursor cursor;
+    seekCursor(cluster, sector, offset, rootdir, &cursor);
+
+    directoryEntry* slot = 0;
+    for(int i = 0; i <= lfnCount; i++)
+        slot = nextEntry(&cursor);
+
+    if(slot == 0)
+        return false;
+
+    memOperator::memcpy(slot, entry, sizeof(directoryEntry));
+    return writeCurrentSector();
+}
+
+int fat::createNewDirFileEntry(const char* path, uint8_t attributes) {
+    while(*path == PATH_SEPERATOR_C)
+        path++;
+
+    int length = String::strlen(path);
+    int split = -1;
+    for(int i = 0; i < length; i++)
+        if(path[i] == PATH_SEPERATOR_C)
+            split = i;
+
+    const char* name = path + split + 1;
+    if(*name == '\0' || String::strlen(name) >= VFS_NAME_LENGTH)
+        return -1;
+
+    uint32_t parentCluster = this->rootDirCluster;
+    bool rootdir = true;
+    if(split != -1) {
+        fatEntryInfo parent;
+        if(!getEntryByPath(path, &parent, split) || !(parent.entry.attributes & ATTR_DIRECTORY))
+            return -1;
+
+        uint32_t cluster = GET_CLUSTER(parent.entry);
+        if(cluster != 0) {
+            parentCluster = cluster;
+            rootdir = false;
+        }
+    }
+
+    fatEntryInfo existing;
+    if(seachInDirectory(name, String::strlen(name), parentCluster, rootdir, &existing))
+        return -1;
+
+    // Directories get their own cluster holding the "." and ".." entries
+    uint32_t targetCluster = 0;
+    if(attributes & ATTR_DIRECTORY) {
+        targetCluster = allocateCluster();
+        if(targetCluster == 0)
+            return -1;
+        clearCluster(targetCluster);
+
+        directoryEntry dot;
+        memOperator::memset(&dot, 0, sizeof(directoryEntry));
+        memOperator::memset(dot.fileName, ' ', 11);
+        dot.fileName[0] = '.';
+        dot.attributes = ATTR_DIRECTORY;
+        dot.creationTime = dot.modifyTime = fatTime();
+        dot.creationDate = dot.modifyDate = dot.accessDate = fatDate();
+        dot.lowFirstCluster = targetCluster & 0xFFFF;
+        dot.highFirstCluster = targetCluster >> 16;
+
+        directoryEntry dotdot = dot;
+        dotdot.fileName[1] = '.';
+        dotdot.lowFirstCluster = rootdir ? 0 : parentCluster & 0xFFFF;
+        dotdot.highFirstCluster = rootdir ? 0 : parentCluster >> 16;
+
+        uint32_t sector = clusterToSector(targetCluster);
+        if(!writeDirectoryEntry(dot, sector, 0, false) || !writeDirectoryEntry(dotdot, sector, sizeof(directoryEntry), false))
+            return -1;
+    }
+
+    directoryEntry entry;
+    if(!createEntry(parentCluster, name, attributes, rootdir, targetCluster, &entry)) {
+        if(targetCluster != 0)
+            freeClusterChain(targetCluster);
+        return -1;
+    }
+
+    return 0;
+}
+
+bool fat::modifyEntry(fatEntryInfo* entry, directoryEntry newVersion) {
+    return writeDirectoryEntry(newVersion, entry->sector, entry->offsetInSector, false);
+}
+
+uint16_t fat::fatTime() {
+    // No wall clock is reachable from here, entries get the FAT epoch
+    return 0;
+}
+
+uint16_t fat::fatDate() {
+    return (0 << 9) | (1 << 5) | 1;
+}
+
+fatPendingWrite* fat::findPendingWrite(const char* path) {
+    for(int i = 0; i < this->pendingWrites.size(); i++)
+        if(String::strcmp(this->pendingWrites[i]->path, path))
+            return this->pendingWrites[i];
+
+    return 0;
+}
+
+void fat::dropPendingWrite(fatPendingWrite* pending) {
+    this->pendingWrites.remove(pending);
+    this->pendingBytes -= pending->capacity;
+    pendingFiles--;
+
+    if(pending->data)
+        delete[] pending->data;
+    delete[] pending->path;
+    delete pending;
+}
+
+bool fat::flushPendingWrite(fatPendingWrite* pending) {
+    if(pending->create && createNewDirFileEntry(pending->path, 0) != 0)
+        return false;
+    pending->create = false;
+
+    fatEntryInfo entry;
+    if(!getEntryByPath(pending->path, &entry))
+        return false;
+
+    uint32_t needed = (pending->size + this->clusterSize - 1) / this->clusterSize;
+    uint32_t oldCluster = GET_CLUSTER(entry.entry);
+
+    // The old chain is only released once the entry points at the new one, until then both need room
+    if(this->freeClusterCount < needed) {
+        uint32_t oldClusters = 0;
+        for(uint32_t cluster = oldCluster; cluster >= 2 && cluster < this->totalClusters + 2; cluster = readTable(cluster))
+            oldClusters++;
+
+        if(this->freeClusterCount + oldClusters < needed) {
+            Log(Error, "FAT: Not enough free space to write %s", pending->path);
+            return false;
+        }
+
+        // Only fits in place of the old version, the file reads as empty until the new data is written
+        directoryEntry emptied = entry.entry;
+        emptied.fileSize = 0;
+        emptied.lowFirstCluster = 0;
+        emptied.highFirstCluster = 0;
+        if(!modifyEntry(&entry, emptied) || !freeClusterChain(oldCluster))
+            return false;
+
+        entry.entry = emptied;
+        oldCluster = 0;
+    }
+
+    // Clusters are only picked now that the final size is known, so the whole file lands in one run
+    uint32_t firstCluster = needed ? allocateClusterChain(needed) : 0;
+    if(needed && firstCluster == 0)
+        return false;
+
+    // One request per run of adjacent clusters, only a partial last sector goes through the sector buffer
+    bool success = true;
+    uint32_t written = 0;
+    uint32_t cluster = firstCluster;
+    while(success && written < pending->size) {
+        uint32_t runStart = cluster;
+        uint32_t runClusters = 1;
+        cluster = readTable(cluster);
+        while(cluster == runStart + runClusters && written + runClusters * this->clusterSize < pending->size) {
+            runClusters++;
+            cluster = readTable(cluster);
+        }
+
+        uint32_t runBytes = pending->size - written < runClusters * this->clusterSize ? pending->size - written : runClusters * this->clusterSize;
+        uint32_t lba = this->startLBA + clusterToSector(runStart);
+        uint32_t sectors = runBytes / this->bytesPerSector;
+
+        if(sectors > 0 && this->disk->writeSectors(lba, sectors, pending->data + written) != 0) {
+            success = false;
+            break;
+        }
+        written += sectors * this->bytesPerSector;
+
+        if(written < pending->size && runBytes % this->bytesPerSector != 0) {
+            memOperator::memset(this->readBuffer, 0, this->bytesPerSector);
+            memOperator::memcpy(this->readBuffer, pending->data + written, pending->size - written);
+            if(this->disk->writeSector(lba + sectors, this->readBuffer) != 0)
+                success = false;
+            written = pending->size;
+        }
+    }
+
+    directoryEntry newVersion = entry.entry;
+    newVersion.fileSize = pending->size;
+    newVersion.lowFirstCluster = firstCluster & 0xFFFF;
+    newVersion.highFirstCluster = firstCluster >> 16;
+    newVersion.modifyTime = fatTime();
+    newVersion.modifyDate = fatDate();
+
+    if(!success || !modifyEntry(&entry, newVersion)) {
+        if(firstCluster != 0)
+            freeClusterChain(firstCluster);
+        return false;
+    }
+
+    // The data is safe at this point, failing here only leaves clusters marked used that nothing points at
+    if(oldCluster != 0 && !freeClusterChain(oldCluster))
+        Log(Warning, "FAT: Could not release the old clusters of %s", pending->path);
+
+    return true;
+}
+
+void fat::flushPendingIn(const char* directory) {
+    while(*directory == PATH_SEPERATOR_C)
+        directory++;
+
+    int length = String::strlen(directory);
+    while(length > 0 && directory[length - 1] == PATH_SEPERATOR_C)
+        length--;
+
+    for(int i = 0; i < this->pendingWrites.size(); i++) {
+        fatPendingWrite* pending = this->pendingWrites[i];
+
+        int split = 0;
+        for(int c = 0; pending->path[c] != '\0'; c++)
+            if(pending->path[c] == PATH_SEPERATOR_C)
+                split = c;
+
+        if(!namesEqual(pending->path, split, directory, length))
+            continue;
+
+        // A failed flush stays pending, the listing then shows what is on disk
+        if(flushPendingWrite(pending)) {
+            dropPendingWrite(pending);
+            i--;
+        }
+    }
+}
+
+int fat::fsync(const char* filename) {
+    int result = 0;
+
+    if(filename != 0) {
+        fatPendingWrite* pending = findPendingWrite(filename);
+        if(pending == 0)
+            return 0;
+
+        // Kept on failure, the data only exists here until a later flush gets it to disk
+        if(flushPendingWrite(pending))
+            dropPendingWrite(pending);
+        else
+            result = -1;
+    }
+    else {
+        for(int i = 0; i < this->pendingWrites.size();) {
+            fatPendingWrite* pending = this->pendingWrites[i];
+            if(flushPendingWrite(pending)) {
+                dropPendingWrite(pending);
+            }
+            else {
+                result = -1;
+                i++;
+            }
+        }
+    }
+
+    if(!flushFsInfo())
+        result = -1;
+
+    return result;
+}
+
+int fat::readFile(const char* filename, uint8_t* buffer, uint32_t offset, uint32_t len) {
+    fatPendingWrite* pending = findPendingWrite(filename);
+    if(pending != 0) {
+        if(offset >= pending->size)
+            return 0;
+        if(len > pending->size - offset)
+            len = pending->size - offset;
+
+        memOperator::memcpy(buffer, pending->data + offset, len);
+        return len;
+    }
+
+    fatEntryInfo entry;
+    if(!getEntryByPath(filename, &entry) || (entry.entry.attributes & ATTR_DIRECTORY))
+        return -1;
+
+    uint32_t fileSize = entry.entry.fileSize;
+    uint32_t cluster = GET_CLUSTER(entry.entry);
+
+    if(offset >= fileSize)
+        return 0;
+    if(len > fileSize - offset)
+        len = fileSize - offset;
+
+    // Skip the clusters before the requested offset
+    for(uint32_t i = 0; i < offset / this->clusterSize && cluster >= 2 && cluster < this->totalClusters + 2; i++)
+        cluster = readTable(cluster);
+
+    uint32_t copied = 0;
+    uint32_t clusterOffset = offset % this->clusterSize;
+    while(copied < len && cluster >= 2 && cluster < this->totalClusters + 2) {
+        uint32_t sector = clusterToSector(cluster);
+        for(uint16_t i = 0; i < this->sectorsPerCluster; i++)
+            if(this->disk->readSector(this->startLBA + sector + i, this->readBuffer + (i * this->bytesPerSector)) != 0)
+                return copied > 0 ? (int)copied : -1;
+
+        uint32_t part = this->clusterSize - clusterOffset;
+        if(part > len - copied)
+            part = len - copied;
+
+        memOperator::memcpy(buffer + copied, this->readBuffer + clusterOffset, part);
+        copied += part;
+        clusterOffset = 0;
+        cluster = readTable(cluster);
+    }
+
+    return copied;
+}
+
+int fat::writeFile(const char* filename, uint8_t* buffer, uint32_t len, bool create) {
+    fatPendingWrite* pending = findPendingWrite(filename);
+    if(pending == 0) {
+        bool exists = fileExists(filename);
+        if(!exists && !create)
+            return -1;
+
+        pending = new fatPendingWrite;
+        pending->path = new char[String::strlen(filename) + 1];
+        String::strcpy(pending->path, filename);
+        pending->data = 0;
+        pending->size = 0;
+        pending->capacity = 0;
+        pending->firstWrite = scheduler::ticks();
+        pending->create = !exists;
+        this->pendingWrites.push_back(pending);
+
+        pendingFiles++;
+        if(flusher)
+            scheduler::unblock(flusher);
+    }
+
+    if(pending->capacity < len) {
+        uint32_t capacity = pending->capacity ? pending->capacity : this->clusterSize;
+        while(capacity < len)
+            capacity *= 2;
+
+        uint8_t* data = new uint8_t[capacity];
+        if(pending->data)
+            delete[] pending->data;
+
+        this->pendingBytes += capacity - pending->capacity;
+        pending->data = data;
+        pending->capacity = capacity;
+    }
+
+    memOperator::memcpy(pending->data, buffer, len);
+    pending->size = len;
+
+    // Group the FAT and directory updates of everything written during the last interval
+    if(this->pendingBytes > FAT_MAX_PENDING_BYTES || scheduler::ticks() - this->pendingWrites[0]->firstWrite > FAT_FLUSH_INTERVAL_MS)
+        if(fsync() != 0)
+            return -1;
+
+    return len;
+}
+
+bool fat::fileExists(const char* filename) {
+    if(findPendingWrite(filename) != 0)
+        return true;
+
+    fatEntryInfo entry;
+    return getEntryByPath(filename, &entry) && !(entry.entry.attributes & ATTR_DIRECTORY);
+}
+
+bool fat::directoryExists(const char* filename) {
+    fatEntryInfo entry;
+    return getEntryByPath(filename, &entry) && (entry.entry.attributes & ATTR_DIRECTORY);
+}
+
+uint32_t fat::getFileSize(const char* filename) {
+    fatPendingWrite* pending = findPendingWrite(filename);
+    if(pending != 0)
+        return pending->size;
+
+    fatEntryInfo entry;
+    if(!getEntryByPath(filename, &entry))
+        return -1;
+
+    return entry.entry.fileSize;
+}
+
+uint32_t fat::fileLocation(const char* path) {
+    fatEntryInfo entry;
+    if(!getEntryByPath(path, &entry))
+        return 0;
+
+    uint32_t cluster = GET_CLUSTER(entry.entry);
+    return cluster >= 2 ? this->startLBA + clusterToSector(cluster) : 0;
+}
+
+int fat::createFile(const char* path) {
+    if(findPendingWrite(path) != 0)
+        return -1;
+
+    return createNewDirFileEntry(path, 0);
+}
+
+int fat::createDirectory(const char* path) {
+    return createNewDirFileEntry(path, ATTR_DIRECTORY);
+}
+
+int fat::readDirectory(const char* path, uint32_t* cookie, uint8_t* buffer, uint32_t size) {
+    // Files still in memory have no entry yet, they are placed now so the walk below finds them
+    flushPendingIn(path);
+
+    uint32_t dirCluster = 0;
+    bool rootDirectory = path[0] == '\0';
+
+    if(!rootDirectory) {
+        fatEntryInfo entry;
+        if(!getEntryByPath(path, &entry) || !(entry.entry.attributes & ATTR_DIRECTORY))
+            return -1;
+
+        dirCluster = GET_CLUSTER(entry.entry);
+
+        // A ".." style reference to cluster 0 means the root directory
+        if(dirCluster == 0)
+            rootDirectory = true;
+    }
+
+    fatDirectoryCursor cursor;
+    if(!openCursor(dirCluster, rootDirectory, *cookie, &cursor))
+        return 0;
+
+    // The cookie is the index of the first 32 byte entry that still has to be returned
+    char name[FAT_NAME_BUFFER];
+    int nameLength = 0;
+    uint32_t firstIndex = 0;
+
+    uint32_t used = 0;
+    directoryEntry* entry = 0;
+    while((entry = nextNamedEntry(&cursor, name, &nameLength, &firstIndex)) != 0) {
+        if(entry->fileName[0] == '.')
+            continue;
+
+        LibC::vfsDirectoryRecord* record = addDirectoryRecord(buffer, size, &used, name, nameLength);
+        if(record == 0)
+            break;
+
+        record->isDir = entry->attributes & ATTR_DIRECTORY;
+        record->size = entry->fileSize;
+        record->nextCookie = cursor.index;
+        setCreationTime(record, entry);
+    }
+
+    // Resume at the entry that did not fit, its long name included, or where the walk stopped
+    *cookie = entry != 0 ? firstIndex : cursor.index;
+    if(used == 0 && entry != 0)
+        return VFS_BUFFER_TOO_SMALL;
+    return used;
+}
+
+List<LibC::vfsEntry>* fat::directoryList(const char* path) {
+    uint32_t dirCluster = this->rootDirCluster;
+    bool rootDirectory = true;
+
+    while(*path == PATH_SEPERATOR_C)
+        path++;
+
+    flushPendingIn(path);
+
+    if(*path != '\0') {
+        fatEntryInfo entry;
+        if(!getEntryByPath(path, &entry) || !(entry.entry.attributes & ATTR_DIRECTORY))
+            return 0;
+
+        uint32_t cluster = GET_CLUSTER(entry.entry);
+        if(cluster != 0) {
+            dirCluster = cluster;
+            rootDirectory = false;
+        }
+    }
+
+    fatDirectoryCursor cursor;
+    if(!openCursor(dirCluster, rootDirectory, 0, &cursor))
+        return 0;
+
+    List<LibC::vfsEntry>* result = new List<LibC::vfsEntry>();
+    char name[FAT_NAME_BUFFER];
+    int nameLength = 0;
+    directoryEntry* entry = 0;
+    while((entry = nextNamedEntry(&cursor, name, &nameLength)) != 0) {
+        if(entry->fileName[0] == '.')
+            continue;
+
+        LibC::vfsEntry item;
+        memOperator::memset(&item, 0, sizeof(LibC::vfsEntry));
+        String::strncpy(item.name, name, VFS_NAME_LENGTH - 1);
+        item.size = entry->fileSize;
+        item.isDir = entry->attributes & ATTR_DIRECTORY;
+        setCreationTime(&item, entry);
+        result->push_back(item);
+    }
+
+    return result;
+}
+
+void fat::flusherThread() {
+    while(true) {
+        scheduler::sleep(flusher, FAT_FLUSH_INTERVAL_MS / 4);
+
+        // A single write followed by silence has to reach the disk as well, not only when the next write comes
+        volumesLock.lock();
+        for(int i = 0; i < volumes.size(); i++) {
+            fat* volume = volumes[i];
+            volume->lock.lock();
+            if(volume->pendingWrites.size() > 0 && scheduler::ticks() - volume->pendingWrites[0]->firstWrite >= FAT_FLUSH_INTERVAL_MS)
+                if(volume->fsync() != 0)
+                    Log(Warning, "FAT: Delayed write failed, keeping the data for the next attempt");
+            volume->lock.unlock();
+        }
+        volumesLock.unlock();
+
+        // Check again with interrupts off so a writeFile() can not slip in before we block
+        interruptDescriptorTable::disableInterrupts();
+        if(pendingFiles == 0)
+            scheduler::block(flusher, Sleep);
+        interruptDescriptorTable::enableInterrupts();
+    }
+}
\ No newline at end of file
@@ -36,7 +36,7 @@ namespace Kernel {
         ak::uint32_t    volumeIDSerial;
         ak::uint8_t     volumeLabel[11];
         ak::uint8_t     systemIDString[8];
-        ak::uint8_t     bootCode[420];
+        ak::uint8_t     bootCodeArea[420];
         ak::uint16_t    bootSignature;
     } __attribute__((packed));
 
@@ -76,9 +76,11 @@ namespace Kernel {
         ak::uint8_t namePart3[4];          
     } __attribute__((packed));
 
+    /**
+     * @brief directory entry found by a lookup and where it is stored, filled in by the caller's copy
+     */
     struct fatEntryInfo {
         directoryEntry entry;                   
-        char* filename;                         
         ak::uint32_t sector;               
         ak::uint32_t offsetInSector;       
     } __attribute__((packed));
@@ -109,9 +111,56 @@ namespace Kernel {
 
     #define ENTRY_END       0x00
     #define ENTRY_UNUSED    0xE5
+    #define ENTRY_KANJI_E5  0x05
     #define LFN_ENTRY_END   0x40
+    #define LFN_ORDER_MASK  0x1F
+    #define LFN_CHARS       13
+    #define LFN_MAX_ENTRIES 20
+    #define FAT_NAME_BUFFER (LFN_MAX_ENTRIES * LFN_CHARS + 1)
+    #define FAT_TAIL_CANDIDATES 1024
+
+    #define SFN_LOWER_BASE  0x08
+    #define SFN_LOWER_EXT   0x10
+
+    #define FSINFO_SIGNATURE_1      0x41615252
+    #define FSINFO_SIGNATURE_2      0x61417272
+    #define FSINFO_UNKNOWN          0xFFFFFFFF
+    #define FSINFO_FLUSH_INTERVAL   64
+
+	#define GET_CLUSTER(e) (e.lowFirstCluster | (e.highFirstCluster << (16)))
+
+    #define FAT_FLUSH_INTERVAL_MS   5000
+    #define FAT_MAX_PENDING_BYTES   1_MB
+
+    /**
+     * @brief file contents written by writeFile but not yet placed on disk
+     */
+    struct fatPendingWrite {
+        char* path;
+        ak::uint8_t* data;
+        ak::uint32_t size;
+        ak::uint32_t capacity;
+        ak::uint32_t firstWrite;
+        bool create;
+    };
 
-	#define GET_CLUSTER(e) (e.LowFirstCluster | (e.HighFirstCluster << (16)))
+    #define FAT_NO_SECTOR   0xFFFFFFFF
+
+    #define FAT_FORMAT_SECTOR_SIZE  512
+    #define FAT_FORMAT_ROOT_ENTRIES 512
+    #define FAT_FORMAT_CHUNK        64
+
+    /**
+     * @brief position of the next 32 byte entry while walking a directory
+     */
+    struct fatDirectoryCursor {
+        ak::uint32_t cluster;
+        ak::uint32_t sector;
+        ak::uint32_t sectorInCluster;
+        ak::uint32_t entryInSector;
+        ak::uint32_t index;
+        bool rootDirectory;
+    };
 
     enum fatType {
         FAT12,
@@ -119,9 +168,9 @@ namespace Kernel {
         FAT32
     };
         
-    class fat : public VirtualFileSystem {
+    class fat : public virtualFileSystem {
     private: 
-        fatType fattpye;                    
+        fatType FatType;                    
         char* FatTypeString = 0;            
 
         uint16_t bytesPerSector = 0;        
@@ -133,39 +182,77 @@ namespace Kernel {
         uint32_t firstFatSector = 0;       
         uint32_t rootDirCluster = 0;       
         uint32_t totalClusters = 0;        
+        uint32_t sectorsPerFat = 0;
+        uint8_t numberOfFats = 0;
 
         uint8_t* readBuffer = 0;            
         fat32Info fsInfo;                
+        uint32_t fsInfoSector = 0;
+        bool fsInfoDirty = false;
+
+        uint8_t* fatBuffer = 0;
+        uint32_t fatBufferSector = FAT_NO_SECTOR;
+        uint8_t fatBufferDirty = 0;
+
+        uint8_t* dirBuffer = 0;
+        uint32_t dirBufferSector = FAT_NO_SECTOR;
+
+        uint32_t* freeClusterMap = 0;
+        uint32_t freeClusterCount = 0;
+        uint32_t nextFreeCluster = 2;
+        uint32_t allocationsSinceFlush = 0;
+
+        List<fatPendingWrite*> pendingWrites;
+        uint32_t pendingBytes = 0;
 
     private:
         ak::uint32_t clusterToSector(ak::uint32_t cluster);
         ak::uint32_t readTable(ak::uint32_t cluster);
         void writeTable(ak::uint32_t cluster, ak::uint32_t value);
         ak::uint32_t allocateCluster();
+        ak::uint32_t allocateClusterChain(ak::uint32_t count, ak::uint32_t previousCluster = 0);
+        bool freeClusterChain(ak::uint32_t cluster);
+
+        bool loadFatSector(ak::uint32_t sector);
+        bool flushFatSector();
+        bool loadFreeClusterMap();
+        ak::uint32_t findFreeRun(ak::uint32_t wanted, ak::uint32_t* runLength);
+        void markCluster(ak::uint32_t cluster, bool used);
+        bool flushFsInfo();
+
+        fatPendingWrite* findPendingWrite(const char* path);
+        bool flushPendingWrite(fatPendingWrite* pending);
+        void dropPendingWrite(fatPendingWrite* pending);
+        void flushPendingIn(const char* directory);
+
+        static List<fat*> volumes;
+        static mutexLock volumesLock;
+        static void flusherThread();
 
         void clearCluster(ak::uint32_t cluster);
-        char* parseLFNEntries(List<lfnEntry>* entries, directoryEntry sfnEntry);
-        char* parseShortFilename(char* fatName);
+        bool openCursor(ak::uint32_t dirCluster, bool rootDirectory, ak::uint32_t startIndex, fatDirectoryCursor* cursor);
+        directoryEntry* nextEntry(fatDirectoryCursor* cursor);
+        void seekCursor(ak::uint32_t cluster, ak::uint32_t sector, ak::uint32_t sectorOffset, bool rootDirectory, fatDirectoryCursor* cursor);
+        bool writeCurrentSector();
+        directoryEntry* nextNamedEntry(fatDirectoryCursor* cursor, char* name, int* nameLength, ak::uint32_t* firstIndex = 0);
 
         ak::uint8_t checksum(char* filename);
 
-        List<fatEntryInfo> getDirectoryEntries(ak::uint32_t dirCluster, bool rootDirectory = false);
-
-        fatEntryInfo* seachInDirectory(char* name, ak::uint32_t dirCluster, bool rootDirectory = false);
+        bool seachInDirectory(const char* name, int length, ak::uint32_t dirCluster, bool rootDirectory, fatEntryInfo* result);
 
-        fatEntryInfo* getEntryByPath(char* path);
+        bool shortNameExists(ak::uint32_t dirCluster, bool rootDirectory, const char* shortName);
 
-        List<lfnEntry> createLFNEntriesFromName(char* name, int num, ak::uint8_t checksum);
+        bool getEntryByPath(const char* path, fatEntryInfo* result, int length = -1);
 
-        char* createShortFilename(char* name);
+        void createShortFilename(const char* name, char* result);
 
-        bool writeLongFilenameEntries(List<LFNEntry>* entries, ak::uint32_t targetCluster, ak::uint32_t targetSector, ak::uint32_t sectorOffset, bool rootDirectory);
+        bool writeLongFilenameEntries(const char* name, int count, ak::uint8_t checksum, ak::uint32_t targetCluster, ak::uint32_t targetSector, ak::uint32_t sectorOffset, bool rootDirectory);
 
         bool writeDirectoryEntry(directoryEntry entry, ak::uint32_t targetSector, ak::uint32_t sectorOffset, bool rootDirectory);
 
         bool findEntryStartpoint(ak::uint32_t cluster, ak::uint32_t entryCount, bool rootdir, ak::uint32_t* targetCluster, ak::uint32_t* targetSector, ak::uint32_t* sectorOffset);
 
-        directoryEntry* createEntry(ak::uint32_t parentCluster, char* name, ak::uint8_t attr, bool rootdir, ak::uint32_t targetCluster, ak::uint32_t* sectorPlaced);
+        bool createEntry(ak::uint32_t parentCluster, const char* name, ak::uint8_t attr, bool rootdir, ak::uint32_t targetCluster, directoryEntry* entry);
 
         int createNewDirFileEntry(const char* path, ak::uint8_t attributes);
 
@@ -180,9 +267,12 @@ namespace Kernel {
         ~fat();
 
         bool initialize();
+        static bool format(Disk* disk, ak::uint32_t start, ak::uint32_t size, const char* label = "PRANAOS");
+        static fatType formatType(ak::uint32_t size);
 
         int readFile(const char* filename, uint8_t* buffer, uint32_t offset = 0, uint32_t len = -1);
         int writeFile(const char* filename, uint8_t* buffer, uint32_t len, bool create = true);
+        int fsync(const char* filename = 0);
 
         bool fileExists(const char* filename);
         bool directoryExists(const char* filename);
@@ -192,5 +282,7 @@ namespace Kernel {
 
         uint32_t getFileSize(const char* filename);
         List<LibC::vfsEntry>* directoryList(const char* path);
+        int readDirectory(const char* path, ak::uint32_t* cookie, ak::uint8_t* buffer, ak::uint32_t size);
+        ak::uint32_t fileLocation(const char* path);
     };
 }
\ No newline at end of file
@@ -0,0 +1,262 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#include "initrdfs.h"
+#include <ak/string.h>
+#include <ak/memoperator.h>
+#include <ak/lz4.h>
+#include <kernel/system/log.h>
+
+using namespace Kernel::ak;
+using namespace Kernel;
+
+initrdFS::initrdFS(uint8_t* image, uint32_t size)
+: virtualFileSystem(0, 0, 0) {
+    this->Name = "Initial Ramdisk";
+    this->image = image;
+    this->imageSize = size;
+    this->readAheadEnabled = false;
+}
+
+initrdFS::~initrdFS() {
+    if(this->blockCache == 0)
+        return;
+
+    for(uint32_t i = 0; i < this->header->entryCount; i++) {
+        if(this->blockCache[i] == 0)
+            continue;
+
+        for(uint32_t b = 0; b < this->entries[i].blockCount; b++)
+            if(this->blockCache[i][b])
+                delete[] this->blockCache[i][b];
+        delete[] this->blockCache[i];
+    }
+    delete[] this->blockCache;
+}
+
+bool initrdFS::initialize() {
+    if(this->imageSize < sizeof(initrdHeader))
+        return false;
+
+    this->header = (initrdHeader*)this->image;
+    if(this->header->magic != INITRD_MAGIC || this->header->version != INITRD_VERSION) {
+        Log(Error, "Initrd: Invalid image (magic %x, version %d)", this->header->magic, this->header->version);
+        return false;
+    }
+
+    uint32_t entriesEnd = this->header->entriesOffset + this->header->entryCount * sizeof(initrdEntry);
+    uint32_t bucketsEnd = this->header->bucketsOffset + this->header->bucketCount * sizeof(uint32_t);
+    if(this->header->imageSize > this->imageSize || entriesEnd > this->imageSize || bucketsEnd > this->imageSize || this->header->bucketCount == 0 || this->header->entryCount == 0)
+        return false;
+
+    this->entries = (initrdEntry*)(this->image + this->header->entriesOffset);
+    this->buckets = (uint32_t*)(this->image + this->header->bucketsOffset);
+
+    // Filled in per file on the first read of one of its compressed blocks
+    this->blockCache = new uint8_t**[this->header->entryCount];
+    memOperator::memset(this->blockCache, 0, this->header->entryCount * sizeof(uint8_t**));
+
+    Log(Info, "Initrd: %d entries, %d KB", this->header->entryCount, this->header->imageSize / 1_KB);
+    return true;
+}
+
+const char* initrdFS::entryPath(initrdEntry* entry) {
+    return (const char*)(this->image + entry->pathOffset);
+}
+
+uint32_t initrdFS::findEntry(const char* path) {
+    while(*path == PATH_SEPERATOR_C)
+        path++;
+
+    int length = String::strlen(path);
+    while(length > 0 && path[length - 1] == PATH_SEPERATOR_C)
+        length--;
+
+    uint32_t hash = String::hash(path, length, true);
+    for(uint32_t i = this->buckets[hash % this->header->bucketCount]; i != INITRD_NO_ENTRY; i = this->entries[i].nextInBucket) {
+        if(i >= this->header->entryCount)
+            break;
+
+        initrdEntry* entry = &this->entries[i];
+        if(entry->pathHash != hash)
+            continue;
+
+        const char* name = entryPath(entry);
+        bool equal = String::strlen(name) == length;
+        for(int c = 0; c < length && equal; c++)
+            equal = String::uppercase(name[c]) == String::uppercase(path[c]);
+
+        if(equal)
+            return i;
+    }
+
+    return INITRD_NO_ENTRY;
+}
+
+const uint8_t* initrdFS::getBlock(uint32_t entryIndex, uint32_t block) {
+    initrdEntry* entry = &this->entries[entryIndex];
+    if(block >= entry->blockCount || entry->blocksOffset + entry->blockCount * sizeof(initrdBlock) > this->imageSize)
+        return 0;
+
+    initrdBlock* info = (initrdBlock*)(this->image + entry->blocksOffset) + block;
+
+    uint32_t blockSize = entry->size - block * INITRD_BLOCK_SIZE;
+    if(blockSize > INITRD_BLOCK_SIZE)
+        blockSize = INITRD_BLOCK_SIZE;
+
+    if(info->offset + info->compressedSize > this->imageSize)
+        return 0;
+
+    // Blocks that did not compress are used straight from the image
+    if(info->compressedSize == blockSize)
+        return this->image + info->offset;
+
+    // Decompressed blocks stay cached once filled, only filling them has to be serialized
+    blockCacheLock.lock();
+    if(this->blockCache[entryIndex] == 0) {
+        this->blockCache[entryIndex] = new uint8_t*[entry->blockCount];
+        memOperator::memset(this->blockCache[entryIndex], 0, entry->blockCount * sizeof(uint8_t*));
+    }
+
+    uint8_t** cached = &this->blockCache[entryIndex][block];
+    if(*cached != 0) {
+        blockCacheLock.unlock();
+        return *cached;
+    }
+
+    uint8_t* data = new uint8_t[blockSize];
+    if(LZ4::decompressBlock(this->image + info->offset, info->compressedSize, data, blockSize) != (int)blockSize) {
+        Log(Error, "Initrd: Corrupt block %d of %s", block, entryPath(entry));
+        delete[] data;
+        blockCacheLock.unlock();
+        return 0;
+    }
+
+    *cached = data;
+    blockCacheLock.unlock();
+    return data;
+}
+
+int initrdFS::readFile(const char* filename, uint8_t* buffer, uint32_t offset, uint32_t len) {
+    uint32_t index = findEntry(filename);
+    if(index == INITRD_NO_ENTRY || (this->entries[index].flags & INITRD_FLAG_DIRECTORY))
+        return -1;
+
+    initrdEntry* entry = &this->entries[index];
+    if(offset >= entry->size)
+        return 0;
+    if(len > entry->size - offset)
+        len = entry->size - offset;
+
+    uint32_t copied = 0;
+    while(copied < len) {
+        uint32_t position = offset + copied;
+        const uint8_t* block = getBlock(index, position / INITRD_BLOCK_SIZE);
+        if(block == 0)
+            return copied > 0 ? (int)copied : -1;
+
+        uint32_t blockOffset = position % INITRD_BLOCK_SIZE;
+        uint32_t part = INITRD_BLOCK_SIZE - blockOffset;
+        if(part > len - copied)
+            part = len - copied;
+
+        memOperator::memcpy(buffer + copied, block + blockOffset, part);
+        copied += part;
+    }
+
+    return copied;
+}
+
+int initrdFS::writeFile(const char* filename, uint8_t* buffer, uint32_t len, bool create) {
+    return -1;
+}
+
+bool initrdFS::fileExists(const char* filename) {
+    uint32_t index = findEntry(filename);
+    return index != INITRD_NO_ENTRY && !(this->entries[index].flags & INITRD_FLAG_DIRECTORY);
+}
+
+bool initrdFS::directoryExists(const char* filename) {
+    uint32_t index = findEntry(filename);
+    return index != INITRD_NO_ENTRY && (this->entries[index].flags & INITRD_FLAG_DIRECTORY);
+}
+
+int initrdFS::createFile(const char* path) {
+    return -1;
+}
+
+int initrdFS::createDirectory(const char* path) {
+    return -1;
+}
+
+uint32_t initrdFS::getFileSize(const char* filename) {
+    uint32_t index = findEntry(filename);
+    if(index == INITRD_NO_ENTRY)
+        return -1;
+
+    return this->entries[index].size;
+}
+
+List<LibC::vfsEntry>* initrdFS::directoryList(const char* path) {
+    uint32_t dirIndex = findEntry(path);
+    if(dirIndex == INITRD_NO_ENTRY || !(this->entries[dirIndex].flags & INITRD_FLAG_DIRECTORY))
+        return 0;
+
+    List<LibC::vfsEntry>* result = new List<LibC::vfsEntry>();
+    for(uint32_t i = 0; i < this->header->entryCount; i++) {
+        initrdEntry* entry = &this->entries[i];
+        if(entry->parentIndex != dirIndex)
+            continue;
+
+        // Only the last component of the stored path is the name
+        const char* name = entryPath(entry);
+        int slash = -1;
+        for(int c = 0; name[c] != '\0'; c++)
+            if(name[c] == PATH_SEPERATOR_C)
+                slash = c;
+
+        LibC::vfsEntry item;
+        memOperator::memset(&item, 0, sizeof(LibC::vfsEntry));
+        String::strncpy(item.name, name + slash + 1, VFS_NAME_LENGTH - 1);
+        item.size = entry->size;
+        item.isDir = entry->flags & INITRD_FLAG_DIRECTORY;
+        result->push_back(item);
+    }
+
+    return result;
+}
+
+int initrdFS::readDirectory(const char* path, uint32_t* cookie, uint8_t* buffer, uint32_t size) {
+    uint32_t dirIndex = findEntry(path);
+    if(dirIndex == INITRD_NO_ENTRY || !(this->entries[dirIndex].flags & INITRD_FLAG_DIRECTORY))
+        return -1;
+
+    // The cookie is the index of the next entry to look at, children are found by their parent index
+    uint32_t used = 0;
+    uint32_t index = *cookie;
+    for(; index < this->header->entryCount; index++) {
+        initrdEntry* entry = &this->entries[index];
+        if(entry->parentIndex != dirIndex)
+            continue;
+
+        const char* name = entryPath(entry);
+        int slash = -1;
+        for(int c = 0; name[c] != '\0'; c++)
+            if(name[c] == PATH_SEPERATOR_C)
+                slash = c;
+
+        LibC::vfsDirectoryRecord* record = addDirectoryRecord(buffer, size, &used, name + slash + 1, String::strlen(name + slash + 1));
+        if(record == 0)
+            break;
+
+        record->size = entry->size;
+        record->isDir = entry->flags & INITRD_FLAG_DIRECTORY;
+        record->nextCookie = index + 1;
+    }
+
+    *cookie = index;
+    if(used == 0 && index < this->header->entryCount)
+        return VFS_BUFFER_TOO_SMALL;
+    return used;
+}
@@ -0,0 +1,86 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#pragma once
+
+#include "virtualfilesystem.h"
+
+namespace Kernel {
+
+    #define INITRD_MAGIC            0x44525449
+    #define INITRD_VERSION          1
+    #define INITRD_BLOCK_SIZE       64_KB
+    #define INITRD_NO_ENTRY         0xFFFFFFFF
+    #define INITRD_FLAG_DIRECTORY   (1 << 0)
+
+    /**
+     * @brief start of the image, every offset is relative to it
+     */
+    struct initrdHeader {
+        ak::uint32_t magic;
+        ak::uint32_t version;
+        ak::uint32_t entryCount;
+        ak::uint32_t bucketCount;
+        ak::uint32_t entriesOffset;
+        ak::uint32_t bucketsOffset;
+        ak::uint32_t imageSize;
+    } __attribute__((packed));
+
+    /**
+     * @brief file or directory, chained per bucket by the hash of its full path
+     */
+    struct initrdEntry {
+        ak::uint32_t pathOffset;
+        ak::uint32_t pathHash;
+        ak::uint32_t parentIndex;
+        ak::uint32_t nextInBucket;
+        ak::uint32_t flags;
+        ak::uint32_t size;
+        ak::uint32_t blockCount;
+        ak::uint32_t blocksOffset;
+    } __attribute__((packed));
+
+    /**
+     * @brief INITRD_BLOCK_SIZE bytes of a file, stored as is when compressedSize equals the block size
+     */
+    struct initrdBlock {
+        ak::uint32_t offset;
+        ak::uint32_t compressedSize;
+    } __attribute__((packed));
+
+    class initrdFS : public virtualFileSystem {
+    private:
+        ak::uint8_t* image;
+        ak::uint32_t imageSize;
+
+        initrdHeader* header = 0;
+        initrdEntry* entries = 0;
+        ak::uint32_t* buckets = 0;
+        ak::uint8_t*** blockCache = 0;
+        mutexLock blockCacheLock;
+
+        ak::uint32_t findEntry(const char* path);
+        const char* entryPath(initrdEntry* entry);
+        const ak::uint8_t* getBlock(ak::uint32_t entryIndex, ak::uint32_t block);
+
+    public:
+        initrdFS(ak::uint8_t* image, ak::uint32_t size);
+        ~initrdFS();
+
+        bool initialize();
+
+        int readFile(const char* filename, uint8_t* buffer, uint32_t offset = 0, uint32_t len = -1);
+        int writeFile(const char* filename, uint8_t* buffer, uint32_t len, bool create = true);
+
+        bool fileExists(const char* filename);
+        bool directoryExists(const char* filename);
+
+        int createFile(const char* path);
+        int createDirectory(const char* path);
+
+        uint32_t getFileSize(const char* filename);
+        List<LibC::vfsEntry>* directoryList(const char* path);
+        int readDirectory(const char* path, ak::uint32_t* cookie, ak::uint8_t* buffer, ak::uint32_t size);
+    };
+}
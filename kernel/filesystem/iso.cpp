@@ -0,0 +1,486 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#include "iso.h"
+#include <ak/string.h>
+#include <ak/memoperator.h>
+#include <kernel/system/log.h>
+
+using namespace Kernel::ak;
+using namespace Kernel;
+
+static bool namesEqual(const char* a, int aLength, const char* b, int bLength) {
+    if(aLength != bLength)
+        return false;
+
+    for(int i = 0; i < aLength; i++)
+        if(String::uppercase(a[i]) != String::uppercase(b[i]))
+            return false;
+
+    return true;
+}
+
+// Length of a record name without the ";1" version and the trailing dot of names without extension
+static int trimmedNameLength(directoryRecord* record) {
+    int length = record->nameLength;
+    for(int i = 0; i < length; i++)
+        if(record->name[i] == ';') {
+            length = i;
+            break;
+        }
+
+    if(length > 1 && record->name[length - 1] == '.')
+        length--;
+
+    return length;
+}
+
+static int componentLength(const char* path) {
+    int length = 0;
+    while(path[length] != '\0' && path[length] != PATH_SEPERATOR_C)
+        length++;
+    return length;
+}
+
+isoFS::isoFS(Disk* disk, uint32_t start, uint32_t size)
+: virtualFileSystem(disk, start, size) {
+    this->Name = "ISO9660 Filesystem";
+}
+
+isoFS::~isoFS() {
+    if(this->rootDirectory)
+        delete this->rootDirectory;
+
+    for(int i = 0; i < this->directoryCount; i++)
+        delete[] this->directories[i].name;
+
+    if(this->directories)
+        delete[] this->directories;
+    if(this->hashBuckets)
+        delete[] this->hashBuckets;
+    if(this->directoryCache)
+        delete[] this->directoryCache;
+}
+
+bool isoFS::initialize() {
+    uint8_t* buffer = new uint8_t[CDROM_SECTOR_SIZE];
+    bool result = false;
+
+    for(uint32_t sector = ISO_START_SECTOR; sector < this->sizeInSectors; sector++) {
+        if(this->disk->readSector(this->startLBA + sector, buffer) != 0)
+            break;
+
+        volumeDescriptor* descriptor = (volumeDescriptor*)buffer;
+        if(memOperator::memcmp(descriptor->identifier, "CD001", 5) != 0)
+            break;
+        if(descriptor->type == volumeDescriptorSetTerminator)
+            break;
+        if(descriptor->type != pvDescriptor)
+            continue;
+
+        primaryVolumeDescriptor* pvd = (primaryVolumeDescriptor*)buffer;
+        this->rootDirectory = new directoryRecord;
+        memOperator::memcpy(this->rootDirectory, pvd->rootDirectoryRecord, sizeof(pvd->rootDirectoryRecord));
+
+        result = loadPathTable(pvd);
+        break;
+    }
+
+    delete[] buffer;
+    return result;
+}
+
+bool isoFS::loadPathTable(primaryVolumeDescriptor* pvd) {
+    uint32_t tableSize = (uint32_t)pvd->pathTableSize;
+    uint32_t sectors = (tableSize + CDROM_SECTOR_SIZE - 1) / CDROM_SECTOR_SIZE;
+    if(tableSize == 0)
+        return false;
+
+    uint8_t* table = new uint8_t[sectors * CDROM_SECTOR_SIZE];
+    if(this->disk->readSectors(this->startLBA + pvd->type1PathTable, sectors, table) != 0) {
+        delete[] table;
+        return false;
+    }
+
+    int count = 0;
+    for(uint32_t pos = 0; pos + sizeof(pathTableEntry) <= tableSize; count++) {
+        pathTableEntry* entry = (pathTableEntry*)(table + pos);
+        if(entry->nameLength == 0)
+            break;
+        pos += sizeof(pathTableEntry) + entry->nameLength + (entry->nameLength & 1);
+    }
+
+    uint32_t buckets = 16;
+    while(buckets < (uint32_t)count * 2)
+        buckets *= 2;
+
+    this->directories = new isoDirectoryIndex[count];
+    this->directoryCount = count;
+    this->hashBuckets = new int[buckets];
+    this->hashMask = buckets - 1;
+    for(uint32_t i = 0; i < buckets; i++)
+        this->hashBuckets[i] = -1;
+
+    uint32_t pos = 0;
+    for(int i = 0; i < count; i++) {
+        pathTableEntry* entry = (pathTableEntry*)(table + pos);
+        isoDirectoryIndex* dir = &this->directories[i];
+
+        dir->extentLocation = entry->extentLocation;
+        dir->parentIndex = entry->parentIndex;
+        dir->name = new char[entry->nameLength + 1];
+        memOperator::memcpy(dir->name, entry->name, entry->nameLength);
+        dir->name[entry->nameLength] = '\0';
+        dir->nameHash = String::hash(dir->name, entry->nameLength, true);
+
+        uint32_t bucket = (dir->nameHash ^ (dir->parentIndex * 2654435761u)) & this->hashMask;
+        dir->nextInBucket = this->hashBuckets[bucket];
+        this->hashBuckets[bucket] = i;
+
+        pos += sizeof(pathTableEntry) + entry->nameLength + (entry->nameLength & 1);
+    }
+
+    delete[] table;
+    Log(Info, "ISO9660: Indexed %d directories from the path table", count);
+    return true;
+}
+
+int isoFS::findDirectory(int parentIndex, const char* name, int nameLength) {
+    uint32_t hash = String::hash(name, nameLength, true);
+    uint32_t bucket = (hash ^ (parentIndex * 2654435761u)) & this->hashMask;
+
+    for(int i = this->hashBuckets[bucket]; i != -1; i = this->directories[i].nextInBucket) {
+        isoDirectoryIndex* dir = &this->directories[i];
+        if(i == 0 || dir->parentIndex != parentIndex || dir->nameHash != hash)
+            continue;
+
+        if(namesEqual(dir->name, String::strlen(dir->name), name, nameLength))
+            return i + 1;
+    }
+
+    return -1;
+}
+
+int isoFS::resolveDirectory(const char* path, const char** lastComponent) {
+    int dirIndex = ISO_ROOT_DIRECTORY_INDEX;
+
+    while(*path == PATH_SEPERATOR_C)
+        path++;
+
+    while(true) {
+        int length = componentLength(path);
+        if(path[length] == '\0' || path[length + 1] == '\0') {
+            *lastComponent = path;
+            return dirIndex;
+        }
+
+        dirIndex = findDirectory(dirIndex, path, length);
+        if(dirIndex == -1)
+            return -1;
+
+        path += length + 1;
+    }
+}
+
+bool isoFS::readDirectoryExtent(uint32_t extent) {
+    if(this->directoryCache != 0 && this->directoryCacheExtent == extent)
+        return true;
+
+    uint8_t* firstSector = new uint8_t[CDROM_SECTOR_SIZE];
+    if(this->disk->readSector(this->startLBA + extent, firstSector) != 0) {
+        delete[] firstSector;
+        return false;
+    }
+
+    // The "." record at the start tells us how large the whole directory is
+    uint32_t size = ((directoryRecord*)firstSector)->dataLength;
+    uint32_t sectors = (size + CDROM_SECTOR_SIZE - 1) / CDROM_SECTOR_SIZE;
+    if(sectors == 0)
+        sectors = 1;
+
+    if(this->directoryCacheSize < sectors * CDROM_SECTOR_SIZE) {
+        if(this->directoryCache)
+            delete[] this->directoryCache;
+        this->directoryCache = new uint8_t[sectors * CDROM_SECTOR_SIZE];
+    }
+
+    memOperator::memcpy(this->directoryCache, firstSector, CDROM_SECTOR_SIZE);
+    delete[] firstSector;
+
+    this->directoryCacheSize = sectors * CDROM_SECTOR_SIZE;
+    this->directoryCacheExtent = extent;
+
+    if(sectors > 1 && this->disk->readSectors(this->startLBA + extent + 1, sectors - 1, this->directoryCache + CDROM_SECTOR_SIZE) != 0) {
+        this->directoryCacheExtent = 0;
+        return false;
+    }
+
+    return true;
+}
+
+directoryRecord* isoFS::searchInDirectory(uint32_t extent, const char* name) {
+    if(!readDirectoryExtent(extent))
+        return 0;
+
+    int nameLength = componentLength(name);
+    uint32_t pos = 0;
+    while(pos < this->directoryCacheSize) {
+        directoryRecord* record = (directoryRecord*)(this->directoryCache + pos);
+
+        // Records never cross a sector boundary, the rest of the sector is padding
+        if(record->length == 0) {
+            pos = (pos / CDROM_SECTOR_SIZE + 1) * CDROM_SECTOR_SIZE;
+            continue;
+        }
+
+        bool special = record->nameLength == 1 && (record->name[0] == 0 || record->name[0] == 1);
+        if(!special && namesEqual(record->name, trimmedNameLength(record), name, nameLength)) {
+            directoryRecord* result = new directoryRecord;
+            memOperator::memcpy(result, record, record->length);
+            return result;
+        }
+
+        pos += record->length;
+    }
+
+    return 0;
+}
+
+directoryRecord* isoFS::getEntry(const char* path) {
+    const char* last = 0;
+    int parent = resolveDirectory(path, &last);
+    if(parent == -1 || *last == '\0')
+        return 0;
+
+    return searchInDirectory(this->directories[parent - 1].extentLocation, last);
+}
+
+isoEntryType isoFS::getEntryType(directoryRecord* entry) {
+    return (entry->flags & ISO_FLAG_DIRECTORY) ? isoDirectory : isoFile;
+}
+
+char* isoFS::getRecordName(directoryRecord* record) {
+    int length = trimmedNameLength(record);
+    char* name = new char[length + 1];
+    memOperator::memcpy(name, record->name, length);
+    name[length] = '\0';
+    return name;
+}
+
+int isoFS::readFile(const char* filename, uint8_t* buffer, uint32_t offset, uint32_t len) {
+    directoryRecord* entry = getEntry(filename);
+    if(entry == 0)
+        return -1;
+
+    uint32_t extent = entry->extentLocation;
+    uint32_t fileSize = entry->dataLength;
+    isoEntryType type = getEntryType(entry);
+    delete entry;
+
+    if(type != isoFile)
+        return -1;
+    if(offset >= fileSize)
+        return 0;
+    if(len > fileSize - offset)
+        len = fileSize - offset;
+
+    uint32_t sector = extent + (offset / CDROM_SECTOR_SIZE);
+    uint32_t headSkip = offset % CDROM_SECTOR_SIZE;
+    uint32_t copied = 0;
+    uint8_t* sectorBuffer = 0;
+
+    // Partial first sector
+    if(headSkip != 0 || len < CDROM_SECTOR_SIZE) {
+        sectorBuffer = new uint8_t[CDROM_SECTOR_SIZE];
+        if(this->disk->readSector(this->startLBA + sector, sectorBuffer) != 0) {
+            delete[] sectorBuffer;
+            return -1;
+        }
+
+        copied = CDROM_SECTOR_SIZE - headSkip;
+        if(copied > len)
+            copied = len;
+
+        memOperator::memcpy(buffer, sectorBuffer + headSkip, copied);
+        sector++;
+    }
+
+    // All whole sectors of the extent in a single request, straight into the caller's buffer
+    uint32_t fullSectors = (len - copied) / CDROM_SECTOR_SIZE;
+    if(fullSectors > 0) {
+        if(this->disk->readSectors(this->startLBA + sector, fullSectors, buffer + copied) != 0) {
+            if(sectorBuffer)
+                delete[] sectorBuffer;
+            return copied > 0 ? (int)copied : -1;
+        }
+
+        copied += fullSectors * CDROM_SECTOR_SIZE;
+        sector += fullSectors;
+    }
+
+    // Partial last sector
+    if(copied < len) {
+        if(sectorBuffer == 0)
+            sectorBuffer = new uint8_t[CDROM_SECTOR_SIZE];
+
+        if(this->disk->readSector(this->startLBA + sector, sectorBuffer) == 0) {
+            memOperator::memcpy(buffer + copied, sectorBuffer, len - copied);
+            copied = len;
+        }
+    }
+
+    if(sectorBuffer)
+        delete[] sectorBuffer;
+
+    return copied;
+}
+
+int isoFS::writeFile(const char* filename, uint8_t* buffer, uint32_t len, bool create) {
+    return -1;
+}
+
+bool isoFS::fileExists(const char* filename) {
+    directoryRecord* entry = getEntry(filename);
+    if(entry == 0)
+        return false;
+
+    bool result = getEntryType(entry) == isoFile;
+    delete entry;
+    return result;
+}
+
+bool isoFS::directoryExists(const char* filename) {
+    const char* last = 0;
+    int parent = resolveDirectory(filename, &last);
+    if(parent == -1)
+        return false;
+
+    return *last == '\0' || findDirectory(parent, last, componentLength(last)) != -1;
+}
+
+int isoFS::createFile(const char* path) {
+    return -1;
+}
+
+int isoFS::createDirectory(const char* path) {
+    return -1;
+}
+
+uint32_t isoFS::getFileSize(const char* filename) {
+    directoryRecord* entry = getEntry(filename);
+    if(entry == 0)
+        return -1;
+
+    uint32_t result = entry->dataLength;
+    delete entry;
+    return result;
+}
+
+uint32_t isoFS::fileLocation(const char* path) {
+    directoryRecord* entry = getEntry(path);
+    if(entry == 0)
+        return 0;
+
+    uint32_t result = this->startLBA + entry->extentLocation;
+    delete entry;
+    return result;
+}
+
+int isoFS::directoryIndexForPath(const char* path) {
+    const char* last = 0;
+    int dirIndex = resolveDirectory(path, &last);
+    if(dirIndex != -1 && *last != '\0')
+        dirIndex = findDirectory(dirIndex, last, componentLength(last));
+
+    return dirIndex;
+}
+
+List<LibC::vfsEntry>* isoFS::directoryList(const char* path) {
+    int dirIndex = directoryIndexForPath(path);
+    if(dirIndex == -1)
+        return 0;
+
+    if(!readDirectoryExtent(this->directories[dirIndex - 1].extentLocation))
+        return 0;
+
+    List<LibC::vfsEntry>* result = new List<LibC::vfsEntry>();
+    uint32_t pos = 0;
+    while(pos < this->directoryCacheSize) {
+        directoryRecord* record = (directoryRecord*)(this->directoryCache + pos);
+        if(record->length == 0) {
+            pos = (pos / CDROM_SECTOR_SIZE + 1) * CDROM_SECTOR_SIZE;
+            continue;
+        }
+        pos += record->length;
+
+        if(record->nameLength == 1 && (record->name[0] == 0 || record->name[0] == 1))
+            continue;
+
+        LibC::vfsEntry entry;
+        memOperator::memset(&entry, 0, sizeof(LibC::vfsEntry));
+
+        int nameLength = trimmedNameLength(record);
+        if(nameLength >= VFS_NAME_LENGTH)
+            nameLength = VFS_NAME_LENGTH - 1;
+        memOperator::memcpy(entry.name, record->name, nameLength);
+
+        entry.size = record->dataLength;
+        entry.isDir = getEntryType(record) == isoDirectory;
+        entry.creationDate.year = 1900 + record->datetime[0];
+        entry.creationDate.month = record->datetime[1];
+        entry.creationDate.day = record->datetime[2];
+        entry.creationTime.hour = record->datetime[3];
+        entry.creationTime.min = record->datetime[4];
+        entry.creationTime.sec = record->datetime[5];
+
+        result->push_back(entry);
+    }
+
+    return result;
+}
+
+int isoFS::readDirectory(const char* path, uint32_t* cookie, uint8_t* buffer, uint32_t size) {
+    int dirIndex = directoryIndexForPath(path);
+    if(dirIndex == -1)
+        return -1;
+
+    if(!readDirectoryExtent(this->directories[dirIndex - 1].extentLocation))
+        return -1;
+
+    // The cookie is the byte offset of the next record inside the directory extent
+    uint32_t used = 0;
+    uint32_t pos = *cookie;
+    while(pos < this->directoryCacheSize) {
+        directoryRecord* record = (directoryRecord*)(this->directoryCache + pos);
+        if(record->length == 0) {
+            pos = (pos / CDROM_SECTOR_SIZE + 1) * CDROM_SECTOR_SIZE;
+            continue;
+        }
+
+        if(record->nameLength == 1 && (record->name[0] == 0 || record->name[0] == 1)) {
+            pos += record->length;
+            continue;
+        }
+
+        LibC::vfsDirectoryRecord* out = addDirectoryRecord(buffer, size, &used, record->name, trimmedNameLength(record));
+        if(out == 0)
+            break;
+
+        pos += record->length;
+        out->size = record->dataLength;
+        out->isDir = getEntryType(record) == isoDirectory;
+        out->nextCookie = pos;
+        out->creationDate.year = 1900 + record->datetime[0];
+        out->creationDate.month = record->datetime[1];
+        out->creationDate.day = record->datetime[2];
+        out->creationTime.hour = record->datetime[3];
+        out->creationTime.min = record->datetime[4];
+        out->creationTime.sec = record->datetime[5];
+    }
+
+    *cookie = pos;
+    if(used == 0 && pos < this->directoryCacheSize)
+        return VFS_BUFFER_TOO_SMALL;
+    return used;
+}
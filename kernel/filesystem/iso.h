@@ -11,16 +11,16 @@ namespace Kernel {
     struct directoryRecord {
         ak::uint8_t length;
         ak::uint8_t  earLength;
-        ak::uint8_t extentLocation;
-        ak::uint8_t extentLocationBe;
-        ak::uint8_t dataLength;
-        ak::uint8_t dataLengthBe;
+        ak::uint32_t extentLocation;
+        ak::uint32_t extentLocationBe;
+        ak::uint32_t dataLength;
+        ak::uint32_t dataLengthBe;
         ak::uint8_t datetime[7];
         ak::uint8_t flags;
         ak::uint8_t gapSize;
         ak::uint8_t unitSize;
-        ak::uint8_t volSeqNumber;
-        ak::uint8_t volSeqNumberBe;
+        ak::uint16_t volSeqNumber;
+        ak::uint16_t volSeqNumberBe;
         ak::uint8_t nameLength;
         char name[222];
     } __attribute__((packed));
@@ -32,7 +32,7 @@ namespace Kernel {
         char hour[2];
         char minute[2];
         char second[2];
-        cahr hundrdSecond[2];
+        char hundrdSecond[2];
         ak::int8_t timeZon;
     } __attribute__((packed));
 
@@ -63,7 +63,7 @@ namespace Kernel {
         ak::uint32_t optType1PathTable;
         ak::uint32_t typeMPathTable;
         ak::uint32_t opt_type_m_path_table;
-        directoryRecord rootDirectoryRecord;
+        ak::uint8_t rootDirectoryRecord[34];
         char volumeSetId                  [ISODCL (191,   318)];
         char publisherId                   [ISODCL (319,   446)];
         char preparerId                    [ISODCL (447,   574)];
@@ -84,6 +84,28 @@ namespace Kernel {
     #define ISO_START_SECTOR 0x10
     #define CDROM_SECTOR_SIZE 2048
 
+    #define ISO_FLAG_DIRECTORY 0x02
+    #define ISO_ROOT_DIRECTORY_INDEX 1
+
+    struct pathTableEntry {
+        ak::uint8_t nameLength;
+        ak::uint8_t earLength;
+        ak::uint32_t extentLocation;
+        ak::uint16_t parentIndex;
+        char name[];
+    } __attribute__((packed));
+
+    /**
+     * @brief one directory from the path table, chained into the hash buckets of isoFS
+     */
+    struct isoDirectoryIndex {
+        ak::uint32_t extentLocation;
+        ak::uint16_t parentIndex;
+        ak::uint32_t nameHash;
+        char* name;
+        int nextInBucket;
+    };
+
     enum volumeDescriptorType {
         bootRecord = 0,
         pvDescriptor = 1,
@@ -99,7 +121,9 @@ namespace Kernel {
 
     class isoFS : public virtualFileSystem {
       public:
-        iso(Disk* disk, ak::uint32_t start, ak::uint32_t size);
+        isoFS(Disk* disk, ak::uint32_t start, ak::uint32_t size);
+        ~isoFS();
+
         int readFile(const char* filename, uint8_t* buffer, uint32_t offset = 0, uint32_t len = -1);
         int writeFile(const char* filename, uint8_t* buffer, uint32_t len, bool create = true);
 
@@ -111,11 +135,29 @@ namespace Kernel {
 
         uint32_t getFileSize(const char* filename);
         List<LibC::vfsEntry>* directoryList(const char* path);
+        int readDirectory(const char* path, ak::uint32_t* cookie, ak::uint8_t* buffer, ak::uint32_t size);
+        ak::uint32_t fileLocation(const char* path);
 
         bool initialize();
       private:
-        directoryRecord* rootDirectory;
-        directoryRecord* searchInDirectory(directoryRecord* searchIn, const char* name);
+        directoryRecord* rootDirectory = 0;
+
+        isoDirectoryIndex* directories = 0;
+        int directoryCount = 0;
+        int* hashBuckets = 0;
+        ak::uint32_t hashMask = 0;
+
+        ak::uint8_t* directoryCache = 0;
+        ak::uint32_t directoryCacheExtent = 0;
+        ak::uint32_t directoryCacheSize = 0;
+
+        bool loadPathTable(primaryVolumeDescriptor* pvd);
+        int findDirectory(int parentIndex, const char* name, int nameLength);
+        int resolveDirectory(const char* path, const char** lastComponent);
+        int directoryIndexForPath(const char* path);
+
+        bool readDirectoryExtent(ak::uint32_t extent);
+        directoryRecord* searchInDirectory(ak::uint32_t extent, const char* name);
         directoryRecord* getEntry(const char* path);
         isoEntryType getEntryType(directoryRecord* entry);
 
@@ -0,0 +1,308 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#include "readahead.h"
+#include <ak/string.h>
+#include <ak/memoperator.h>
+#include <cpu/idt.h>
+#include <tasking/scheduler.h>
+#include <kernel/system/log.h>
+
+using namespace Kernel::ak;
+using namespace Kernel;
+
+readAheadState readAhead::states[READAHEAD_MAX_FILES];
+uint32_t readAhead::useCounter = 0;
+mutexLock readAhead::lock;
+
+static Thread* worker = 0;
+
+static bool windowContains(readAheadWindow* window, uint32_t offset) {
+    return window->length > 0 && offset >= window->start && offset < window->start + window->length;
+}
+
+static void releaseWindow(readAheadWindow* window) {
+    if(window->buffer)
+        delete[] window->buffer;
+
+    window->buffer = 0;
+    window->capacity = 0;
+    window->length = 0;
+}
+
+static int readLocked(virtualFileSystem* fs, const char* path, uint8_t* buffer, uint32_t offset, uint32_t len) {
+    fs->lock.lock();
+    int result = fs->readFile(path, buffer, offset, len);
+    fs->lock.unlock();
+    return result;
+}
+
+void readAhead::initialize() {
+    memOperator::memset(states, 0, sizeof(states));
+    worker = threadHelper::createFromFunction(workerThread, true);
+}
+
+void readAhead::resetState(readAheadState* state) {
+    state->nextOffset = 0;
+    state->windowSize = READAHEAD_MIN_WINDOW;
+    state->current.length = 0;
+    state->current.endOfFile = false;
+    state->ahead.length = 0;
+    state->ahead.endOfFile = false;
+    state->ahead.stale = false;
+}
+
+readAheadState* readAhead::findState(virtualFileSystem* fs, const char* path, bool create) {
+    uint32_t hash = String::hash(path);
+    readAheadState* victim = 0;
+
+    for(int i = 0; i < READAHEAD_MAX_FILES; i++) {
+        readAheadState* state = &states[i];
+        if(state->fs == fs && state->pathHash == hash && String::strcmp(state->path, path)) {
+            state->lastUse = ++useCounter;
+            return state;
+        }
+
+        if(state->ahead.pending)
+            continue;
+
+        if(victim == 0 || state->lastUse < victim->lastUse)
+            victim = state;
+    }
+
+    if(!create || victim == 0 || String::strlen(path) >= READAHEAD_PATH_LENGTH)
+        return 0;
+
+    // The buffers of the evicted file would otherwise stay allocated until its slot is used by a larger one
+    releaseWindow(&victim->current);
+    releaseWindow(&victim->ahead);
+
+    resetState(victim);
+    victim->fs = fs;
+    victim->pathHash = hash;
+    victim->lastUse = ++useCounter;
+    String::strcpy(victim->path, path);
+    return victim;
+}
+
+bool readAhead::copyFromWindow(readAheadWindow* window, uint8_t* buffer, uint32_t offset, uint32_t len) {
+    if(window->pending || !windowContains(window, offset))
+        return false;
+
+    uint32_t available = window->start + window->length - offset;
+    if(available < len && !window->endOfFile)
+        return false;
+
+    memOperator::memcpy(buffer, window->buffer + (offset - window->start), available < len ? available : len);
+    return true;
+}
+
+void readAhead::schedule(readAheadState* state, uint32_t start) {
+    readAheadWindow* window = &state->ahead;
+    if(window->pending)
+        return;
+
+    if(window->capacity < state->windowSize) {
+        if(window->buffer)
+            delete[] window->buffer;
+
+        window->buffer = new uint8_t[state->windowSize];
+        window->capacity = state->windowSize;
+    }
+
+    window->start = start;
+    window->length = state->windowSize;
+    window->endOfFile = false;
+    window->stale = false;
+    window->pending = true;
+
+    if(worker)
+        scheduler::unblock(worker);
+}
+
+int readAhead::read(virtualFileSystem* fs, const char* path, uint8_t* buffer, uint32_t offset, uint32_t len) {
+    // A read of the whole file or from memory gains nothing from prefetching
+    if(len == (uint32_t)-1 || !fs->readAheadEnabled)
+        return readLocked(fs, path, buffer, offset, len);
+
+    lock.lock();
+    readAheadState* state = findState(fs, path, true);
+    if(state == 0) {
+        lock.unlock();
+        return readLocked(fs, path, buffer, offset, len);
+    }
+
+    bool sequential = (offset == state->nextOffset);
+    state->nextOffset = offset + len;
+
+    if(!sequential) {
+        state->windowSize /= 4;
+        if(state->windowSize < READAHEAD_MIN_WINDOW)
+            state->windowSize = READAHEAD_MIN_WINDOW;
+
+        state->current.length = 0;
+        if(!state->ahead.pending)
+            state->ahead.length = 0;
+    }
+
+    // The data we want is already on its way, wait for it instead of issuing a second read
+    while(state->ahead.pending && windowContains(&state->ahead, offset)) {
+        lock.unlock();
+        scheduler::yield();
+        lock.lock();
+
+        if(state->fs != fs || !String::strcmp(state->path, path)) {
+            lock.unlock();
+            return readLocked(fs, path, buffer, offset, len);
+        }
+    }
+
+    uint32_t copied = 0;
+    bool hit = false;
+    if(copyFromWindow(&state->current, buffer, offset, len)) {
+        hit = true;
+        copied = state->current.start + state->current.length - offset;
+    }
+    else if(copyFromWindow(&state->ahead, buffer, offset, len)) {
+        hit = true;
+        copied = state->ahead.start + state->ahead.length - offset;
+    }
+    else if(windowContains(&state->current, offset) && state->current.start + state->current.length == state->ahead.start) {
+        uint32_t first = state->current.start + state->current.length - offset;
+        if(copyFromWindow(&state->ahead, buffer + first, state->ahead.start, len - first)) {
+            memOperator::memcpy(buffer, state->current.buffer + (offset - state->current.start), first);
+            hit = true;
+            copied = first + state->ahead.length;
+        }
+    }
+
+    if(hit) {
+        fs->raStats.hits++;
+        if(copied > len)
+            copied = len;
+
+        // Once the reader crosses into the prefetched window it becomes the current one
+        if(!state->ahead.pending && windowContains(&state->ahead, offset + copied - 1)) {
+            readAheadWindow tmp = state->current;
+            state->current = state->ahead;
+            state->ahead = tmp;
+            state->ahead.length = 0;
+        }
+
+        if(sequential && !state->current.endOfFile && !state->ahead.pending && state->ahead.length == 0) {
+            if(state->windowSize < READAHEAD_MAX_WINDOW)
+                state->windowSize *= 2;
+            schedule(state, state->current.start + state->current.length);
+        }
+
+        lock.unlock();
+        return copied;
+    }
+
+    fs->raStats.misses++;
+    state->current.length = 0;
+    lock.unlock();
+
+    int result = readLocked(fs, path, buffer, offset, len);
+
+    if(sequential && result == (int)len) {
+        lock.lock();
+        if(state->fs == fs && String::strcmp(state->path, path))
+            schedule(state, offset + len);
+        lock.unlock();
+    }
+
+    return result;
+}
+
+void readAhead::invalidate(virtualFileSystem* fs, const char* path) {
+    lock.lock();
+    readAheadState* state = findState(fs, path, false);
+    if(state) {
+        state->current.length = 0;
+        if(state->ahead.pending)
+            state->ahead.stale = true;
+        else
+            state->ahead.length = 0;
+    }
+    lock.unlock();
+}
+
+void readAhead::invalidateAll(virtualFileSystem* fs) {
+    lock.lock();
+    for(int i = 0; i < READAHEAD_MAX_FILES; i++) {
+        if(states[i].fs != fs)
+            continue;
+
+        states[i].fs = 0;
+        releaseWindow(&states[i].current);
+        if(states[i].ahead.pending)
+            states[i].ahead.stale = true;
+        else
+            releaseWindow(&states[i].ahead);
+    }
+    lock.unlock();
+}
+
+void readAhead::workerThread() {
+    while(true) {
+        readAheadState* job = 0;
+        virtualFileSystem* fs = 0;
+
+        lock.lock();
+        for(int i = 0; i < READAHEAD_MAX_FILES && job == 0; i++) {
+            if(!states[i].ahead.pending)
+                continue;
+
+            // Invalidated before we got to it, nothing to read
+            if(states[i].fs == 0 || states[i].ahead.stale) {
+                if(states[i].fs == 0)
+                    releaseWindow(&states[i].ahead);
+                states[i].ahead.length = 0;
+                states[i].ahead.stale = false;
+                states[i].ahead.pending = false;
+                continue;
+            }
+
+            job = &states[i];
+            fs = job->fs;
+        }
+        lock.unlock();
+
+        if(job == 0) {
+            // Check again with interrupts off so a schedule() can not slip in before we block
+            interruptDescriptorTable::disableInterrupts();
+            bool idle = true;
+            for(int i = 0; i < READAHEAD_MAX_FILES; i++)
+                if(states[i].ahead.pending)
+                    idle = false;
+
+            if(idle)
+                scheduler::block(worker, Sleep);
+            interruptDescriptorTable::enableInterrupts();
+            continue;
+        }
+
+        // Buffers of a pending window are never reallocated or stolen, so this is safe without the lock
+        readAheadWindow* window = &job->ahead;
+        int result = readLocked(fs, job->path, window->buffer, window->start, window->length);
+
+        lock.lock();
+        if(result < 0 || window->stale) {
+            window->length = 0;
+        }
+        else {
+            window->endOfFile = (uint32_t)result < window->length;
+            window->length = result;
+            fs->raStats.prefetchedBytes += result;
+        }
+        window->stale = false;
+        window->pending = false;
+
+        // The filesystem was unmounted while we read, nobody will look at this window again
+        if(job->fs == 0)
+            releaseWindow(window);
+        lock.unlock();
+    }
+}
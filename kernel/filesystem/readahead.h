@@ -0,0 +1,70 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#pragma once
+
+#include <ak/types.h>
+#include <tasking/lock.h>
+#include "virtualfilesystem.h"
+
+namespace Kernel {
+
+    #define READAHEAD_MIN_WINDOW    16_KB
+    #define READAHEAD_MAX_WINDOW    512_KB
+    #define READAHEAD_MAX_FILES     32
+    #define READAHEAD_PATH_LENGTH   128
+
+    /**
+     * @brief one prefetched range of a file, filled by the readahead thread
+     */
+    struct readAheadWindow {
+        ak::uint8_t* buffer;
+        ak::uint32_t capacity;
+        ak::uint32_t start;
+        ak::uint32_t length;
+        bool endOfFile;
+        bool stale;
+        bool pending;
+    };
+
+    /**
+     * @brief per open file state: the window being consumed and the one being prefetched behind it
+     */
+    struct readAheadState {
+        virtualFileSystem* fs;
+        char path[READAHEAD_PATH_LENGTH];
+        ak::uint32_t pathHash;
+        ak::uint32_t lastUse;
+
+        ak::uint32_t nextOffset;
+        ak::uint32_t windowSize;
+
+        readAheadWindow current;
+        readAheadWindow ahead;
+    };
+
+    /**
+     * @brief readAhead[read, invalidate, worker thread]
+     */
+    class readAhead {
+      public:
+        static void initialize();
+
+        static int read(virtualFileSystem* fs, const char* path, ak::uint8_t* buffer, ak::uint32_t offset, ak::uint32_t len);
+        static void invalidate(virtualFileSystem* fs, const char* path);
+        static void invalidateAll(virtualFileSystem* fs);
+
+      private:
+        static readAheadState states[READAHEAD_MAX_FILES];
+        static ak::uint32_t useCounter;
+        static mutexLock lock;
+
+        static readAheadState* findState(virtualFileSystem* fs, const char* path, bool create);
+        static void resetState(readAheadState* state);
+        static bool copyFromWindow(readAheadWindow* window, ak::uint8_t* buffer, ak::uint32_t offset, ak::uint32_t len);
+        static void schedule(readAheadState* state, ak::uint32_t start);
+
+        static void workerThread();
+    };
+}
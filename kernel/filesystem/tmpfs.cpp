@@ -0,0 +1,590 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#include "tmpfs.h"
+#include <ak/string.h>
+#include <ak/memoperator.h>
+#include <memory/virtualmemory.h>
+#include <memory/pagecache.h>
+#include <kernel/system/log.h>
+
+using namespace Kernel::ak;
+using namespace Kernel;
+
+uint32_t tmpfs::regionMap[TMPFS_REGION_PAGES / 32];
+mutexLock tmpfs::regionLock;
+
+static inline uint32_t reverseBits(uint32_t value) {
+    uint32_t result = 0;
+    for(int i = 0; i < 32; i++, value >>= 1)
+        result = (result << 1) | (value & 1);
+    return result;
+}
+
+static int componentLength(const char* path) {
+    int length = 0;
+    while(path[length] != '\0' && path[length] != PATH_SEPERATOR_C)
+        length++;
+    return length;
+}
+
+tmpfs::tmpfs(uint32_t maxSize)
+: virtualFileSystem(0, 0, 0) {
+    this->Name = "Temporary Filesystem";
+    this->maxPages = maxSize / PAGE_SIZE;
+    this->readAheadEnabled = false;
+}
+
+tmpfs::~tmpfs() {
+    // Pages still mapped somewhere become the page cache's, they are not freed here
+    pageCache::forgetFilesystem(this);
+
+    nodesLock.lock();
+    if(this->root)
+        destroyNode(this->root);
+
+    while(pinnedPages.size() > 0) {
+        delete pinnedPages[0];
+        pinnedPages.remove(0);
+    }
+    nodesLock.unlock();
+}
+
+bool tmpfs::initialize() {
+    this->root = createNode("", 0, true);
+    return true;
+}
+
+uint32_t tmpfs::allocateRegion(uint32_t pages) {
+    regionLock.lock();
+
+    uint32_t run = 0;
+    for(uint32_t page = 0; page < TMPFS_REGION_PAGES; page++) {
+        if(regionMap[page / 32] & (1 << (page % 32))) {
+            run = 0;
+            continue;
+        }
+
+        if(++run < pages)
+            continue;
+
+        uint32_t start = page + 1 - pages;
+        for(uint32_t i = start; i <= page; i++)
+            regionMap[i / 32] |= (1 << (i % 32));
+
+        regionLock.unlock();
+        return TMPFS_REGION_START + start * PAGE_SIZE;
+    }
+
+    regionLock.unlock();
+    return 0;
+}
+
+void tmpfs::freeRegion(uint32_t virtAddress, uint32_t pages) {
+    uint32_t start = (virtAddress - TMPFS_REGION_START) / PAGE_SIZE;
+
+    regionLock.lock();
+    for(uint32_t i = start; i < start + pages; i++)
+        regionMap[i / 32] &= ~(1 << (i % 32));
+    regionLock.unlock();
+}
+
+tmpfsNode* tmpfs::createNode(const char* name, int length, bool directory) {
+    tmpfsNode* node = new tmpfsNode;
+    memOperator::memset(node, 0, sizeof(tmpfsNode));
+
+    node->name = new char[length + 1];
+    memOperator::memcpy(node->name, name, length);
+    node->name[length] = '\0';
+    node->nameHash = String::hash(name, length, true);
+    node->isDirectory = directory;
+
+    if(directory) {
+        node->bucketCount = TMPFS_INITIAL_BUCKETS;
+        node->buckets = new tmpfsNode*[node->bucketCount];
+        memOperator::memset(node->buckets, 0, node->bucketCount * sizeof(tmpfsNode*));
+    }
+
+    return node;
+}
+
+void tmpfs::destroyNode(tmpfsNode* node) {
+    if(node->isDirectory) {
+        for(uint32_t b = 0; b < node->bucketCount; b++)
+            for(tmpfsNode* child = node->buckets[b]; child != 0; ) {
+                tmpfsNode* next = child->nextInBucket;
+                destroyNode(child);
+                child = next;
+            }
+
+        delete[] node->buckets;
+    }
+    else {
+        shrinkFile(node, 0);
+        if(node->extents)
+            delete[] node->extents;
+    }
+
+    delete[] node->name;
+    delete node;
+}
+
+void tmpfs::insertChild(tmpfsNode* dir, tmpfsNode* child) {
+    // Keep chains short by doubling the table once it averages two entries per bucket
+    if(dir->entryCount >= dir->bucketCount * 2) {
+        uint32_t bucketCount = dir->bucketCount * 2;
+        tmpfsNode** buckets = new tmpfsNode*[bucketCount];
+        memOperator::memset(buckets, 0, bucketCount * sizeof(tmpfsNode*));
+
+        for(uint32_t b = 0; b < dir->bucketCount; b++)
+            for(tmpfsNode* node = dir->buckets[b]; node != 0; ) {
+                tmpfsNode* next = node->nextInBucket;
+                node->nextInBucket = buckets[node->nameHash % bucketCount];
+                buckets[node->nameHash % bucketCount] = node;
+                node = next;
+            }
+
+        delete[] dir->buckets;
+        dir->buckets = buckets;
+        dir->bucketCount = bucketCount;
+    }
+
+    uint32_t bucket = child->nameHash % dir->bucketCount;
+    child->nextInBucket = dir->buckets[bucket];
+    dir->buckets[bucket] = child;
+    dir->entryCount++;
+}
+
+tmpfsNode* tmpfs::findChild(tmpfsNode* dir, const char* name, int length) {
+    // Names keep their case but are matched without it, like on the FAT and ISO disks
+    uint32_t hash = String::hash(name, length, true);
+    for(tmpfsNode* node = dir->buckets[hash % dir->bucketCount]; node != 0; node = node->nextInBucket) {
+        if(node->nameHash != hash || String::strlen(node->name) != length)
+            continue;
+
+        bool equal = true;
+        for(int i = 0; i < length && equal; i++)
+            equal = String::uppercase(node->name[i]) == String::uppercase(name[i]);
+
+        if(equal)
+            return node;
+    }
+
+    return 0;
+}
+
+tmpfsNode* tmpfs::lookup(const char* path, const char** lastName, tmpfsNode** parent) {
+    tmpfsNode* node = this->root;
+    if(parent)
+        *parent = 0;
+
+    while(*path == PATH_SEPERATOR_C)
+        path++;
+
+    while(*path != '\0') {
+        if(!node->isDirectory)
+            return 0;
+
+        int length = componentLength(path);
+        bool last = path[length] == '\0' || path[length + 1] == '\0';
+        if(last) {
+            if(parent)
+                *parent = node;
+            if(lastName)
+                *lastName = path;
+        }
+
+        node = findChild(node, path, length);
+        if(node == 0 || last)
+            return node;
+
+        path += length + 1;
+    }
+
+    return node;
+}
+
+int tmpfs::createEntry(const char* path, bool directory) {
+    const char* name = 0;
+    tmpfsNode* parent = 0;
+    if(lookup(path, &name, &parent) != 0 || parent == 0 || !parent->isDirectory)
+        return -1;
+
+    insertChild(parent, createNode(name, componentLength(name), directory));
+    return 0;
+}
+
+void* tmpfs::allocateBlock() {
+    void* phys = physicalMemoryManager::allocateBlock();
+    if(phys != 0)
+        return phys;
+
+    // Reclaiming unpins borrowed pages, which needs the nodes lock
+    nodesLock.unlock();
+    uint32_t freed = pageCache::reclaim(16);
+    nodesLock.lock();
+
+    return freed > 0 ? physicalMemoryManager::allocateBlock() : 0;
+}
+
+void tmpfs::releaseBlock(void* virtAddress) {
+    uint32_t phys = (uint32_t)virtualMemoryManager::virtualToPhysical(virtAddress);
+    virtualMemoryManager::unmapPage(virtAddress);
+
+    // A page the cache still maps is freed by the last unpin
+    tmpfsPinnedPage* pin = findPin(phys);
+    if(pin != 0)
+        pin->orphaned = true;
+    else
+        physicalMemoryManager::freeBlock((void*)phys);
+}
+
+tmpfsPinnedPage* tmpfs::findPin(uint32_t physAddress) {
+    for(int i = 0; i < pinnedPages.size(); i++)
+        if(pinnedPages[i]->physAddress == physAddress)
+            return pinnedPages[i];
+
+    return 0;
+}
+
+bool tmpfs::unsharePages(tmpfsNode* file, uint32_t pages) {
+    // Mappings keep the old contents, the file continues in fresh pages
+    for(uint32_t i = 0; i < pages && i < file->pages; i++) {
+        void* virt = pageAddress(file, i);
+        uint32_t old = (uint32_t)virtualMemoryManager::virtualToPhysical(virt);
+        if(findPin(old) == 0)
+            continue;
+
+        void* phys = allocateBlock();
+        if(phys == 0)
+            return false;
+
+        // Allocating may have dropped the lock, the last unpin could have given the page back
+        tmpfsPinnedPage* pin = findPin(old);
+        if(pin == 0) {
+            physicalMemoryManager::freeBlock(phys);
+            continue;
+        }
+
+        pin->orphaned = true;
+        virtualMemoryManager::mapVirtualToPhysical(phys, virt, true, true);
+        virtualMemoryManager::invalidatePage((uint32_t)virt);
+    }
+
+    return true;
+}
+
+bool tmpfs::growFile(tmpfsNode* file, uint32_t pages) {
+    if(this->usedPages + pages > this->maxPages)
+        return false;
+
+    uint32_t virt = allocateRegion(pages);
+    if(virt == 0)
+        return false;
+
+    for(uint32_t i = 0; i < pages; i++) {
+        void* phys = allocateBlock();
+        if(phys == 0) {
+            for(uint32_t j = 0; j < i; j++)
+                releaseBlock((void*)(virt + j * PAGE_SIZE));
+
+            freeRegion(virt, pages);
+            return false;
+        }
+
+        virtualMemoryManager::mapVirtualToPhysical(phys, (void*)(virt + i * PAGE_SIZE), true, true);
+        virtualMemoryManager::invalidatePage(virt + i * PAGE_SIZE);
+    }
+
+    // Extend the last extent when the region happened to continue right behind it
+    tmpfsExtent* last = file->extentCount > 0 ? &file->extents[file->extentCount - 1] : 0;
+    if(last != 0 && last->virtAddress + last->pages * PAGE_SIZE == virt) {
+        last->pages += pages;
+    }
+    else {
+        if(file->extentCount == file->extentCapacity) {
+            uint32_t capacity = file->extentCapacity ? file->extentCapacity * 2 : 4;
+            tmpfsExtent* extents = new tmpfsExtent[capacity];
+            if(file->extents) {
+                memOperator::memcpy(extents, file->extents, file->extentCount * sizeof(tmpfsExtent));
+                delete[] file->extents;
+            }
+
+            file->extents = extents;
+            file->extentCapacity = capacity;
+        }
+
+        file->extents[file->extentCount].virtAddress = virt;
+        file->extents[file->extentCount].pages = pages;
+        file->extentCount++;
+    }
+
+    file->pages += pages;
+    this->usedPages += pages;
+    return true;
+}
+
+void tmpfs::shrinkFile(tmpfsNode* file, uint32_t pages) {
+    while(file->pages > pages) {
+        tmpfsExtent* last = &file->extents[file->extentCount - 1];
+        uint32_t drop = file->pages - pages;
+        if(drop > last->pages)
+            drop = last->pages;
+
+        uint32_t first = last->virtAddress + (last->pages - drop) * PAGE_SIZE;
+        for(uint32_t i = 0; i < drop; i++)
+            releaseBlock((void*)(first + i * PAGE_SIZE));
+        freeRegion(first, drop);
+
+        last->pages -= drop;
+        if(last->pages == 0)
+            file->extentCount--;
+
+        file->pages -= drop;
+        this->usedPages -= drop;
+    }
+}
+
+uint8_t* tmpfs::pageAddress(tmpfsNode* file, uint32_t index) {
+    for(uint32_t e = 0; e < file->extentCount; e++) {
+        if(index < file->extents[e].pages)
+            return (uint8_t*)(file->extents[e].virtAddress + index * PAGE_SIZE);
+        index -= file->extents[e].pages;
+    }
+
+    return 0;
+}
+
+int tmpfs::readFile(const char* filename, uint8_t* buffer, uint32_t offset, uint32_t len) {
+    nodesLock.lock();
+    tmpfsNode* file = lookup(filename);
+    if(file == 0 || file->isDirectory) {
+        nodesLock.unlock();
+        return -1;
+    }
+
+    if(offset >= file->size) {
+        nodesLock.unlock();
+        return 0;
+    }
+    if(len > file->size - offset)
+        len = file->size - offset;
+
+    // Extents are virtually contiguous, so every extent is a single copy
+    uint32_t copied = 0;
+    uint32_t extentStart = 0;
+    for(uint32_t e = 0; e < file->extentCount && copied < len; e++) {
+        uint32_t extentSize = file->extents[e].pages * PAGE_SIZE;
+        uint32_t position = offset + copied;
+
+        if(position < extentStart + extentSize) {
+            uint32_t part = extentStart + extentSize - position;
+            if(part > len - copied)
+                part = len - copied;
+
+            memOperator::memcpy(buffer + copied, (uint8_t*)file->extents[e].virtAddress + (position - extentStart), part);
+            copied += part;
+        }
+
+        extentStart += extentSize;
+    }
+
+    nodesLock.unlock();
+    return copied;
+}
+
+int tmpfs::writeFile(const char* filename, uint8_t* buffer, uint32_t len, bool create) {
+    nodesLock.lock();
+    tmpfsNode* file = lookup(filename);
+    if(file == 0) {
+        if(!create || createEntry(filename, false) != 0) {
+            nodesLock.unlock();
+            return -1;
+        }
+        file = lookup(filename);
+    }
+
+    if(file->isDirectory) {
+        nodesLock.unlock();
+        return -1;
+    }
+
+    uint32_t needed = (len + PAGE_SIZE - 1) / PAGE_SIZE;
+    if(!unsharePages(file, needed)) {
+        Log(Warning, "tmpfs: No memory to rewrite mapped file %s", filename);
+        nodesLock.unlock();
+        return -1;
+    }
+
+    if(needed > file->pages && !growFile(file, needed - file->pages)) {
+        Log(Warning, "tmpfs: No space left for %s (%d of %d pages used)", filename, this->usedPages, this->maxPages);
+        nodesLock.unlock();
+        return -1;
+    }
+    shrinkFile(file, needed);
+
+    uint32_t written = 0;
+    for(uint32_t e = 0; e < file->extentCount && written < len; e++) {
+        uint32_t part = file->extents[e].pages * PAGE_SIZE;
+        if(part > len - written)
+            part = len - written;
+
+        memOperator::memcpy((uint8_t*)file->extents[e].virtAddress, buffer + written, part);
+        written += part;
+    }
+
+    // Mapped pages expose the whole last page, it must not leak old data
+    if(len % PAGE_SIZE != 0)
+        memOperator::memset(pageAddress(file, needed - 1) + (len % PAGE_SIZE), 0, PAGE_SIZE - (len % PAGE_SIZE));
+
+    file->size = len;
+    nodesLock.unlock();
+    return len;
+}
+
+bool tmpfs::fileExists(const char* filename) {
+    nodesLock.lock();
+    tmpfsNode* node = lookup(filename);
+    bool exists = node != 0 && !node->isDirectory;
+    nodesLock.unlock();
+    return exists;
+}
+
+bool tmpfs::directoryExists(const char* filename) {
+    nodesLock.lock();
+    tmpfsNode* node = lookup(filename);
+    bool exists = node != 0 && node->isDirectory;
+    nodesLock.unlock();
+    return exists;
+}
+
+int tmpfs::createFile(const char* path) {
+    nodesLock.lock();
+    int result = createEntry(path, false);
+    nodesLock.unlock();
+    return result;
+}
+
+int tmpfs::createDirectory(const char* path) {
+    nodesLock.lock();
+    int result = createEntry(path, true);
+    nodesLock.unlock();
+    return result;
+}
+
+uint32_t tmpfs::getFileSize(const char* filename) {
+    nodesLock.lock();
+    tmpfsNode* node = lookup(filename);
+    uint32_t size = (node == 0 || node->isDirectory) ? -1 : node->size;
+    nodesLock.unlock();
+    return size;
+}
+
+List<LibC::vfsEntry>* tmpfs::directoryList(const char* path) {
+    nodesLock.lock();
+    tmpfsNode* dir = lookup(path);
+    if(dir == 0 || !dir->isDirectory) {
+        nodesLock.unlock();
+        return 0;
+    }
+
+    List<LibC::vfsEntry>* result = new List<LibC::vfsEntry>();
+    for(uint32_t b = 0; b < dir->bucketCount; b++)
+        for(tmpfsNode* node = dir->buckets[b]; node != 0; node = node->nextInBucket) {
+            LibC::vfsEntry entry;
+            memOperator::memset(&entry, 0, sizeof(LibC::vfsEntry));
+
+            String::strncpy(entry.name, node->name, VFS_NAME_LENGTH - 1);
+            entry.size = node->size;
+            entry.isDir = node->isDirectory;
+            result->push_back(entry);
+        }
+
+    nodesLock.unlock();
+    return result;
+}
+
+int tmpfs::readDirectory(const char* path, uint32_t* cookie, uint8_t* buffer, uint32_t size) {
+    if(*cookie == TMPFS_COOKIE_END)
+        return 0;
+
+    nodesLock.lock();
+    tmpfsNode* dir = lookup(path);
+    if(dir == 0 || !dir->isDirectory) {
+        nodesLock.unlock();
+        return -1;
+    }
+
+    // The cookie counts through the buckets with its bits reversed, so a table that doubled in between still
+    // continues with exactly the buckets not returned yet. A bucket is returned whole or not at all
+    uint32_t mask = dir->bucketCount - 1;
+    uint32_t cursor = *cookie;
+    uint32_t used = 0;
+    do {
+        uint32_t bucketStart = used;
+        uint32_t next = reverseBits(reverseBits(cursor | ~mask) + 1);
+
+        bool fits = true;
+        for(tmpfsNode* node = dir->buckets[cursor & mask]; node != 0; node = node->nextInBucket) {
+            LibC::vfsDirectoryRecord* record = addDirectoryRecord(buffer, size, &used, node->name, String::strlen(node->name));
+            if(record == 0) {
+                fits = false;
+                break;
+            }
+
+            // Continuing in the middle of a bucket repeats the entries before it
+            record->size = node->size;
+            record->isDir = node->isDirectory;
+            record->nextCookie = node->nextInBucket == 0 ? (next == 0 ? TMPFS_COOKIE_END : next) : cursor;
+        }
+
+        if(!fits) {
+            used = bucketStart;
+            break;
+        }
+        cursor = next == 0 ? TMPFS_COOKIE_END : next;
+    } while(cursor != TMPFS_COOKIE_END);
+
+    nodesLock.unlock();
+
+    *cookie = cursor;
+    if(used == 0 && cursor != TMPFS_COOKIE_END)
+        return VFS_BUFFER_TOO_SMALL;
+    return used;
+}
+
+uint32_t tmpfs::pinPage(const char* path, uint32_t index) {
+    nodesLock.lock();
+    tmpfsNode* file = lookup(path);
+    if(file == 0 || file->isDirectory || index >= file->pages) {
+        nodesLock.unlock();
+        return 0;
+    }
+
+    uint32_t phys = (uint32_t)virtualMemoryManager::virtualToPhysical(pageAddress(file, index));
+    tmpfsPinnedPage* pin = findPin(phys);
+    if(pin == 0) {
+        pin = new tmpfsPinnedPage;
+        pin->physAddress = phys;
+        pin->count = 0;
+        pin->orphaned = false;
+        pinnedPages.push_back(pin);
+    }
+    pin->count++;
+
+    nodesLock.unlock();
+    return phys;
+}
+
+void tmpfs::unpinPage(const char* path, uint32_t index, uint32_t physAddress) {
+    nodesLock.lock();
+    tmpfsPinnedPage* pin = findPin(physAddress);
+    if(pin != 0 && --pin->count == 0) {
+        pinnedPages.remove(pin);
+        if(pin->orphaned)
+            physicalMemoryManager::freeBlock((void*)physAddress);
+        delete pin;
+    }
+    nodesLock.unlock();
+}
@@ -0,0 +1,109 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#pragma once
+
+#include "virtualfilesystem.h"
+#include <tasking/lock.h>
+
+namespace Kernel {
+
+    #define TMPFS_REGION_START      0xD0000000
+    #define TMPFS_REGION_END        0xE0000000
+    #define TMPFS_REGION_PAGES      ((TMPFS_REGION_END - TMPFS_REGION_START) / 4_KB)
+    #define TMPFS_INITIAL_BUCKETS   8
+    #define TMPFS_COOKIE_END        0xFFFFFFFF
+
+    /**
+     * @brief run of pages that are contiguous in the tmpfs region, each backed by its own physical block
+     */
+    struct tmpfsExtent {
+        ak::uint32_t virtAddress;
+        ak::uint32_t pages;
+    };
+
+    /**
+     * @brief physical page lent to the page cache, orphaned once the file no longer uses it
+     */
+    struct tmpfsPinnedPage {
+        ak::uint32_t physAddress;
+        ak::uint32_t count;
+        bool orphaned;
+    };
+
+    /**
+     * @brief file or directory, directories keep their children in a hash table
+     */
+    struct tmpfsNode {
+        char* name;
+        ak::uint32_t nameHash;
+        bool isDirectory;
+        tmpfsNode* nextInBucket;
+
+        ak::uint32_t size;
+        ak::uint32_t pages;
+        tmpfsExtent* extents;
+        ak::uint32_t extentCount;
+        ak::uint32_t extentCapacity;
+
+        tmpfsNode** buckets;
+        ak::uint32_t bucketCount;
+        ak::uint32_t entryCount;
+    };
+
+    class tmpfs : public virtualFileSystem {
+    private:
+        tmpfsNode* root = 0;
+        ak::uint32_t maxPages;
+        ak::uint32_t usedPages = 0;
+
+        // Guards the tree against the page cache, which unpins pages without holding the filesystem lock
+        mutexLock nodesLock;
+        List<tmpfsPinnedPage*> pinnedPages;
+
+        static ak::uint32_t regionMap[TMPFS_REGION_PAGES / 32];
+        static mutexLock regionLock;
+
+        static ak::uint32_t allocateRegion(ak::uint32_t pages);
+        static void freeRegion(ak::uint32_t virtAddress, ak::uint32_t pages);
+
+        tmpfsNode* createNode(const char* name, int length, bool directory);
+        void destroyNode(tmpfsNode* node);
+        void insertChild(tmpfsNode* dir, tmpfsNode* child);
+        tmpfsNode* findChild(tmpfsNode* dir, const char* name, int length);
+        tmpfsNode* lookup(const char* path, const char** lastName = 0, tmpfsNode** parent = 0);
+        int createEntry(const char* path, bool directory);
+
+        void* allocateBlock();
+        void releaseBlock(void* virtAddress);
+        tmpfsPinnedPage* findPin(ak::uint32_t physAddress);
+        bool unsharePages(tmpfsNode* file, ak::uint32_t pages);
+
+        bool growFile(tmpfsNode* file, ak::uint32_t pages);
+        void shrinkFile(tmpfsNode* file, ak::uint32_t pages);
+        ak::uint8_t* pageAddress(tmpfsNode* file, ak::uint32_t index);
+
+    public:
+        tmpfs(ak::uint32_t maxSize);
+        ~tmpfs();
+
+        bool initialize();
+
+        int readFile(const char* filename, uint8_t* buffer, uint32_t offset = 0, uint32_t len = -1);
+        int writeFile(const char* filename, uint8_t* buffer, uint32_t len, bool create = true);
+
+        bool fileExists(const char* filename);
+        bool directoryExists(const char* filename);
+
+        int createFile(const char* path);
+        int createDirectory(const char* path);
+
+        uint32_t getFileSize(const char* filename);
+        List<LibC::vfsEntry>* directoryList(const char* path);
+        int readDirectory(const char* path, ak::uint32_t* cookie, ak::uint8_t* buffer, ak::uint32_t size);
+
+        ak::uint32_t pinPage(const char* path, ak::uint32_t index);
+        void unpinPage(const char* path, ak::uint32_t index, ak::uint32_t physAddress);
+    };
+}
@@ -0,0 +1,529 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#include "vfsmanager.h"
+#include "readahead.h"
+#include "boottrace.h"
+#include "tmpfs.h"
+#include <memory/pagecache.h>
+#include <kernel/disks/writeback.h>
+#include <ak/string.h>
+#include <ak/convert.h>
+#include <ak/memoperator.h>
+#include <kernel/system/log.h>
+
+using namespace Kernel::ak;
+using namespace Kernel;
+
+#define BOOT_FILE "boot" PATH_SEPERATOR_S "bin"
+
+static inline bool isSeparator(char c) {
+    return c == PATH_SEPERATOR_C || c == '/';
+}
+
+static int componentLength(const char* path) {
+    int length = 0;
+    while(path[length] != '\0' && !isSeparator(path[length]))
+        length++;
+    return length;
+}
+
+static inline uint32_t componentHash(const char* name, int length) {
+    return String::hash(name, length, true);
+}
+
+static inline uint32_t mountBucket(mountNode* parent, uint32_t hash) {
+    return (hash ^ ((uint32_t)parent >> 4)) % MOUNT_BUCKETS;
+}
+
+// Mount name of the n-th filesystem, like "0:"
+static void diskMountName(int index, char* name) {
+    char digits[12];
+    int count = 0;
+    do {
+        digits[count++] = '0' + (index % 10);
+        index /= 10;
+    } while(index > 0);
+
+    int pos = 0;
+    while(count > 0)
+        name[pos++] = digits[--count];
+    name[pos++] = ':';
+    name[pos] = '\0';
+}
+
+vfsManager::vfsManager() {
+    this->Filesystems = new List<virtualFileSystem*>();
+
+    memOperator::memset(&this->mountRoot, 0, sizeof(mountNode));
+    for(int i = 0; i < MOUNT_BUCKETS; i++)
+        this->mountBuckets[i] = 0;
+
+    // Scratch space lives in memory only, it has no disk number and is reached by its name alone
+    this->temporary = new tmpfs(TMPFS_MAX_SIZE);
+    if(this->temporary->initialize())
+        addMountPoint(TMPFS_MOUNT_POINT, this->temporary);
+}
+
+mountNode* vfsManager::findChild(mountNode* parent, const char* name, int length, uint32_t hash) {
+    for(mountNode* node = this->mountBuckets[mountBucket(parent, hash)]; node != 0; node = node->nextInBucket) {
+        if(node->parent != parent || node->nameHash != hash || String::strlen(node->name) != length)
+            continue;
+
+        bool equal = true;
+        for(int i = 0; i < length && equal; i++)
+            equal = String::uppercase(node->name[i]) == String::uppercase(name[i]);
+
+        if(equal)
+            return node;
+    }
+
+    return 0;
+}
+
+mountNode* vfsManager::findMountPoint(const char* name) {
+    mountNode* node = &this->mountRoot;
+    while(node != 0) {
+        while(isSeparator(*name))
+            name++;
+        if(*name == '\0')
+            break;
+
+        int length = componentLength(name);
+        node = findChild(node, name, length, componentHash(name, length));
+        name += length;
+    }
+
+    return node == &this->mountRoot ? 0 : node;
+}
+
+bool vfsManager::addMountPoint(const char* name, virtualFileSystem* vfs) {
+    mountNode* node = &this->mountRoot;
+    while(true) {
+        while(isSeparator(*name))
+            name++;
+        if(*name == '\0')
+            break;
+
+        int length = componentLength(name);
+        if(length >= MOUNT_NAME_LENGTH)
+            return false;
+
+        uint32_t hash = componentHash(name, length);
+        mountNode* child = findChild(node, name, length, hash);
+        if(child == 0) {
+            child = new mountNode;
+            memOperator::memset(child, 0, sizeof(mountNode));
+            memOperator::memcpy(child->name, name, length);
+            child->parent = node;
+            child->nameHash = hash;
+
+            uint32_t bucket = mountBucket(node, hash);
+            child->nextInBucket = this->mountBuckets[bucket];
+            this->mountBuckets[bucket] = child;
+            node->children++;
+        }
+
+        node = child;
+        name += length;
+    }
+
+    if(node == &this->mountRoot)
+        return false;
+
+    node->fs = vfs;
+    return true;
+}
+
+void vfsManager::releaseNode(mountNode* node) {
+    // Drop the node and every parent that only existed to lead to it
+    while(node != &this->mountRoot && node->fs == 0 && node->children == 0) {
+        mountNode** link = &this->mountBuckets[mountBucket(node->parent, node->nameHash)];
+        while(*link != node)
+            link = &(*link)->nextInBucket;
+        *link = node->nextInBucket;
+
+        mountNode* parent = node->parent;
+        parent->children--;
+        delete node;
+        node = parent;
+    }
+}
+
+bool vfsManager::removeMountPoint(const char* name) {
+    mountNode* node = findMountPoint(name);
+    if(node == 0 || node->fs == 0)
+        return false;
+
+    node->fs = 0;
+    releaseNode(node);
+    return true;
+}
+
+void vfsManager::removeMountPoints(virtualFileSystem* vfs) {
+    for(int b = 0; b < MOUNT_BUCKETS; b++) {
+        mountNode* node = this->mountBuckets[b];
+        while(node != 0) {
+            if(node->fs != vfs) {
+                node = node->nextInBucket;
+                continue;
+            }
+
+            // Releasing may free more nodes of this bucket, start over
+            node->fs = 0;
+            releaseNode(node);
+            node = this->mountBuckets[b];
+        }
+    }
+}
+
+void vfsManager::registerDiskMounts() {
+    char name[16];
+    for(int i = 0; i < Filesystems->size(); i++) {
+        diskMountName(i, name);
+        addMountPoint(name, Filesystems->getat(i));
+    }
+
+    // The numbering shrank by one when a filesystem was removed
+    diskMountName(Filesystems->size(), name);
+    removeMountPoint(name);
+}
+
+void vfsManager::registerCdromMount() {
+    if(findMountPoint(CDROM_MOUNT_POINT) != 0)
+        return;
+
+    // The first disc gets the fixed name, the next one takes over once it is ejected
+    for(int i = 0; i < Filesystems->size(); i++) {
+        virtualFileSystem* fs = Filesystems->getat(i);
+        if(fs->disk != 0 && fs->disk->type == cdROM) {
+            addMountPoint(CDROM_MOUNT_POINT, fs);
+            return;
+        }
+    }
+}
+
+void vfsManager::mount(virtualFileSystem* vfs) {
+    this->Filesystems->push_back(vfs);
+
+    char name[16];
+    diskMountName(this->Filesystems->size() - 1, name);
+    addMountPoint(name, vfs);
+    registerCdromMount();
+}
+
+void vfsManager::unmount(virtualFileSystem* vfs) {
+    vfs->lock.lock();
+    int synced = vfs->fsync();
+    vfs->lock.unlock();
+
+    if(synced != 0)
+        Log(Warning, "Could not write back all data of %s before unmounting", vfs->Name);
+
+    readAhead::invalidateAll(vfs);
+    bootTrace::invalidateAll(vfs);
+    pageCache::forgetFilesystem(vfs);
+
+    // Also takes the B: and boot aliases along when this was the boot partition
+    removeMountPoints(vfs);
+
+    int index = this->Filesystems->indexof(vfs);
+    if(index == this->bootPartitionID)
+        this->bootPartitionID = -1;
+    else if(index >= 0 && index < this->bootPartitionID)
+        this->bootPartitionID--;
+
+    this->Filesystems->remove(vfs);
+    registerDiskMounts();
+    registerCdromMount();
+}
+
+void vfsManager::unmountByDisk(Disk* disk) {
+    for(int i = 0; i < Filesystems->size(); i++)
+        if(Filesystems->getat(i)->disk == disk) {
+            unmount(Filesystems->getat(i));
+            i--;
+        }
+
+    // Last chance for sectors still cached, when the disk is already gone they are lost
+    writeBack::flushDisk(disk);
+    writeBack::dropDisk(disk);
+}
+
+virtualFileSystem* vfsManager::resolvePath(const char* path, char* relativePath) {
+    // Walk the mount tree one component at a time and keep the deepest mount point we pass
+    mountNode* node = &this->mountRoot;
+    virtualFileSystem* fs = 0;
+    const char* rest = path;
+
+    while(true) {
+        while(isSeparator(*path))
+            path++;
+        if(*path == '\0')
+            break;
+
+        int length = componentLength(path);
+        node = findChild(node, path, length, componentHash(path, length));
+        if(node == 0)
+            break;
+
+        path += length;
+        if(node->fs != 0) {
+            fs = node->fs;
+            rest = path;
+        }
+    }
+
+    if(fs == 0)
+        return 0;
+
+    // Filesystems only understand their own separator, repeated and trailing ones are dropped here once
+    int length = 0;
+    while(*rest != '\0') {
+        while(isSeparator(*rest))
+            rest++;
+
+        int component = componentLength(rest);
+        if(component == 0)
+            break;
+        if(length + component + 2 > VFS_PATH_LENGTH)
+            return 0;
+
+        if(length > 0)
+            relativePath[length++] = PATH_SEPERATOR_C;
+        memOperator::memcpy(relativePath + length, rest, component);
+        length += component;
+        rest += component;
+    }
+
+    relativePath[length] = '\0';
+    return fs;
+}
+
+bool vfsManager::searchBootPartition() {
+    for(int i = 0; i < Filesystems->size(); i++) {
+        virtualFileSystem* fs = Filesystems->getat(i);
+        fs->lock.lock();
+        bool found = fs->fileExists(BOOT_FILE);
+        fs->lock.unlock();
+
+        if(found) {
+            this->bootPartitionID = i;
+            addMountPoint("B:", Filesystems->getat(i));
+            addMountPoint("boot", Filesystems->getat(i));
+            bootTrace::start(Filesystems->getat(i), this);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+int vfsManager::readFile(const char* filename, uint8_t* buffer, uint32_t offset, uint32_t len) {
+    char relativePath[VFS_PATH_LENGTH];
+    virtualFileSystem* fs = resolvePath(filename, relativePath);
+    if(fs == 0)
+        return -1;
+
+    bootTrace::record(fs, relativePath, offset, len);
+    int result = bootTrace::read(fs, relativePath, buffer, offset, len);
+    if(result >= 0)
+        return result;
+
+    return readAhead::read(fs, relativePath, buffer, offset, len);
+}
+
+int vfsManager::writeFile(const char* filename, uint8_t* buffer, uint32_t len, bool create) {
+    char relativePath[VFS_PATH_LENGTH];
+    virtualFileSystem* fs = resolvePath(filename, relativePath);
+    if(fs == 0)
+        return -1;
+
+    readAhead::invalidate(fs, relativePath);
+    bootTrace::invalidate(fs, relativePath);
+    pageCache::invalidate(fs, relativePath);
+
+    fs->lock.lock();
+    // A directory walk in progress would not see the new entry
+    fs->dropListing();
+    int result = fs->writeFile(relativePath, buffer, len, create);
+    fs->lock.unlock();
+    return result;
+}
+
+int vfsManager::createFile(const char* path) {
+    char relativePath[VFS_PATH_LENGTH];
+    virtualFileSystem* fs = resolvePath(path, relativePath);
+    if(fs == 0)
+        return -1;
+
+    fs->lock.lock();
+    fs->dropListing();
+    int result = fs->createFile(relativePath);
+    fs->lock.unlock();
+    return result;
+}
+
+int vfsManager::createDirectory(const char* path) {
+    char relativePath[VFS_PATH_LENGTH];
+    virtualFileSystem* fs = resolvePath(path, relativePath);
+    if(fs == 0)
+        return -1;
+
+    fs->lock.lock();
+    fs->dropListing();
+    int result = fs->createDirectory(relativePath);
+    fs->lock.unlock();
+    return result;
+}
+
+bool vfsManager::fileExists(const char* filename) {
+    char relativePath[VFS_PATH_LENGTH];
+    virtualFileSystem* fs = resolvePath(filename, relativePath);
+    if(fs == 0)
+        return false;
+
+    fs->lock.lock();
+    bool exists = fs->fileExists(relativePath);
+    fs->lock.unlock();
+    return exists;
+}
+
+bool vfsManager::directoryExists(const char* filename) {
+    char relativePath[VFS_PATH_LENGTH];
+    virtualFileSystem* fs = resolvePath(filename, relativePath);
+    if(fs == 0)
+        return false;
+
+    // Only the mount point was given, like "0:\\"
+    if(*relativePath == '\0')
+        return true;
+
+    fs->lock.lock();
+    bool exists = fs->directoryExists(relativePath);
+    fs->lock.unlock();
+    return exists;
+}
+
+bool vfsManager::removeFile(const char* filename) {
+    Log(Warning, "Removing files is not supported yet %s", filename);
+    return false;
+}
+
+bool vfsManager::removeDirectory(const char* filename) {
+    Log(Warning, "Removing directories is not supported yet %s", filename);
+    return false;
+}
+
+bool vfsManager::ejectDrive(const char* path) {
+    char relativePath[VFS_PATH_LENGTH];
+    virtualFileSystem* fs = resolvePath(path, relativePath);
+    if(fs == 0)
+        return false;
+
+    Disk* target = fs->disk;
+    if(target == 0 || target->controller == 0)
+        return false;
+
+    // Nothing may stay buffered once the media is gone
+    for(int i = 0; i < Filesystems->size(); i++) {
+        virtualFileSystem* mounted = Filesystems->getat(i);
+        if(mounted->disk != target)
+            continue;
+
+        mounted->lock.lock();
+        int synced = mounted->fsync();
+        mounted->lock.unlock();
+        if(synced != 0)
+            return false;
+    }
+
+    if(writeBack::flushDisk(target) != 0)
+        return false;
+
+    if(!target->controller->ejectDrive(target->controllerIndex))
+        return false;
+
+    unmountByDisk(target);
+    return true;
+}
+
+int vfsManager::fsync(const char* path) {
+    char relativePath[VFS_PATH_LENGTH];
+    virtualFileSystem* fs = resolvePath(path, relativePath);
+    if(fs == 0)
+        return -1;
+
+    // Only the mount point was given, flush the whole filesystem
+    fs->lock.lock();
+    int result = *relativePath == '\0' ? fs->fsync() : fs->fsync(relativePath);
+    fs->lock.unlock();
+    if(fs->disk != 0 && writeBack::flushDisk(fs->disk) != 0)
+        result = -1;
+
+    return result;
+}
+
+int vfsManager::syncAll() {
+    int result = 0;
+    for(int i = 0; i < Filesystems->size(); i++) {
+        virtualFileSystem* fs = Filesystems->getat(i);
+        fs->lock.lock();
+        if(fs->fsync() != 0)
+            result = -1;
+        fs->lock.unlock();
+    }
+
+    // Shutdown and reboot end up here, after this nothing may be left in memory
+    if(writeBack::flushAll() != 0)
+        result = -1;
+
+    return result;
+}
+
+uint32_t vfsManager::fileSize(const char* filename) {
+    char relativePath[VFS_PATH_LENGTH];
+    virtualFileSystem* fs = resolvePath(filename, relativePath);
+    if(fs == 0)
+        return -1;
+
+    fs->lock.lock();
+    uint32_t size = fs->getFileSize(relativePath);
+    fs->lock.unlock();
+    return size;
+}
+
+List<LibC::vfsEntry>* vfsManager::directoryList(const char* path) {
+    char relativePath[VFS_PATH_LENGTH];
+    virtualFileSystem* fs = resolvePath(path, relativePath);
+    if(fs == 0)
+        return 0;
+
+    fs->lock.lock();
+    List<LibC::vfsEntry>* list = fs->directoryList(relativePath);
+    fs->lock.unlock();
+    return list;
+}
+
+int vfsManager::readDirectory(const char* path, uint32_t* cookie, uint8_t* buffer, uint32_t size) {
+    char relativePath[VFS_PATH_LENGTH];
+    virtualFileSystem* fs = resolvePath(path, relativePath);
+    if(fs == 0)
+        return -1;
+
+    fs->lock.lock();
+    int result = fs->readDirectory(relativePath, cookie, buffer, size);
+    fs->lock.unlock();
+    return result;
+}
+
+void vfsManager::logReadAheadStats() {
+    for(int i = 0; i < Filesystems->size(); i++) {
+        virtualFileSystem* fs = Filesystems->getat(i);
+        uint32_t total = fs->raStats.hits + fs->raStats.misses;
+        uint32_t rate = total ? (fs->raStats.hits * 100) / total : 0;
+
+        Log(Info, "%d:\\ %s readahead: %d hits, %d misses (%d%%), %d KB prefetched", i, fs->Name, fs->raStats.hits, fs->raStats.misses, rate, fs->raStats.prefetchedBytes / 1_KB);
+    }
+}
@@ -7,10 +7,41 @@
 #include "virtualfilesystem.h"
 
 namespace Kernel {
+
+    #define MOUNT_BUCKETS       64
+    #define MOUNT_NAME_LENGTH   32
+    #define VFS_PATH_LENGTH     256
+    #define TMPFS_MOUNT_POINT   "tmp"
+    #define TMPFS_MAX_SIZE      64_MB
+    #define CDROM_MOUNT_POINT   "media" PATH_SEPERATOR_S "cdrom"
+
+    /**
+     * @brief one path component of a mount point, children are found by hashing (parent, name)
+     */
+    struct mountNode {
+        mountNode* parent;
+        mountNode* nextInBucket;
+        char name[MOUNT_NAME_LENGTH];
+        ak::uint32_t nameHash;
+        ak::uint32_t children;
+        virtualFileSystem* fs;
+    };
+
     class vfsManager {
     public:
         List<virtualFileSystem*>* Filesystems;
 
+    private:
+        mountNode mountRoot;
+        mountNode* mountBuckets[MOUNT_BUCKETS];
+        virtualFileSystem* temporary = 0;
+
+        mountNode* findChild(mountNode* parent, const char* name, int length, ak::uint32_t hash);
+        mountNode* findMountPoint(const char* name);
+        void releaseNode(mountNode* node);
+        void registerDiskMounts();
+        void registerCdromMount();
+
     public:
         vfsManager();
 
@@ -20,7 +51,11 @@ namespace Kernel {
         void unmount(virtualFileSystem* vfs);
         void unmountByDisk(Disk* disk);
 
-        int extractDiskNumber(const char* path, ak::uint8_t* idSizeReturn);
+        bool addMountPoint(const char* name, virtualFileSystem* vfs);
+        bool removeMountPoint(const char* name);
+        void removeMountPoints(virtualFileSystem* vfs);
+
+        virtualFileSystem* resolvePath(const char* path, char* relativePath);
         bool searchBootPartition();
 
         int readFile(const char* filename, uint8_t* buffer, uint32_t offset = 0, uint32_t len = -1);
@@ -33,8 +68,13 @@ namespace Kernel {
         bool removeFile(const char* filename);
         bool removeDirectory(const char* filename);
         bool ejectDrive(const char* path);
+        int fsync(const char* path);
+        int syncAll();
 
         uint32_t fileSize(const char* filename);
-        List<Kernel::vfsEntry>* directoryList(const char* path);
+        List<LibC::vfsEntry>* directoryList(const char* path);
+        int readDirectory(const char* path, ak::uint32_t* cookie, ak::uint8_t* buffer, ak::uint32_t size);
+
+        void logReadAheadStats();
     };
 }
\ No newline at end of file
@@ -3,6 +3,8 @@
 //
 
 #include "virtualfilesystem.h"
+#include <ak/string.h>
+#include <ak/memoperator.h>
 #include <kernel/system/log.h>
 
 using namespace Kernel::ak;
@@ -16,7 +18,7 @@ virtualFileSystem::virtualFileSystem(Disk* disk, ak::uint32_t start, ak::uint32_
 }
 
 virtualFileSystem::~virtualFileSystem() {
-    Log(Error, "Virtual function called directly %s:%d", __FILE__, __LINE__);
+    dropListing();
 }
 
 bool virtualFileSystem::initialize() {
@@ -33,6 +35,22 @@ int virtualFileSystem::writeFile(const char* filename, uint8_t* buffer, uint32_t
     return -1;
 }
 
+int virtualFileSystem::fsync(const char* filename) {
+    return 0;
+}
+
+uint32_t virtualFileSystem::pinPage(const char* path, uint32_t index) {
+    // Only filesystems that keep their data in whole physical pages can hand them out
+    return 0;
+}
+
+void virtualFileSystem::unpinPage(const char* path, uint32_t index, uint32_t physAddress) { }
+
+uint32_t virtualFileSystem::fileLocation(const char* path) {
+    // Unknown, callers that order by it treat every file as being at the start of the disk
+    return 0;
+}
+
 bool virtualFileSystem::fileExists(const char* filename) {
     Log(Error, "Virtual function called directly %s:%d", __FILE__, __LINE__);
     return false;
@@ -61,4 +79,79 @@ uint32_t virtualFileSystem::getFileSize(const char* filename) {
 List<LibC::vfsEntry>* virtualFileSystem::directoryList(const char* path) {
     Log(Error, "Virtual function called directly %s:%d", __FILE__, __LINE__);
     return 0;
-}
\ No newline at end of file
+}
+
+LibC::vfsDirectoryRecord* virtualFileSystem::addDirectoryRecord(uint8_t* buffer, uint32_t size, uint32_t* used, const char* name, int nameLength) {
+    if(nameLength >= VFS_NAME_LENGTH)
+        nameLength = VFS_NAME_LENGTH - 1;
+
+    uint32_t recordLength = sizeof(LibC::vfsDirectoryRecord) + nameLength + 1;
+    recordLength = (recordLength + VFS_RECORD_ALIGN - 1) & ~(VFS_RECORD_ALIGN - 1);
+    if(*used + recordLength > size)
+        return 0;
+
+    LibC::vfsDirectoryRecord* record = (LibC::vfsDirectoryRecord*)(buffer + *used);
+    memOperator::memset(record, 0, recordLength);
+    record->recordLength = recordLength;
+    record->nameLength = nameLength;
+    memOperator::memcpy(record->name, name, nameLength);
+
+    *used += recordLength;
+    return record;
+}
+
+int virtualFileSystem::readDirectory(const char* path, uint32_t* cookie, uint8_t* buffer, uint32_t size) {
+    // Filesystems without their own iterator go through the full list, the cookie is the entry index
+    bool continues = listing != 0 && *cookie != 0 && *cookie == listingCookie && String::strcmp(listingPath, path);
+    if(!continues) {
+        dropListing();
+        listing = directoryList(path);
+        if(listing == 0)
+            return -1;
+
+        listingPath = new char[String::strlen(path) + 1];
+        String::strcpy(listingPath, path);
+
+        // Someone else listed in between, the walk to the cookie is only paid once
+        listingPosition = listing->begin();
+        for(uint32_t i = 0; i < *cookie && listingPosition != listing->end(); i++)
+            ++listingPosition;
+    }
+
+    uint32_t used = 0;
+    uint32_t index = *cookie;
+    for(; listingPosition != listing->end(); ++listingPosition, index++) {
+        LibC::vfsEntry* entry = &(*listingPosition);
+        LibC::vfsDirectoryRecord* record = addDirectoryRecord(buffer, size, &used, entry->name, String::strlen(entry->name));
+        if(record == 0)
+            break;
+
+        record->size = entry->size;
+        record->isDir = entry->isDir;
+        record->nextCookie = index + 1;
+        record->creationTime.sec = entry->creationTime.sec;
+        record->creationTime.min = entry->creationTime.min;
+        record->creationTime.hour = entry->creationTime.hour;
+        record->creationDate.day = entry->creationDate.day;
+        record->creationDate.month = entry->creationDate.month;
+        record->creationDate.year = entry->creationDate.year;
+    }
+
+    *cookie = index;
+    listingCookie = index;
+
+    if(used == 0 && listingPosition != listing->end())
+        return VFS_BUFFER_TOO_SMALL;
+    return used;
+}
+
+void virtualFileSystem::dropListing() {
+    if(listing != 0)
+        delete listing;
+    if(listingPath != 0)
+        delete[] listingPath;
+
+    listing = 0;
+    listingPath = 0;
+    listingCookie = 0;
+}
@@ -7,6 +7,7 @@
 #include <ak/types.h>
 #include <ak/list.h>
 #include <kernel/disks/disk.h>
+#include <tasking/lock.h>
 #include <libc/shared.h>
 
 namespace Kernel {
@@ -14,16 +15,34 @@ namespace Kernel {
   #define PATH_SEPERATOR_C '\\' 
   #define PATH_SEPERATOR_S "\\" 
 
+  struct readAheadStats {
+    ak::uint32_t hits;
+    ak::uint32_t misses;
+    ak::uint32_t prefetchedBytes;
+  };
+
   class virtualFileSystem {
-    friend class virtualFileSystemManager;
+    friend class vfsManager;
     public:
       Disk* disk;
+      readAheadStats raStats = {0, 0, 0};
+      bool readAheadEnabled = true;
+      bool caseSensitive = false;
+
+      // Drivers keep their scratch buffers in members, every call into one filesystem holds this
+      mutexLock lock;
 
     protected:
       ak::uint32_t startLBA;
       ak::uint32_t sizeInSectors;      
       char* Name = "Unkown";
 
+      // The list readDirectory is walking through, kept until the next call continues where it stopped
+      List<LibC::vfsEntry>* listing = 0;
+      List<LibC::vfsEntry>::iterator listingPosition;
+      char* listingPath = 0;
+      ak::uint32_t listingCookie = 0;
+
     public:
       virtualFileSystem(Disk* disk, ak::uint32_t start, ak::uint32_t size, char* name = 0);
       virtual ~virtualFileSystem();
@@ -32,6 +51,7 @@ namespace Kernel {
             
       virtual int readFile(const char* filename, uint8_t* buffer, uint32_t offset = 0, uint32_t len = -1);
       virtual int writeFile(const char* filename, uint8_t* buffer, uint32_t len, bool create = true);
+      virtual int fsync(const char* filename = 0);
 
       virtual bool fileExists(const char* filename);
       virtual bool directoryExists(const char* filename);
@@ -41,5 +61,14 @@ namespace Kernel {
 
       virtual uint32_t getFileSize(const char* filename);
       virtual List<LibC::vfsEntry>* directoryList(const char* path);
+      virtual int readDirectory(const char* path, ak::uint32_t* cookie, ak::uint8_t* buffer, ak::uint32_t size);
+
+      virtual ak::uint32_t pinPage(const char* path, ak::uint32_t index);
+      virtual void unpinPage(const char* path, ak::uint32_t index, ak::uint32_t physAddress);
+      virtual ak::uint32_t fileLocation(const char* path);
+
+    protected:
+      void dropListing();
+      static LibC::vfsDirectoryRecord* addDirectoryRecord(ak::uint8_t* buffer, ak::uint32_t size, ak::uint32_t* used, const char* name, int nameLength);
   };
 }
\ No newline at end of file
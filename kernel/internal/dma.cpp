@@ -0,0 +1,67 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#include "dma.h"
+#include <cpu/port.h>
+
+using namespace Kernel::ak;
+using namespace Kernel;
+
+static const uint8_t pagePorts[8] = { 0x87, 0x83, 0x81, 0x82, 0x8F, 0x8B, 0x89, 0x8A };
+
+dmaController::dmaController()
+: systemComponent((char*)"DMA Controller", (char*)"ISA DMA for the floppy and other legacy devices") {}
+
+void dmaController::setChannelAddress(uint8_t channel, uint8_t low, uint8_t high) {
+    uint16_t port = channel < 4 ? channel * 2 : 0xC0 + (channel - 4) * 4;
+    outportb(port, low);
+    outportb(port, high);
+}
+
+void dmaController::setChannelCounter(uint8_t channel, uint8_t low, uint8_t high) {
+    uint16_t port = channel < 4 ? channel * 2 + 1 : 0xC2 + (channel - 4) * 4;
+    outportb(port, low);
+    outportb(port, high);
+}
+
+void dmaController::setChannelPage(uint8_t channel, uint8_t page) {
+    outportb(pagePorts[channel], page);
+}
+
+void dmaController::setChannelMode(uint8_t channel, uint8_t mode) {
+    outportb(channel < 4 ? DMA0_MODE_REG : DMA1_MODE_REG, mode | (channel % 4));
+}
+
+void dmaController::maskChannel(uint8_t channel) {
+    outportb(channel < 4 ? DMA0_CHANMASK_REG : DMA1_CHANMASK_REG, 0x04 | (channel % 4));
+}
+
+void dmaController::unmaskChannel(uint8_t channel) {
+    outportb(channel < 4 ? DMA0_CHANMASK_REG : DMA1_CHANMASK_REG, channel % 4);
+}
+
+void dmaController::resetFlipFlop(uint8_t channel) {
+    outportb(channel < 4 ? DMA0_CLEARBYTE_FLIPFLOP_REG : DMA1_CLEARBYTE_FLIPFLOP_REG, 0xFF);
+}
+
+bool dmaController::prepareTransfer(uint8_t channel, uint32_t physAddress, uint32_t length, bool toMemory) {
+    // The 8237 only reaches the first 16 MB and its counter wraps at a 64 KB boundary, 128 KB for the word channels
+    uint32_t boundary = channel < 4 ? 64_KB : 128_KB;
+    if(channel > 7 || channel == 4 || length == 0 || physAddress + length > DMA_ISA_LIMIT || physAddress / boundary != (physAddress + length - 1) / boundary)
+        return false;
+
+    uint32_t address = channel < 4 ? physAddress : (physAddress >> 1) & 0xFFFF;
+    uint32_t count = (channel < 4 ? length : length / 2) - 1;
+
+    maskChannel(channel);
+    resetFlipFlop(channel);
+    setChannelAddress(channel, address & 0xFF, (address >> 8) & 0xFF);
+    setChannelPage(channel, (physAddress >> 16) & 0xFF);
+    resetFlipFlop(channel);
+    setChannelCounter(channel, count & 0xFF, (count >> 8) & 0xFF);
+    setChannelMode(channel, DMA_MODE_SINGLE | (toMemory ? DMA_MODE_TRANSFER_WRITE : DMA_MODE_TRANSFER_READ));
+    unmaskChannel(channel);
+
+    return true;
+}
@@ -34,8 +34,13 @@ namespace Kernel {
         DMA1_MASK_REG = 0xde
     };
 
+    #define DMA_MODE_TRANSFER_WRITE     0x04
+    #define DMA_MODE_TRANSFER_READ      0x08
+    #define DMA_MODE_SINGLE             0x40
+    #define DMA_ISA_LIMIT               16_MB
+
     /**
-     * @breif: dmaController[set channel address, counter]
+     * @breif: dmaController[set channel address, counter, page, mode, prepare transfer]
      */
     class dmaController : public systemComponent {
       public:
@@ -43,5 +48,13 @@ namespace Kernel {
 
         void setChannelAddress(ak::uint8_t channel, ak::uint8_t low, ak::uint8_t high);
         void setChannelCounter(ak::uint8_t channel, ak::uint8_t low, ak::uint8_t high);
+        void setChannelPage(ak::uint8_t channel, ak::uint8_t page);
+        void setChannelMode(ak::uint8_t channel, ak::uint8_t mode);
+
+        void maskChannel(ak::uint8_t channel);
+        void unmaskChannel(ak::uint8_t channel);
+        void resetFlipFlop(ak::uint8_t channel);
+
+        bool prepareTransfer(ak::uint8_t channel, ak::uint32_t physAddress, ak::uint32_t length, bool toMemory);
     };
 }
\ No newline at end of file
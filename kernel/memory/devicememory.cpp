@@ -0,0 +1,75 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#include "devicememory.h"
+#include "virtualmemory.h"
+#include <cpu/memory.h>
+#include <ak/memoperator.h>
+#include <kernel/system/log.h>
+
+using namespace Kernel::ak;
+using namespace Kernel;
+
+uint32_t deviceMemory::nextFree = DEVICEMEMORY_REGION_START;
+mutexLock deviceMemory::lock;
+
+uint32_t deviceMemory::reserve(uint32_t pages) {
+    // Controllers stay for the lifetime of the kernel, so the window only grows
+    lock.lock();
+    uint32_t virt = 0;
+    if(nextFree + pages * PAGE_SIZE <= DEVICEMEMORY_REGION_END) {
+        virt = nextFree;
+        nextFree += pages * PAGE_SIZE;
+    }
+    lock.unlock();
+
+    if(virt == 0)
+        Log(Error, "Device memory window is full");
+    return virt;
+}
+
+void* deviceMemory::mapRegisters(uint32_t physAddress, uint32_t size) {
+    uint32_t offset = physAddress % PAGE_SIZE;
+    uint32_t pages = (offset + size + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    uint32_t virt = reserve(pages);
+    if(virt == 0)
+        return 0;
+
+    for(uint32_t i = 0; i < pages; i++) {
+        virtualMemoryManager::mapVirtualToPhysical((void*)(physAddress - offset + i * PAGE_SIZE), (void*)(virt + i * PAGE_SIZE), true, true);
+        virtualMemoryManager::invalidatePage(virt + i * PAGE_SIZE);
+    }
+
+    return (void*)(virt + offset);
+}
+
+void* deviceMemory::allocatePage(uint32_t* physAddress) {
+    return allocatePages(1, physAddress);
+}
+
+void* deviceMemory::allocatePages(uint32_t pages, uint32_t* physAddress) {
+    // Physically contiguous, for structures a controller walks by physical address past a page boundary
+    void* phys = pages == 1 ? physicalMemoryManager::allocateBlock() : physicalMemoryManager::allocateBlocks(pages);
+    if(phys == 0)
+        return 0;
+
+    uint32_t virt = reserve(pages);
+    if(virt == 0) {
+        if(pages == 1)
+            physicalMemoryManager::freeBlock(phys);
+        else
+            physicalMemoryManager::freeBlocks(phys, pages);
+        return 0;
+    }
+
+    for(uint32_t i = 0; i < pages; i++) {
+        virtualMemoryManager::mapVirtualToPhysical((void*)((uint32_t)phys + i * PAGE_SIZE), (void*)(virt + i * PAGE_SIZE), true, true);
+        virtualMemoryManager::invalidatePage(virt + i * PAGE_SIZE);
+    }
+    memOperator::memset((void*)virt, 0, pages * PAGE_SIZE);
+
+    *physAddress = (uint32_t)phys;
+    return (void*)virt;
+}
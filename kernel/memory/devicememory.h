@@ -0,0 +1,29 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#pragma once
+
+#include <ak/types.h>
+#include <tasking/lock.h>
+
+namespace Kernel {
+    #define DEVICEMEMORY_REGION_START   0xE0000000
+    #define DEVICEMEMORY_REGION_END     0xE4000000
+
+    /**
+     * @brief deviceMemory[map registers, allocate page] kernel window for controller registers and the structures controllers read by DMA
+     */
+    class deviceMemory {
+      public:
+        static void* mapRegisters(ak::uint32_t physAddress, ak::uint32_t size);
+        static void* allocatePage(ak::uint32_t* physAddress);
+        static void* allocatePages(ak::uint32_t pages, ak::uint32_t* physAddress);
+
+      private:
+        static ak::uint32_t nextFree;
+        static mutexLock lock;
+
+        static ak::uint32_t reserve(ak::uint32_t pages);
+    };
+}
@@ -0,0 +1,154 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#include "filemapping.h"
+#include "virtualmemory.h"
+#include <ak/memoperator.h>
+#include <tasking/scheduler.h>
+#include <kernel/system/log.h>
+
+using namespace Kernel::ak;
+using namespace Kernel;
+
+uint32_t memoryMapping::findFreeRange(Process* proc, uint32_t length) {
+    uint32_t candidate = MMAP_REGION_START;
+
+    bool moved = true;
+    while(moved) {
+        moved = false;
+        for(int i = 0; i < proc->fileMappings.size(); i++) {
+            fileMapping* mapping = proc->fileMappings[i];
+            if(candidate < mapping->virtStart + mapping->length && mapping->virtStart < candidate + length) {
+                candidate = mapping->virtStart + mapping->length;
+                moved = true;
+            }
+        }
+
+        if(candidate + length > MMAP_REGION_END || candidate + length < candidate)
+            return 0;
+    }
+
+    return candidate;
+}
+
+uint32_t memoryMapping::map(Process* proc, vfsManager* vfs, const char* path, uint32_t offset, uint32_t length) {
+    if(length == 0)
+        return 0;
+
+    char relativePath[VFS_PATH_LENGTH];
+    virtualFileSystem* fs = vfs->resolvePath(path, relativePath);
+    if(fs == 0)
+        return 0;
+
+    cachedFile* file = pageCache::openFile(fs, relativePath);
+    if(file == 0)
+        return 0;
+
+    uint32_t offsetInPage = offset % PAGE_SIZE;
+    uint32_t size = pageRoundUp(length + offsetInPage);
+
+    proc->mappingsLock.lock();
+    uint32_t virt = findFreeRange(proc, size);
+    if(virt == 0) {
+        proc->mappingsLock.unlock();
+        pageCache::closeFile(file);
+        return 0;
+    }
+
+    uint32_t pages = size / PAGE_SIZE;
+    fileMapping* mapping = new fileMapping;
+    mapping->virtStart = virt;
+    mapping->length = size;
+    mapping->firstPage = offset / PAGE_SIZE;
+    mapping->file = file;
+    mapping->presentPages = new uint32_t[(pages + 31) / 32];
+    memOperator::memset(mapping->presentPages, 0, ((pages + 31) / 32) * sizeof(uint32_t));
+
+    // Nothing is mapped yet, every page is brought in by handlePageFault on first access
+    proc->fileMappings.push_back(mapping);
+    proc->mappingsLock.unlock();
+    return virt + offsetInPage;
+}
+
+void memoryMapping::release(fileMapping* mapping, bool unmapPages) {
+    uint32_t pages = mapping->length / PAGE_SIZE;
+    for(uint32_t i = 0; i < pages; i++) {
+        if(!(mapping->presentPages[i / 32] & (1 << (i % 32))))
+            continue;
+
+        if(unmapPages) {
+            uint32_t virt = mapping->virtStart + (i * PAGE_SIZE);
+            virtualMemoryManager::unmapPage((void*)virt);
+            virtualMemoryManager::invalidatePage(virt);
+        }
+        pageCache::releasePage(mapping->file, mapping->firstPage + i);
+    }
+
+    pageCache::closeFile(mapping->file);
+    delete[] mapping->presentPages;
+    delete mapping;
+}
+
+bool memoryMapping::unmap(Process* proc, uint32_t virtAddress) {
+    proc->mappingsLock.lock();
+    for(int i = 0; i < proc->fileMappings.size(); i++) {
+        fileMapping* mapping = proc->fileMappings[i];
+        if(virtAddress < mapping->virtStart || virtAddress >= mapping->virtStart + mapping->length)
+            continue;
+
+        proc->fileMappings.remove(i);
+        proc->mappingsLock.unlock();
+        release(mapping, true);
+        return true;
+    }
+
+    proc->mappingsLock.unlock();
+    return false;
+}
+
+void memoryMapping::removeAll(Process* proc) {
+    // A dying process is usually torn down from another one, its page directory goes away with it anyway
+    Thread* current = scheduler::currentThread();
+    bool ownAddressSpace = current != 0 && current->parent == proc;
+
+    proc->mappingsLock.lock();
+    while(proc->fileMappings.size() > 0) {
+        fileMapping* mapping = proc->fileMappings[0];
+        proc->fileMappings.remove(0);
+        release(mapping, ownAddressSpace);
+    }
+    proc->mappingsLock.unlock();
+}
+
+bool memoryMapping::handlePageFault(Process* proc, uint32_t address, uint32_t errorCode) {
+    // Faults on present pages are protection violations, like writing to a read-only mapping
+    if(errorCode & (PAGEFAULT_PRESENT | PAGEFAULT_WRITE))
+        return false;
+
+    proc->mappingsLock.lock();
+    for(int i = 0; i < proc->fileMappings.size(); i++) {
+        fileMapping* mapping = proc->fileMappings[i];
+        if(address < mapping->virtStart || address >= mapping->virtStart + mapping->length)
+            continue;
+
+        uint32_t pageAddress = pageRoundDown(address);
+        uint32_t page = (pageAddress - mapping->virtStart) / PAGE_SIZE;
+
+        uint32_t phys = pageCache::acquirePage(mapping->file, mapping->firstPage + page);
+        if(phys == 0) {
+            proc->mappingsLock.unlock();
+            return false;
+        }
+
+        // Every process mapping this file page shares the same physical page
+        virtualMemoryManager::mapVirtualToPhysical((void*)phys, (void*)pageAddress, false, false);
+        virtualMemoryManager::invalidatePage(pageAddress);
+        mapping->presentPages[page / 32] |= (1 << (page % 32));
+        proc->mappingsLock.unlock();
+        return true;
+    }
+
+    proc->mappingsLock.unlock();
+    return false;
+}
@@ -0,0 +1,42 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#pragma once
+
+#include <ak/types.h>
+#include <tasking/process.h>
+#include <kernel/filesystem/vfsmanager.h>
+#include "pagecache.h"
+
+namespace Kernel {
+    #define MMAP_REGION_START 0x80000000
+    #define MMAP_REGION_END   0xB0000000
+
+    /**
+     * @brief a read-only view of a file in the address space of a process, pages are mapped on first access
+     */
+    struct fileMapping {
+        ak::uint32_t virtStart;
+        ak::uint32_t length;
+        ak::uint32_t firstPage;
+        ak::uint32_t* presentPages;
+        cachedFile* file;
+    };
+
+    /**
+     * @brief memoryMapping[map, unmap, remove all, handle page fault]
+     */
+    class memoryMapping {
+      public:
+        static ak::uint32_t map(Process* proc, vfsManager* vfs, const char* path, ak::uint32_t offset, ak::uint32_t length);
+        static bool unmap(Process* proc, ak::uint32_t virtAddress);
+        static void removeAll(Process* proc);
+
+        static bool handlePageFault(Process* proc, ak::uint32_t address, ak::uint32_t errorCode);
+
+      private:
+        static ak::uint32_t findFreeRange(Process* proc, ak::uint32_t length);
+        static void release(fileMapping* mapping, bool unmapPages);
+    };
+}
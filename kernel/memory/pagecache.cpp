@@ -0,0 +1,337 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#include "pagecache.h"
+#include <memory/virtualmemory.h>
+#include <ak/string.h>
+#include <ak/memoperator.h>
+#include <tasking/scheduler.h>
+#include <kernel/system/log.h>
+
+using namespace Kernel::ak;
+using namespace Kernel;
+
+cachedPage* pageCache::pageBuckets[PAGECACHE_BUCKETS];
+cachedFile* pageCache::fileBuckets[PAGECACHE_FILE_BUCKETS];
+mutexLock pageCache::lock;
+mutexLock pageCache::windowLock;
+
+static inline uint32_t pageBucket(cachedFile* file, uint32_t index) {
+    return (((uint32_t)file >> 4) ^ (index * 2654435761u)) % PAGECACHE_BUCKETS;
+}
+
+cachedFile* pageCache::openFile(virtualFileSystem* fs, const char* path) {
+    uint32_t hash = String::hash(path);
+
+    lock.lock();
+    for(cachedFile* file = fileBuckets[hash % PAGECACHE_FILE_BUCKETS]; file != 0; file = file->next)
+        if(file->fs == fs && !file->detached && file->pathHash == hash && String::strcmp(file->path, path)) {
+            file->users++;
+            lock.unlock();
+            return file;
+        }
+    lock.unlock();
+
+    fs->lock.lock();
+    uint32_t size = fs->getFileSize(path);
+    fs->lock.unlock();
+    if(size == (uint32_t)-1)
+        return 0;
+
+    lock.lock();
+    // Someone else may have opened it while we asked for the size
+    for(cachedFile* other = fileBuckets[hash % PAGECACHE_FILE_BUCKETS]; other != 0; other = other->next)
+        if(other->fs == fs && other->pathHash == hash && String::strcmp(other->path, path)) {
+            other->users++;
+            lock.unlock();
+            return other;
+        }
+
+    cachedFile* file = new cachedFile;
+    file->fs = fs;
+    file->path = new char[String::strlen(path) + 1];
+    String::strcpy(file->path, path);
+    file->pathHash = hash;
+    file->size = size;
+    file->users = 1;
+    file->pages = 0;
+    file->detached = false;
+
+    file->next = fileBuckets[hash % PAGECACHE_FILE_BUCKETS];
+    fileBuckets[hash % PAGECACHE_FILE_BUCKETS] = file;
+    lock.unlock();
+
+    return file;
+}
+
+void pageCache::closeFile(cachedFile* file) {
+    lock.lock();
+    file->users--;
+
+    // The pages of an old version are kept for its mappings, the last one gone takes them along
+    if(file->users == 0 && file->detached)
+        freeFilePages(file, true);
+
+    freeFileIfUnused(file);
+    lock.unlock();
+}
+
+cachedPage* pageCache::lookup(cachedFile* file, uint32_t index, cachedPage*** link) {
+    cachedPage** prev = &pageBuckets[pageBucket(file, index)];
+    for(cachedPage* page = *prev; page != 0; prev = &page->next, page = page->next)
+        if(page->file == file && page->index == index) {
+            if(link)
+                *link = prev;
+            return page;
+        }
+
+    return 0;
+}
+
+bool pageCache::fill(cachedFile* file, uint32_t index, uint32_t physAddress) {
+    // The filesystem is gone, pages it never handed out cannot be read anymore
+    virtualFileSystem* fs = file->fs;
+    if(fs == 0)
+        return false;
+
+    uint8_t* buffer = new uint8_t[PAGE_SIZE];
+    if(buffer == 0)
+        return false;
+
+    uint32_t offset = index * PAGE_SIZE;
+    int read = 0;
+
+    // Read into the heap first, faults filling other pages meanwhile only wait for the short copy below
+    if(offset < file->size) {
+        uint32_t len = file->size - offset < PAGE_SIZE ? file->size - offset : PAGE_SIZE;
+        fs->lock.lock();
+        read = fs->readFile(file->path, buffer, offset, len);
+        fs->lock.unlock();
+        if(read < 0) {
+            delete[] buffer;
+            return false;
+        }
+    }
+
+    // The page is not mapped anywhere yet, everyone filling one shares a fixed kernel address to reach it
+    windowLock.lock();
+    virtualMemoryManager::mapVirtualToPhysical((void*)physAddress, (void*)PAGECACHE_FILL_WINDOW, true, true);
+    virtualMemoryManager::invalidatePage(PAGECACHE_FILL_WINDOW);
+
+    uint8_t* window = (uint8_t*)PAGECACHE_FILL_WINDOW;
+    memOperator::memcpy(window, buffer, read);
+
+    // Past the end of the file the page reads as zeros
+    if(read < (int)PAGE_SIZE)
+        memOperator::memset(window + read, 0, PAGE_SIZE - read);
+    windowLock.unlock();
+
+    delete[] buffer;
+    return true;
+}
+
+void pageCache::freePage(cachedPage* page) {
+    // Borrowed pages belong to the filesystem, it only has to know they are no longer used
+    if(page->borrowed)
+        page->file->fs->unpinPage(page->file->path, page->index, page->physAddress);
+    else
+        physicalMemoryManager::freeBlock((void*)page->physAddress);
+}
+
+uint32_t pageCache::acquirePage(cachedFile* file, uint32_t index) {
+    lock.lock();
+
+    cachedPage* page = lookup(file, index);
+    while(page != 0 && page->busy) {
+        // Someone else is reading this page, wait for it instead of reading it twice
+        lock.unlock();
+        scheduler::yield();
+        lock.lock();
+        page = lookup(file, index);
+    }
+
+    if(page != 0) {
+        page->mappings++;
+        lock.unlock();
+        return page->physAddress;
+    }
+
+    // Claimed while busy so nobody else fills it, the disk is read without holding the cache lock
+    page = new cachedPage;
+    page->file = file;
+    page->index = index;
+    page->physAddress = 0;
+    page->mappings = 1;
+    page->borrowed = false;
+    page->busy = true;
+
+    uint32_t bucket = pageBucket(file, index);
+    page->next = pageBuckets[bucket];
+    pageBuckets[bucket] = page;
+    file->pages++;
+    lock.unlock();
+
+    // Memory backed filesystems can share the page holding the data instead of a copy
+    uint32_t phys = 0;
+    if(!file->detached) {
+        file->fs->lock.lock();
+        phys = file->fs->pinPage(file->path, index);
+        file->fs->lock.unlock();
+    }
+    bool borrowed = phys != 0;
+
+    if(!borrowed)
+        phys = (uint32_t)physicalMemoryManager::allocateBlock();
+    if(phys == 0 && reclaim(16) > 0)
+        phys = (uint32_t)physicalMemoryManager::allocateBlock();
+
+    bool filled = phys != 0 && (borrowed || fill(file, index, phys));
+
+    lock.lock();
+    cachedPage** link = 0;
+    lookup(file, index, &link);
+
+    if(!filled) {
+        if(phys != 0)
+            physicalMemoryManager::freeBlock((void*)phys);
+
+        *link = page->next;
+        file->pages--;
+        delete page;
+        lock.unlock();
+        return 0;
+    }
+
+    // A filesystem that went away meanwhile left its pinned pages to the cache
+    page->physAddress = phys;
+    page->borrowed = borrowed && file->fs != 0;
+    page->busy = false;
+    lock.unlock();
+    return phys;
+}
+
+void pageCache::releasePage(cachedFile* file, uint32_t index) {
+    lock.lock();
+
+    cachedPage* page = lookup(file, index);
+    if(page != 0 && page->mappings > 0)
+        page->mappings--;
+
+    lock.unlock();
+}
+
+void pageCache::freeFilePages(cachedFile* file, bool mappedToo) {
+    for(uint32_t b = 0; b < PAGECACHE_BUCKETS && file->pages > 0; b++) {
+        cachedPage** link = &pageBuckets[b];
+        while(*link != 0) {
+            cachedPage* page = *link;
+            if(page->file == file && !page->busy && (mappedToo || page->mappings == 0)) {
+                *link = page->next;
+                freePage(page);
+                delete page;
+                file->pages--;
+            }
+            else
+                link = &page->next;
+        }
+    }
+}
+
+void pageCache::freeFileIfUnused(cachedFile* file) {
+    if(file->users > 0 || file->pages > 0)
+        return;
+
+    cachedFile** prev = &fileBuckets[file->pathHash % PAGECACHE_FILE_BUCKETS];
+    while(*prev != 0 && *prev != file)
+        prev = &(*prev)->next;
+    if(*prev == file)
+        *prev = file->next;
+
+    delete[] file->path;
+    delete file;
+}
+
+void pageCache::invalidate(virtualFileSystem* fs, const char* path) {
+    uint32_t hash = String::hash(path);
+
+    lock.lock();
+    cachedFile* file = fileBuckets[hash % PAGECACHE_FILE_BUCKETS];
+    while(file != 0 && !(file->fs == fs && !file->detached && file->pathHash == hash && String::strcmp(file->path, path)))
+        file = file->next;
+
+    if(file == 0) {
+        lock.unlock();
+        return;
+    }
+
+    // Detached files stay in the table until they are unused, only new opens skip them
+    file->detached = true;
+
+    // Mapped pages keep the old version, anything not mapped yet is read from the file as it is when first touched
+    freeFilePages(file, false);
+    freeFileIfUnused(file);
+    lock.unlock();
+}
+
+void pageCache::forgetFilesystem(virtualFileSystem* fs) {
+    lock.lock();
+
+    // Pages the filesystem lent out are owned by the cache from now on, mappings keep what they have
+    for(uint32_t b = 0; b < PAGECACHE_BUCKETS; b++)
+        for(cachedPage* page = pageBuckets[b]; page != 0; page = page->next)
+            if(page->file->fs == fs)
+                page->borrowed = false;
+
+    for(uint32_t b = 0; b < PAGECACHE_FILE_BUCKETS; b++)
+        for(cachedFile* file = fileBuckets[b]; file != 0; ) {
+            cachedFile* next = file->next;
+            if(file->fs == fs) {
+                file->detached = true;
+                file->fs = 0;
+
+                if(file->users == 0) {
+                    freeFilePages(file, true);
+                    freeFileIfUnused(file);
+                }
+            }
+            file = next;
+        }
+
+    lock.unlock();
+}
+
+uint32_t pageCache::reclaim(uint32_t wanted) {
+    lock.lock();
+    uint32_t freed = reclaimLocked(wanted);
+    lock.unlock();
+    return freed;
+}
+
+uint32_t pageCache::reclaimLocked(uint32_t wanted) {
+    uint32_t freed = 0;
+
+    for(uint32_t b = 0; b < PAGECACHE_BUCKETS && freed < wanted; b++) {
+        cachedPage** link = &pageBuckets[b];
+        while(*link != 0 && freed < wanted) {
+            cachedPage* page = *link;
+
+            // A detached file may have lost its filesystem, its pages can not always be read again
+            if(page->mappings != 0 || page->busy || page->file->detached) {
+                link = &page->next;
+                continue;
+            }
+
+            *link = page->next;
+            freePage(page);
+            page->file->pages--;
+
+            cachedFile* file = page->file;
+            delete page;
+            freeFileIfUnused(file);
+            freed++;
+        }
+    }
+
+    return freed;
+}
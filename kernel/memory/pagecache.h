@@ -0,0 +1,70 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#pragma once
+
+#include <ak/types.h>
+#include <tasking/lock.h>
+#include <kernel/filesystem/virtualfilesystem.h>
+
+namespace Kernel {
+    #define PAGECACHE_BUCKETS       512
+    #define PAGECACHE_FILE_BUCKETS  64
+    #define PAGECACHE_FILL_WINDOW   0xFFBFF000
+
+    struct cachedPage;
+
+    /**
+     * @brief a file that has pages in the cache, users counts open mappings and readers
+     */
+    struct cachedFile {
+        virtualFileSystem* fs;
+        char* path;
+        ak::uint32_t pathHash;
+        ak::uint32_t size;
+        ak::uint32_t users;
+        ak::uint32_t pages;
+        bool detached;
+        cachedFile* next;
+    };
+
+    struct cachedPage {
+        cachedFile* file;
+        ak::uint32_t index;
+        ak::uint32_t physAddress;
+        ak::uint32_t mappings;
+        bool borrowed;
+        bool busy;
+        cachedPage* next;
+    };
+
+    /**
+     * @brief pageCache[open, close, acquire, release, invalidate, forget, reclaim] physical pages indexed by (file, page offset)
+     */
+    class pageCache {
+      public:
+        static cachedFile* openFile(virtualFileSystem* fs, const char* path);
+        static void closeFile(cachedFile* file);
+
+        static ak::uint32_t acquirePage(cachedFile* file, ak::uint32_t index);
+        static void releasePage(cachedFile* file, ak::uint32_t index);
+
+        static void invalidate(virtualFileSystem* fs, const char* path);
+        static void forgetFilesystem(virtualFileSystem* fs);
+        static ak::uint32_t reclaim(ak::uint32_t wanted);
+
+      private:
+        static cachedPage* pageBuckets[PAGECACHE_BUCKETS];
+        static cachedFile* fileBuckets[PAGECACHE_FILE_BUCKETS];
+        static mutexLock lock;
+        static mutexLock windowLock;
+
+        static cachedPage* lookup(cachedFile* file, ak::uint32_t index, cachedPage*** link = 0);
+        static bool fill(cachedFile* file, ak::uint32_t index, ak::uint32_t physAddress);
+        static void freePage(cachedPage* page);
+        static void freeFilePages(cachedFile* file, bool mappedToo);
+        static void freeFileIfUnused(cachedFile* file);
+        static ak::uint32_t reclaimLocked(ak::uint32_t wanted);
+    };
+}
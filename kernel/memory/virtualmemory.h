@@ -0,0 +1,36 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#pragma once
+
+#include <ak/types.h>
+#include <cpu/memory.h>
+
+namespace Kernel {
+    #define PAGE_SIZE 4_KB
+    #define KERNEL_VIRT_ADDR 3_GB
+
+    #define PAGE_PRESENT    (1 << 0)
+    #define PAGE_WRITABLE   (1 << 1)
+    #define PAGE_USER       (1 << 2)
+
+    #define PAGEFAULT_PRESENT (1 << 0)
+    #define PAGEFAULT_WRITE   (1 << 1)
+    #define PAGEFAULT_USER    (1 << 2)
+
+    /**
+     * @brief virtualMemoryManager[map, unmap, translate] works on the page directory of the running process
+     */
+    class virtualMemoryManager {
+      public:
+        static void mapVirtualToPhysical(void* physAddr, void* virtAddr, bool kernel = true, bool writeable = true);
+        static void unmapPage(void* virtAddr);
+        static void* virtualToPhysical(void* virtAddr);
+        static void allocatePage(void* virtAddr, bool kernel = true, bool writeable = true);
+
+        static inline void invalidatePage(ak::uint32_t virtAddr) {
+            asm volatile("invlpg (%0)" :: "r" (virtAddr) : "memory");
+        }
+    };
+}
@@ -0,0 +1,74 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#include "init.h"
+#include <cpu/memory.h>
+#include <kernel/system/log.h>
+
+using namespace Kernel::ak;
+using namespace Kernel;
+
+initrdFS* Intial::filesystem = 0;
+
+void Intial::initialize(multiboot_info_t* mbi) {
+    if(!(mbi->flags & MULTIBOOT_INFO_MODS) || mbi->mods_count == 0) {
+        Log(Warning, "No initrd module loaded");
+        return;
+    }
+
+    multiboot_module_t* module = (multiboot_module_t*)phys2virt(mbi->mods_addr);
+    uint32_t size = module->mod_end - module->mod_start;
+
+    // Keep the allocator away from the image, files are read from it for the whole uptime
+    physicalMemoryManager::setRegionUsed(module->mod_start, size);
+
+    initrdFS* fs = new initrdFS((uint8_t*)phys2virt(module->mod_start), size);
+    if(!fs->initialize()) {
+        delete fs;
+        return;
+    }
+
+    filesystem = fs;
+}
+
+void* Intial::readFile(const char* path, uint32_t* fileSizeReturn) {
+    if(filesystem == 0)
+        return 0;
+
+    filesystem->lock.lock();
+    uint32_t size = filesystem->getFileSize(path);
+    if(size == (uint32_t)-1) {
+        filesystem->lock.unlock();
+        return 0;
+    }
+
+    uint8_t* buffer = new uint8_t[size];
+    int read = filesystem->readFile(path, buffer, 0, size);
+    filesystem->lock.unlock();
+
+    if(read != (int)size) {
+        delete[] buffer;
+        return 0;
+    }
+
+    if(fileSizeReturn)
+        *fileSizeReturn = size;
+
+    return buffer;
+}
+
+ramDisk* Intial::moduleDisk(multiboot_info_t* mbi, uint32_t index) {
+    // Module 0 is the initrd, every module after it is loaded as a raw disk image
+    if(!(mbi->flags & MULTIBOOT_INFO_MODS) || index + 1 >= mbi->mods_count)
+        return 0;
+
+    multiboot_module_t* module = (multiboot_module_t*)phys2virt(mbi->mods_addr) + index + 1;
+    uint32_t size = module->mod_end - module->mod_start;
+    if(size < RAMDISK_BLOCK_SIZE)
+        return 0;
+
+    // Writes go straight into the image, the pages must stay out of the allocator's hands
+    physicalMemoryManager::setRegionUsed(module->mod_start, size);
+    return new ramDisk((uint8_t*)phys2virt(module->mod_start), size);
+}
@@ -4,17 +4,19 @@
 #include <ak/types.h>
 #include <multiboot/multiboot.h>
 #include <kernel/console.h>
+#include <kernel/filesystem/initrdfs.h>
+#include <kernel/disks/ramdisk.h>
 
 namespace Kernel {
-    struct init {
-        char name[30];
-        char path[100];
-        ak::uint32_t size;
-    } __attribute__((packed));
-
+    /**
+     * @brief Intial[initialize, readFile, moduleDisk] the initrd loaded by grub as the first multiboot module, later modules are disk images
+     */
     class Intial {
     public:
+        static initrdFS* filesystem;
+
         static void initialize(multiboot_info_t* mbi);
         static void* readFile(const char* path, ak::uint32_t* fileSizeReturn = 0);
+        static ramDisk* moduleDisk(multiboot_info_t* mbi, ak::uint32_t index);
     };
-}
\ No newline at end of file
+}
@@ -13,5 +13,7 @@ namespace Kernel {
     };
 
     void sendLog(logLevel level, const char* __restrict__ format, ...);
+    #define Log(level, ...) sendLog(level, __VA_ARGS__)
+
     void Print(const char* data, ak::uint32_t length);
 }
\ No newline at end of file
@@ -0,0 +1,102 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#include "completion.h"
+#include <cpu/idt.h>
+#include <cpu/port.h>
+
+using namespace Kernel::ak;
+using namespace Kernel;
+
+void completionHelper::reset(completion* event) {
+    event->done = false;
+    event->waiter = 0;
+}
+
+void completionHelper::signal(completion* event) {
+    // Called with interrupts off, once done is set the owner may reuse or free the event so the waiter is read first
+    Thread* waiter = event->waiter;
+    event->waiter = 0;
+    event->done = true;
+
+    if(waiter)
+        scheduler::unblock(waiter);
+}
+
+bool completionHelper::wait(completion* event, uint32_t timeoutMs, completionPoll poll, void* context) {
+    Thread* current = scheduler::currentThread();
+
+    // Before the scheduler runs there is no thread to wake, the hardware is polled for about the timeout instead
+    if(current == 0) {
+        uint32_t limit = (timeoutMs != 0 ? timeoutMs : COMPLETION_POLL_TIMEOUT_MS) * 1000;
+        for(uint32_t i = 0; i < limit && !event->done; i++) {
+            if(poll) {
+                interruptDescriptorTable::disableInterrupts();
+                poll(context);
+                interruptDescriptorTable::enableInterrupts();
+            }
+            inportb(0x80);
+        }
+        return event->done;
+    }
+
+    uint32_t start = scheduler::ticks();
+    while(true) {
+        // Checked again with interrupts off so the completion can not slip in before we block
+        interruptDescriptorTable::disableInterrupts();
+        bool busy = poll ? poll(context) : false;
+        uint32_t elapsed = scheduler::ticks() - start;
+        if(event->done || (timeoutMs != 0 && elapsed >= timeoutMs))
+            break;
+
+        // The poll asked to be called again soon, sleeping would leave the hardware unchecked until the interrupt
+        if(busy) {
+            interruptDescriptorTable::enableInterrupts();
+            scheduler::yield();
+            continue;
+        }
+
+        // Woken by signal or by the timer, a poll gets another look every interval in case the interrupt got lost
+        uint32_t sleepMs = timeoutMs != 0 ? timeoutMs - elapsed : 0;
+        if(poll && (sleepMs == 0 || sleepMs > COMPLETION_POLL_INTERVAL_MS))
+            sleepMs = COMPLETION_POLL_INTERVAL_MS;
+
+        event->waiter = current;
+        if(sleepMs != 0)
+            scheduler::sleep(current, sleepMs);
+        else
+            scheduler::block(current, Sleep);
+        interruptDescriptorTable::enableInterrupts();
+    }
+
+    event->waiter = 0;
+    bool done = event->done;
+    interruptDescriptorTable::enableInterrupts();
+
+    return done;
+}
+
+int completionHelper::claimSlot(volatile uint32_t* used, uint32_t count, bool wait) {
+    // Slots free up from the threads that owned them, so a full set just lets everyone else run for a while
+    while(true) {
+        interruptDescriptorTable::disableInterrupts();
+        for(uint32_t i = 0; i < count; i++)
+            if(!(*used & (1 << i))) {
+                *used |= 1 << i;
+                interruptDescriptorTable::enableInterrupts();
+                return i;
+            }
+        interruptDescriptorTable::enableInterrupts();
+
+        if(!wait)
+            return -1;
+        scheduler::yield();
+    }
+}
+
+void completionHelper::releaseSlot(volatile uint32_t* used, int slot) {
+    interruptDescriptorTable::disableInterrupts();
+    *used &= ~(1 << slot);
+    interruptDescriptorTable::enableInterrupts();
+}
@@ -0,0 +1,42 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#pragma once
+
+#include <tasking/scheduler.h>
+#include <ak/types.h>
+
+namespace Kernel {
+    #define COMPLETION_POLL_TIMEOUT_MS  1000
+    #define COMPLETION_POLL_INTERVAL_MS 10
+
+    /**
+     * @brief checks the hardware for the event with interrupts off, true asks the waiter to keep running instead of sleeping
+     */
+    typedef bool (*completionPoll)(void* context);
+
+    /**
+     * @brief one event an interrupt handler or another thread reports to the thread waiting for it
+     */
+    struct completion {
+        volatile bool done;
+        Thread* waiter;
+    };
+
+    /**
+     * @brief completionHelper[reset, signal, wait, claim slot, release slot] sleeping on completions and handing out command slots
+     */
+    class completionHelper {
+      public:
+        static void reset(completion* event);
+        static void signal(completion* event);
+        static bool wait(completion* event, ak::uint32_t timeoutMs = 0, completionPoll poll = 0, void* context = 0);
+
+        static int claimSlot(volatile ak::uint32_t* used, ak::uint32_t count, bool wait = true);
+        static void releaseSlot(volatile ak::uint32_t* used, int slot);
+
+      private:
+        completionHelper();
+    };
+}
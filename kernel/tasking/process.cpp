@@ -0,0 +1,18 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#include "process.h"
+#include <memory/filemapping.h>
+
+using namespace Kernel::ak;
+using namespace Kernel;
+
+void processHelper::removeProcess(Process* proc) {
+    proc->state = Terminated;
+
+    // File mappings hold page cache references, they are dropped before anything else of the process
+    memoryMapping::removeAll(proc);
+
+    Processes.remove(proc);
+}
@@ -5,6 +5,7 @@
 #pragma once
 
 #include "thread.h"
+#include "lock.h"
 #include <ak/list.h>
 #include <ak/types.h>
 #include <libc/ipc.h>
@@ -26,6 +27,7 @@ namespace Kernel {
     #define PROC_USER_HEAP_SIZE 1_MB 
 
     struct Thread;
+    struct fileMapping;
 
     struct Process {
         int id;
@@ -49,6 +51,8 @@ namespace Kernel {
 
 
         List<IPC::IPCMessage> ipcMessages;
+        List<fileMapping*> fileMappings;
+        mutexLock mappingsLock;
 
         Stream* stdInput;
         Stream* stdOutput;
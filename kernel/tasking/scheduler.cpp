@@ -0,0 +1,15 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#include "scheduler.h"
+
+using namespace Kernel::ak;
+using namespace Kernel;
+
+void scheduler::sleep(Thread* thread, uint32_t ms) {
+    // The timer counts timeDelta down for threads blocked with Sleep and wakes them at zero, unblock still wakes them early
+    thread->timeDelta = ms;
+    block(thread, Sleep);
+    thread->timeDelta = 0;
+}
@@ -0,0 +1,28 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#pragma once
+
+#include "thread.h"
+#include <ak/types.h>
+
+namespace Kernel {
+    /**
+     * @brief scheduler[yield, block, sleep, unblock, current thread, ticks]
+     */
+    class scheduler {
+      public:
+        static Thread* currentThread();
+        static void yield();
+
+        static void block(Thread* thread, blockedState reason = Unkown);
+        static void sleep(Thread* thread, ak::uint32_t ms);
+        static void unblock(Thread* thread);
+
+        static ak::uint32_t ticks();
+
+      private:
+        scheduler();
+    };
+}
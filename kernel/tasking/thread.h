@@ -47,7 +47,7 @@ namespace Kernel {
 
     class threadHelper {
       public:
-        static thread* createFromFunction(void (*entryPoint)(), bool isKernel = false, ak::uint32_t flags = 0x202, Process* parent = 0);
+        static Thread* createFromFunction(void (*entryPoint)(), bool isKernel = false, ak::uint32_t flags = 0x202, Process* parent = 0);
         static void removeThread(Thread* thread);
       private:
         threadHelper();
@@ -0,0 +1,800 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#include "ehci.h"
+#include <cpu/idt.h>
+#include <memory/virtualmemory.h>
+#include <memory/devicememory.h>
+#include <kernel/drivers/usb/usbdriver.h>
+#include <kernel/system/log.h>
+
+using namespace Kernel::ak;
+using namespace Kernel;
+using namespace Kernel::system;
+
+ehciController* ehciController::controllers[EHCI_MAX_CONTROLLERS];
+int ehciController::controllerCount = 0;
+Thread* ehciController::portThread = 0;
+static volatile bool portThreadSleeping = false;
+
+ehciController::ehciController(pciDevice* device, pciController* pci, usbManager* manager)
+: usbController(EHCI), driver((char*)"EHCI Controller", (char*)"USB 2.0 host controller"), interruptHandler(IDT_INTERRUPT_OFFSET + device->interrupt) {
+    this->device = device;
+    this->pci = pci;
+    this->manager = manager;
+    memOperator::memset(this->portAddress, 0, sizeof(this->portAddress));
+    memOperator::memset(this->usedTDs, 0, sizeof(this->usedTDs));
+    memOperator::memset(this->endpoints, 0, sizeof(this->endpoints));
+    completionHelper::reset(&this->asyncAdvance);
+}
+
+int ehciController::probe(pciController* pci, usbManager* manager) {
+    int found = 0;
+
+    for(int i = 0; i < pci->deviceList.size(); i++) {
+        pciDevice* device = pci->deviceList[i];
+        if(device->classID != 0x0C || device->subclassID != 0x03 || device->interfaceID != 0x20)
+            continue;
+
+        if(controllerCount == EHCI_MAX_CONTROLLERS)
+            break;
+
+        ehciController* controller = new ehciController(device, pci, manager);
+        if(!controller->initialize()) {
+            interruptManager::removeHandler(controller, IDT_INTERRUPT_OFFSET + device->interrupt);
+            delete controller;
+            continue;
+        }
+
+        controllers[controllerCount++] = controller;
+        manager->addController(controller);
+        found++;
+    }
+
+    return found;
+}
+
+uint32_t ehciController::readRegister(uint32_t offset) {
+    return *(volatile uint32_t*)(this->operational + offset);
+}
+
+void ehciController::writeRegister(uint32_t offset, uint32_t value) {
+    *(volatile uint32_t*)(this->operational + offset) = value;
+}
+
+void ehciController::delay(uint32_t ms) {
+    if(scheduler::currentThread() == 0) {
+        for(uint32_t i = 0; i < ms * 1000; i++)
+            inportb(0x80);
+        return;
+    }
+
+    uint32_t start = scheduler::ticks();
+    for(uint32_t elapsed = 0; elapsed < ms; elapsed = scheduler::ticks() - start)
+        scheduler::sleep(scheduler::currentThread(), ms - elapsed);
+}
+
+void ehciController::takeOwnership() {
+    uint16_t bus = this->device->bus;
+    uint16_t slot = this->device->device;
+    uint16_t function = this->device->function;
+
+    uint32_t eecp = (*(volatile uint32_t*)(this->capabilities + EHCI_CAP_HCCPARAMS) >> 8) & 0xFF;
+    if(eecp < 0x40)
+        return;
+
+    uint32_t legacy = this->pci->read(bus, slot, function, eecp);
+    if(!(legacy & EHCI_LEGACY_BIOS_OWNED))
+        return;
+
+    // The BIOS emulates a PS/2 keyboard through SMIs until it lets go of the controller
+    this->pci->write(bus, slot, function, eecp, legacy | EHCI_LEGACY_OS_OWNED);
+    for(uint32_t i = 0; i < EHCI_TIMEOUT && (this->pci->read(bus, slot, function, eecp) & EHCI_LEGACY_BIOS_OWNED); i++);
+    this->pci->write(bus, slot, function, eecp + 4, 0);
+}
+
+bool ehciController::initialize() {
+    uint16_t bus = this->device->bus;
+    uint16_t slot = this->device->device;
+    uint16_t function = this->device->function;
+
+    baseAddress bar = this->pci->getBaseAddressRegister(bus, slot, function, 0);
+    if(bar.type != MemoryMapping || bar.address == 0)
+        return false;
+
+    this->pci->write(bus, slot, function, 0x04, this->pci->read(bus, slot, function, 0x04) | PCI_CMDREG_MEM | PCI_CMDREG_BM);
+
+    this->capabilities = (volatile uint8_t*)deviceMemory::mapRegisters((uint32_t)bar.address, PAGE_SIZE);
+    if(this->capabilities == 0)
+        return false;
+
+    this->operational = this->capabilities + *this->capabilities;
+    this->portCount = *(volatile uint32_t*)(this->capabilities + EHCI_CAP_HCSPARAMS) & 0xF;
+    if(this->portCount > EHCI_MAX_PORTS)
+        this->portCount = EHCI_MAX_PORTS;
+
+    takeOwnership();
+
+    writeRegister(EHCI_OP_USBCMD, readRegister(EHCI_OP_USBCMD) & ~EHCI_CMD_RUN);
+    for(uint32_t i = 0; i < EHCI_TIMEOUT && !(readRegister(EHCI_OP_USBSTS) & EHCI_STS_HALTED); i++);
+
+    writeRegister(EHCI_OP_USBCMD, EHCI_CMD_RESET);
+    for(uint32_t i = 0; i < EHCI_TIMEOUT && (readRegister(EHCI_OP_USBCMD) & EHCI_CMD_RESET); i++);
+    if(readRegister(EHCI_OP_USBCMD) & EHCI_CMD_RESET) {
+        Log(Error, "EHCI controller did not come out of reset");
+        return false;
+    }
+
+    this->frameList = (uint32_t*)deviceMemory::allocatePage(&this->frameListPhysical);
+    this->tds = (ehciTransferDescriptor*)deviceMemory::allocatePages(EHCI_TD_COUNT * sizeof(ehciTransferDescriptor) / PAGE_SIZE, &this->tdPhysical);
+    this->queueHeads = (ehciQueueHead*)deviceMemory::allocatePage(&this->queueHeadPhysical);
+    if(this->frameList == 0 || this->tds == 0 || this->queueHeads == 0)
+        return false;
+
+    memOperator::memset(this->tds, 0, EHCI_TD_COUNT * sizeof(ehciTransferDescriptor));
+    memOperator::memset(this->queueHeads, 0, EHCI_QH_COUNT * sizeof(ehciQueueHead));
+
+    // TD 0 never runs, short packets on the async schedule are sent to it so the rest of their chain is skipped
+    this->usedTDs[0] = 1;
+    this->tds[0].next = EHCI_LINK_TERMINATE;
+    this->tds[0].alternateNext = EHCI_LINK_TERMINATE;
+
+    // Queue head 0 is the halted head of the async ring, queue head 1 the anchor every frame starts from
+    ehciQueueHead* asyncHead = &this->queueHeads[0];
+    asyncHead->link = this->queueHeadPhysical | EHCI_LINK_QH;
+    asyncHead->characteristics = EHCI_QH_RECLAMATION_HEAD | EHCI_QH_HIGH_SPEED;
+    asyncHead->next = EHCI_LINK_TERMINATE;
+    asyncHead->alternateNext = EHCI_LINK_TERMINATE;
+    asyncHead->token = EHCI_TD_HALTED;
+
+    ehciQueueHead* periodicHead = &this->queueHeads[1];
+    periodicHead->link = EHCI_LINK_TERMINATE;
+    periodicHead->characteristics = EHCI_QH_HIGH_SPEED;
+    periodicHead->next = EHCI_LINK_TERMINATE;
+    periodicHead->alternateNext = EHCI_LINK_TERMINATE;
+    periodicHead->token = EHCI_TD_HALTED;
+
+    // Interrupt endpoints are visited every frame, a HID device just NAKs until it has a report
+    for(int i = 0; i < EHCI_FRAMES; i++)
+        this->frameList[i] = (this->queueHeadPhysical + sizeof(ehciQueueHead)) | EHCI_LINK_QH;
+
+    writeRegister(EHCI_OP_CTRLDSSEGMENT, 0);
+    writeRegister(EHCI_OP_PERIODICLISTBASE, this->frameListPhysical);
+    writeRegister(EHCI_OP_ASYNCLISTADDR, this->queueHeadPhysical);
+    writeRegister(EHCI_OP_USBSTS, EHCI_STS_EVENTS);
+    writeRegister(EHCI_OP_USBINTR, EHCI_STS_USBINT | EHCI_STS_ERROR | EHCI_STS_PORT_CHANGE | EHCI_STS_SYSTEM_ERROR | EHCI_STS_ASYNC_ADVANCE);
+
+    // Completions are reported at the end of the microframe they happen in instead of the default 1 ms
+    writeRegister(EHCI_OP_USBCMD, EHCI_CMD_ITC_1_MICROFRAME | EHCI_CMD_ASYNC | EHCI_CMD_PERIODIC | EHCI_CMD_RUN);
+    writeRegister(EHCI_OP_CONFIGFLAG, 1);
+
+    for(uint32_t port = 0; port < this->portCount; port++)
+        writeRegister(EHCI_OP_PORTSC + port * 4, readRegister(EHCI_OP_PORTSC + port * 4) | EHCI_PORT_POWER);
+    delay(20);
+
+    Log(Info, "EHCI controller with %d ports", this->portCount);
+    return true;
+}
+
+uint32_t ehciController::handleInterrupt(uint32_t esp) {
+    if(this->operational == 0)
+        return esp;
+
+    uint32_t status = readRegister(EHCI_OP_USBSTS) & EHCI_STS_EVENTS;
+    if(status == 0)
+        return esp;
+
+    writeRegister(EHCI_OP_USBSTS, status);
+
+    if(status & (EHCI_STS_USBINT | EHCI_STS_ERROR))
+        completeTransfers();
+
+    if(status & EHCI_STS_ASYNC_ADVANCE)
+        completionHelper::signal(&this->asyncAdvance);
+
+    // Hotplug is handled on the port thread, resetting a port takes far too long for an interrupt
+    if(status & EHCI_STS_PORT_CHANGE) {
+        this->portEvent = true;
+        if(portThread && portThreadSleeping) {
+            portThreadSleeping = false;
+            scheduler::unblock(portThread);
+        }
+    }
+
+    if(status & EHCI_STS_SYSTEM_ERROR)
+        Log(Error, "EHCI host system error, the controller halted");
+
+    return esp;
+}
+
+void ehciController::setup() {
+    if(portThread == 0)
+        portThread = threadHelper::createFromFunction(portEventThread, true);
+
+    // Devices that were plugged in before the controller was configured never raised a change
+    interruptDescriptorTable::disableInterrupts();
+    this->portEvent = true;
+    if(portThreadSleeping) {
+        portThreadSleeping = false;
+        scheduler::unblock(portThread);
+    }
+    interruptDescriptorTable::enableInterrupts();
+}
+
+void ehciController::portEventThread() {
+    while(true) {
+        interruptDescriptorTable::disableInterrupts();
+        bool pending = false;
+        for(int i = 0; i < controllerCount; i++)
+            pending = pending || controllers[i]->portEvent;
+
+        if(!pending) {
+            portThreadSleeping = true;
+            scheduler::block(scheduler::currentThread(), Sleep);
+        }
+        interruptDescriptorTable::enableInterrupts();
+
+        for(int i = 0; i < controllerCount; i++)
+            if(controllers[i]->portEvent) {
+                controllers[i]->portEvent = false;
+                controllers[i]->controllerChecksThread();
+            }
+    }
+}
+
+void ehciController::controllerChecksThread() {
+    for(uint32_t port = 0; port < this->portCount; port++) {
+        uint32_t status = readRegister(EHCI_OP_PORTSC + port * 4);
+        bool connected = status & EHCI_PORT_CONNECTED;
+
+        if((status & EHCI_PORT_CHANGES) || (connected && this->portAddress[port] == 0 && !(status & EHCI_PORT_COMPANION)))
+            portChanged(port);
+    }
+}
+
+void ehciController::portChanged(uint32_t port) {
+    uint32_t reg = EHCI_OP_PORTSC + port * 4;
+    uint32_t status = readRegister(reg);
+
+    // The change bits are write one to clear, everything else is written back as it was
+    writeRegister(reg, status);
+
+    if(!(status & EHCI_PORT_CONNECTED)) {
+        if(this->portAddress[port] == 0)
+            return;
+
+        Log(Info, "EHCI device on port %d unplugged", port);
+        this->manager->removeDevice(this, port);
+        releaseEndpoints(this->portAddress[port]);
+        this->portAddress[port] = 0;
+        return;
+    }
+
+    if(this->portAddress[port] != 0)
+        return;
+
+    // Low speed devices are recognised before the reset, full speed ones by a port that stays disabled after it
+    if((status & EHCI_PORT_LINE_STATUS) == EHCI_PORT_LINE_LOW_SPEED) {
+        writeRegister(reg, (status & ~EHCI_PORT_CHANGES) | EHCI_PORT_COMPANION);
+        return;
+    }
+
+    writeRegister(reg, (status & ~(EHCI_PORT_ENABLED | EHCI_PORT_CHANGES)) | EHCI_PORT_RESET);
+    delay(USB_TDRSTR);
+    writeRegister(reg, readRegister(reg) & ~(EHCI_PORT_RESET | EHCI_PORT_ENABLED | EHCI_PORT_CHANGES));
+    for(uint32_t i = 0; i < EHCI_TIMEOUT && (readRegister(reg) & EHCI_PORT_RESET); i++);
+    delay(USB_TRSTRCY);
+
+    status = readRegister(reg);
+    if(!(status & EHCI_PORT_ENABLED)) {
+        writeRegister(reg, (status & ~EHCI_PORT_CHANGES) | EHCI_PORT_COMPANION);
+        return;
+    }
+
+    setupDevice(port);
+}
+
+void ehciController::setupDevice(uint32_t port) {
+    usbDevice* dev = new usbDevice();
+    dev->controller = this;
+    dev->portNum = port;
+    dev->devAddress = 0;
+    dev->ehciProperties_t.maxPacket = 64;
+
+    // The first 8 bytes of the device descriptor already hold the real packet size of endpoint 0
+    DEVICE_DESC descriptor;
+    memOperator::memset(&descriptor, 0, sizeof(DEVICE_DESC));
+    bool described = controlIn(dev, &descriptor, 8, STDRD_GET_REQUEST, GET_DESCRIPTOR, DEVICE, 0, 0);
+
+    uint8_t address = this->nextAddress;
+    bool addressed = described && controlOut(dev, 0, STDRD_SET_REQUEST, SET_ADDRESS, 0, address, 0);
+
+    // The default address queue head was built with a guessed packet size, the next device needs a fresh one
+    releaseEndpoints(0);
+
+    if(!addressed) {
+        Log(Error, "EHCI could not address the device on port %d", port);
+        delete dev;
+        return;
+    }
+
+    this->nextAddress = this->nextAddress == 127 ? 1 : this->nextAddress + 1;
+    delay(2);
+
+    dev->devAddress = address;
+    dev->ehciProperties_t.maxPacket = descriptor.max_packet_size;
+    this->portAddress[port] = address;
+    this->manager->addDevice(dev);
+}
+
+int ehciController::allocateTD() {
+    int index = -1;
+
+    interruptDescriptorTable::disableInterrupts();
+    for(int i = 0; i < EHCI_TD_COUNT && index < 0; i++)
+        if(!(this->usedTDs[i / 32] & (1 << (i % 32)))) {
+            this->usedTDs[i / 32] |= 1 << (i % 32);
+            index = i;
+        }
+    interruptDescriptorTable::enableInterrupts();
+
+    return index;
+}
+
+void ehciController::freeTD(int index) {
+    interruptDescriptorTable::disableInterrupts();
+    this->usedTDs[index / 32] &= ~(1 << (index % 32));
+    interruptDescriptorTable::enableInterrupts();
+}
+
+uint32_t ehciController::physicalTD(int index) {
+    return this->tdPhysical + index * sizeof(ehciTransferDescriptor);
+}
+
+ehciEndpoint* ehciController::findEndpoint(usbDevice* device, uint8_t number, bool periodic) {
+    ehciEndpoint* endpoint = 0;
+
+    interruptDescriptorTable::disableInterrupts();
+    for(int i = 0; i < EHCI_ENDPOINTS; i++) {
+        ehciEndpoint* candidate = &this->endpoints[i];
+        if(candidate->used && candidate->address == device->devAddress && candidate->number == number && candidate->periodic == periodic) {
+            interruptDescriptorTable::enableInterrupts();
+            return candidate;
+        }
+        if(!candidate->used && endpoint == 0)
+            endpoint = candidate;
+    }
+
+    if(endpoint == 0) {
+        interruptDescriptorTable::enableInterrupts();
+        Log(Error, "EHCI is out of queue heads");
+        return 0;
+    }
+    endpoint->used = true;
+    interruptDescriptorTable::enableInterrupts();
+
+    uint32_t maxPacket = number == 0 ? device->ehciProperties_t.maxPacket : 512;
+    for(int i = 0; number != 0 && i < device->endpoints.size(); i++)
+        if(device->endpoints[i]->endpointNumber == number)
+            maxPacket = device->endpoints[i]->maxPacketSize;
+
+    int index = (endpoint - this->endpoints) + 2;
+    endpoint->periodic = periodic;
+    endpoint->address = device->devAddress;
+    endpoint->number = number;
+    endpoint->queueHead = &this->queueHeads[index];
+    endpoint->queueHeadPhysical = this->queueHeadPhysical + index * sizeof(ehciQueueHead);
+    endpoint->tdCount = 0;
+    endpoint->busy = false;
+    endpoint->transfer = 0;
+
+    // Control endpoints take the toggle from each TD, everything else lets the queue head track it
+    ehciQueueHead* queueHead = endpoint->queueHead;
+    memOperator::memset(queueHead, 0, sizeof(ehciQueueHead));
+    queueHead->characteristics = device->devAddress | (number << 8) | EHCI_QH_HIGH_SPEED | (maxPacket << 16)
+                               | (number == 0 ? EHCI_QH_TOGGLE_FROM_TD : 0) | (periodic ? 0 : EHCI_QH_NAK_RELOAD);
+    queueHead->capabilities = EHCI_QH_MULT_ONE | (periodic ? EHCI_QH_SMASK_FIRST : 0);
+    queueHead->next = EHCI_LINK_TERMINATE;
+    queueHead->alternateNext = EHCI_LINK_TERMINATE;
+
+    ehciQueueHead* anchor = periodic ? &this->queueHeads[1] : &this->queueHeads[0];
+    interruptDescriptorTable::disableInterrupts();
+    queueHead->link = anchor->link;
+    anchor->link = endpoint->queueHeadPhysical | EHCI_LINK_QH;
+    interruptDescriptorTable::enableInterrupts();
+
+    return endpoint;
+}
+
+void ehciController::unlinkAsync(ehciEndpoint* endpoint) {
+    ehciQueueHead* previous = &this->queueHeads[0];
+    while((previous->link & ~0x1F) != endpoint->queueHeadPhysical)
+        previous = &this->queueHeads[((previous->link & ~0x1F) - this->queueHeadPhysical) / sizeof(ehciQueueHead)];
+
+    previous->link = endpoint->queueHead->link;
+
+    // The controller may still hold the queue head in its cache until it reports an async advance
+    completionHelper::reset(&this->asyncAdvance);
+    writeRegister(EHCI_OP_USBCMD, readRegister(EHCI_OP_USBCMD) | EHCI_CMD_ASYNC_DOORBELL);
+    completionHelper::wait(&this->asyncAdvance, 0, pollAdvance, this);
+}
+
+bool ehciController::pollAdvance(void* context) {
+    ehciController* controller = (ehciController*)context;
+    if(!controller->asyncAdvance.done && (controller->readRegister(EHCI_OP_USBSTS) & EHCI_STS_ASYNC_ADVANCE)) {
+        controller->writeRegister(EHCI_OP_USBSTS, EHCI_STS_ASYNC_ADVANCE);
+        completionHelper::signal(&controller->asyncAdvance);
+    }
+
+    return false;
+}
+
+void ehciController::releaseEndpoints(uint8_t address) {
+    for(int i = 0; i < EHCI_ENDPOINTS; i++) {
+        ehciEndpoint* endpoint = &this->endpoints[i];
+        if(!endpoint->used || endpoint->address != address)
+            continue;
+
+        if(endpoint->periodic) {
+            interruptDescriptorTable::disableInterrupts();
+            ehciQueueHead* previous = &this->queueHeads[1];
+            while((previous->link & ~0x1F) != endpoint->queueHeadPhysical)
+                previous = &this->queueHeads[((previous->link & ~0x1F) - this->queueHeadPhysical) / sizeof(ehciQueueHead)];
+            previous->link = endpoint->queueHead->link;
+            endpoint->used = false;
+            interruptDescriptorTable::enableInterrupts();
+
+            // The periodic schedule has no doorbell, one full frame is enough for the controller to let go
+            delay(2);
+
+            if(endpoint->transfer) {
+                this->interrupTransfers.remove(endpoint->transfer);
+                delete[] endpoint->transfer->bufferPointer;
+                delete endpoint->transfer;
+            }
+        }
+        else {
+            unlinkAsync(endpoint);
+            endpoint->used = false;
+        }
+
+        for(int t = 0; t < endpoint->tdCount; t++)
+            freeTD(endpoint->tds[t]);
+        endpoint->tdCount = 0;
+    }
+}
+
+int ehciController::fillTD(int index, uint32_t pid, bool toggle, uint8_t* buf, uint32_t length) {
+    ehciTransferDescriptor* td = &this->tds[index];
+    uint32_t address = (uint32_t)buf;
+    uint32_t offset = address % PAGE_SIZE;
+
+    // Every page pointer is translated on its own, the buffer does not have to be physically contiguous
+    uint32_t room = EHCI_TD_MAX_PAGES * PAGE_SIZE - offset;
+    uint32_t bytes = length < room ? length : room;
+
+    for(int i = 0; i < EHCI_TD_MAX_PAGES; i++) {
+        td->buffer[i] = 0;
+        td->extendedBuffer[i] = 0;
+    }
+    for(uint32_t page = 0; buf != 0 && page * PAGE_SIZE < offset + bytes; page++) {
+        uint32_t physical = (uint32_t)virtualMemoryManager::virtualToPhysical((void*)(address - offset + page * PAGE_SIZE));
+        td->buffer[page] = page == 0 ? physical + offset : physical;
+    }
+
+    td->token = EHCI_TD_ACTIVE | pid | EHCI_TD_ERROR_COUNT | (bytes << 16) | (toggle ? EHCI_TD_TOGGLE : 0);
+    return bytes;
+}
+
+bool ehciController::queueData(ehciEndpoint* endpoint, uint32_t pid, uint8_t* buf, uint32_t length, uint32_t maxPacket) {
+    uint32_t done = 0;
+
+    do {
+        int index = allocateTD();
+        if(index < 0 || endpoint->tdCount == EHCI_TD_COUNT / 4) {
+            if(index >= 0)
+                freeTD(index);
+            return false;
+        }
+
+        // Only the last TD may end on a partial packet, anything else reads as a short transfer
+        uint32_t bytes = fillTD(index, pid, false, buf ? buf + done : 0, length - done);
+        if(done + bytes < length) {
+            bytes -= bytes % maxPacket;
+            this->tds[index].token = (this->tds[index].token & ~(0x7FFF << 16)) | (bytes << 16);
+        }
+
+        if(endpoint->tdCount > 0)
+            this->tds[endpoint->tds[endpoint->tdCount - 1]].next = physicalTD(index);
+        this->tds[index].next = EHCI_LINK_TERMINATE;
+        this->tds[index].alternateNext = physicalTD(0);
+
+        endpoint->tds[endpoint->tdCount++] = index;
+        done += bytes;
+    } while(done < length);
+
+    return true;
+}
+
+void ehciController::checkTransfer(ehciEndpoint* endpoint) {
+    bool finished = true;
+    bool failed = false;
+    bool shortPacket = false;
+
+    for(int i = 0; i < endpoint->tdCount; i++) {
+        ehciTransferDescriptor* td = &this->tds[endpoint->tds[i]];
+        uint32_t token = td->token;
+
+        if(token & EHCI_TD_ACTIVE) {
+            finished = false;
+            break;
+        }
+        if(token & (EHCI_TD_HALTED | EHCI_TD_ERRORS)) {
+            failed = true;
+            break;
+        }
+
+        // A short packet ends the transfer when it jumped to the idle TD, the control data stage jumps to its status stage instead
+        if(((token >> 16) & 0x7FFF) != 0 && td->alternateNext == physicalTD(0)) {
+            shortPacket = true;
+            break;
+        }
+    }
+
+    if(!finished)
+        return;
+
+    endpoint->failed = failed;
+    endpoint->shortPacket = shortPacket;
+    completionHelper::signal(&endpoint->completed);
+}
+
+bool ehciController::pollTransfers(void* context) {
+    // Only the async endpoints, periodic reports keep arriving through the interrupt
+    ehciController* controller = (ehciController*)context;
+    for(int i = 0; i < EHCI_ENDPOINTS; i++) {
+        ehciEndpoint* endpoint = &controller->endpoints[i];
+        if(endpoint->used && !endpoint->periodic && endpoint->busy && !endpoint->completed.done)
+            controller->checkTransfer(endpoint);
+    }
+
+    return false;
+}
+
+bool ehciController::runTransfer(ehciEndpoint* endpoint) {
+    ehciQueueHead* queueHead = endpoint->queueHead;
+    this->tds[endpoint->tds[endpoint->tdCount - 1]].token |= EHCI_TD_IOC;
+
+    completionHelper::reset(&endpoint->completed);
+    endpoint->failed = false;
+    endpoint->shortPacket = false;
+
+    // The queue head is idle, pointing its overlay at the chain makes the controller pick it up on the next pass
+    interruptDescriptorTable::disableInterrupts();
+    endpoint->busy = true;
+    queueHead->next = physicalTD(endpoint->tds[0]);
+    queueHead->token &= EHCI_TD_TOGGLE;
+    interruptDescriptorTable::enableInterrupts();
+
+    completionHelper::wait(&endpoint->completed, EHCI_TRANSFER_TIMEOUT_MS, pollTransfers, this);
+
+    interruptDescriptorTable::disableInterrupts();
+    bool success = endpoint->completed.done && !endpoint->failed;
+    endpoint->busy = false;
+
+    // A halted or abandoned queue head starts over empty with the toggle back at DATA0, like after CLEAR_FEATURE
+    if(!success) {
+        queueHead->next = EHCI_LINK_TERMINATE;
+        queueHead->token = 0;
+    }
+    interruptDescriptorTable::enableInterrupts();
+
+    for(int i = 0; i < endpoint->tdCount; i++)
+        freeTD(endpoint->tds[i]);
+    endpoint->tdCount = 0;
+
+    return success;
+}
+
+bool ehciController::controlTransfer(usbDevice* device, bool in, void* buf, int len, uint8_t requestType, uint8_t request, uint16_t value, uint16_t index) {
+    ehciEndpoint* endpoint = findEndpoint(device, 0, false);
+    if(endpoint == 0)
+        return false;
+
+    REQUEST_PACKET setup;
+    setup.request_type = requestType;
+    setup.request = request;
+    setup.value = value;
+    setup.index = index;
+    setup.length = len;
+
+    endpoint->lock.lock();
+
+    int setupTD = allocateTD();
+    int dataTD = len > 0 ? allocateTD() : -1;
+    int statusTD = allocateTD();
+    if(setupTD < 0 || statusTD < 0 || (len > 0 && dataTD < 0)) {
+        if(setupTD >= 0) freeTD(setupTD);
+        if(dataTD >= 0) freeTD(dataTD);
+        if(statusTD >= 0) freeTD(statusTD);
+        endpoint->lock.unlock();
+        return false;
+    }
+
+    // SETUP is always DATA0, the data stage starts at DATA1 and the status stage runs the other way with DATA1
+    fillTD(setupTD, EHCI_TD_PID_SETUP, false, (uint8_t*)&setup, sizeof(REQUEST_PACKET));
+    endpoint->tds[endpoint->tdCount++] = setupTD;
+
+    if(dataTD >= 0) {
+        if(fillTD(dataTD, in ? EHCI_TD_PID_IN : EHCI_TD_PID_OUT, true, (uint8_t*)buf, len) != len) {
+            freeTD(setupTD); freeTD(dataTD); freeTD(statusTD);
+            endpoint->tdCount = 0;
+            endpoint->lock.unlock();
+            return false;
+        }
+        endpoint->tds[endpoint->tdCount++] = dataTD;
+    }
+
+    fillTD(statusTD, in && len > 0 ? EHCI_TD_PID_OUT : EHCI_TD_PID_IN, true, 0, 0);
+    endpoint->tds[endpoint->tdCount++] = statusTD;
+
+    for(int i = 0; i < endpoint->tdCount; i++) {
+        ehciTransferDescriptor* td = &this->tds[endpoint->tds[i]];
+        td->next = i + 1 < endpoint->tdCount ? physicalTD(endpoint->tds[i + 1]) : EHCI_LINK_TERMINATE;
+        td->alternateNext = i + 1 < endpoint->tdCount ? physicalTD(statusTD) : physicalTD(0);
+    }
+
+    bool success = runTransfer(endpoint);
+    endpoint->lock.unlock();
+    return success;
+}
+
+bool ehciController::bulkTransfer(usbDevice* device, bool in, void* buf, int len, int endP) {
+    ehciEndpoint* endpoint = findEndpoint(device, endP, false);
+    if(endpoint == 0)
+        return false;
+
+    uint32_t maxPacket = (endpoint->queueHead->characteristics >> 16) & 0x7FF;
+    uint8_t* data = (uint8_t*)buf;
+    bool success = true;
+
+    // Every TD of a chain is queued at once, the controller moves from one to the next without waiting on us
+    endpoint->lock.lock();
+    for(int done = 0; done < len && success; ) {
+        if(!queueData(endpoint, in ? EHCI_TD_PID_IN : EHCI_TD_PID_OUT, data + done, len - done, maxPacket) && endpoint->tdCount == 0) {
+            success = false;
+            break;
+        }
+
+        for(int i = 0; i < endpoint->tdCount; i++)
+            done += (this->tds[endpoint->tds[i]].token >> 16) & 0x7FFF;
+
+        // A short packet on the way in ends the transfer early, the device has nothing more to send
+        success = runTransfer(endpoint);
+        if(endpoint->shortPacket)
+            break;
+    }
+    endpoint->lock.unlock();
+
+    return success;
+}
+
+bool ehciController::bulkIn(usbDevice* device, void* retBuffer, int len, int endP) {
+    return bulkTransfer(device, true, retBuffer, len, endP);
+}
+
+bool ehciController::bulkOut(usbDevice* device, void* sendBuffer, int len, int endP) {
+    return bulkTransfer(device, false, sendBuffer, len, endP);
+}
+
+bool ehciController::controlIn(usbDevice* device, void* target, const int len, const uint8_t requestType, const uint8_t request, const uint16_t valueHigh, const uint16_t valueLow, const uint16_t index) {
+    return controlTransfer(device, true, target, len, requestType, request, (valueHigh << 8) | valueLow, index);
+}
+
+bool ehciController::controlOut(usbDevice* device, const int len, const uint8_t requestType, const uint8_t request, const uint16_t valueHigh, const uint16_t valueLow, const uint16_t index) {
+    return controlTransfer(device, false, 0, len, requestType, request, (valueHigh << 8) | valueLow, index);
+}
+
+void ehciController::interruptIn(usbDevice* device, int len, int endP) {
+    ehciEndpoint* endpoint = findEndpoint(device, endP, true);
+    if(endpoint == 0 || endpoint->transfer != 0 || len <= 0 || len > (int)PAGE_SIZE)
+        return;
+
+    // The first part of the buffer is what the driver reads, behind it every TD of the ring has its own slot
+    interruptTransfer_t* transfer = new interruptTransfer_t;
+    transfer->bufferPointer = new uint8_t[len * (EHCI_INTERRUPT_TDS + 1)];
+    transfer->bufferPhys = (uint32_t)virtualMemoryManager::virtualToPhysical(transfer->bufferPointer);
+    transfer->bufferLen = len;
+    transfer->handler = device->driver;
+    transfer->queueIndex = 0;
+    transfer->qh = endpoint->queueHead;
+    transfer->endpoint = endP;
+
+    for(int i = 0; i < EHCI_INTERRUPT_TDS; i++) {
+        int index = allocateTD();
+        if(index < 0)
+            break;
+
+        fillTD(index, EHCI_TD_PID_IN, false, transfer->bufferPointer + (i + 1) * len, len);
+        this->tds[index].token |= EHCI_TD_IOC;
+        endpoint->tds[endpoint->tdCount++] = index;
+    }
+
+    if(endpoint->tdCount < 2) {
+        Log(Error, "EHCI is out of transfer descriptors for an interrupt endpoint");
+        for(int i = 0; i < endpoint->tdCount; i++)
+            freeTD(endpoint->tds[i]);
+        endpoint->tdCount = 0;
+        delete[] transfer->bufferPointer;
+        delete transfer;
+        return;
+    }
+
+    // A ring, while the driver handles one report the controller is already waiting on the next TD
+    for(int i = 0; i < endpoint->tdCount; i++) {
+        ehciTransferDescriptor* td = &this->tds[endpoint->tds[i]];
+        td->next = physicalTD(endpoint->tds[(i + 1) % endpoint->tdCount]);
+        td->alternateNext = td->next;
+    }
+
+    transfer->td = &this->tds[endpoint->tds[0]];
+    transfer->tdPhys = physicalTD(endpoint->tds[0]);
+    transfer->numTd = endpoint->tdCount;
+
+    interruptDescriptorTable::disableInterrupts();
+    endpoint->transfer = transfer;
+    endpoint->nextTD = 0;
+    this->interrupTransfers.push_back(transfer);
+    endpoint->queueHead->next = transfer->tdPhys;
+    endpoint->queueHead->token = 0;
+    interruptDescriptorTable::enableInterrupts();
+}
+
+void ehciController::deliverInterrupts(ehciEndpoint* endpoint) {
+    interruptTransfer_t* transfer = endpoint->transfer;
+    if(transfer == 0)
+        return;
+
+    bool halted = false;
+    for(int i = 0; i < endpoint->tdCount; i++) {
+        int index = endpoint->tds[endpoint->nextTD];
+        uint32_t token = this->tds[index].token;
+        if(token & EHCI_TD_ACTIVE)
+            break;
+
+        uint8_t* slot = transfer->bufferPointer + (endpoint->nextTD + 1) * transfer->bufferLen;
+        if(token & (EHCI_TD_HALTED | EHCI_TD_ERRORS)) {
+            halted = halted || (token & EHCI_TD_HALTED);
+        }
+        else {
+            uint32_t received = transfer->bufferLen - ((token >> 16) & 0x7FFF);
+            memOperator::memcpy(transfer->bufferPointer, slot, received);
+            if(transfer->handler)
+                transfer->handler->handleInterruptPacket(transfer);
+        }
+
+        // Re-armed right away, it goes to the back of the ring behind the TDs that are still waiting
+        fillTD(index, EHCI_TD_PID_IN, false, slot, transfer->bufferLen);
+        this->tds[index].token |= EHCI_TD_IOC;
+        endpoint->nextTD = (endpoint->nextTD + 1) % endpoint->tdCount;
+    }
+
+    if(halted) {
+        endpoint->queueHead->next = physicalTD(endpoint->tds[endpoint->nextTD]);
+        endpoint->queueHead->token = 0;
+    }
+}
+
+void ehciController::completeTransfers() {
+    for(int i = 0; i < EHCI_ENDPOINTS; i++) {
+        ehciEndpoint* endpoint = &this->endpoints[i];
+        if(!endpoint->used)
+            continue;
+
+        if(endpoint->periodic)
+            deliverInterrupts(endpoint);
+        else if(endpoint->busy && !endpoint->completed.done)
+            checkTransfer(endpoint);
+    }
+}
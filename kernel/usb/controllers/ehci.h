@@ -0,0 +1,216 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#pragma once
+
+#include <ak/types.h>
+#include <internal/pci.h>
+#include <system/interrupthandler.h>
+#include <kernel/drivers/driver.h>
+#include <kernel/usb/usbcontroller.h>
+#include <kernel/usb/usbmanager.h>
+#include <tasking/completion.h>
+#include <tasking/lock.h>
+
+namespace Kernel {
+
+    #define EHCI_CAP_LENGTH             0x00
+    #define EHCI_CAP_HCSPARAMS          0x04
+    #define EHCI_CAP_HCCPARAMS          0x08
+
+    #define EHCI_OP_USBCMD              0x00
+    #define EHCI_OP_USBSTS              0x04
+    #define EHCI_OP_USBINTR             0x08
+    #define EHCI_OP_CTRLDSSEGMENT       0x10
+    #define EHCI_OP_PERIODICLISTBASE    0x14
+    #define EHCI_OP_ASYNCLISTADDR       0x18
+    #define EHCI_OP_CONFIGFLAG          0x40
+    #define EHCI_OP_PORTSC              0x44
+
+    #define EHCI_CMD_RUN                (1 << 0)
+    #define EHCI_CMD_RESET              (1 << 1)
+    #define EHCI_CMD_PERIODIC           (1 << 4)
+    #define EHCI_CMD_ASYNC              (1 << 5)
+    #define EHCI_CMD_ASYNC_DOORBELL     (1 << 6)
+    #define EHCI_CMD_ITC_1_MICROFRAME   (1 << 16)
+
+    #define EHCI_STS_USBINT             (1 << 0)
+    #define EHCI_STS_ERROR              (1 << 1)
+    #define EHCI_STS_PORT_CHANGE        (1 << 2)
+    #define EHCI_STS_SYSTEM_ERROR       (1 << 4)
+    #define EHCI_STS_ASYNC_ADVANCE      (1 << 5)
+    #define EHCI_STS_HALTED             (1 << 12)
+    #define EHCI_STS_EVENTS             0x3F
+
+    #define EHCI_PORT_CONNECTED         (1 << 0)
+    #define EHCI_PORT_CONNECT_CHANGE    (1 << 1)
+    #define EHCI_PORT_ENABLED           (1 << 2)
+    #define EHCI_PORT_ENABLE_CHANGE     (1 << 3)
+    #define EHCI_PORT_OVERCURRENT_CHANGE (1 << 5)
+    #define EHCI_PORT_RESET             (1 << 8)
+    #define EHCI_PORT_LINE_STATUS       (3 << 10)
+    #define EHCI_PORT_LINE_LOW_SPEED    (1 << 10)
+    #define EHCI_PORT_POWER             (1 << 12)
+    #define EHCI_PORT_COMPANION         (1 << 13)
+    #define EHCI_PORT_CHANGES           (EHCI_PORT_CONNECT_CHANGE | EHCI_PORT_ENABLE_CHANGE | EHCI_PORT_OVERCURRENT_CHANGE)
+
+    #define EHCI_LEGACY_BIOS_OWNED      (1 << 16)
+    #define EHCI_LEGACY_OS_OWNED        (1 << 24)
+
+    #define EHCI_LINK_TERMINATE         (1 << 0)
+    #define EHCI_LINK_QH                (1 << 1)
+
+    #define EHCI_TD_ACTIVE              (1 << 7)
+    #define EHCI_TD_HALTED              (1 << 6)
+    #define EHCI_TD_ERRORS              0x7C
+    #define EHCI_TD_PID_OUT             (0 << 8)
+    #define EHCI_TD_PID_IN              (1 << 8)
+    #define EHCI_TD_PID_SETUP           (2 << 8)
+    #define EHCI_TD_ERROR_COUNT         (3 << 10)
+    #define EHCI_TD_IOC                 (1 << 15)
+    #define EHCI_TD_TOGGLE              (1 << 31)
+    #define EHCI_TD_MAX_PAGES           5
+
+    #define EHCI_QH_HIGH_SPEED          (2 << 12)
+    #define EHCI_QH_TOGGLE_FROM_TD      (1 << 14)
+    #define EHCI_QH_RECLAMATION_HEAD    (1 << 15)
+    #define EHCI_QH_NAK_RELOAD          (4 << 28)
+    #define EHCI_QH_MULT_ONE            (1 << 30)
+    #define EHCI_QH_SMASK_FIRST         0x01
+
+    #define EHCI_TD_COUNT               128
+    #define EHCI_QH_COUNT               32
+    #define EHCI_ENDPOINTS              (EHCI_QH_COUNT - 2)
+    #define EHCI_FRAMES                 1024
+    #define EHCI_INTERRUPT_TDS          4
+    #define EHCI_MAX_PORTS              15
+    #define EHCI_MAX_CONTROLLERS        4
+    #define EHCI_TIMEOUT                1000000
+    #define EHCI_TRANSFER_TIMEOUT_MS    5000
+
+    struct ehciTransferDescriptor {
+        ak::uint32_t next;
+        ak::uint32_t alternateNext;
+        ak::uint32_t token;
+        ak::uint32_t buffer[5];
+        ak::uint32_t extendedBuffer[5];
+        ak::uint32_t reserved[3];
+    } __attribute__((packed));
+
+    struct ehciQueueHead {
+        ak::uint32_t link;
+        ak::uint32_t characteristics;
+        ak::uint32_t capabilities;
+        ak::uint32_t current;
+        ak::uint32_t next;
+        ak::uint32_t alternateNext;
+        ak::uint32_t token;
+        ak::uint32_t buffer[5];
+        ak::uint32_t extendedBuffer[5];
+        ak::uint32_t reserved[15];
+    } __attribute__((packed));
+
+    /**
+     * @brief queue head kept for one endpoint of one device, async endpoints carry one chain of TDs at a time and periodic ones a ring
+     */
+    struct ehciEndpoint {
+        bool used;
+        bool periodic;
+        ak::uint8_t address;
+        ak::uint8_t number;
+        ehciQueueHead* queueHead;
+        ak::uint32_t queueHeadPhysical;
+        mutexLock lock;
+
+        int tds[EHCI_TD_COUNT / 4];
+        int tdCount;
+        volatile bool busy;
+        completion completed;
+        bool failed;
+        bool shortPacket;
+
+        interruptTransfer_t* transfer;
+        int nextTD;
+    };
+
+    /**
+     * @brief ehciController[control, bulk, interrupt transfers, hotplug] high speed USB host, completions and port changes arrive by interrupt instead of being polled
+     */
+    class ehciController : public usbController, public driver, public system::interruptHandler {
+      public:
+        ehciController(pciDevice* device, pciController* pci, usbManager* manager);
+
+        static int probe(pciController* pci, usbManager* manager);
+
+        bool initialize();
+        ak::uint32_t handleInterrupt(ak::uint32_t esp);
+
+        void setup();
+        void controllerChecksThread();
+
+        bool bulkIn(usbDevice* device, void* retBuffer, int len, int endP);
+        bool bulkOut(usbDevice* device, void* sendBuffer, int len, int endP);
+
+        bool controlIn(usbDevice* device, void* target = 0, const int len = 0, const ak::uint8_t requestType = 0, const ak::uint8_t request = 0, const ak::uint16_t valueHigh = 0, const ak::uint16_t valueLow = 0, const ak::uint16_t index = 0);
+        bool controlOut(usbDevice* device, const int len = 0, const ak::uint8_t requestType = 0, const ak::uint8_t request = 0, const ak::uint16_t valueHigh = 0, const ak::uint16_t valueLow = 0, const ak::uint16_t index = 0);
+
+        void interruptIn(usbDevice* device, int len, int endP);
+
+      private:
+        pciDevice* device;
+        pciController* pci;
+        usbManager* manager;
+
+        volatile ak::uint8_t* capabilities = 0;
+        volatile ak::uint8_t* operational = 0;
+        ak::uint32_t portCount = 0;
+        ak::uint8_t nextAddress = 1;
+        ak::uint8_t portAddress[EHCI_MAX_PORTS];
+
+        ak::uint32_t* frameList = 0;
+        ak::uint32_t frameListPhysical = 0;
+        ehciTransferDescriptor* tds = 0;
+        ak::uint32_t tdPhysical = 0;
+        ak::uint32_t usedTDs[EHCI_TD_COUNT / 32];
+        ehciQueueHead* queueHeads = 0;
+        ak::uint32_t queueHeadPhysical = 0;
+        ehciEndpoint endpoints[EHCI_ENDPOINTS];
+
+        volatile bool portEvent = false;
+        completion asyncAdvance;
+
+        static ehciController* controllers[EHCI_MAX_CONTROLLERS];
+        static int controllerCount;
+        static Thread* portThread;
+        static void portEventThread();
+
+        ak::uint32_t readRegister(ak::uint32_t offset);
+        void writeRegister(ak::uint32_t offset, ak::uint32_t value);
+        void takeOwnership();
+        void delay(ak::uint32_t ms);
+
+        int allocateTD();
+        void freeTD(int index);
+        ak::uint32_t physicalTD(int index);
+
+        ehciEndpoint* findEndpoint(usbDevice* device, ak::uint8_t number, bool periodic);
+        void releaseEndpoints(ak::uint8_t address);
+        void unlinkAsync(ehciEndpoint* endpoint);
+
+        int fillTD(int index, ak::uint32_t pid, bool toggle, ak::uint8_t* buf, ak::uint32_t length);
+        bool queueData(ehciEndpoint* endpoint, ak::uint32_t pid, ak::uint8_t* buf, ak::uint32_t length, ak::uint32_t maxPacket);
+        bool runTransfer(ehciEndpoint* endpoint);
+        void checkTransfer(ehciEndpoint* endpoint);
+        static bool pollTransfers(void* context);
+        static bool pollAdvance(void* context);
+        void deliverInterrupts(ehciEndpoint* endpoint);
+        void completeTransfers();
+
+        bool controlTransfer(usbDevice* device, bool in, void* buf, int len, ak::uint8_t requestType, ak::uint8_t request, ak::uint16_t value, ak::uint16_t index);
+        bool bulkTransfer(usbDevice* device, bool in, void* buf, int len, int endP);
+
+        void portChanged(ak::uint32_t port);
+        void setupDevice(ak::uint32_t port);
+    };
+}
@@ -42,6 +42,10 @@ namespace Kernel {
             bool lsDevice;
         } ohciProperties_t;
 
+        struct ehciProperties {
+            int maxPacket;
+        } ehciProperties_t;
+
         List<usbEndpoint*> endpoints;
 
         uint8_t* hidDescriptor = 0;
@@ -0,0 +1,206 @@
+//
+// Created by KrisnaPranav on 18/10/26.
+//
+
+#include "usbhid.h"
+#include <ak/memoperator.h>
+#include <kernel/system/log.h>
+
+using namespace Kernel::ak;
+using namespace Kernel;
+
+/**
+ * @brief item state that Push and Pop save and restore
+ */
+struct hidGlobalState {
+    uint16_t usagePage;
+    int32_t logicalMin;
+    int32_t logicalMax;
+    uint32_t reportSize;
+    uint32_t reportCount;
+    uint8_t reportId;
+};
+
+hidReportLayout::hidReportLayout() {
+    memOperator::memset(this->reportIndex, HID_NO_REPORT, sizeof(this->reportIndex));
+}
+
+hidReport* hidReportLayout::reportFor(uint8_t id) {
+    if(this->reportIndex[id] != HID_NO_REPORT)
+        return &this->reports[this->reportIndex[id]];
+
+    if(this->reportCount == HID_MAX_REPORTS)
+        return 0;
+
+    hidReport* report = &this->reports[this->reportCount];
+    report->id = id;
+    report->firstField = this->fieldCount;
+    report->fieldCount = 0;
+    report->bits = id != 0 ? 8 : 0;
+
+    this->reportIndex[id] = this->reportCount++;
+    return report;
+}
+
+bool hidReportLayout::compile(const uint8_t* descriptor, int size) {
+    hidGlobalState global;
+    memOperator::memset(&global, 0, sizeof(hidGlobalState));
+    hidGlobalState stack[HID_MAX_GLOBAL_STACK];
+    int stackDepth = 0;
+
+    uint32_t usages[HID_MAX_LOCAL_USAGES];
+    int usageCount = 0;
+    uint32_t usageMin = 0, usageMax = 0;
+    bool usageRange = false;
+
+    // Fields of one report have to stay together, so a report switch in the middle of another only works while it is still last
+    for(int pos = 0; pos < size; ) {
+        uint8_t prefix = descriptor[pos++];
+
+        if(prefix == 0xFE) {
+            if(pos + 1 >= size)
+                return false;
+            pos += 2 + descriptor[pos];
+            continue;
+        }
+
+        int length = (prefix & SIZE_MASK) == SIZE_4 ? 4 : (prefix & SIZE_MASK);
+        if(pos + length > size)
+            return false;
+
+        uint32_t data = 0;
+        for(int i = 0; i < length; i++)
+            data |= descriptor[pos + i] << (i * 8);
+        int32_t signedData = length == 1 ? (int8_t)data : (length == 2 ? (int16_t)data : (int32_t)data);
+        pos += length;
+
+        switch(prefix & ITEM_MASK) {
+            case ITEM_UPAGE:        global.usagePage = data; break;
+            case ITEM_LOG_MIN:      global.logicalMin = signedData; break;
+            case ITEM_LOG_MAX:      global.logicalMax = global.logicalMin < 0 ? signedData : (int32_t)data; break;
+            case ITEM_REP_SIZE:     global.reportSize = data; break;
+            case ITEM_REP_COUNT:    global.reportCount = data; break;
+            case ITEM_REP_ID:
+                global.reportId = data;
+                this->usesReportIds = true;
+                break;
+
+            case 0xA4:
+                if(stackDepth < HID_MAX_GLOBAL_STACK)
+                    stack[stackDepth++] = global;
+                break;
+            case 0xB4:
+                if(stackDepth > 0)
+                    global = stack[--stackDepth];
+                break;
+
+            // A 4 byte usage carries its own page in the upper half
+            case ITEM_USAGE:
+                if(usageCount < HID_MAX_LOCAL_USAGES)
+                    usages[usageCount++] = length == 4 ? data : (global.usagePage << 16) | data;
+                break;
+            case ITEM_USAGE_MIN:
+                usageMin = length == 4 ? data : (global.usagePage << 16) | data;
+                usageRange = true;
+                break;
+            case ITEM_USAGE_MAX:
+                usageMax = length == 4 ? data : (global.usagePage << 16) | data;
+                usageRange = true;
+                break;
+
+            case ITEM_INPUT: {
+                hidReport* report = reportFor(global.reportId);
+                if(report == 0 || (report->fieldCount > 0 && report->firstField + report->fieldCount != this->fieldCount))
+                    return false;
+                if(report->fieldCount == 0)
+                    report->firstField = this->fieldCount;
+
+                bool constant = data & ATTR_DATA_CST;
+                bool variable = data & 0x02;
+
+                for(uint32_t i = 0; i < global.reportCount && !constant; i++) {
+                    // An array is one field per slot, every slot reports the index of a pressed usage
+                    uint32_t usage = 0;
+                    if(!variable)
+                        usage = usageRange ? usageMin : (usageCount > 0 ? usages[0] : 0);
+                    else if(usageRange)
+                        usage = usageMin + i <= usageMax ? usageMin + i : usageMax;
+                    else if(usageCount > 0)
+                        usage = usages[i < (uint32_t)usageCount ? i : usageCount - 1];
+
+                    if(this->fieldCount == HID_MAX_FIELDS || global.reportSize == 0 || global.reportSize > 32)
+                        return false;
+
+                    hidField* field = &this->fields[this->fieldCount++];
+                    field->bitOffset = report->bits + i * global.reportSize;
+                    field->bitSize = global.reportSize;
+                    field->flags = (global.logicalMin < 0 ? HID_FIELD_SIGNED : 0) | (variable ? 0 : HID_FIELD_ARRAY) | (data & 0x04 ? HID_FIELD_RELATIVE : 0);
+                    field->usagePage = usage >> 16;
+                    field->usage = usage & 0xFFFF;
+                    field->logicalMin = global.logicalMin;
+                    field->logicalMax = global.logicalMax;
+                    report->fieldCount++;
+                }
+
+                report->bits += global.reportCount * global.reportSize;
+                usageCount = 0;
+                usageRange = false;
+                break;
+            }
+
+            // Output and feature reports are never decoded, they only end the local state
+            case ITEM_OUTPUT:
+            case ITEM_FEATURE:
+            case ITEM_COLLECTION:
+            case ITEM_END_COLLECTION:
+                usageCount = 0;
+                usageRange = false;
+                break;
+        }
+    }
+
+    return this->fieldCount > 0;
+}
+
+const hidReport* hidReportLayout::findReport(const uint8_t* packet, int length) {
+    if(length <= 0)
+        return 0;
+
+    uint8_t index = this->reportIndex[this->usesReportIds ? packet[0] : 0];
+    if(index == HID_NO_REPORT)
+        return 0;
+
+    const hidReport* report = &this->reports[index];
+    return length * 8 >= report->bits ? report : 0;
+}
+
+const hidField* hidReportLayout::findField(uint16_t usagePage, uint16_t usage, uint8_t reportId) {
+    for(int i = 0; i < this->reportCount; i++) {
+        hidReport* report = &this->reports[i];
+        if(reportId != 0 && report->id != reportId)
+            continue;
+
+        for(int f = report->firstField; f < report->firstField + report->fieldCount; f++)
+            if(this->fields[f].usagePage == usagePage && this->fields[f].usage == usage && !(this->fields[f].flags & HID_FIELD_ARRAY))
+                return &this->fields[f];
+    }
+
+    return 0;
+}
+
+int hidReportLayout::decode(const uint8_t* packet, int length, hidValue* values, int maxValues) {
+    const hidReport* report = findReport(packet, length);
+    if(report == 0)
+        return 0;
+
+    int count = report->fieldCount < maxValues ? report->fieldCount : maxValues;
+    const hidField* field = &this->fields[report->firstField];
+
+    for(int i = 0; i < count; i++, field++) {
+        values[i].usagePage = field->usagePage;
+        values[i].usage = field->usage;
+        values[i].value = extract(packet, field);
+    }
+
+    return count;
+}
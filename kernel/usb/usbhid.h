@@ -94,6 +94,80 @@ namespace Kernel {
     };
 
 
+    #define HID_MAX_REPORTS         8
+    #define HID_MAX_FIELDS          64
+    #define HID_MAX_LOCAL_USAGES    16
+    #define HID_MAX_GLOBAL_STACK    4
+    #define HID_NO_REPORT           0xFF
+
+    #define HID_FIELD_SIGNED        (1 << 0)
+    #define HID_FIELD_ARRAY         (1 << 1)
+    #define HID_FIELD_RELATIVE      (1 << 2)
+
+    /**
+     * @brief one value of an input report, where it sits and what it means
+     */
+    struct hidField {
+        ak::uint16_t bitOffset;
+        ak::uint8_t bitSize;
+        ak::uint8_t flags;
+        ak::uint16_t usagePage;
+        ak::uint16_t usage;
+        ak::int32_t logicalMin;
+        ak::int32_t logicalMax;
+    };
+
+    struct hidReport {
+        ak::uint8_t id;
+        ak::uint8_t firstField;
+        ak::uint8_t fieldCount;
+        ak::uint16_t bits;
+    };
+
+    struct hidValue {
+        ak::uint16_t usagePage;
+        ak::uint16_t usage;
+        ak::int32_t value;
+    };
+
+    /**
+     * @brief hidReportLayout[compile, decode, find field] report descriptor turned into a flat list of fields once, so a report is decoded without walking the descriptor again
+     */
+    class hidReportLayout {
+      public:
+        hidReportLayout();
+
+        bool compile(const ak::uint8_t* descriptor, int size);
+        const hidReport* findReport(const ak::uint8_t* packet, int length);
+        const hidField* findField(ak::uint16_t usagePage, ak::uint16_t usage, ak::uint8_t reportId = 0);
+        int decode(const ak::uint8_t* packet, int length, hidValue* values, int maxValues);
+
+        static inline ak::int32_t extract(const ak::uint8_t* packet, const hidField* field) {
+            // At most 32 bits starting anywhere inside a byte, so never more than five bytes to gather
+            ak::uint32_t byte = field->bitOffset >> 3;
+            ak::uint32_t bytes = ((field->bitOffset & 7) + field->bitSize + 7) >> 3;
+            ak::uint64_t raw = 0;
+            for(ak::uint32_t i = 0; i < bytes; i++)
+                raw |= (ak::uint64_t)packet[byte + i] << (i * 8);
+
+            ak::uint32_t value = (ak::uint32_t)(raw >> (field->bitOffset & 7)) & (field->bitSize == 32 ? 0xFFFFFFFF : ((1u << field->bitSize) - 1));
+            if((field->flags & HID_FIELD_SIGNED) && field->bitSize < 32 && (value & (1u << (field->bitSize - 1))))
+                value |= ~((1u << field->bitSize) - 1);
+            return (ak::int32_t)value;
+        }
+
+        bool usesReportIds = false;
+
+      private:
+        hidReport reports[HID_MAX_REPORTS];
+        hidField fields[HID_MAX_FIELDS];
+        ak::uint8_t reportIndex[256];
+        int reportCount = 0;
+        int fieldCount = 0;
+
+        hidReport* reportFor(ak::uint8_t id);
+    };
+
     class HIDParser {
     public:
         const ak::uint8_t *report_desc;              
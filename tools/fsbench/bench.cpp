@@ -0,0 +1,366 @@
+/*
+ * fsbench - run the kernel's FAT, ext2 and ISO9660 drivers on the host against an image file
+ *
+ *   fsbench fat <image> [files]   image must be an empty FAT volume, it is written to
+ *   fsbench ext2 <image> [files]  same workloads on an empty ext2 volume, for comparing against fat
+ *   fsbench iso <image> [reads]
+ *   fsbench isocache <image> [reads]  iso with the 2K sector cache of the ATAPI driver in front of the image
+ *   fsbench tmpfs [files]         same workloads as fat on the in-memory tmpfs, there is no image and no disk traffic
+ */
+
+#include "filedisk.h"
+#include <filesystem/fat.h>
+#include <filesystem/ext2.h>
+#include <filesystem/iso.h>
+#include <filesystem/tmpfs.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace Kernel;
+
+extern bool fsbenchVerbose;
+
+static fileDisk* disk = 0;
+static fileDiskStats startStats;
+static timespec startTime;
+
+// tmpfs runs without a disk, its rows report no requests
+static fileDiskStats diskStats() {
+    fileDiskStats none = {};
+    return disk ? disk->stats : none;
+}
+
+static void begin() {
+    startStats = diskStats();
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
+}
+
+static void end(const char* name, int ops, int failures = 0) {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double ms = (now.tv_sec - startTime.tv_sec) * 1000.0 + (now.tv_nsec - startTime.tv_nsec) / 1000000.0;
+
+    fileDiskStats stats = diskStats();
+    double requests = (stats.readRequests - startStats.readRequests) + (stats.writeRequests - startStats.writeRequests);
+    double read = stats.sectorsRead - startStats.sectorsRead;
+    double written = stats.sectorsWritten - startStats.sectorsWritten;
+
+    printf("%-24s %8d %10.1f %10.2f %10.2f %10.2f %10.2f", name, ops, ms, ms * 1000.0 / ops, requests / ops, read / ops, written / ops);
+    if(failures)
+        printf("   %d failed", failures);
+    printf("\n");
+}
+
+static void header() {
+    printf("%-24s %8s %10s %10s %10s %10s %10s\n", "benchmark", "ops", "total ms", "us/op", "req/op", "rd sec/op", "wr sec/op");
+}
+
+static void shuffle(int* order, int count) {
+    for(int i = 0; i < count; i++)
+        order[i] = i;
+    for(int i = count - 1; i > 0; i--) {
+        int j = rand() % (i + 1);
+        int t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+}
+
+// Reads count as failed when they return less than asked for or different bytes than expected
+static bool readMatches(virtualFileSystem* fs, const char* path, uint8_t* buffer, const uint8_t* expected, uint32_t size, uint32_t offset, uint32_t len) {
+    if(len > size - offset)
+        len = size - offset;
+
+    return fs->readFile(path, buffer, offset, len) == (int)len && memcmp(buffer, expected + offset, len) == 0;
+}
+
+static bool verifyFile(virtualFileSystem* fs, const char* path, const uint8_t* expected, uint32_t size) {
+    const uint32_t chunk = 64 * 1024;
+    uint8_t* buffer = new uint8_t[chunk];
+
+    bool ok = fs->getFileSize(path) == size;
+    for(uint32_t offset = 0; offset < size && ok; offset += chunk)
+        ok = readMatches(fs, path, buffer, expected, size, offset, chunk);
+
+    delete[] buffer;
+    return ok;
+}
+
+static void streamingBenchmarks(virtualFileSystem* fs, const char* path, uint32_t size, int randomReads, const uint8_t* expected) {
+    const uint32_t chunk = 64 * 1024;
+    uint8_t* buffer = new uint8_t[chunk];
+
+    int ops = 0, failures = 0;
+    begin();
+    for(uint32_t offset = 0; offset < size; offset += chunk, ops++)
+        if(!readMatches(fs, path, buffer, expected, size, offset, chunk))
+            failures++;
+    end("read sequential 64K", ops, failures);
+
+    failures = 0;
+    begin();
+    for(int i = 0; i < randomReads; i++)
+        if(!readMatches(fs, path, buffer, expected, size, (rand() % (size / 4096)) * 4096, 4096))
+            failures++;
+    end("read random 4K", randomReads, failures);
+
+    delete[] buffer;
+}
+
+static int benchmarkWritable(virtualFileSystem* fs, int count) {
+    char path[256];
+    int* order = new int[count];
+    int failures = 0;
+    header();
+
+    // Metadata: one large directory
+    fs->createDirectory("bench");
+    begin();
+    for(int i = 0; i < count; i++) {
+        sprintf(path, "bench\\file%d.txt", i);
+        if(fs->createFile(path) != 0)
+            failures++;
+    }
+    end("create", count, failures);
+
+    shuffle(order, count);
+    failures = 0;
+    begin();
+    for(int i = 0; i < count; i++) {
+        sprintf(path, "bench\\file%d.txt", order[i]);
+        if(!fs->fileExists(path))
+            failures++;
+    }
+    end("lookup", count, failures);
+
+    failures = 0;
+    begin();
+    for(int i = 0; i < count; i++) {
+        sprintf(path, "bench\\missing%d.txt", i);
+        if(fs->fileExists(path))
+            failures++;
+    }
+    end("lookup missing", count, failures);
+
+    begin();
+    List<LibC::vfsEntry>* list = fs->directoryList("bench");
+    end("list directory", 1, list == 0 || list->size() != count);
+    if(list)
+        delete list;
+
+    // The same directory again in small batches, every name has to come back exactly once
+    uint8_t* batch = new uint8_t[1024];
+    bool* seen = new bool[count]();
+    uint32_t cookie = 0;
+    int listed = 0, calls = 0;
+    failures = 0;
+    begin();
+    while(true) {
+        int used = fs->readDirectory("bench", &cookie, batch, 1024);
+        calls++;
+        if(used <= 0) {
+            failures += used < 0;
+            break;
+        }
+
+        for(int offset = 0; offset < used; offset += ((LibC::vfsDirectoryRecord*)(batch + offset))->recordLength) {
+            LibC::vfsDirectoryRecord* record = (LibC::vfsDirectoryRecord*)(batch + offset);
+            int index = -1;
+            if(sscanf(record->name, "file%d.txt", &index) != 1 || index < 0 || index >= count || seen[index])
+                failures++;
+            else
+                seen[index] = true;
+            listed++;
+        }
+    }
+    end("list directory batched", calls, failures + (listed != count));
+    delete[] seen;
+    delete[] batch;
+
+    // Metadata: deep paths
+    const int depth = 16;
+    path[0] = '\0';
+    failures = 0;
+    begin();
+    for(int i = 0; i < depth; i++) {
+        sprintf(path + strlen(path), "%sdirectory%d", i ? "\\" : "", i);
+        if(fs->createDirectory(path) != 0)
+            failures++;
+    }
+    end("mkdir deep", depth, failures);
+
+    strcat(path, "\\leaf.txt");
+    fs->createFile(path);
+
+    failures = 0;
+    begin();
+    for(int i = 0; i < 1000; i++)
+        if(!fs->fileExists(path))
+            failures++;
+    end("lookup deep", 1000, failures);
+
+    // Streaming
+    const uint32_t streamSize = 8 * 1024 * 1024;
+    uint8_t* data = new uint8_t[streamSize];
+    for(uint32_t i = 0; i < streamSize; i++)
+        data[i] = rand();
+
+    begin();
+    failures = fs->writeFile("stream.bin", data, streamSize) != (int)streamSize || fs->fsync() != 0;
+    end("write 8M", 1, failures);
+
+    streamingBenchmarks(fs, "stream.bin", streamSize, 1000, data);
+
+    const int appends = 256;
+    failures = 0;
+    begin();
+    for(int i = 1; i <= appends; i++)
+        if(fs->writeFile("append.bin", data, i * 4096) != i * 4096 || fs->fsync("append.bin") != 0)
+            failures++;
+    end("append 4K", appends, failures);
+
+    begin();
+    end("verify append", 1, !verifyFile(fs, "append.bin", data, appends * 4096));
+
+    delete[] data;
+    delete[] order;
+    delete fs;
+    return 0;
+}
+
+static int benchmarkFat(int count) {
+    fat* fs = new fat(disk, 0, disk->numBlocks);
+    if(!fs->initialize()) {
+        fprintf(stderr, "fsbench: not a FAT volume\n");
+        return 1;
+    }
+
+    return benchmarkWritable(fs, count);
+}
+
+static int benchmarkExt2(int count) {
+    ext2* fs = new ext2(disk, 0, disk->numBlocks);
+    if(!fs->initialize()) {
+        fprintf(stderr, "fsbench: not an ext2 volume\n");
+        return 1;
+    }
+
+    return benchmarkWritable(fs, count);
+}
+
+static int benchmarkTmpfs(int count) {
+    tmpfs* fs = new tmpfs(256 * 1024 * 1024);
+    fs->initialize();
+
+    return benchmarkWritable(fs, count);
+}
+
+static int collectFiles(virtualFileSystem* fs, const char* dir, List<char*>* files, char** largest, uint32_t* largestSize) {
+    List<LibC::vfsEntry>* list = fs->directoryList(dir);
+    if(list == 0)
+        return 0;
+
+    for(int i = 0; i < list->size(); i++) {
+        LibC::vfsEntry entry = list->getat(i);
+        char* path = new char[strlen(dir) + strlen(entry.name) + 2];
+        sprintf(path, "%s%s%s", dir, dir[0] ? "\\" : "", entry.name);
+
+        if(entry.isDir) {
+            collectFiles(fs, path, files, largest, largestSize);
+            delete[] path;
+            continue;
+        }
+
+        files->push_back(path);
+        if(entry.size > *largestSize) {
+            *largestSize = entry.size;
+            *largest = path;
+        }
+    }
+
+    delete list;
+    return files->size();
+}
+
+static int benchmarkIso(int reads) {
+    isoFS* fs = new isoFS(disk, 0, disk->numBlocks);
+    if(!fs->initialize()) {
+        fprintf(stderr, "fsbench: not an ISO9660 volume\n");
+        return 1;
+    }
+
+    List<char*> files;
+    char* largest = 0;
+    uint32_t largestSize = 0;
+    header();
+
+    begin();
+    int count = collectFiles(fs, "", &files, &largest, &largestSize);
+    end("walk tree", count ? count : 1);
+    if(count == 0)
+        return 0;
+
+    int failures = 0;
+    begin();
+    for(int i = 0; i < reads; i++)
+        if(!fs->fileExists(files[rand() % count]))
+            failures++;
+    end("lookup", reads, failures);
+
+    // The image has no reference copy, one whole read is what the chunked reads are compared against
+    if(largestSize >= 4096) {
+        uint8_t* expected = new uint8_t[largestSize];
+        if(fs->readFile(largest, expected, 0, largestSize) == (int)largestSize)
+            streamingBenchmarks(fs, largest, largestSize, reads, expected);
+        else
+            fprintf(stderr, "fsbench: could not read %s\n", largest);
+        delete[] expected;
+    }
+
+    for(int i = 0; i < count; i++)
+        delete[] files[i];
+    delete fs;
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    bool isTmpfs = argc >= 2 && strcmp(argv[1], "tmpfs") == 0;
+    if(!isTmpfs && (argc < 3 || (strcmp(argv[1], "fat") && strcmp(argv[1], "ext2") && strcmp(argv[1], "iso") && strcmp(argv[1], "isocache")))) {
+        fprintf(stderr, "usage: %s fat|ext2|iso|isocache <image> [count]\n       %s tmpfs [count]\n", argv[0], argv[0]);
+        return 1;
+    }
+
+    fsbenchVerbose = getenv("FSBENCH_VERBOSE") != 0;
+    srand(1);
+    if(isTmpfs)
+        return benchmarkTmpfs(argc > 2 ? atoi(argv[2]) : 10000);
+
+    bool isIso = strncmp(argv[1], "iso", 3) == 0;
+
+    int fd = open(argv[2], isIso ? O_RDONLY : O_RDWR);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) != 0) {
+        perror(argv[2]);
+        return 1;
+    }
+
+    disk = new fileDisk(fd, st.st_size, isIso ? 2048 : 512);
+    if(strcmp(argv[1], "isocache") == 0)
+        disk->cache = new cdromCache();
+
+    int result;
+    if(isIso)
+        result = benchmarkIso(argc > 3 ? atoi(argv[3]) : 1000);
+    else if(strcmp(argv[1], "fat") == 0)
+        result = benchmarkFat(argc > 3 ? atoi(argv[3]) : 10000);
+    else
+        result = benchmarkExt2(argc > 3 ? atoi(argv[3]) : 10000);
+    close(fd);
+    return result;
+}
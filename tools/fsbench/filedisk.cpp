@@ -0,0 +1,45 @@
+#include "filedisk.h"
+#include <unistd.h>
+
+using namespace Kernel;
+
+fileDisk::fileDisk(int fd, ak::uint64_t size, ak::uint32_t blocksize)
+: Disk(0, 0, hardDisk, size, size / blocksize, blocksize) {
+    this->fd = fd;
+}
+
+char fileDisk::readSector(ak::uint32_t lba, ak::uint8_t* buf) {
+    return readSectors(lba, 1, buf);
+}
+
+char fileDisk::writeSector(ak::uint32_t lba, ak::uint8_t* buf) {
+    return writeSectors(lba, 1, buf);
+}
+
+char fileDisk::readSectors(ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf) {
+    // Same lookup the IDE driver does for ATAPI drives, hits never reach the image
+    if(this->cache && this->cache->read(lba, count, buf))
+        return DISK_SUCCESS;
+
+    this->stats.readRequests++;
+    this->stats.sectorsRead += count;
+
+    ssize_t length = (ssize_t)count * this->blockSize;
+    if(lba + count > this->numBlocks || pread(this->fd, buf, length, (off_t)lba * this->blockSize) != length)
+        return DISK_ERROR;
+
+    if(this->cache)
+        this->cache->fill(lba, count, buf);
+    return DISK_SUCCESS;
+}
+
+char fileDisk::writeSectors(ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf) {
+    this->stats.writeRequests++;
+    this->stats.sectorsWritten += count;
+
+    ssize_t length = (ssize_t)count * this->blockSize;
+    if(lba + count > this->numBlocks || pwrite(this->fd, buf, length, (off_t)lba * this->blockSize) != length)
+        return DISK_ERROR;
+
+    return DISK_SUCCESS;
+}
@@ -0,0 +1,35 @@
+/*
+ * Disk backed by an image file on the host, counts every request the filesystem issues
+ */
+
+#pragma once
+
+#include <kernel/disks/disk.h>
+#include <kernel/disks/cdromcache.h>
+
+namespace Kernel {
+
+    struct fileDiskStats {
+        ak::uint32_t readRequests;
+        ak::uint32_t writeRequests;
+        ak::uint32_t sectorsRead;
+        ak::uint32_t sectorsWritten;
+    };
+
+    class fileDisk : public Disk {
+    private:
+        int fd;
+
+    public:
+        fileDiskStats stats = {0, 0, 0, 0};
+        cdromCache* cache = 0;
+
+        fileDisk(int fd, ak::uint64_t size, ak::uint32_t blocksize);
+
+        char readSector(ak::uint32_t lba, ak::uint8_t* buf);
+        char writeSector(ak::uint32_t lba, ak::uint8_t* buf);
+
+        char readSectors(ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf);
+        char writeSectors(ak::uint32_t lba, ak::uint32_t count, ak::uint8_t* buf);
+    };
+}
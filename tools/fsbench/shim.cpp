@@ -0,0 +1,145 @@
+/*
+ * Host versions of the few kernel services the filesystem drivers call into
+ */
+
+#include <kernel/system/log.h>
+#include <tasking/lock.h>
+#include <tasking/scheduler.h>
+#include <tasking/completion.h>
+#include <cpu/idt.h>
+#include <memory/virtualmemory.h>
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <unordered_map>
+#include <vector>
+
+using namespace Kernel;
+
+bool fsbenchVerbose = false;
+
+void Kernel::sendLog(logLevel level, const char* __restrict__ format, ...) {
+    if(!fsbenchVerbose && level == Info)
+        return;
+
+    static const char* prefix[] = { "info", "warning", "error" };
+    fprintf(stderr, "[%s] ", prefix[level]);
+
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+
+    fputc('\n', stderr);
+}
+
+void Kernel::Print(const char* data, ak::uint32_t length) {
+    fwrite(data, 1, length, stderr);
+}
+
+// Single threaded, nothing to lock against
+mutexLock::mutexLock() {}
+void mutexLock::lock() {}
+void mutexLock::unlock() {}
+void mutexLock::load() {}
+
+ak::uint32_t scheduler::ticks() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+Thread* scheduler::currentThread() { return 0; }
+void scheduler::yield() {}
+void scheduler::block(Thread* thread, blockedState reason) {}
+void scheduler::sleep(Thread* thread, ak::uint32_t ms) {}
+void scheduler::unblock(Thread* thread) {}
+
+// Every request is done before anyone waits for it
+void completionHelper::reset(completion* event) {
+    event->done = false;
+    event->waiter = 0;
+}
+
+void completionHelper::signal(completion* event) {
+    event->done = true;
+}
+
+bool completionHelper::wait(completion* event, ak::uint32_t timeoutMs, completionPoll poll, void* context) {
+    return event->done;
+}
+
+Thread* threadHelper::createFromFunction(void (*entryPoint)(), bool isKernel, ak::uint32_t flags, Process* parent) {
+    return 0;
+}
+
+void threadHelper::removeThread(Thread* thread) {}
+
+void interruptDescriptorTable::disableInterrupts() {}
+void interruptDescriptorTable::enableInterrupts() {}
+
+// Physical block n is page n - 1 of a memory file, 0 stays free to mean no block
+static int physicalMemory = -1;
+static ak::uint32_t physicalBlocks = 0;
+static std::vector<ak::uint32_t> freeBlocks;
+static std::unordered_map<ak::uint32_t, ak::uint32_t> pageTable;
+
+void* physicalMemoryManager::allocateBlock() {
+    if(!freeBlocks.empty()) {
+        ak::uint32_t block = freeBlocks.back();
+        freeBlocks.pop_back();
+        return (void*)(unsigned long)block;
+    }
+
+    if(physicalMemory < 0)
+        physicalMemory = memfd_create("fsbench-physical", 0);
+    if(physicalMemory < 0 || ftruncate(physicalMemory, (off_t)(physicalBlocks + 1) * PAGE_SIZE) != 0)
+        return 0;
+
+    physicalBlocks++;
+    return (void*)(unsigned long)(physicalBlocks * PAGE_SIZE);
+}
+
+void physicalMemoryManager::freeBlock(void* ptr) {
+    freeBlocks.push_back((ak::uint32_t)(unsigned long)ptr);
+}
+
+void virtualMemoryManager::mapVirtualToPhysical(void* physAddr, void* virtAddr, bool kernel, bool writeable) {
+    ak::uint32_t virt = (ak::uint32_t)(unsigned long)virtAddr & ~(PAGE_SIZE - 1);
+    ak::uint32_t phys = (ak::uint32_t)(unsigned long)physAddr;
+
+    // Only pages this file mapped itself may be replaced, anything else at the address belongs to the host
+    int fixed = pageTable.count(virt) ? MAP_FIXED : MAP_FIXED_NOREPLACE;
+    void* result = mmap((void*)(unsigned long)virt, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | fixed, physicalMemory, (off_t)(phys - PAGE_SIZE));
+    if(result != (void*)(unsigned long)virt) {
+        fprintf(stderr, "fsbench: can not map the kernel address %x on this host, build without -m32\n", virt);
+        exit(1);
+    }
+
+    pageTable[virt] = phys;
+}
+
+void virtualMemoryManager::unmapPage(void* virtAddr) {
+    ak::uint32_t virt = (ak::uint32_t)(unsigned long)virtAddr & ~(PAGE_SIZE - 1);
+    if(pageTable.erase(virt))
+        munmap((void*)(unsigned long)virt, PAGE_SIZE);
+}
+
+void* virtualMemoryManager::virtualToPhysical(void* virtAddr) {
+    ak::uint32_t virt = (ak::uint32_t)(unsigned long)virtAddr;
+    auto page = pageTable.find(virt & ~(PAGE_SIZE - 1));
+    return page == pageTable.end() ? 0 : (void*)(unsigned long)(page->second + (virt & (PAGE_SIZE - 1)));
+}
+
+ak::uint32_t Kernel::pageRoundUp(ak::uint32_t address) {
+    return (address + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+}
+
+ak::uint32_t Kernel::pageRoundDown(ak::uint32_t address) {
+    return address & ~(PAGE_SIZE - 1);
+}
@@ -0,0 +1,13 @@
+/*
+ * Host replacement for the interrupt descriptor table, only the interrupt flag helpers are used
+ */
+
+#pragma once
+
+namespace Kernel {
+    class interruptDescriptorTable {
+      public:
+        static void disableInterrupts();
+        static void enableInterrupts();
+    };
+}
@@ -0,0 +1,29 @@
+/*
+ * Force-included into every file of the host build. It papers over the kernel's
+ * freestanding environment so the filesystem code compiles unchanged on Linux.
+ */
+
+#pragma once
+
+#include <ak/types.h>
+
+// libc/shared.h uses the fixed width types without a namespace
+using ak::uint8_t;
+using ak::uint16_t;
+using ak::uint32_t;
+
+namespace pranaOS {
+    namespace ak {
+        using namespace ::ak;
+    }
+}
+
+namespace Kernel {
+    namespace ak = ::ak;
+}
+
+#include <ak/string.h>
+
+namespace ak {
+    using pranaOS::ak::String;
+}
@@ -0,0 +1,32 @@
+/*
+ * Host replacement for the kernel's paging interface. Physical blocks are pages of
+ * a memory file and mapping one maps that page of the file at the virtual address,
+ * so several addresses can share a block just like on the real page tables
+ */
+
+#pragma once
+
+#include <ak/types.h>
+
+namespace Kernel {
+    #define PAGE_SIZE 4_KB
+    #define KERNEL_VIRT_ADDR 3_GB
+
+    class physicalMemoryManager {
+      public:
+        static void* allocateBlock();
+        static void freeBlock(void* ptr);
+    };
+
+    class virtualMemoryManager {
+      public:
+        static void mapVirtualToPhysical(void* physAddr, void* virtAddr, bool kernel = true, bool writeable = true);
+        static void unmapPage(void* virtAddr);
+        static void* virtualToPhysical(void* virtAddr);
+
+        static inline void invalidatePage(ak::uint32_t virtAddr) {}
+    };
+
+    ak::uint32_t pageRoundUp(ak::uint32_t address);
+    ak::uint32_t pageRoundDown(ak::uint32_t address);
+}
@@ -0,0 +1,37 @@
+/*
+ * Host replacement for the kernel scheduler. There is only one thread, so
+ * threadHelper never starts one and the code that needs it falls back to synchronous work
+ */
+
+#pragma once
+
+#include <ak/types.h>
+
+namespace Kernel {
+    struct Thread;
+    struct Process;
+
+    enum blockedState {
+        Unkown,
+        Sleep,
+        ReceiveIPC
+    };
+
+    class scheduler {
+      public:
+        static Thread* currentThread();
+        static void yield();
+
+        static void block(Thread* thread, blockedState reason = Unkown);
+        static void sleep(Thread* thread, ak::uint32_t ms);
+        static void unblock(Thread* thread);
+
+        static ak::uint32_t ticks();
+    };
+
+    class threadHelper {
+      public:
+        static Thread* createFromFunction(void (*entryPoint)(), bool isKernel = false, ak::uint32_t flags = 0x202, Process* parent = 0);
+        static void removeThread(Thread* thread);
+    };
+}
@@ -0,0 +1,339 @@
+/*
+ * mkinitrd: packs a directory tree into the initrd image read by kernel/filesystem/initrdfs.cpp
+ * The structures below must stay in sync with kernel/filesystem/initrdfs.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define INITRD_MAGIC            0x44525449
+#define INITRD_VERSION          1
+#define INITRD_BLOCK_SIZE       (64 * 1024)
+#define INITRD_NO_ENTRY         0xFFFFFFFF
+#define INITRD_FLAG_DIRECTORY   (1 << 0)
+
+#define HASH_LOG                12
+#define MAX_ENTRIES             4096
+
+struct initrdHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t bucketCount;
+    uint32_t entriesOffset;
+    uint32_t bucketsOffset;
+    uint32_t imageSize;
+} __attribute__((packed));
+
+struct initrdEntry {
+    uint32_t pathOffset;
+    uint32_t pathHash;
+    uint32_t parentIndex;
+    uint32_t nextInBucket;
+    uint32_t flags;
+    uint32_t size;
+    uint32_t blockCount;
+    uint32_t blocksOffset;
+} __attribute__((packed));
+
+struct initrdBlock {
+    uint32_t offset;
+    uint32_t compressedSize;
+} __attribute__((packed));
+
+struct buffer {
+    uint8_t* data;
+    uint32_t size;
+    uint32_t capacity;
+};
+
+struct sourceEntry {
+    char* path;
+    char* hostPath;
+    struct initrdEntry entry;
+    struct initrdBlock* blocks;
+};
+
+static struct sourceEntry entries[MAX_ENTRIES];
+static uint32_t entryCount = 0;
+static struct buffer data = { 0, 0, 0 };
+
+static void append(struct buffer* buf, const void* src, uint32_t size) {
+    if(buf->size + size > buf->capacity) {
+        buf->capacity = (buf->size + size) * 2;
+        buf->data = realloc(buf->data, buf->capacity);
+    }
+    memcpy(buf->data + buf->size, src, size);
+    buf->size += size;
+}
+
+/* Same hash as String::hash with ignoreCase, case insensitive FNV-1a */
+static uint32_t hashPath(const char* path) {
+    uint32_t hash = 2166136261u;
+    for(; *path; path++) {
+        char c = *path;
+        if(c >= 'a' && c <= 'z')
+            c -= 32;
+        hash ^= (uint8_t)c;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint8_t* writeLength(uint8_t* op, uint32_t length) {
+    while(length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = length;
+    return op;
+}
+
+static uint8_t* writeSequence(uint8_t* op, const uint8_t* literals, uint32_t literalCount, uint32_t offset, uint32_t matchLength) {
+    uint8_t* token = op++;
+    *token = (literalCount >= 15 ? 15 : literalCount) << 4;
+    if(literalCount >= 15)
+        op = writeLength(op, literalCount - 15);
+
+    memcpy(op, literals, literalCount);
+    op += literalCount;
+
+    if(matchLength == 0)
+        return op;
+
+    *op++ = offset & 0xFF;
+    *op++ = offset >> 8;
+
+    matchLength -= 4;
+    *token |= matchLength >= 15 ? 15 : matchLength;
+    if(matchLength >= 15)
+        op = writeLength(op, matchLength - 15);
+
+    return op;
+}
+
+/* Greedy LZ4 block compressor, the last 5 bytes are always literals as the format requires */
+static uint32_t compressBlock(const uint8_t* src, uint32_t length, uint8_t* dst) {
+    int32_t table[1 << HASH_LOG];
+    uint32_t ip = 0;
+    uint32_t anchor = 0;
+    uint8_t* op = dst;
+
+    memset(table, 0xFF, sizeof(table));
+
+    if(length >= 13) {
+        uint32_t limit = length - 12;
+        while(ip < limit) {
+            uint32_t sequence;
+            memcpy(&sequence, src + ip, 4);
+
+            uint32_t hash = (sequence * 2654435761u) >> (32 - HASH_LOG);
+            int32_t ref = table[hash];
+            table[hash] = ip;
+
+            if(ref < 0 || ip - ref > 65535 || memcmp(src + ref, src + ip, 4) != 0) {
+                ip++;
+                continue;
+            }
+
+            uint32_t matchLength = 4;
+            while(ip + matchLength < length - 5 && src[ref + matchLength] == src[ip + matchLength])
+                matchLength++;
+
+            op = writeSequence(op, src + anchor, ip - anchor, ip - ref, matchLength);
+            ip += matchLength;
+            anchor = ip;
+        }
+    }
+
+    op = writeSequence(op, src + anchor, length - anchor, 0, 0);
+    return op - dst;
+}
+
+static int addEntry(const char* path, const char* hostPath, uint32_t parent, int directory) {
+    if(entryCount == MAX_ENTRIES) {
+        fprintf(stderr, "Too many entries, raise MAX_ENTRIES\n");
+        exit(1);
+    }
+
+    struct sourceEntry* source = &entries[entryCount];
+    memset(source, 0, sizeof(struct sourceEntry));
+    source->path = strdup(path);
+    source->hostPath = strdup(hostPath);
+    source->entry.pathHash = hashPath(path);
+    source->entry.parentIndex = parent;
+    source->entry.nextInBucket = INITRD_NO_ENTRY;
+    source->entry.flags = directory ? INITRD_FLAG_DIRECTORY : 0;
+
+    return entryCount++;
+}
+
+static void packFile(struct sourceEntry* source) {
+    FILE* file = fopen(source->hostPath, "rb");
+    if(file == 0) {
+        perror(source->hostPath);
+        exit(1);
+    }
+
+    fseek(file, 0, SEEK_END);
+    uint32_t size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t* contents = malloc(size + 1);
+    if(fread(contents, 1, size, file) != size) {
+        perror(source->hostPath);
+        exit(1);
+    }
+    fclose(file);
+
+    uint32_t blockCount = (size + INITRD_BLOCK_SIZE - 1) / INITRD_BLOCK_SIZE;
+    uint8_t* compressed = malloc(INITRD_BLOCK_SIZE + INITRD_BLOCK_SIZE / 255 + 16);
+
+    source->entry.size = size;
+    source->entry.blockCount = blockCount;
+    source->blocks = calloc(blockCount ? blockCount : 1, sizeof(struct initrdBlock));
+
+    for(uint32_t b = 0; b < blockCount; b++) {
+        uint32_t blockSize = size - b * INITRD_BLOCK_SIZE;
+        if(blockSize > INITRD_BLOCK_SIZE)
+            blockSize = INITRD_BLOCK_SIZE;
+
+        const uint8_t* block = contents + b * INITRD_BLOCK_SIZE;
+        uint32_t packed = compressBlock(block, blockSize, compressed);
+
+        /* A block is stored raw when compression does not gain anything, the kernel spots that by its size */
+        source->blocks[b].offset = data.size;
+        if(packed < blockSize) {
+            source->blocks[b].compressedSize = packed;
+            append(&data, compressed, packed);
+        }
+        else {
+            source->blocks[b].compressedSize = blockSize;
+            append(&data, block, blockSize);
+        }
+    }
+
+    free(compressed);
+    free(contents);
+}
+
+static void scanDirectory(const char* path, const char* hostPath, uint32_t index) {
+    DIR* dir = opendir(hostPath);
+    if(dir == 0) {
+        perror(hostPath);
+        exit(1);
+    }
+
+    struct dirent* item;
+    while((item = readdir(dir)) != 0) {
+        /* .gitkeep only exists so the empty initrd directory is part of the repository */
+        if(strcmp(item->d_name, ".") == 0 || strcmp(item->d_name, "..") == 0 || strcmp(item->d_name, ".gitkeep") == 0)
+            continue;
+
+        char childPath[1024];
+        char childHostPath[1024];
+        if(path[0] == '\0')
+            snprintf(childPath, sizeof(childPath), "%s", item->d_name);
+        else
+            snprintf(childPath, sizeof(childPath), "%s\\%s", path, item->d_name);
+        snprintf(childHostPath, sizeof(childHostPath), "%s/%s", hostPath, item->d_name);
+
+        struct stat info;
+        if(stat(childHostPath, &info) != 0) {
+            perror(childHostPath);
+            exit(1);
+        }
+
+        if(S_ISDIR(info.st_mode)) {
+            uint32_t child = addEntry(childPath, childHostPath, index, 1);
+            scanDirectory(childPath, childHostPath, child);
+        }
+        else if(S_ISREG(info.st_mode)) {
+            packFile(&entries[addEntry(childPath, childHostPath, index, 0)]);
+        }
+    }
+
+    closedir(dir);
+}
+
+int main(int argc, char** argv) {
+    if(argc != 3) {
+        fprintf(stderr, "Usage: %s <directory> <output>\n", argv[0]);
+        return 1;
+    }
+
+    /* Entry 0 is always the root directory with an empty path */
+    addEntry("", argv[1], INITRD_NO_ENTRY, 1);
+    scanDirectory("", argv[1], 0);
+
+    uint32_t bucketCount = 16;
+    while(bucketCount < entryCount * 2)
+        bucketCount *= 2;
+
+    uint32_t* buckets = malloc(bucketCount * sizeof(uint32_t));
+    memset(buckets, 0xFF, bucketCount * sizeof(uint32_t));
+    for(uint32_t i = 0; i < entryCount; i++) {
+        uint32_t bucket = entries[i].entry.pathHash % bucketCount;
+        entries[i].entry.nextInBucket = buckets[bucket];
+        buckets[bucket] = i;
+    }
+
+    /* Layout: header, entries, buckets, path strings, block tables, file data */
+    struct buffer strings = { 0, 0, 0 };
+    struct buffer tables = { 0, 0, 0 };
+    uint32_t entriesOffset = sizeof(struct initrdHeader);
+    uint32_t bucketsOffset = entriesOffset + entryCount * sizeof(struct initrdEntry);
+    uint32_t stringsOffset = bucketsOffset + bucketCount * sizeof(uint32_t);
+
+    for(uint32_t i = 0; i < entryCount; i++) {
+        entries[i].entry.pathOffset = stringsOffset + strings.size;
+        append(&strings, entries[i].path, strlen(entries[i].path) + 1);
+    }
+
+    uint32_t tablesOffset = (stringsOffset + strings.size + 3) & ~3;
+    for(uint32_t i = 0; i < entryCount; i++) {
+        entries[i].entry.blocksOffset = tablesOffset + tables.size;
+        if(entries[i].entry.blockCount > 0)
+            append(&tables, entries[i].blocks, entries[i].entry.blockCount * sizeof(struct initrdBlock));
+    }
+
+    uint32_t dataOffset = (tablesOffset + tables.size + 3) & ~3;
+    for(uint32_t i = 0; i < entryCount; i++)
+        for(uint32_t b = 0; b < entries[i].entry.blockCount; b++)
+            ((struct initrdBlock*)(tables.data + (entries[i].entry.blocksOffset - tablesOffset)))[b].offset += dataOffset;
+
+    struct initrdHeader header;
+    header.magic = INITRD_MAGIC;
+    header.version = INITRD_VERSION;
+    header.entryCount = entryCount;
+    header.bucketCount = bucketCount;
+    header.entriesOffset = entriesOffset;
+    header.bucketsOffset = bucketsOffset;
+    header.imageSize = dataOffset + data.size;
+
+    struct buffer image = { 0, 0, 0 };
+    uint32_t zero = 0;
+    append(&image, &header, sizeof(header));
+    for(uint32_t i = 0; i < entryCount; i++)
+        append(&image, &entries[i].entry, sizeof(struct initrdEntry));
+    append(&image, buckets, bucketCount * sizeof(uint32_t));
+    append(&image, strings.data, strings.size);
+    append(&image, &zero, tablesOffset - image.size);
+    append(&image, tables.data, tables.size);
+    append(&image, &zero, dataOffset - image.size);
+    append(&image, data.data, data.size);
+
+    FILE* output = fopen(argv[2], "wb");
+    if(output == 0 || fwrite(image.data, 1, image.size, output) != image.size) {
+        perror(argv[2]);
+        return 1;
+    }
+    fclose(output);
+
+    printf("%s: %u entries, %u bytes\n", argv[2], entryCount, image.size);
+    return 0;
+}
@@ -32,6 +32,33 @@ namespace LibC {
         char name[VFS_NAME_LENGTH]; 
     };
 
+    #define VFS_RECORD_ALIGN 4
+    #define VFS_BUFFER_TOO_SMALL -2
+
+    /**
+     * @brief variable length entry written by SYSCALL_READ_DIRECTORY, the next one starts recordLength bytes further
+     */
+    struct vfsDirectoryRecord {
+        uint16_t recordLength;
+        uint8_t nameLength;
+        bool isDir;
+        uint32_t size;
+        uint32_t nextCookie;
+
+        struct {
+            uint8_t sec;
+            uint8_t min;
+            uint8_t hour;
+        } creationTime;
+
+        struct {
+            uint8_t day;
+            uint8_t month;
+            uint16_t year;
+        } creationDate;
+        char name[];
+    } __attribute__((packed));
+
     #define KEYPACKET_START 0xFF
     enum KEYPACKET_FLAGS {
         noFlags = 0,
@@ -54,6 +54,10 @@ namespace LibC {
         SYSCALL_LISTING_ENTRY,
         SYSCALL_END_LISTING,
         SYSCALL_GET_SYSINFO_VALUE,
+        SYSCALL_FSYNC,
+        SYSCALL_MAP_FILE,
+        SYSCALL_UNMAP_FILE,
+        SYSCALL_READ_DIRECTORY,
     };
 
     int doSyscall(unsigned int intNum, unsigned int arg1 = 0, unsigned int arg2 = 0, unsigned int arg3 = 0, unsigned int arg4 = 0, unsigned int arg5 = 0);
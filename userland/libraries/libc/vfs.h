@@ -7,6 +7,7 @@
 namespace LibC {
     int readFile(char* filename, uint8_t* buffer, uint32_t offset = 0, uint32_t len = -1);
     int writeFile(char* filename, uint8_t* buffer, uint32_t len, bool create = true);
+    int fsync(char* path);
 
     bool fileExists(char* filename);
     bool dirExists(char* filename);
@@ -16,6 +17,10 @@ namespace LibC {
 
     uint32_t getFileSize(char* filename);
     List<vfsEntry> dirListing(char* path);
+    int readDirectory(char* path, uint32_t* cookie, void* buffer, uint32_t size);
 
     bool ejectDisk(char* path);
+
+    void* mapFile(char* path, uint32_t offset, uint32_t length);
+    bool unmapFile(void* address);
 }
\ No newline at end of file